@@ -11,15 +11,18 @@
 #include "memdmp/memdmp.h"          // memdmp
 #include "hfs/btree/btree.h"
 #include "hfs/btree/btree_endian.h"
+#include "hfs/btree/cursor.h"
+#include "hfs/btree/readahead.h"
 #include "hfs/unicode.h"
-#include "volumes/utilities.h"      // fpread
+#include "hfs/hfs_index.h"          // hfs_index_node_bitmap
+#include "hfs/hfs_io.h"             // hfs_read_fork_range
 #include "logging/logging.h"        // console printing routines
 
 
 static inline int icmp(const void* a, const void* b)
 {
-    int64_t A = *(int64_t*)a;
-    int64_t B = *(int64_t*)b;
+    bt_nodeid_t A = *(const bt_nodeid_t*)a;
+    bt_nodeid_t B = *(const bt_nodeid_t*)b;
     return cmp(A,B);
 }
 
@@ -38,6 +41,18 @@ bool BTIsNodeUsed(const BTreePtr bTree, bt_nodeid_t nodeNum)
 
     assert(bTree);
 
+    // Take the bitmap from an attached metadata index, if there is one.
+    if ((bTree->nodeBitmap == NULL) && (bTree->fork != NULL) && (bTree->fork->hfs->index != NULL)) {
+        const uint8_t* bitmap = NULL;
+        size_t         length = 0;
+        if (hfs_index_node_bitmap(bTree->fork->hfs->index, bTree->treeID, &bitmap, &length) == 1) {
+            bTree->nodeBitmap     = ALLOC(length);
+            assert(bTree->nodeBitmap != NULL);
+            memcpy(bTree->nodeBitmap, bitmap, length);
+            bTree->nodeBitmapSize = length;
+        }
+    }
+
     // Load the tree bitmap, if needed.
     if (bTree->nodeBitmap == NULL) {
         debug("Tree %u: loading node bitmap.", bTree->treeID);
@@ -101,7 +116,7 @@ bool BTIsNodeUsed(const BTreePtr bTree, bt_nodeid_t nodeNum)
 bool BTIsBlockUsed(uint32_t thisAllocationBlock, void* allocationFileContents, size_t length)
 {
     size_t  idx      = (thisAllocationBlock / 8);
-    if (idx > length) return false;
+    if (idx >= length) return false;
 
     uint8_t thisByte = ((uint8_t*)allocationFileContents)[idx];
     return (thisByte & (1 << (7 - (thisAllocationBlock % 8)))) != 0;
@@ -164,24 +179,24 @@ uint16_t BTGetRecordKeyLength(const BTreeNodePtr node, uint16_t recNum)
        http://developer.apple.com/legacy/library/technotes/tn/tn1150.html#KeyedRecords
      */
 
-    BTHeaderRec       headerRecord = node->bTree->headerRecord;
+    const BTreePtr    tree         = node->bTree;
     BTNodeDescriptor* nodeDesc     = (BTNodeDescriptor*)node->data;
 
     if ((nodeDesc->kind != kBTIndexNode) && (nodeDesc->kind != kBTLeafNode))
         return 0;
 
     uint8_t*    record  = BTGetRecord(node, recNum);
-    BTRecOffset keySize = headerRecord.maxKeyLength;
+    BTRecOffset keySize = tree->maxKeyLength;
     BTreeKey*   keyPtr  = (void*)record;
 
     // Variable-length keys
     if (
         (nodeDesc->kind == kBTLeafNode) ||
-        ((nodeDesc->kind == kBTIndexNode) && headerRecord.attributes & kBTVariableIndexKeysMask)
+        ((nodeDesc->kind == kBTIndexNode) && tree->keyAttributes & kBTVariableIndexKeysMask)
         ) {
 
         keySize = (
-            (headerRecord.attributes & kBTBigKeysMask) ?
+            (tree->keyAttributes & kBTBigKeysMask) ?
             (keyPtr->length16) :
             (keyPtr->length8)
             );
@@ -189,14 +204,14 @@ uint16_t BTGetRecordKeyLength(const BTreeNodePtr node, uint16_t recNum)
 
     // Handle too-long keys
     // Note that while this will let us fight another day, it generally means Things Are Bad.
-    if (keySize > headerRecord.maxKeyLength) {
-        warning("Key length for (tree %u, node %u, record %u) was %u; the maximum for this B-tree is %u.", node->treeID, node->nodeNumber, recNum, keySize, headerRecord.maxKeyLength);
-        keySize = headerRecord.maxKeyLength;
+    if (keySize > tree->maxKeyLength) {
+        warning("Key length for (tree %u, node %u, record %u) was %u; the maximum for this B-tree is %u.", node->treeID, node->nodeNumber, recNum, keySize, tree->maxKeyLength);
+        keySize = tree->maxKeyLength;
     }
 
     // Adjust for the initial key length field
     keySize += (
-        (headerRecord.attributes & kBTBigKeysMask) ?
+        (tree->keyAttributes & kBTBigKeysMask) ?
         sizeof(keyPtr->length16) :
         sizeof(keyPtr->length8)
         );
@@ -207,7 +222,7 @@ uint16_t BTGetRecordKeyLength(const BTreeNodePtr node, uint16_t recNum)
     return keySize;
 }
 
-int btree_init(BTreePtr btree, FILE* fp)
+int btree_init(BTreePtr btree, struct HFSPlusFork* fork)
 {
     ssize_t nbytes = 0;
     void*   buf    = NULL;
@@ -216,10 +231,10 @@ int btree_init(BTreePtr btree, FILE* fp)
     assert(buf != NULL);
 
     // First, init the fork record for future calls.
-    btree->fp = fp;
+    btree->fork = fork;
 
     // Now load up the header node.
-    if ( (nbytes = fpread(btree->fp, buf, sizeof(BTNodeDescriptor), 0)) < 0 ) {
+    if ( (nbytes = hfs_read_fork_range(buf, btree->fork, sizeof(BTNodeDescriptor), 0)) < 0 ) {
         SFREE(buf);
         return -1;
     }
@@ -231,7 +246,7 @@ int btree_init(BTreePtr btree, FILE* fp)
     if (btree->nodeDescriptor.numRecords > 0) {
         memset(buf, 0, 512);
 
-        if ( (nbytes = fpread(btree->fp, buf, sizeof(BTHeaderRec), sizeof(BTNodeDescriptor))) < 0 ) {
+        if ( (nbytes = hfs_read_fork_range(buf, btree->fork, sizeof(BTHeaderRec), sizeof(BTNodeDescriptor))) < 0 ) {
             SFREE(buf);
             return -1;
         }
@@ -239,23 +254,40 @@ int btree_init(BTreePtr btree, FILE* fp)
         btree->headerRecord = *(BTHeaderRec*)buf;
         swap_BTHeaderRec(&btree->headerRecord);
 
+        btree->keyAttributes = btree->headerRecord.attributes;
+        btree->maxKeyLength  = btree->headerRecord.maxKeyLength;
+
         // Next comes 128 bytes of "user" space for record 2 that we don't care about.
         // TODO: Then the remainder of the node is allocation bitmap data for record 3 which we'll care about later.
     }
 
-    // Init the node cache.
-    cache_init(&btree->nodeCache, 100);
+    // Init the node cache: a share of the volume's budget if it has one, otherwise a fixed count.
+    uint64_t nodes = 100;
+    if ((fork->hfs->node_cache_size != 0) && (btree->headerRecord.nodeSize != 0))
+        nodes = MAX(fork->hfs->node_cache_size / (kHFSNodeCacheTrees * btree->headerRecord.nodeSize), 16);
+
+    cache_init(&btree->nodeCache, nodes);
+    btree->readAhead = btree_readahead_make(btree);
     SFREE(buf);
 
     return 0;
 }
 
-int btree_get_node(BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeNumber)
+void btree_free(BTreePtr btree)
+{
+    btree_readahead_free(btree->readAhead);
+    cache_destroy(btree->nodeCache);
+    hfsfork_free(btree->fork);
+    SFREE(btree->nodeBitmap);
+    SFREE(btree);
+}
+
+int btree_read_node(BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeNumber)
 {
     BTreeNodePtr node       = NULL;
     ssize_t      bytes_read = 0;
 
-    trace("Tree %u: getting node %d", tree->treeID, nodeNumber);
+    trace("Tree %u: reading node %d", tree->treeID, nodeNumber);
 
     if(nodeNumber >= tree->headerRecord.totalNodes) {
         error("Node %u is beyond file range.", nodeNumber);
@@ -283,13 +315,14 @@ int btree_get_node(BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeN
     assert(tree->nodeCache != NULL);
 
     // Check the tree's node cache for a previous load.
-    if (cache_get(tree->nodeCache, (void*)node->data, node->nodeSize, nodeNumber) == 1) {
+    if (btree_readahead_cache_get(tree->readAhead, (void*)node->data, node->nodeSize, nodeNumber) == 1) {
         debug("Loaded a cached node for %u:%u", node->treeID, nodeNumber);
 
     } else {
         assert(node->data != NULL);
 
-        bytes_read = fpread(node->bTree->fp, node->data, node->nodeSize, node->nodeOffset);
+        // Nodes are whole blocks (or whole multiples of them) at block-aligned offsets, so this reads straight into the node buffer.
+        bytes_read = hfs_read_fork_range(node->data, node->bTree->fork, node->nodeSize, node->nodeOffset);
 
         if (bytes_read < 0) {
             error("Error reading from fork.");
@@ -301,12 +334,30 @@ int btree_get_node(BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeN
             warning("node read failed: expected %zd bytes, got %zd", node->nodeSize, bytes_read);
 
         } else if (tree->nodeCache != NULL) {
-            cache_set(tree->nodeCache, (char*)node->data, node->nodeSize, nodeNumber);
+            btree_readahead_cache_set(tree->readAhead, (char*)node->data, node->nodeSize, nodeNumber);
         }
     }
 
     assert(node->nodeDescriptor->numRecords > 0);
 
+    *outNode = node;
+
+    // Leaf walks are what read-ahead is for; index and map nodes only muddy the pattern. The kind is a byte, so it reads the same unswapped.
+    if (node->nodeDescriptor->kind == kBTLeafNode)
+        btree_readahead_access(tree->readAhead, nodeNumber);
+
+    return 0;
+}
+
+int btree_get_node(BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeNumber)
+{
+    BTreeNodePtr node = NULL;
+
+    trace("Tree %u: getting node %d", tree->treeID, nodeNumber);
+
+    if (btree_read_node(&node, tree, nodeNumber) < 0)
+        return -1;
+
     if ( swap_BTreeNode(node) < 0 ) {
         error("node %u: byte-swap of node failed.", node->nodeNumber);
         btree_free_node(node);
@@ -350,28 +401,28 @@ int btree_get_record(BTreeKeyPtr* key, void** data, const BTreeNodePtr node, BTR
 }
 
 // Not a "real" tree walker; follows the linked list fields for the leaf nodes.
+// Iterates with a cursor so only one node is held at a time; the walker can return false to stop early.
 int btree_walk(const BTreePtr btree, const BTreeNodePtr node, btree_walk_func walker)
 {
-    BTreeNodePtr _node = node;
+    BTreeCursor cursor = {0};
+    bt_nodeid_t start  = btree->headerRecord.firstLeafNode;
+    int         result = 0;
 
-    // Fetch the first leaf node if no node was passed in.
-    if (node == NULL) {
-        BTGetNode(&_node, btree, btree->headerRecord.firstLeafNode);
+    // A node passed in belongs to the caller; visit it, then continue from its right sibling.
+    if (node != NULL) {
+        if (walker(btree, node) == false) return 0;
+        start = node->nodeDescriptor->fLink;
     }
 
-    walker(btree, _node);
+    btree_cursor_init(&cursor, btree);
 
-    if ( (signed)_node->nodeDescriptor->fLink > 0 ) {
-        BTreeNodePtr right = NULL;
-        BTGetNode(&right, btree, _node->nodeDescriptor->fLink);
-        btree_walk(btree, right, walker);
-        btree_free_node(right);
+    for (result = btree_cursor_goto_node(&cursor, start); result == 1; result = btree_cursor_next_node(&cursor)) {
+        if (walker(btree, cursor.node) == false) break;
     }
 
-    if (!node && _node)
-        btree_free_node(_node);
+    btree_cursor_free(&cursor);
 
-    return 0;
+    return (result < 0 ? -1 : 0);
 }
 
 int btree_search(BTreeNodePtr* node, BTRecNum* recordID, const BTreePtr btree, const void* searchKey)
@@ -44,14 +44,17 @@ enum {
 #define BTFreeNode(node)               btree_free_node(node)
 
 struct _BTree {
-    FILE*                  fp;                  // funopen handle
+    struct HFSPlusFork*    fork;                // Fork containing the tree file
     Cache                  nodeCache;
+    struct BTreeReadAhead* readAhead;           // Leaf-walk prefetcher; owns the lock for nodeCache
     uint8_t*               nodeBitmap;
     size_t                 nodeBitmapSize;
     btree_key_compare_func keyCompare;          // Function used to compare the keys in this tree.
     btree_get_node_func    getNode;             // Fetch and swap a node for this tree.
     BTNodeDescriptor       nodeDescriptor;      // For the header node
     BTHeaderRec            headerRecord;        // From the header node
+    uint32_t               keyAttributes;       // Key layout (kBTBigKeysMask, kBTVariableIndexKeysMask) of the nodes getNode returns; the header's unless getNode rewrites them
+    uint16_t               maxKeyLength;        // Longest key in those nodes
     bt_nodeid_t            treeID;
     bool                   _loadingBitmap;
     uint8_t                _reserved[3];
@@ -94,11 +97,13 @@ struct _BTNodeRecord {
     uint8_t      _reserved[6];
 } __attribute__((aligned(2)));
 
-int  btree_init          (BTreePtr btree, FILE* fp) __attribute__((nonnull));
+int  btree_init          (BTreePtr btree, struct HFSPlusFork* fork) __attribute__((nonnull));
+void btree_free          (BTreePtr btree) __attribute__((nonnull));    // Also frees the tree's fork
 int  btree_get_node      (BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeNumber) __attribute__((nonnull));
+int  btree_read_node     (BTreeNodePtr* outNode, const BTreePtr tree, bt_nodeid_t nodeNumber) __attribute__((nonnull));  // As read from disk; not swapped
 void btree_free_node    (BTreeNodePtr node);
 int  btree_get_record    (BTreeKeyPtr* key, void** data, const BTreeNodePtr node, BTRecNum recordID) __attribute__((nonnull(1,3)));
-int  btree_walk          (const BTreePtr btree, const BTreeNodePtr node, btree_walk_func walker) __attribute__((nonnull));
+int  btree_walk          (const BTreePtr btree, const BTreeNodePtr node, btree_walk_func walker) __attribute__((nonnull(1,3)));
 int  btree_search        (BTreeNodePtr* node, BTRecNum* recordID, const BTreePtr btree, const void* searchKey) __attribute__((nonnull));
 int  btree_search_node   (BTRecNum* index, const BTreePtr btree, const BTreeNodePtr node, const void* searchKey) __attribute__((nonnull));
 
@@ -18,7 +18,8 @@ struct _Cache {
     uint64_t       max_records;
     uint64_t       record_count;
     void*          index;
-    CacheRecordPtr records;
+    CacheRecordPtr records;                 // List head; the most recently used record follows it
+    CacheRecordPtr tail;                    // Least recently used record, or the head if empty
 } __attribute__((aligned(2)));
 
 struct CacheRecord {
@@ -78,13 +79,11 @@ CacheRecordPtr cache_record_new_(Cache cache)
     if (record == NULL) return NULL;
 
     insque(record, cache->records);
-    if (cache->records == NULL) {
-        cache->records = record;
+    if (record->next == NULL) cache->tail = record;
 
-    } else if (cache->record_count > cache->max_records) {
+    if (cache->record_count > cache->max_records) {
         // Remove the LRU record if we're over the limit.
-        CacheRecordPtr r = cache->records;
-        while (r->next != NULL) r = r->next;
+        CacheRecordPtr r = cache->tail;
         cache_record_remove_(cache, &r);
     }
 
@@ -110,6 +109,7 @@ int cache_record_remove_(Cache cache, CacheRecordPtr* r)
         if (tfind(record, &cache->index, key_compare) != NULL)
             tdelete(record, &cache->index, key_compare);
 
+        if (cache->tail == record) cache->tail = record->prev;
         remque(record);
 
         if (record->data != NULL) {
@@ -140,9 +140,10 @@ int cache_init(Cache* cache, uint64_t num_records)
     c->record_count = 0;
     c->records      = ALLOC(sizeof(CacheRecord));
     if (c->records == NULL) {
-        SFREE(cache);
+        SFREE(*cache);
         return -1;
     }
+    c->tail         = c->records;
 
     return 0;
 }
@@ -150,16 +151,12 @@ int cache_init(Cache* cache, uint64_t num_records)
 void cache_destroy(Cache cache)
 {
     if (cache == NULL)   return;
-    // Clean up all the records
-    CacheRecordPtr r = cache->records;
-    CacheRecordPtr n = NULL;
-    while ( (n = r->next) ) {
+    // Clean up all the records, then the list head.
+    CacheRecordPtr r = NULL;
+    while ( (r = cache->records->next) )
         cache_record_remove_(cache, &r);
-        r = n;
-    }
-
-    cache_record_remove_(cache, &cache->records);
 
+    SFREE(cache->records);
     SFREE(cache);
 }
 
@@ -174,8 +171,10 @@ int cache_get(Cache cache, void* buf, size_t len, ckey_t key)
         return 0;
 
     // Move the record to the front of the list since it's been used.
+    if (cache->tail == record) cache->tail = record->prev;
     remque(record);
     insque(record, cache->records);
+    if (record->next == NULL) cache->tail = record;
 
     if( (buf != NULL) && (len > 0) ) {
         len = MIN(record->datalen, len);
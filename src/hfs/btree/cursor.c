@@ -0,0 +1,152 @@
+//
+//  cursor.c
+//  hfsinspect
+//
+//
+
+#include "hfs/btree/cursor.h"
+
+#include "logging/logging.h"        // console printing routines
+
+
+void btree_cursor_init(BTreeCursor* cursor, BTreePtr tree)
+{
+    *cursor      = (BTreeCursor){0};
+    cursor->tree = tree;
+}
+
+void btree_cursor_free(BTreeCursor* cursor)
+{
+    btree_free_node(cursor->node);
+    cursor->node     = NULL;
+    cursor->recordID = 0;
+}
+
+// Replaces the current node with `nodeNumber`; 0 (the header node) or -1 mark the end of the chain.
+static int btree_cursor_load(BTreeCursor* cursor, bt_nodeid_t nodeNumber)
+{
+    btree_cursor_free(cursor);
+
+    if ((nodeNumber == 0) || ((signed)nodeNumber == -1)) return 0;
+
+    if (++cursor->hops > cursor->tree->headerRecord.totalNodes) {
+        error("Tree %u: the leaf chain loops back at node %u.", cursor->tree->treeID, nodeNumber);
+        errno = ELOOP;
+        return -1;
+    }
+
+    if ( BTGetNode(&cursor->node, cursor->tree, nodeNumber) < 0 ) {
+        error("Tree %u: couldn't get node %u.", cursor->tree->treeID, nodeNumber);
+        cursor->node = NULL;
+        return -1;
+    }
+
+    if (cursor->node->nodeDescriptor->kind != kBTLeafNode) {
+        error("Tree %u: node %u is not a leaf node.", cursor->tree->treeID, nodeNumber);
+        btree_cursor_free(cursor);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 1;
+}
+
+// Moves to `nodeNumber` and on along fLink past any empty leaves, counting the hops from the last explicit positioning.
+static int btree_cursor_follow(BTreeCursor* cursor, bt_nodeid_t nodeNumber)
+{
+    int result = btree_cursor_load(cursor, nodeNumber);
+
+    // An empty leaf shouldn't exist, but skip past one rather than stopping the walk.
+    while ((result == 1) && (cursor->node->recordCount == 0))
+        result = btree_cursor_load(cursor, cursor->node->nodeDescriptor->fLink);
+
+    return result;
+}
+
+int btree_cursor_first(BTreeCursor* cursor)
+{
+    return btree_cursor_goto_node(cursor, cursor->tree->headerRecord.firstLeafNode);
+}
+
+int btree_cursor_goto_node(BTreeCursor* cursor, bt_nodeid_t nodeNumber)
+{
+    cursor->hops = 0;
+    return btree_cursor_follow(cursor, nodeNumber);
+}
+
+int btree_cursor_seek(BTreeCursor* cursor, const void* key)
+{
+    BTreeNodePtr node     = NULL;
+    BTRecNum     recordID = 0;
+
+    btree_cursor_free(cursor);
+
+    int          found    = btree_search(&node, &recordID, cursor->tree, key);
+    if (node == NULL) return -1;
+
+    if (btree_cursor_attach(cursor, node, recordID) < 0) return -1;
+
+    return (found == 1);
+}
+
+int btree_cursor_attach(BTreeCursor* cursor, BTreeNodePtr node, BTRecNum recordID)
+{
+    btree_cursor_free(cursor);
+
+    cursor->node     = node;
+    cursor->recordID = recordID;
+    cursor->hops     = 0;
+
+    if ((node->nodeDescriptor->kind != kBTLeafNode) || (recordID >= node->recordCount)) {
+        btree_cursor_free(cursor);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 1;
+}
+
+int btree_cursor_next(BTreeCursor* cursor)
+{
+    if (cursor->node == NULL) return 0;
+
+    if ((uint32_t)cursor->recordID + 1 < cursor->node->recordCount) {
+        cursor->recordID++;
+        return 1;
+    }
+
+    return btree_cursor_next_node(cursor);
+}
+
+int btree_cursor_prev(BTreeCursor* cursor)
+{
+    if (cursor->node == NULL) return 0;
+
+    if (cursor->recordID > 0) {
+        cursor->recordID--;
+        return 1;
+    }
+
+    int result = btree_cursor_load(cursor, cursor->node->nodeDescriptor->bLink);
+    while ((result == 1) && (cursor->node->recordCount == 0))
+        result = btree_cursor_load(cursor, cursor->node->nodeDescriptor->bLink);
+
+    if (result == 1) cursor->recordID = cursor->node->recordCount - 1;
+
+    return result;
+}
+
+int btree_cursor_next_node(BTreeCursor* cursor)
+{
+    if (cursor->node == NULL) return 0;
+
+    return btree_cursor_follow(cursor, cursor->node->nodeDescriptor->fLink);
+}
+
+int btree_cursor_get(const BTreeCursor* cursor, BTreeKeyPtr* key, void** value)
+{
+    if (cursor->node == NULL) { errno = EINVAL; return -1; }
+
+    return btree_get_record(key, value, cursor->node, cursor->recordID);
+}
+
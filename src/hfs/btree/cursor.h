@@ -0,0 +1,58 @@
+//
+//  cursor.h
+//  hfsinspect
+//
+//
+
+#ifndef hfsinspect_hfs_btree_cursor_h
+#define hfsinspect_hfs_btree_cursor_h
+
+#include "hfs/btree/btree.h"
+
+/*
+   A position in the leaf level of a B-tree. A cursor holds exactly one node at a time,
+   so walking a tree of any size takes constant memory and stack. Callers that want a
+   whole node's worth of records at once can step with btree_cursor_next_node and read
+   cursor->node directly.
+
+   Movement functions return 1 when the cursor is on a record, 0 when it ran off either
+   end of the leaf chain (the node is released), and -1 on error. A chain that visits more
+   nodes than the tree holds must loop back on itself; the walk fails with ELOOP.
+ */
+
+typedef struct BTreeCursor {
+    BTreePtr     tree;
+    BTreeNodePtr node;          // Current leaf node, owned by the cursor; NULL when not positioned
+    BTRecNum     recordID;      // Current record within node
+    uint8_t      _reserved[2];
+    uint32_t     hops;          // Nodes loaded since the cursor was last positioned; bounds walks of a looping chain
+} BTreeCursor;
+
+void btree_cursor_init      (BTreeCursor* cursor, BTreePtr tree) __attribute__((nonnull));
+
+// Releases the current node. The cursor can be positioned again afterwards.
+void btree_cursor_free      (BTreeCursor* cursor) __attribute__((nonnull));
+
+// Positions on the first record of the first leaf node.
+int  btree_cursor_first     (BTreeCursor* cursor) __attribute__((nonnull));
+
+// Positions on the first record of the given leaf node.
+int  btree_cursor_goto_node (BTreeCursor* cursor, bt_nodeid_t nodeNumber) __attribute__((nonnull));
+
+// Positions on the record matching `key`, or the record that would precede it (see btree_search).
+// Returns 1 for an exact match, 0 for a near match, -1 on error.
+int  btree_cursor_seek      (BTreeCursor* cursor, const void* key) __attribute__((nonnull));
+
+// Takes ownership of a leaf node (as returned by btree_search) and positions on recordID.
+int  btree_cursor_attach    (BTreeCursor* cursor, BTreeNodePtr node, BTRecNum recordID) __attribute__((nonnull));
+
+int  btree_cursor_next      (BTreeCursor* cursor) __attribute__((nonnull));
+int  btree_cursor_prev      (BTreeCursor* cursor) __attribute__((nonnull));
+
+// Positions on the first record of the next leaf node.
+int  btree_cursor_next_node (BTreeCursor* cursor) __attribute__((nonnull));
+
+// Fetches the key and/or value of the current record.
+int  btree_cursor_get       (const BTreeCursor* cursor, BTreeKeyPtr* key, void** value) __attribute__((nonnull(1)));
+
+#endif
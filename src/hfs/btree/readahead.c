@@ -0,0 +1,214 @@
+//
+//  readahead.c
+//  hfsinspect
+//
+//
+
+#include "hfs/btree/readahead.h"
+
+#include <pthread.h>
+
+#include "hfs/hfs_io.h"             // hfs_read_fork_range_async
+#include "volumes/workqueue.h"
+#include "logging/logging.h"        // console printing routines
+
+
+struct BTreeReadAhead {
+    BTreePtr        tree;
+    pthread_mutex_t lock;               // Guards the fields below and the tree's node cache
+    pthread_cond_t  landed_cond;        // Broadcast when part of a prefetch lands, and when it finishes
+    WorkQueue*      queue;              // One worker, started with the first prefetch
+    IOEngine*       engine;             // Used by the worker only
+
+    // Pattern detection (main thread only, but kept under the lock for simplicity)
+    bt_nodeid_t     last;               // Last leaf reported
+    uint32_t        streak;             // In-order leaf accesses in a row
+    uint32_t        window;             // Current prefetch size in nodes; 0 when off
+    bt_nodeid_t     issued_end;         // One past the last node prefetched in this run
+
+    // The prefetch in progress, if any
+    bool            busy;
+    uint8_t         _reserved[3];
+    bt_nodeid_t     inflight_start;
+    bt_nodeid_t     inflight_end;
+    uint32_t        landed;             // Bit i set once node inflight_start + i has arrived
+
+    void*           buffer;             // BTREE_READAHEAD_MAX_WINDOW nodes, used by the worker
+};
+
+BTreeReadAhead* btree_readahead_make(BTreePtr tree)
+{
+    BTreeReadAhead* ra = NULL;
+    SALLOC(ra, sizeof(BTreeReadAhead));
+
+    ra->tree = tree;
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->landed_cond, NULL);
+
+    return ra;
+}
+
+void btree_readahead_free(BTreeReadAhead* ra)
+{
+    if (ra->queue != NULL) workqueue_free(ra->queue);
+    if (ra->engine != NULL) ioengine_free(ra->engine);
+
+    pthread_cond_destroy(&ra->landed_cond);
+    pthread_mutex_destroy(&ra->lock);
+    SFREE(ra->buffer);
+    SFREE(ra);
+}
+
+#pragma mark Prefetch
+
+typedef struct ReadAheadPiece {
+    BTreeReadAhead* ra;
+    bt_nodeid_t     first;              // Index within the window
+    bt_nodeid_t     count;
+} ReadAheadPiece;
+
+// Runs on the worker as each piece of the window arrives.
+static void btree_readahead_landed(void* context, void* buf, ssize_t bytes)
+{
+    ReadAheadPiece* piece     = context;
+    BTreeReadAhead* ra        = piece->ra;
+    BTreePtr        tree      = ra->tree;
+    size_t          node_size = tree->headerRecord.nodeSize;
+    bt_nodeid_t     start     = ra->inflight_start + piece->first;
+
+    if (bytes < 0) {
+        debug("Tree %u: read-ahead of nodes %u-%u failed.", tree->treeID, start, start + piece->count - 1);
+        bytes = 0;
+    }
+
+    pthread_mutex_lock(&ra->lock);
+
+    for (bt_nodeid_t i = 0; i < piece->count; i++) {
+        const BTNodeDescriptor* desc = (void*)((char*)buf + (i * node_size));
+
+        ra->landed |= (1u << (piece->first + i));
+
+        // Unused nodes are normally zero-filled; don't spend cache slots on them.
+        if (((size_t)bytes < ((i + 1) * node_size)) || (desc->numRecords == 0)) continue;
+
+        cache_set(tree->nodeCache, desc, node_size, start + i);
+    }
+
+    pthread_cond_broadcast(&ra->landed_cond);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+static void btree_readahead_run(void* context)
+{
+    BTreeReadAhead* ra        = context;
+    BTreePtr        tree      = ra->tree;
+    size_t          node_size = tree->headerRecord.nodeSize;
+    ReadAheadPiece  pieces[BTREE_READAHEAD_MAX_WINDOW / BTREE_READAHEAD_READ_NODES + 1];
+    unsigned        piece_count = 0;
+
+    // The range can't change while busy is set, so it's safe to read without the lock.
+    bt_nodeid_t     start     = ra->inflight_start;
+    bt_nodeid_t     count     = ra->inflight_end - ra->inflight_start;
+
+    for (bt_nodeid_t first = 0; first < count; first += BTREE_READAHEAD_READ_NODES) {
+        ReadAheadPiece* piece = &pieces[piece_count++];
+        piece->ra    = ra;
+        piece->first = first;
+        piece->count = MIN(BTREE_READAHEAD_READ_NODES, count - first);
+
+        if (hfs_read_fork_range_async(ra->engine, (char*)ra->buffer + (first * node_size), tree->fork, piece->count * node_size, (size_t)(start + first) * node_size, btree_readahead_landed, piece) < 0) {
+            debug("Tree %u: read-ahead of nodes %u-%u failed.", tree->treeID, start + first, start + first + piece->count - 1);
+            break;
+        }
+    }
+
+    ioengine_wait(ra->engine);
+
+    pthread_mutex_lock(&ra->lock);
+    ra->busy = false;
+    pthread_cond_broadcast(&ra->landed_cond);
+    pthread_mutex_unlock(&ra->lock);
+}
+
+void btree_readahead_access(BTreeReadAhead* ra, bt_nodeid_t nodeNumber)
+{
+    pthread_mutex_lock(&ra->lock);
+
+    if (nodeNumber == ra->last) goto OUT;
+
+    // Leaf chains of a freshly-built tree ascend one node at a time, with the occasional index
+    // node in between; treat short forward hops as part of the same run.
+    bool sequential = (nodeNumber > ra->last) && ((nodeNumber - ra->last) <= MAX(ra->window, BTREE_READAHEAD_MIN_WINDOW));
+    ra->last = nodeNumber;
+
+    if ( !sequential ) {
+        if (ra->window) debug("Tree %u: random access at node %u; read-ahead off.", ra->tree->treeID, nodeNumber);
+        ra->streak     = 0;
+        ra->window     = 0;
+        ra->issued_end = 0;
+        goto OUT;
+    }
+
+    if (++ra->streak < BTREE_READAHEAD_TRIGGER) goto OUT;
+
+    // One prefetch at a time, and only once the walker is into the second half of the last one.
+    if (ra->busy) goto OUT;
+    if ((ra->issued_end > nodeNumber) && ((ra->issued_end - nodeNumber) > (ra->window / 2))) goto OUT;
+
+    uint32_t    window = (ra->window ? MIN(ra->window * 2, BTREE_READAHEAD_MAX_WINDOW) : BTREE_READAHEAD_MIN_WINDOW);
+    bt_nodeid_t start  = MAX(nodeNumber + 1, ra->issued_end);
+    bt_nodeid_t end    = MIN(nodeNumber + 1 + window, ra->tree->headerRecord.totalNodes);
+    if (start >= end) goto OUT;
+
+    if (ra->queue == NULL) {
+        if ( (ra->engine = ioengine_make(ra->tree->fork->hfs->queue_depth, kIOEngineAuto)) == NULL ) goto OUT;
+        if ( (ra->queue = workqueue_make(1)) == NULL ) {
+            ioengine_free(ra->engine);
+            ra->engine = NULL;
+            goto OUT;
+        }
+        SALLOC(ra->buffer, BTREE_READAHEAD_MAX_WINDOW * ra->tree->headerRecord.nodeSize);
+    }
+
+    if (window != ra->window) debug("Tree %u: read-ahead window now %u nodes.", ra->tree->treeID, window);
+
+    ra->window         = window;
+    ra->issued_end     = end;
+    ra->inflight_start = start;
+    ra->inflight_end   = end;
+    ra->landed         = 0;
+    ra->busy           = true;
+
+    if (workqueue_add(ra->queue, btree_readahead_run, ra) < 0)
+        ra->busy = false;
+
+OUT:
+    pthread_mutex_unlock(&ra->lock);
+}
+
+#pragma mark Cache
+
+int btree_readahead_cache_get(BTreeReadAhead* ra, void* buf, size_t len, bt_nodeid_t nodeNumber)
+{
+    pthread_mutex_lock(&ra->lock);
+
+    // A node that is on its way in will be cheaper to wait for than to read again.
+    while (ra->busy && (nodeNumber >= ra->inflight_start) && (nodeNumber < ra->inflight_end) && !(ra->landed & (1u << (nodeNumber - ra->inflight_start))))
+        pthread_cond_wait(&ra->landed_cond, &ra->lock);
+
+    int result = cache_get(ra->tree->nodeCache, buf, len, nodeNumber);
+
+    pthread_mutex_unlock(&ra->lock);
+
+    return result;
+}
+
+int btree_readahead_cache_set(BTreeReadAhead* ra, const void* buf, size_t len, bt_nodeid_t nodeNumber)
+{
+    pthread_mutex_lock(&ra->lock);
+    int result = cache_set(ra->tree->nodeCache, buf, len, nodeNumber);
+    pthread_mutex_unlock(&ra->lock);
+
+    return result;
+}
+
@@ -0,0 +1,51 @@
+//
+//  readahead.h
+//  hfsinspect
+//
+//
+
+#ifndef hfsinspect_hfs_btree_readahead_h
+#define hfsinspect_hfs_btree_readahead_h
+
+#include "hfs/btree/btree.h"
+
+/*
+   Adaptive read-ahead for leaf-chain walks. Every leaf node the tree hands out is
+   reported here; once several arrive in ascending file order, the nodes that follow
+   are read on a background thread and dropped into the tree's node cache, doubling
+   the window while the pattern holds. A window goes out as several smaller reads at
+   the volume's queue depth, and each lands in the cache (waking anyone waiting on
+   its nodes) as soon as it arrives. The first access that
+   jumps backwards or far ahead turns read-ahead off again until a new run appears.
+
+   The tree's node cache is shared with the prefetch thread, so btree_get_node goes
+   through the cache accessors below rather than calling cache_get/cache_set itself.
+ */
+
+// Smallest and largest number of nodes requested by one prefetch.
+#define BTREE_READAHEAD_MIN_WINDOW 4
+#define BTREE_READAHEAD_MAX_WINDOW 32        // At most 32: landed nodes are tracked in one word
+
+// Nodes per read within a window.
+#define BTREE_READAHEAD_READ_NODES 4
+
+// Consecutive in-order leaf accesses needed before the first prefetch.
+#define BTREE_READAHEAD_TRIGGER    2
+
+typedef struct BTreeReadAhead BTreeReadAhead;
+
+BTreeReadAhead* btree_readahead_make      (BTreePtr tree) __attribute__((nonnull));
+
+// Waits for any prefetch in progress, then releases the state. The node cache is left alone.
+void            btree_readahead_free      (BTreeReadAhead* ra) __attribute__((nonnull));
+
+// Records a leaf access and schedules a prefetch if the tree is being read in order.
+void            btree_readahead_access    (BTreeReadAhead* ra, bt_nodeid_t nodeNumber) __attribute__((nonnull));
+
+// cache_get for the tree's node cache. If the node is being prefetched, waits for the read to land first.
+int             btree_readahead_cache_get (BTreeReadAhead* ra, void* buf, size_t len, bt_nodeid_t nodeNumber) __attribute__((nonnull));
+
+// cache_set for the tree's node cache.
+int             btree_readahead_cache_set (BTreeReadAhead* ra, const void* buf, size_t len, bt_nodeid_t nodeNumber) __attribute__((nonnull));
+
+#endif
@@ -9,11 +9,16 @@
 
 #include "hfs/Apple/hfs_types.h"   // Apple's FastUnicodeCompare and conversion table.
 #include "hfs/catalog.h"
+#include "hfs/btree/cursor.h"
+#include "hfs/btree/btree_endian.h"
 #include "hfs/hfs_endian.h"
+#include "hfs/hfs_index.h"
 #include "hfs/hfs_io.h"
+#include "hfs/hfs_standard.h"
 #include "hfs/output_hfs.h"
 #include "hfs/unicode.h"
 #include "volumes/utilities.h"     // commonly-used utility functions
+#include "volumes/workqueue.h"
 #include "logging/logging.h"       // console printing routines
 
 
@@ -29,11 +34,12 @@ int hfsplus_get_catalog_btree(BTreePtr* tree, const HFSPlus* hfs)
     trace("tree (%p), hfs (%p)", tree, hfs);
     debug("Getting catalog B-Tree");
 
-    static BTreePtr cachedTree;
+    // Each volume keeps its own trees, so several can be open at once.
+    HFSPlus* volume = (HFSPlus*)hfs;
 
-    if (cachedTree == NULL) {
-        HFSPlusFork* fork = NULL;
-        FILE*        fp   = NULL;
+    if (volume->catalogTree == NULL) {
+        HFSPlusFork* fork       = NULL;
+        BTreePtr     cachedTree = NULL;
 
         debug("Creating catalog B-Tree");
 
@@ -43,10 +49,12 @@ int hfsplus_get_catalog_btree(BTreePtr* tree, const HFSPlus* hfs)
             critical("Could not create fork for Catalog B-Tree!");
         }
 
-        fp = fopen_hfsfork(fork);
-        if (fp == NULL) return -1;
+        if (btree_init(cachedTree, fork) < 0) {
+            hfsfork_free(fork);
+            SFREE(cachedTree);
+            return -1;
+        }
 
-        btree_init(cachedTree, fp);
         if (hfs->vh.signature == kHFSXSigWord) {
             if (cachedTree->headerRecord.keyCompareType == kHFSCaseFolding) {
                 // Case Folding (normal; case-insensitive)
@@ -63,15 +71,53 @@ int hfsplus_get_catalog_btree(BTreePtr* tree, const HFSPlus* hfs)
         }
         cachedTree->treeID  = kHFSCatalogFileID;
         cachedTree->getNode = hfsplus_catalog_get_node;
+
+        if (hfs_is_standard(hfs))
+            hfs_standard_prepare_tree(cachedTree);
+
+        volume->catalogTree = cachedTree;
     }
 
     // Copy the cached tree out.
     // Note this copies a reference to the same extent list in the HFSPlusFork struct so NEVER free that fork.
-    *tree = cachedTree;
+    *tree = volume->catalogTree;
 
     return 0;
 }
 
+// Swaps the catalog keys (and leaf records) of a node that swap_BTreeNode has already prepared.
+static void hfsplus_catalog_swap_records(BTreeNodePtr node)
+{
+    if ((node->nodeDescriptor->kind != kBTIndexNode) && (node->nodeDescriptor->kind != kBTLeafNode)) return;
+
+    for (unsigned recNum = 0; recNum < node->recordCount; recNum++) {
+        void*              record     = NULL;
+        HFSPlusCatalogKey* catalogKey = NULL;
+        BTRecOffset        keyLen     = 0;
+
+        // Get the raw record
+        record     = BTGetRecord(node, recNum);
+
+        // Swap the key first since we need a correct key length
+        catalogKey = (HFSPlusCatalogKey*)record;
+        swap_HFSPlusCatalogKey(catalogKey);
+
+        // Verify key
+        if (catalogKey->nodeName.length > 255) {
+            warning("Record %d in node %d has an invalid name length: %d", recNum, node->nodeNumber, catalogKey->nodeName.length);
+            catalogKey->nodeName.length = 255; // Not the right answer, but better than reading 8K of data later on.
+        }
+
+        // Index nodes are already swapped, so only swap leaf nodes
+        if (node->nodeDescriptor->kind == kBTLeafNode) {
+            void* catalogRecord = NULL;
+            keyLen        = BTGetRecordKeyLength(node, recNum);
+            catalogRecord = ((char*)record + keyLen);
+            swap_HFSPlusCatalogRecord((HFSPlusCatalogRecord*)catalogRecord);
+        }
+    }
+}
+
 int hfsplus_catalog_get_node(BTreeNodePtr* out_node, const BTreePtr bTree, bt_nodeid_t nodeNum)
 {
     trace("out_node (%p), bTree (%p), nodeNum %u", out_node, bTree, nodeNum);
@@ -88,35 +134,7 @@ int hfsplus_catalog_get_node(BTreeNodePtr* out_node, const BTreePtr bTree, bt_no
         return 0;
     }
 
-    // Swap catalog-specific structs in the records
-    if ((node->nodeDescriptor->kind == kBTIndexNode) || (node->nodeDescriptor->kind == kBTLeafNode)) {
-        for (unsigned recNum = 0; recNum < node->recordCount; recNum++) {
-            void*              record     = NULL;
-            HFSPlusCatalogKey* catalogKey = NULL;
-            BTRecOffset        keyLen     = 0;
-
-            // Get the raw record
-            record     = BTGetRecord(node, recNum);
-
-            // Swap the key first since we need a correct key length
-            catalogKey = (HFSPlusCatalogKey*)record;
-            swap_HFSPlusCatalogKey(catalogKey);
-
-            // Verify key
-            if (catalogKey->nodeName.length > 255) {
-                warning("Record %d in node %d has an invalid name length: %d", recNum, nodeNum, catalogKey->nodeName.length);
-                catalogKey->nodeName.length = 255; // Not the right answer, but better than reading 8K of data later on.
-            }
-
-            // Index nodes are already swapped, so only swap leaf nodes
-            if (node->nodeDescriptor->kind == kBTLeafNode) {
-                void* catalogRecord = NULL;
-                keyLen        = BTGetRecordKeyLength(node, recNum);
-                catalogRecord = ((char*)record + keyLen);
-                swap_HFSPlusCatalogRecord((HFSPlusCatalogRecord*)catalogRecord);
-            }
-        }
-    }
+    hfsplus_catalog_swap_records(node);
 
     *out_node = node;
 
@@ -242,6 +260,190 @@ int hfsplus_catalog_compare_keys_bc(const HFSPlusCatalogKey* key1, const HFSPlus
     return result;
 }
 
+int hfsplus_catalog_scan(const HFSPlus* hfs, hfsplus_catalog_scan_func func, void* context)
+{
+    BTreePtr    catalog = NULL;
+    BTreeCursor cursor  = {0};
+    int         status  = 0;
+    int         result  = 0;
+
+    trace("hfs (%p), func (%p), context (%p)", hfs, func, context);
+
+    if (hfsplus_get_catalog_btree(&catalog, hfs) < 0)
+        return -1;
+
+    // Leaf nodes are chained in key order; follow the chain from the first one.
+    btree_cursor_init(&cursor, catalog);
+
+    for (status = btree_cursor_first(&cursor); (status == 1) && (result == 0); status = btree_cursor_next(&cursor)) {
+        BTreeKeyPtr recordKey   = NULL;
+        void*       recordValue = NULL;
+        btree_cursor_get(&cursor, &recordKey, &recordValue);
+
+        result = func(context, (HFSPlusCatalogKey*)recordKey, (HFSPlusCatalogRecord*)recordValue);
+    }
+
+    btree_cursor_free(&cursor);
+
+    return ((status < 0) || (result < 0) ? -1 : 0);
+}
+
+#define CATALOG_SCAN_CHUNK_SIZE (256 * 1024)    // Bytes of the catalog file read, and handed to a worker, at once
+
+typedef struct CatalogScanShared {
+    BTreePtr                  tree;
+    hfsplus_catalog_node_func func;
+    void*                     context;
+    int                       stop;         // Set (atomically) once func fails
+    WorkQueue*                queue;
+    unsigned                  queued;       // Chunks handed to the workers since the last wait
+    int                       result;
+} CatalogScanShared;
+
+typedef struct CatalogScanChunk {
+    CatalogScanShared* shared;
+    char*              buffer;
+    bt_nodeid_t        start;
+    bt_nodeid_t        count;
+} CatalogScanChunk;
+
+static void hfsplus_catalog_scan_chunk(void* context)
+{
+    CatalogScanChunk*  chunk    = context;
+    CatalogScanShared* shared   = chunk->shared;
+    BTreePtr           tree     = shared->tree;
+    size_t             nodeSize = tree->headerRecord.nodeSize;
+
+    for (bt_nodeid_t i = 0; i < chunk->count; i++) {
+        if (__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) break;
+
+        bt_nodeid_t nodeNumber = chunk->start + i;
+        char*       data       = chunk->buffer + (i * nodeSize);
+
+        // Only allocated leaf nodes; the kind is a byte, so it can be checked before swapping.
+        if ((nodeNumber == 0) || !BTIsNodeUsed(tree, nodeNumber)) continue;
+        if (((BTNodeDescriptor*)data)->kind != kBTLeafNode) continue;
+
+        struct _BTreeNode node = {
+            .bTree      = tree,
+            .data       = data,
+            .nodeSize   = nodeSize,
+            .nodeOffset = (off_t)nodeNumber * nodeSize,
+            .nodeNumber = nodeNumber,
+            .treeID     = tree->treeID,
+            .dataLen    = nodeSize,
+        };
+        if (hfs_is_standard(tree->fork->hfs)) {
+            if (hfs_standard_translate_node(&node) < 0) continue;
+        } else {
+            if (swap_BTreeNode(&node) < 0) continue;
+            node.recordCount = node.nodeDescriptor->numRecords;
+            hfsplus_catalog_swap_records(&node);
+        }
+
+        if (shared->func(shared->context, &node) < 0) __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+
+        // Translated nodes live in a buffer of their own.
+        if (node.data != data) SFREE(node.data);
+    }
+
+    SFREE(chunk->buffer);
+    SFREE(chunk);
+}
+
+// Runs on the scanning thread as each chunk's read lands.
+static void hfsplus_catalog_scan_landed(void* context, void* buf, ssize_t result)
+{
+    CatalogScanChunk*  chunk    = context;
+    CatalogScanShared* shared   = chunk->shared;
+    size_t             nodeSize = shared->tree->headerRecord.nodeSize;
+    (void)buf;
+
+    if ((result < 0) || ((size_t)result < (chunk->count * nodeSize))) {
+        error("Error reading catalog nodes %u-%u.", chunk->start, chunk->start + chunk->count - 1);
+        __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+        shared->result = -1;
+        SFREE(chunk->buffer);
+        SFREE(chunk);
+        return;
+    }
+
+    if (workqueue_add(shared->queue, hfsplus_catalog_scan_chunk, chunk) < 0) {
+        shared->result = -1;
+        SFREE(chunk->buffer);
+        SFREE(chunk);
+        return;
+    }
+    shared->queued++;
+}
+
+int hfsplus_catalog_scan_parallel(const HFSPlus* hfs, hfsplus_catalog_node_func func, void* context)
+{
+    BTreePtr          catalog = NULL;
+    IOEngine*         engine  = NULL;
+    CatalogScanShared shared  = { .func = func, .context = context };
+
+    trace("hfs (%p), func (%p), context (%p)", hfs, func, context);
+
+    if (hfsplus_get_catalog_btree(&catalog, hfs) < 0)
+        return -1;
+
+    // A header node that didn't read (say, from a truncated image) leaves no node size to scan by.
+    if (catalog->headerRecord.nodeSize < sizeof(BTNodeDescriptor)) {
+        error("The catalog header has an invalid node size (%u).", catalog->headerRecord.nodeSize);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((engine = ioengine_make(hfs->queue_depth, kIOEngineAuto)) == NULL)
+        return -1;
+
+    if ((shared.queue = workqueue_make(hfs->threads)) == NULL) {
+        ioengine_free(engine);
+        return -1;
+    }
+
+    // The node bitmap loads on first use; do it here, before the workers share it.
+    (void)BTIsNodeUsed(catalog, 0);
+    shared.tree = catalog;
+
+    size_t      nodeSize = catalog->headerRecord.nodeSize;
+    bt_nodeid_t total    = MIN(catalog->headerRecord.totalNodes, catalog->fork->logicalSize / nodeSize);
+    bt_nodeid_t perChunk = MAX(1, CATALOG_SCAN_CHUNK_SIZE / nodeSize);
+
+    // Keep up to the queue depth of reads in flight; each lands on a worker as soon as it arrives.
+    for (bt_nodeid_t start = 0; (start < total) && !__atomic_load_n(&shared.stop, __ATOMIC_RELAXED); start += perChunk) {
+        CatalogScanChunk* chunk = NULL;
+        SALLOC(chunk, sizeof(CatalogScanChunk));
+        chunk->shared = &shared;
+        chunk->start  = start;
+        chunk->count  = MIN(perChunk, total - start);
+        SALLOC(chunk->buffer, chunk->count * nodeSize);
+
+        if (hfs_read_fork_range_async(engine, chunk->buffer, catalog->fork, chunk->count * nodeSize, (size_t)start * nodeSize, hfsplus_catalog_scan_landed, chunk) < 0) {
+            error("Error reading catalog nodes %u-%u.", start, start + chunk->count - 1);
+            SFREE(chunk->buffer);
+            SFREE(chunk);
+            shared.result = -1;
+            break;
+        }
+
+        // Bound the memory held by chunks waiting for a worker.
+        if (shared.queued >= (2 * workqueue_threads(shared.queue))) {
+            workqueue_wait(shared.queue);
+            shared.queued = 0;
+        }
+    }
+
+    ioengine_free(engine);
+    workqueue_free(shared.queue);
+
+    // Chunks that failed to read (or came up short) are the only way result goes negative.
+    if (shared.result < 0) errno = EIO;
+
+    return ((shared.result < 0) || shared.stop ? -1 : 0);
+}
+
 int HFSPlusGetCNIDName(hfs_str* name, FSSpec spec)
 {
     const HFSPlus*    hfs      = spec.hfs;
@@ -253,6 +455,12 @@ int HFSPlusGetCNIDName(hfs_str* name, FSSpec spec)
 
     trace("name %p, spec (%p, %u, (%u))", name, spec.hfs, spec.parentID, spec.name.length);
 
+    if ((hfs != NULL) && (hfs->index != NULL)) {
+        FSSpec indexed = {0};
+        if (hfs_index_find_cnid(hfs->index, cnid, &indexed, NULL) == 1)
+            return hfsuc_to_str(name, &indexed.name);
+    }
+
     key.parentID  = cnid;
     key.keyLength = kHFSPlusCatalogKeyMinimumLength;
 
@@ -455,7 +663,9 @@ int HFSPlusGetCatalogRecordByFSSpec(HFSPlusCatalogRecord* catalogRecord, FSSpec
         return -1;
     }
 
-    *catalogRecord = *(HFSPlusCatalogRecord*)record.value; //copy
+    // Thread and folder records are shorter than the union; don't read past the end of the node.
+    memset(catalogRecord, 0, sizeof(HFSPlusCatalogRecord));
+    memcpy(catalogRecord, record.value, MIN(record.valueLen, sizeof(HFSPlusCatalogRecord)));
 
     btree_free_node(searchNode);
 
@@ -470,6 +680,12 @@ int HFSPlusGetCatalogInfoByCNID(FSSpec* out_spec, HFSPlusCatalogRecord* out_cata
 
     trace("out_spec (%p), out_catalogRecord (%p), hfs (%p), cnid %u", out_spec, out_catalogRecord, hfs, cnid);
 
+    if ((hfs->index != NULL) && (hfs_index_find_cnid(hfs->index, cnid, &spec, &catalogRecord) == 1)) {
+        if (out_spec)           *out_spec = spec;
+        if (out_catalogRecord)  *out_catalogRecord = catalogRecord;
+        return 0;
+    }
+
     if ( HFSPlusGetCatalogRecordByFSSpec(&catalogRecord, spec) < 0 )
         return -1;
 
@@ -64,6 +64,21 @@ int hfsplus_catalog_get_node (BTreeNodePtr* node, const BTreePtr bTree, bt_nodei
 // int hfs_get_catalog_leaf_record (HFSPlusCatalogKey* const record_key, HFSPlusCatalogRecord* const record_value, const BTreeNodePtr node, BTRecNum recordID) __deprecated;
 
 int8_t hfsplus_catalog_find_record     (BTreeNodePtr* node, BTRecNum* recordID, FSSpec spec) __attribute__((nonnull));
+/**
+   Calls `func` for every record in the catalog's leaf nodes, in key order.  The key and record are only valid for the duration of the call.
+   Return 0 from `func` to continue, 1 to stop early, or -1 to stop with an error.
+ */
+typedef int (* hfsplus_catalog_scan_func)(void* context, const HFSPlusCatalogKey* key, const HFSPlusCatalogRecord* record);
+int    hfsplus_catalog_scan            (const HFSPlus* hfs, hfsplus_catalog_scan_func func, void* context) __attribute__((nonnull(1,2)));
+
+/**
+   Calls `func` once for every catalog leaf node, from several threads at once and in no particular order.  The catalog file is read
+   straight through in large chunks rather than along the leaf chain, so whole-catalog passes that don't need key order run much faster.
+   The node (already byte-swapped) is only valid for the duration of the call.  Return -1 from `func` to stop the scan with an error.
+ */
+typedef int (* hfsplus_catalog_node_func)(void* context, const BTreeNodePtr node);
+int    hfsplus_catalog_scan_parallel   (const HFSPlus* hfs, hfsplus_catalog_node_func func, void* context) __attribute__((nonnull(1,2)));
+
 int    hfsplus_catalog_compare_keys_cf (const HFSPlusCatalogKey* key1, const HFSPlusCatalogKey* key2) __attribute__((nonnull));
 int    hfsplus_catalog_compare_keys_bc (const HFSPlusCatalogKey* key1, const HFSPlusCatalogKey* key2) __attribute__((nonnull));
 
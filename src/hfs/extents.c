@@ -10,7 +10,10 @@
 
 #include "volumes/output.h"
 #include "volumes/utilities.h" // commonly-used utility functions
+#include "hfs/btree/cursor.h"
+#include "hfs/hfs_index.h"
 #include "hfs/hfs_io.h"
+#include "hfs/hfs_standard.h"
 #include "hfs/output_hfs.h"
 #include "logging/logging.h"   // console printing routines
 
@@ -24,9 +27,11 @@ int hfsplus_get_extents_btree(BTreePtr* tree, const HFSPlus* hfs)
 
     debug("Get extents B-Tree");
 
-    static BTreePtr cachedTree = NULL;
+    HFSPlus* volume = (HFSPlus*)hfs;
+
+    if (volume->extentsTree == NULL) {
+        BTreePtr cachedTree = NULL;
 
-    if (cachedTree == NULL) {
         debug("Creating extents B-Tree");
 
         SALLOC(cachedTree, sizeof(struct _BTree));
@@ -35,20 +40,26 @@ int hfsplus_get_extents_btree(BTreePtr* tree, const HFSPlus* hfs)
         if ( hfsplus_get_special_fork(&fork, hfs, kHFSExtentsFileID) < 0 ) {
             critical("Could not create fork for Extents B-Tree!");
         }
-        FILE*        fp = fopen_hfsfork(fork);
-        if (fp == NULL)
+        if (btree_init(cachedTree, fork) < 0) {
+            hfsfork_free(fork);
+            SFREE(cachedTree);
             return -1;
-        btree_init(cachedTree, fp);
+        }
 
         cachedTree->treeID     = kHFSExtentsFileID;
         cachedTree->keyCompare = (btree_key_compare_func)hfsplus_extents_compare_keys;
         cachedTree->getNode    = hfsplus_extents_get_node;
 
+        if (hfs_is_standard(hfs))
+            hfs_standard_prepare_tree(cachedTree);
+
         // Load the bitmap.
         (void)BTIsNodeUsed(cachedTree, 0);
+
+        volume->extentsTree = cachedTree;
     }
 
-    *tree = cachedTree;
+    *tree = volume->extentsTree;
 
     return 0;
 }
@@ -114,6 +125,9 @@ int hfsplus_extents_find_record(HFSPlusExtentRecord* record, hfs_block_t* record
     trace("record (%p), record_start_block (%p), fork (%p), startBlock %zu", record, record_start_block, fork, startBlock);
     debug("Finding extents record for CNID %d with start block %zu", fork->cnid, startBlock);
 
+    if (hfs->index != NULL)
+        return hfs_index_find_extents(hfs->index, fileID, forkType, (hfs_block_t)startBlock, record, record_start_block);
+
     if ( hfsplus_get_extents_btree(&extentsTree, hfs) < 0)
         return -1;
 
@@ -189,6 +203,109 @@ int hfsplus_extents_compare_keys(const HFSPlusExtentKey* key1, const HFSPlusExte
     return 0;
 }
 
+int hfsplus_extents_compare_entries(const HFSPlusExtentEntry* entry1, const HFSPlusExtentEntry* entry2)
+{
+    int result = 0;
+    if ( (result = cmp(entry1->fileID, entry2->fileID)) != 0) return result;
+    if ( (result = cmp(entry1->forkType, entry2->forkType)) != 0) return result;
+    if ( (result = cmp(entry1->startBlock, entry2->startBlock)) != 0) return result;
+    return 0;
+}
+
+static int compare_extent_entries(const void* a, const void* b)
+{
+    return hfsplus_extents_compare_entries(a, b);
+}
+
+int hfsplus_extents_read_all(HFSPlusExtentEntry** out_entries, size_t* out_count, const HFSPlus* hfs)
+{
+    BTreePtr            tree     = NULL;
+    BTreeCursor         cursor   = {0};
+    HFSPlusExtentEntry* entries  = NULL;
+    size_t              count    = 0;
+    size_t              capacity = 0;
+    int                 result   = 0;
+
+    trace("out_entries (%p), out_count (%p), hfs (%p)", out_entries, out_count, hfs);
+
+    if ( hfsplus_get_extents_btree(&tree, hfs) < 0)
+        return -1;
+
+    if (tree->headerRecord.rootNode != 0) {
+        btree_cursor_init(&cursor, tree);
+        for (result = btree_cursor_first(&cursor); result == 1; result = btree_cursor_next(&cursor)) {
+            HFSPlusExtentKey* key   = NULL;
+            void*             value = NULL;
+
+            if (btree_cursor_get(&cursor, (BTreeKeyPtr*)&key, &value) < 0) { result = -1; break; }
+            if (key->keyLength != kHFSPlusExtentKeyMaximumLength) continue;
+
+            if (count == capacity) {
+                capacity = (capacity ? capacity * 2 : 256);
+                SREALLOC(entries, capacity * sizeof(HFSPlusExtentEntry));
+            }
+
+            HFSPlusExtentEntry* entry = &entries[count++];
+            memset(entry, 0, sizeof(HFSPlusExtentEntry));
+            entry->fileID     = key->fileID;
+            entry->forkType   = key->forkType;
+            entry->startBlock = key->startBlock;
+            memcpy(entry->extents, value, sizeof(HFSPlusExtentRecord));
+        }
+        btree_cursor_free(&cursor);
+
+        if (result < 0) {
+            SFREE(entries);
+            return -1;
+        }
+    }
+
+    // The tree is already in key order unless it is damaged; lookups depend on it.
+    if (count) qsort(entries, count, sizeof(HFSPlusExtentEntry), compare_extent_entries);
+
+    *out_entries = entries;
+    *out_count   = count;
+
+    return 0;
+}
+
+const HFSPlusExtentEntry* hfsplus_extents_find_entry(const HFSPlusExtentEntry* entries, size_t count, hfs_cnid_t fileID, hfs_forktype_t forkType, hfs_block_t startBlock)
+{
+    HFSPlusExtentEntry search = { .fileID = fileID, .forkType = forkType, .startBlock = startBlock };
+    size_t             lo     = 0, hi = count;
+
+    // First entry past the search key; the one before it is the candidate.
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (hfsplus_extents_compare_entries(&entries[mid], &search) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo == 0) return NULL;
+
+    const HFSPlusExtentEntry* found = &entries[lo - 1];
+    if ((found->fileID != fileID) || (found->forkType != forkType)) return NULL;
+
+    return found;
+}
+
+size_t hfsplus_extents_fork_entries(const HFSPlusExtentEntry* entries, size_t count, hfs_cnid_t fileID, hfs_forktype_t forkType, const HFSPlusExtentEntry** first)
+{
+    HFSPlusExtentEntry search = { .fileID = fileID, .forkType = forkType, .startBlock = 0 };
+    size_t             lo     = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (hfsplus_extents_compare_entries(&entries[mid], &search) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t end = lo;
+    while ((end < count) && (entries[end].fileID == fileID) && (entries[end].forkType == forkType)) end++;
+
+    *first = (entries ? &entries[lo] : NULL);
+    return end - lo;
+}
+
 bool hfsplus_extents_get_extentlist_for_fork(ExtentList* list, const HFSPlusFork* fork)
 {
     unsigned blocks = 0;
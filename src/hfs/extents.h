@@ -12,12 +12,31 @@
 #include "hfs/types.h"
 #include "hfs/hfs_extentlist.h"
 
+// An extents overflow leaf record and its key, in host byte order.
+typedef struct HFSPlusExtentEntry {
+    hfs_cnid_t          fileID;
+    hfs_block_t         startBlock;
+    hfs_forktype_t      forkType;
+    uint8_t             _reserved[7];
+    HFSPlusExtentRecord extents;
+} HFSPlusExtentEntry;
+
 int  hfsplus_get_extents_btree (BTreePtr* tree, const HFSPlus* hfs) __attribute__((nonnull));
 int  hfsplus_extents_find_record (HFSPlusExtentRecord* record, hfs_block_t* record_start_block, const HFSPlusFork* fork, size_t startBlock) __attribute__((nonnull));
 int  hfsplus_extents_compare_keys (const HFSPlusExtentKey* key1, const HFSPlusExtentKey* key2) __attribute__((nonnull));
 bool hfsplus_extents_get_extentlist_for_fork (ExtentList* list, const HFSPlusFork* fork) __attribute__((nonnull));
 int  hfsplus_extents_get_node (BTreeNodePtr* node, const BTreePtr bTree, bt_nodeid_t nodeNum) __attribute__((nonnull));
 
+// Reads every leaf record of the extents overflow tree into a table in key order, so bulk operations can look up overflow extents without searching the tree.
+int  hfsplus_extents_read_all (HFSPlusExtentEntry** entries, size_t* count, const HFSPlus* hfs) __attribute__((nonnull));
+int  hfsplus_extents_compare_entries (const HFSPlusExtentEntry* entry1, const HFSPlusExtentEntry* entry2) __attribute__((nonnull));
+
+// Finds the entry in a key-ordered table whose record holds `startBlock` of a fork, or NULL.
+const HFSPlusExtentEntry* hfsplus_extents_find_entry (const HFSPlusExtentEntry* entries, size_t count, hfs_cnid_t fileID, hfs_forktype_t forkType, hfs_block_t startBlock);
+
+// Finds all of a fork's entries in a key-ordered table. Returns the number of entries starting at *first.
+size_t hfsplus_extents_fork_entries (const HFSPlusExtentEntry* entries, size_t count, hfs_cnid_t fileID, hfs_forktype_t forkType, const HFSPlusExtentEntry** first) __attribute__((nonnull(5)));
+
 void swap_HFSPlusExtentKey          (HFSPlusExtentKey* record) __attribute__((nonnull));
 void swap_HFSPlusExtentRecord       (HFSPlusExtentDescriptor record[]) __attribute__((nonnull));
 void swap_HFSPlusExtentDescriptor   (HFSPlusExtentDescriptor* extent) __attribute__((nonnull));
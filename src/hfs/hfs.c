@@ -7,6 +7,8 @@
 //
 
 #include "hfs/hfs.h"
+#include "hfs/hfs_index.h"
+#include "hfs/hfs_standard.h"
 #include "logging/logging.h" // console printing routines
 
 
@@ -46,7 +48,17 @@ int hfsplus_load_header(Volume* vol, HFSPlusVolumeHeader* vh)
 int hfs_close(HFSPlus* hfs) {
     trace("hfs (%p)", hfs);
     debug("Closing volume.");
-    int result = vol_close(hfs->vol);
+    hfs_index_close(hfs);
+
+    BTreePtr* trees[] = { &hfs->hotfilesTree, &hfs->attributesTree, &hfs->catalogTree, &hfs->extentsTree };
+    for (unsigned i = 0; i < (sizeof(trees) / sizeof(trees[0])); i++) {
+        if (*trees[i] != NULL) btree_free(*trees[i]);
+        *trees[i] = NULL;
+    }
+
+    // A standard HFS volume reads through a partition over its allocation blocks; closing the volume it was opened on takes that with it.
+    Volume* vol    = (hfs_is_standard(hfs) ? hfs->vol->parent_partition : hfs->vol);
+    int     result = vol_close(vol);
     return result;
 }
 
@@ -65,7 +77,7 @@ int hfs_open(HFSPlus* hfs, Volume* vol)
 
     type   = (unsigned)result;
 
-    if ((type != kFSTypeHFSPlus) && (type != kFSTypeWrappedHFSPlus) && (type != kFSTypeHFSX)) {
+    if ((type != kFSTypeHFSPlus) && (type != kFSTypeWrappedHFSPlus) && (type != kFSTypeHFSX) && (type != kFSTypeHFS)) {
         errno = EINVAL;
         return -1;
     }
@@ -73,6 +85,9 @@ int hfs_open(HFSPlus* hfs, Volume* vol)
     // Clear the HFSVolume struct (hope you didn't need that)
     memset(hfs, 0, sizeof(struct HFSPlus));
 
+    if (type == kFSTypeHFS)
+        return hfs_standard_open(hfs, vol);
+
     // Handle wrapped volumes.
     if (type == kFSTypeWrappedHFSPlus) {
         HFSMasterDirectoryBlock mdb = {0};
@@ -145,7 +160,7 @@ int hfs_test(Volume* vol)
     return type;
 }
 
-/** returns the first HFS+ volume in a tree of volumes */
+/** returns the first HFS or HFS+ volume in a tree of volumes */
 Volume* hfsplus_find(Volume* vol)
 {
     Volume* result = NULL;
@@ -156,9 +171,13 @@ Volume* hfsplus_find(Volume* vol)
     debug("hfsplus_find");
 
     assert(vol != NULL);
-    test = hfs_test(vol);
 
-    if ( (test) & (kFSTypeHFSPlus | kFSTypeWrappedHFSPlus)) {
+    // A Core Storage physical volume usually starts with its first logical volume's blocks, so it can pass for
+    // HFS+ itself; only the logical volume reads the rest of the filesystem from the right place.
+    if (vol->subtype != kPMCoreStorage)
+        test = hfs_test(vol);
+
+    if ((test == kFSTypeHFSPlus) || (test == kFSTypeWrappedHFSPlus) || (test == kFSTypeHFSX) || (test == kFSTypeHFS)) {
         result = vol;
     } else if (vol->partition_count) {
         for(unsigned i = 0; i < vol->partition_count; i++) {
@@ -182,6 +201,10 @@ bool hfs_get_HFSMasterDirectoryBlock(HFSMasterDirectoryBlock* vh, const HFSPlus*
 
     trace("vh (%p), hfs (%p)", vh, hfs);
 
+    // A standard volume's reads start at its allocation blocks; the MDB is back in the volume it was opened on.
+    if (hfs->vol && hfs_is_standard(hfs))
+        return (hfs_load_mbd(hfs->vol->parent_partition, vh) == 0);
+
     if (hfs->vol) {
         SALLOC(buffer, 2048)
 
@@ -16,6 +16,7 @@
 
 #include "hfs/extents.h"
 #include "hfs/catalog.h"
+#include "hfs/hfs_standard.h"
 #include "hfs/btree/btree.h"
 #include "hfs/Apple/hfs_types.h"
 
@@ -24,6 +25,8 @@
 int     hfs_test (Volume* vol) __attribute__((nonnull));
 Volume* hfsplus_find (Volume* vol) __attribute__((nonnull));
 
+int hfs_load_mbd (Volume* vol, HFSMasterDirectoryBlock* mdb) __attribute__((nonnull));
+
 int hfs_open (HFSPlus* hfs, Volume* vol) __attribute__((nonnull));
 int hfs_close (HFSPlus* hfs) __attribute__((nonnull));
 
@@ -20,11 +20,7 @@ int hfs_get_btree(BTreePtr* btree, const HFSPlus* hfs, hfs_cnid_t cnid)
     if ( hfsplus_get_special_fork(&fork, hfs, cnid) < 0 )
         goto ERR;
 
-    FILE* fp = NULL;
-    if ( (fp = fopen_hfsfork(fork)) == NULL )
-        goto ERR;
-
-    if (btree_init(tree, fp) < 0)
+    if (btree_init(tree, fork) < 0)
         goto ERR;
 
     tree->treeID = cnid;
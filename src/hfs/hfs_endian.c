@@ -25,7 +25,7 @@ void swap_HFSExtentRecord(HFSExtentRecord* record)
 {
     // trace("record (%p)", record);
     for(unsigned i = 0; i < kHFSExtentDensity; i++)
-        swap_HFSExtentDescriptor(record[i]);
+        swap_HFSExtentDescriptor(&(*record)[i]);
 }
 
 void swap_HFSMasterDirectoryBlock(HFSMasterDirectoryBlock* record)
@@ -62,6 +62,63 @@ void swap_HFSMasterDirectoryBlock(HFSMasterDirectoryBlock* record)
     swap_HFSExtentRecord(&record->drCTExtRec);        /* extent record for catalog file */
 }
 
+void swap_HFSExtentKey(HFSExtentKey* record)
+{
+    // trace("record (%p)", record);
+//    noswap: keyLength, forkType
+    Swap32(record->fileID);
+    Swap16(record->startBlock);
+}
+
+void swap_HFSCatalogKey(HFSCatalogKey* record)
+{
+    // trace("record (%p)", record);
+//    noswap: keyLength, nodeName (Pascal string)
+    Swap32(record->parentID);
+}
+
+void swap_HFSCatalogFolder(HFSCatalogFolder* record)
+{
+    // trace("record (%p)", record);
+    Swap16(record->recordType);
+    Swap16(record->flags);
+    Swap16(record->valence);
+    Swap32(record->folderID);
+    Swap32(record->createDate);
+    Swap32(record->modifyDate);
+    Swap32(record->backupDate);
+    swap_FndrDirInfo(&record->userInfo);
+    swap_FndrOpaqueInfo(&record->finderInfo);
+}
+
+void swap_HFSCatalogFile(HFSCatalogFile* record)
+{
+    // trace("record (%p)", record);
+    Swap16(record->recordType);
+    swap_FndrFileInfo(&record->userInfo);
+    Swap32(record->fileID);
+    Swap16(record->dataStartBlock);
+    Swap32(record->dataLogicalSize);
+    Swap32(record->dataPhysicalSize);
+    Swap16(record->rsrcStartBlock);
+    Swap32(record->rsrcLogicalSize);
+    Swap32(record->rsrcPhysicalSize);
+    Swap32(record->createDate);
+    Swap32(record->modifyDate);
+    Swap32(record->backupDate);
+    swap_FndrOpaqueInfo(&record->finderInfo);
+    Swap16(record->clumpSize);
+    swap_HFSExtentRecord(&record->dataExtents);
+    swap_HFSExtentRecord(&record->rsrcExtents);
+}
+
+void swap_HFSCatalogThread(HFSCatalogThread* record)
+{
+    // trace("record (%p)", record);
+    Swap16(record->recordType);
+    Swap32(record->parentID);
+}
+
 void swap_HFSPlusVolumeHeader(HFSPlusVolumeHeader* record)
 {
     // trace("record (%p)", record);
@@ -17,6 +17,11 @@
 void swap_HFSMasterDirectoryBlock   (HFSMasterDirectoryBlock* record) __attribute__((nonnull));
 void swap_HFSExtentRecord           (HFSExtentRecord* record) __attribute__((nonnull));
 void swap_HFSExtentDescriptor       (HFSExtentDescriptor* record) __attribute__((nonnull));
+void swap_HFSExtentKey              (HFSExtentKey* record) __attribute__((nonnull));
+void swap_HFSCatalogKey             (HFSCatalogKey* record) __attribute__((nonnull));
+void swap_HFSCatalogFolder          (HFSCatalogFolder* record) __attribute__((nonnull));
+void swap_HFSCatalogFile            (HFSCatalogFile* record) __attribute__((nonnull));
+void swap_HFSCatalogThread          (HFSCatalogThread* record) __attribute__((nonnull));
 
 #pragma mark HFS Plus
 
@@ -0,0 +1,395 @@
+//
+//  hfs_index.c
+//  hfsinspect
+//
+//
+
+#include <sys/mman.h>           // mmap
+#include <sys/stat.h>           // fstat
+#include <fcntl.h>              // open
+
+#include "hfs/hfs_index.h"
+
+#include "hfs/extents.h"
+#include "hfs/btree/cursor.h"
+#include "hfsplus/attributes.h"
+#include "logging/logging.h"    // console printing routines
+
+#define HFS_INDEX_BYTE_ORDER 0x01020304
+
+struct HFSIndex {
+    void*                       map;
+    size_t                      length;
+    const HFSIndexEntry*        entries;
+    size_t                      entryCount;
+    const HFSIndexChild*        children;
+    size_t                      childCount;
+    const char*                 names;
+    size_t                      namesLength;
+    const char*                 records;
+    size_t                      recordsLength;
+    const HFSPlusExtentEntry*   extents;
+    size_t                      extentCount;
+    const uint8_t*              bitmaps[3];     // Catalog, extents, attributes
+    size_t                      bitmapLengths[3];
+};
+
+// A growing section while the index is being built.
+typedef struct IndexBuffer {
+    char*  data;
+    size_t length;
+    size_t capacity;
+} IndexBuffer;
+
+typedef struct IndexBuild {
+    IndexBuffer sections[HFSIndexSectionCount];
+} IndexBuild;
+
+#pragma mark Building
+
+// Appends `length` bytes at the next multiple of `align` and returns their offset.
+static uint64_t index_buffer_append(IndexBuffer* buffer, const void* data, size_t length, size_t align)
+{
+    size_t offset = (buffer->length + align - 1) & ~(align - 1);
+
+    if (offset + length > buffer->capacity) {
+        buffer->capacity = MAX(offset + length, (buffer->capacity ? buffer->capacity * 2 : 65536));
+        SREALLOC(buffer->data, buffer->capacity);
+    }
+
+    memset(buffer->data + buffer->length, 0, offset - buffer->length);
+    memcpy(buffer->data + offset, data, length);
+    buffer->length = offset + length;
+
+    return offset;
+}
+
+static int index_compare_entries(const void* a, const void* b)
+{
+    const HFSIndexEntry* A = a;
+    const HFSIndexEntry* B = b;
+    return cmp(A->cnid, B->cnid);
+}
+
+static int index_scan_record(void* context, const HFSPlusCatalogKey* key, const HFSPlusCatalogRecord* record)
+{
+    IndexBuild*   build  = context;
+    HFSIndexEntry entry  = { .parentID = key->parentID };
+    size_t        length = 0;
+
+    switch (record->record_type) {
+        case kHFSPlusFileRecord:
+            entry.cnid = record->catalogFile.fileID;
+            length     = sizeof(HFSPlusCatalogFile);
+            break;
+
+        case kHFSPlusFolderRecord:
+            entry.cnid = record->catalogFolder.folderID;
+            length     = sizeof(HFSPlusCatalogFolder);
+            break;
+
+        default:
+            return 0;
+    }
+
+    size_t nameLength = sizeof(key->nodeName.length) + (MIN(key->nodeName.length, 255) * sizeof(key->nodeName.unicode[0]));
+
+    entry.name   = index_buffer_append(&build->sections[HFSIndexNames], &key->nodeName, nameLength, 2);
+    entry.record = index_buffer_append(&build->sections[HFSIndexRecords], record, length, 8);
+    (void)index_buffer_append(&build->sections[HFSIndexCatalog], &entry, sizeof(entry), 8);
+
+    HFSIndexChild child = { .parentID = key->parentID, .cnid = entry.cnid };
+    (void)index_buffer_append(&build->sections[HFSIndexChildren], &child, sizeof(child), 4);
+
+    return 0;
+}
+
+static int index_scan_extents(IndexBuild* build, const HFSPlus* hfs)
+{
+    HFSPlusExtentEntry* entries = NULL;
+    size_t              count   = 0;
+
+    if (hfsplus_extents_read_all(&entries, &count, hfs) < 0) return -1;
+
+    if (count) (void)index_buffer_append(&build->sections[HFSIndexExtents], entries, count * sizeof(HFSPlusExtentEntry), 8);
+    SFREE(entries);
+
+    return 0;
+}
+
+static int index_copy_bitmap(IndexBuffer* buffer, BTreePtr tree)
+{
+    // Loads the bitmap from the tree's map records.
+    (void)BTIsNodeUsed(tree, 0);
+    if (tree->nodeBitmap == NULL) { errno = EIO; return -1; }
+
+    (void)index_buffer_append(buffer, tree->nodeBitmap, tree->nodeBitmapSize, 1);
+    return 0;
+}
+
+int hfs_index_build(const HFSPlus* hfs, const char* path)
+{
+    IndexBuild     build          = {0};
+    HFSIndexHeader header         = {0};
+    BTreePtr       tree           = NULL;
+    char           temp[PATH_MAX] = "";
+    FILE*          fp             = NULL;
+    int            result         = -1;
+
+    debug("Building metadata index %s", path);
+
+    if (hfsplus_catalog_scan(hfs, index_scan_record, &build) < 0) goto RETURN;
+    if (index_scan_extents(&build, hfs) < 0) goto RETURN;
+
+    if ((hfsplus_get_catalog_btree(&tree, hfs) < 0) || (index_copy_bitmap(&build.sections[HFSIndexCatalogBitmap], tree) < 0)) goto RETURN;
+    if ((hfsplus_get_extents_btree(&tree, hfs) < 0) || (index_copy_bitmap(&build.sections[HFSIndexExtentsBitmap], tree) < 0)) goto RETURN;
+    if (hfs->vh.attributesFile.logicalSize) {
+        if ((hfs_get_attribute_btree(&tree, hfs) < 0) || (index_copy_bitmap(&build.sections[HFSIndexAttributesBitmap], tree) < 0)) goto RETURN;
+    }
+
+    IndexBuffer* catalog = &build.sections[HFSIndexCatalog];
+    IndexBuffer* extents = &build.sections[HFSIndexExtents];
+    qsort(catalog->data, catalog->length / sizeof(HFSIndexEntry), sizeof(HFSIndexEntry), index_compare_entries);
+
+    memcpy(header.signature, HFS_INDEX_SIGNATURE, sizeof(header.signature));
+    header.version     = HFS_INDEX_VERSION;
+    header.byteOrder   = HFS_INDEX_BYTE_ORDER;
+    header.volumeID    = ((const HFSPlusVolumeFinderInfo*)&hfs->vh.finderInfo)->volID;
+    header.createDate  = hfs->vh.createDate;
+    header.modifyDate  = hfs->vh.modifyDate;
+    header.writeCount  = hfs->vh.writeCount;
+    header.blockSize   = hfs->vh.blockSize;
+    header.totalBlocks = hfs->vh.totalBlocks;
+
+    uint64_t offset = (sizeof(header) + 7) & ~7ULL;
+    for (unsigned i = 0; i < HFSIndexSectionCount; i++) {
+        header.sections[i].offset = offset;
+        header.sections[i].length = build.sections[i].length;
+        offset                    = (offset + build.sections[i].length + 7) & ~7ULL;
+    }
+
+    // Write beside the final name and rename into place, so a reader never maps half a file.
+    (void)snprintf(temp, PATH_MAX, "%s.tmp", path);
+    if ((fp = fopen(temp, "wb")) == NULL) goto RETURN;
+
+    static const char padding[8] = {0};
+    bool              failed     = (fwrite(&header, sizeof(header), 1, fp) != 1);
+    size_t            written    = sizeof(header);
+    for (unsigned i = 0; (i < HFSIndexSectionCount) && !failed; i++) {
+        size_t pad = header.sections[i].offset - written;
+        if (pad && (fwrite(padding, 1, pad, fp) != pad)) failed = true;
+        if (build.sections[i].length && (fwrite(build.sections[i].data, build.sections[i].length, 1, fp) != 1)) failed = true;
+        written = header.sections[i].offset + header.sections[i].length;
+    }
+
+    if ((fclose(fp) != 0) || failed || (rename(temp, path) < 0)) {
+        (void)unlink(temp);
+        goto RETURN;
+    }
+
+    info("Built metadata index %s (%zu records, %zu extent records).", path,
+         catalog->length / sizeof(HFSIndexEntry), extents->length / sizeof(HFSPlusExtentEntry));
+    result = 0;
+
+RETURN:
+    for (unsigned i = 0; i < HFSIndexSectionCount; i++) SFREE(build.sections[i].data);
+    return result;
+}
+
+#pragma mark Mapping
+
+// Maps a sidecar. Returns 1 if it is usable for this volume, 0 if missing or stale, and -1 on error.
+static int index_map(HFSIndex** out_index, const HFSPlus* hfs, const char* path)
+{
+    struct stat           st     = {0};
+    void*                 map    = NULL;
+    int                   fd     = -1;
+    const HFSIndexHeader* header = NULL;
+
+    if ((fd = open(path, O_RDONLY)) < 0) return (errno == ENOENT ? 0 : -1);
+
+    if ((fstat(fd, &st) < 0) || ((size_t)st.st_size < sizeof(HFSIndexHeader))) {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    header = map;
+
+    bool current = (
+        (memcmp(header->signature, HFS_INDEX_SIGNATURE, sizeof(header->signature)) == 0) &&
+        (header->version == HFS_INDEX_VERSION) &&
+        (header->byteOrder == HFS_INDEX_BYTE_ORDER) &&
+        (header->volumeID == ((const HFSPlusVolumeFinderInfo*)&hfs->vh.finderInfo)->volID) &&
+        (header->createDate == hfs->vh.createDate) &&
+        (header->modifyDate == hfs->vh.modifyDate) &&
+        (header->writeCount == hfs->vh.writeCount) &&
+        (header->blockSize == hfs->vh.blockSize) &&
+        (header->totalBlocks == hfs->vh.totalBlocks)
+        );
+
+    for (unsigned i = 0; (i < HFSIndexSectionCount) && current; i++) {
+        const HFSIndexSection* section = &header->sections[i];
+        if ((section->offset % 8) || (section->offset > (uint64_t)st.st_size) || (section->length > (uint64_t)st.st_size - section->offset))
+            current = false;
+    }
+
+    if (!current) {
+        munmap(map, st.st_size);
+        info("Metadata index %s does not match the volume; rebuilding.", path);
+        return 0;
+    }
+
+    HFSIndex* index = NULL;
+    SALLOC(index, sizeof(HFSIndex));
+
+    const HFSIndexSection* s = header->sections;
+    index->map           = map;
+    index->length        = st.st_size;
+    index->entries       = (const void*)((char*)map + s[HFSIndexCatalog].offset);
+    index->entryCount    = s[HFSIndexCatalog].length / sizeof(HFSIndexEntry);
+    index->children      = (const void*)((char*)map + s[HFSIndexChildren].offset);
+    index->childCount    = s[HFSIndexChildren].length / sizeof(HFSIndexChild);
+    index->names         = (const char*)map + s[HFSIndexNames].offset;
+    index->namesLength   = s[HFSIndexNames].length;
+    index->records       = (const char*)map + s[HFSIndexRecords].offset;
+    index->recordsLength = s[HFSIndexRecords].length;
+    index->extents       = (const void*)((char*)map + s[HFSIndexExtents].offset);
+    index->extentCount   = s[HFSIndexExtents].length / sizeof(HFSPlusExtentEntry);
+
+    for (unsigned i = 0; i < 3; i++) {
+        index->bitmaps[i]       = (const uint8_t*)map + s[HFSIndexCatalogBitmap + i].offset;
+        index->bitmapLengths[i] = s[HFSIndexCatalogBitmap + i].length;
+    }
+
+    *out_index = index;
+    return 1;
+}
+
+int hfs_index_open(HFSPlus* hfs, const char* path)
+{
+    HFSIndex* index  = NULL;
+    int       result = 0;
+
+    if (hfs->index != NULL) hfs_index_close(hfs);
+
+    if ((result = index_map(&index, hfs, path)) == 0) {
+        if (hfs_index_build(hfs, path) < 0) return -1;
+        result = index_map(&index, hfs, path);
+    }
+
+    if (result < 0) return -1;
+    if (result == 0) { errno = EINVAL; return -1; }
+
+    debug("Attached metadata index %s (%zu records).", path, index->entryCount);
+    hfs->index = index;
+
+    return 0;
+}
+
+void hfs_index_close(HFSPlus* hfs)
+{
+    if (hfs->index == NULL) return;
+
+    munmap(hfs->index->map, hfs->index->length);
+    SFREE(hfs->index);
+}
+
+#pragma mark Lookups
+
+static const HFSIndexEntry* index_find_entry(const HFSIndex* index, bt_nodeid_t cnid)
+{
+    size_t lo = 0, hi = index->entryCount;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index->entries[mid].cnid < cnid) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if ((lo < index->entryCount) && (index->entries[lo].cnid == cnid)) return &index->entries[lo];
+    return NULL;
+}
+
+int hfs_index_find_cnid(const HFSIndex* index, bt_nodeid_t cnid, FSSpec* spec, HFSPlusCatalogRecord* record)
+{
+    const HFSIndexEntry* entry = index_find_entry(index, cnid);
+    if (entry == NULL) return 0;
+
+    if (spec != NULL) {
+        uint16_t length = 0;
+        if (entry->name + sizeof(length) > index->namesLength) return 0;
+        memcpy(&length, index->names + entry->name, sizeof(length));
+        length = MIN(length, 255);
+        if (entry->name + sizeof(length) + (length * sizeof(uint16_t)) > index->namesLength) return 0;
+
+        spec->parentID    = entry->parentID;
+        memset(&spec->name, 0, sizeof(spec->name));
+        spec->name.length = length;
+        memcpy(spec->name.unicode, index->names + entry->name + sizeof(length), length * sizeof(uint16_t));
+    }
+
+    if (record != NULL) {
+        int16_t type = 0;
+        if (entry->record + sizeof(type) > index->recordsLength) return 0;
+        memcpy(&type, index->records + entry->record, sizeof(type));
+
+        size_t length = (type == kHFSPlusFileRecord ? sizeof(HFSPlusCatalogFile) : sizeof(HFSPlusCatalogFolder));
+        if (entry->record + length > index->recordsLength) return 0;
+
+        memset(record, 0, sizeof(HFSPlusCatalogRecord));
+        memcpy(record, index->records + entry->record, length);
+    }
+
+    return 1;
+}
+
+int hfs_index_find_extents(const HFSIndex* index, hfs_cnid_t fileID, hfs_forktype_t forkType, hfs_block_t startBlock, HFSPlusExtentRecord* record, hfs_block_t* recordStart)
+{
+    const HFSPlusExtentEntry* found = hfsplus_extents_find_entry(index->extents, index->extentCount, fileID, forkType, startBlock);
+    if (found == NULL) return 0;
+
+    if (record != NULL) memcpy(*record, found->extents, sizeof(HFSPlusExtentRecord));
+    *recordStart = found->startBlock;
+
+    return 1;
+}
+
+size_t hfs_index_children(const HFSIndex* index, bt_nodeid_t parentID, const HFSIndexChild** children)
+{
+    size_t lo = 0, hi = index->childCount;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index->children[mid].parentID < parentID) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t end = lo;
+    while ((end < index->childCount) && (index->children[end].parentID == parentID)) end++;
+
+    *children = &index->children[lo];
+    return end - lo;
+}
+
+int hfs_index_node_bitmap(const HFSIndex* index, bt_nodeid_t treeID, const uint8_t** bitmap, size_t* length)
+{
+    unsigned slot = 0;
+
+    switch (treeID) {
+        case kHFSCatalogFileID:    slot = 0; break;
+        case kHFSExtentsFileID:    slot = 1; break;
+        case kHFSAttributesFileID: slot = 2; break;
+        default:                   return 0;
+    }
+
+    if (index->bitmapLengths[slot] == 0) return 0;
+
+    *bitmap = index->bitmaps[slot];
+    *length = index->bitmapLengths[slot];
+    return 1;
+}
+
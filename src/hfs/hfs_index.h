@@ -0,0 +1,103 @@
+//
+//  hfs_index.h
+//  hfsinspect
+//
+//
+
+#ifndef hfsinspect_hfs_index_h
+#define hfsinspect_hfs_index_h
+
+#include "hfs/types.h"
+#include "hfs/catalog.h"
+
+/*
+   An optional sidecar file holding a flattened copy of the volume's metadata, mapped
+   read-only into memory. Once one is attached to an HFSPlus, catalog lookups by CNID,
+   folder listings, overflow extent lookups and B-tree node bitmaps are answered from the
+   map instead of walking the trees.
+
+   The sidecar is tied to one volume (its finder info volume ID and create date) in one
+   state (modify date and write count); a sidecar that no longer matches is rebuilt.
+
+   File layout (host byte order, every section 8-byte aligned):
+
+     HFSIndexHeader
+     Catalog      HFSIndexEntry[]       one per file and folder record, ordered by CNID
+     Children     HFSIndexChild[]       the same records in catalog key order (by parent, then name)
+     Names        HFSUniStr255s packed to their length (u16 length, then the characters)
+     Records      catalog file and folder records, 8-byte aligned
+     Extents      HFSPlusExtentEntry[]  every extents overflow leaf record in key order
+     Bitmaps      node bitmaps of the catalog, extents and attributes trees
+ */
+
+#define HFS_INDEX_SIGNATURE "HIMETAIX"
+#define HFS_INDEX_VERSION   1
+
+enum {
+    HFSIndexCatalog = 0,
+    HFSIndexChildren,
+    HFSIndexNames,
+    HFSIndexRecords,
+    HFSIndexExtents,
+    HFSIndexCatalogBitmap,
+    HFSIndexExtentsBitmap,
+    HFSIndexAttributesBitmap,
+    HFSIndexSectionCount
+};
+
+typedef struct HFSIndexSection {
+    uint64_t offset;            // From the start of the file
+    uint64_t length;            // Bytes
+} HFSIndexSection;
+
+typedef struct HFSIndexHeader {
+    char            signature[8];
+    uint32_t        version;
+    uint32_t        byteOrder;  // 0x01020304 as written by the host that built it
+    uint64_t        volumeID;   // Finder info volume ID
+    uint32_t        createDate;
+    uint32_t        modifyDate;
+    uint32_t        writeCount;
+    uint32_t        blockSize;
+    uint32_t        totalBlocks;
+    uint32_t        _reserved;
+    HFSIndexSection sections[HFSIndexSectionCount];
+} HFSIndexHeader;
+
+typedef struct HFSIndexEntry {
+    hfs_cnid_t cnid;
+    hfs_cnid_t parentID;
+    uint64_t   name;            // Offset into Names
+    uint64_t   record;          // Offset into Records
+} HFSIndexEntry;
+
+typedef struct HFSIndexChild {
+    hfs_cnid_t parentID;
+    hfs_cnid_t cnid;
+} HFSIndexChild;
+
+typedef struct HFSIndex HFSIndex;
+
+// Maps the sidecar at `path` and attaches it to `hfs`, building (or rebuilding) it first if it is missing or stale.
+int  hfs_index_open           (HFSPlus* hfs, const char* path) __attribute__((nonnull));
+
+// Writes a new sidecar for the volume's current state.
+int  hfs_index_build          (const HFSPlus* hfs, const char* path) __attribute__((nonnull));
+
+void hfs_index_close          (HFSPlus* hfs) __attribute__((nonnull));
+
+// Lookups return 1 when found, 0 when not.
+
+// Fetches the file or folder record for a CNID and the FSSpec (parent and name) that keys it.
+int  hfs_index_find_cnid      (const HFSIndex* index, bt_nodeid_t cnid, FSSpec* spec, HFSPlusCatalogRecord* record) __attribute__((nonnull(1)));
+
+// Fetches the extents overflow record holding `startBlock` of a fork, like hfsplus_extents_find_record.
+int  hfs_index_find_extents   (const HFSIndex* index, hfs_cnid_t fileID, hfs_forktype_t forkType, hfs_block_t startBlock, HFSPlusExtentRecord* record, hfs_block_t* recordStart) __attribute__((nonnull(1,6)));
+
+// Returns the children of a folder, in catalog order, as a range of the Children table.
+size_t hfs_index_children     (const HFSIndex* index, bt_nodeid_t parentID, const HFSIndexChild** children) __attribute__((nonnull));
+
+// Points at the node bitmap of a B-tree (by its file ID).
+int  hfs_index_node_bitmap    (const HFSIndex* index, bt_nodeid_t treeID, const uint8_t** bitmap, size_t* length) __attribute__((nonnull));
+
+#endif
@@ -266,17 +266,17 @@ ssize_t hfs_read_fork(void* buffer, const HFSPlusFork* fork, size_t block_count,
         debug("Trimmed request to (%zu, %zu) (file only has %d blocks)", request.start, request.count, fork->totalBlocks);
     }
 
-    char*       read_buffer = NULL;
-    SALLOC(read_buffer, block_count * fork->hfs->block_size);
-    ExtentList* extentList  = fork->extents;
+    ExtentList* extentList = fork->extents;
 
     // Keep track of what's left to get
-    range       remaining   = request;
+    range       remaining  = request;
 
+    // Each extent is read straight into its place in the caller's buffer.
     while (remaining.count != 0) {
         range   read_range;
         bool    found  = false;
         ssize_t blocks = 0;
+        char*   target = (char*)buffer + ((remaining.start - request.start) * fork->hfs->block_size);
 
         if (++loopCounter > 2000) {
             Extent* extent = NULL;
@@ -300,26 +300,27 @@ ssize_t hfs_read_fork(void* buffer, const HFSPlusFork* fork, size_t block_count,
             continue;
         }
 
-        read_range.count = MIN(read_range.count, request.count);
+        read_range.count = MIN(read_range.count, remaining.count);
 
-        blocks           = hfs_read_blocks(read_buffer, fork->hfs, read_range.count, read_range.start);
+        blocks           = hfs_read_blocks(target, fork->hfs, read_range.count, read_range.start);
         if (blocks < 0) {
-            SFREE(read_buffer);
             perror("read fork");
             critical("Read error.");
             return -1;
         }
 
+        // vol_read returns bytes.
+        blocks           = blocks / fork->hfs->block_size;
+        if (blocks == 0) {
+            warning("Short read of CNID %u at logical block %zu.", fork->cnid, remaining.start);
+            break;
+        }
+
         remaining.count -= MIN((size_t)blocks, remaining.count);
         remaining.start += blocks;
-
-        if (remaining.count == 0) break;
     }
 
-    memcpy(buffer, read_buffer, MIN(block_count, request.count) * fork->hfs->block_size);
-    SFREE(read_buffer);
-
-    return request.count;
+    return (request.count - remaining.count);
 }
 
 // Grab a specific byte range of a fork.
@@ -328,11 +329,8 @@ ssize_t hfs_read_fork_range(void* buffer, const HFSPlusFork* fork, size_t size,
     ASSERT_PTR(buffer);
     ASSERT_PTR(fork);
 
-    size_t  start_block = 0;
-    size_t  byte_offset = 0;
-    size_t  block_count = 0;
-    char*   read_buffer = NULL;
-    ssize_t read_blocks = 0;
+    size_t block_size = fork->hfs->block_size;
+    size_t done       = 0;
 
     // Range check.
     if (offset > fork->logicalSize) {
@@ -348,31 +346,137 @@ ssize_t hfs_read_fork_range(void* buffer, const HFSPlusFork* fork, size_t size,
         return 0;
     }
 
-    // The range starts somewhere in this block.
-    start_block = (size_t)(offset / fork->hfs->block_size);
+    // Walk the extents covering the range, reading each contiguous run directly into the caller's
+    // buffer. vol_read only needs a bounce buffer for the sector-unaligned ends.
+    while (done < size) {
+        size_t position     = offset + done;
+        size_t within_block = position % block_size;
+        size_t start_block  = 0;
+        size_t run_blocks   = 0;
+
+        if ( !extentlist_find(fork->extents, position / block_size, &start_block, &run_blocks) ) {
+            error("Logical block %zu not found in the extents for CNID %u.", position / block_size, fork->cnid);
+            break;
+        }
+
+        size_t  length = MIN(size - done, (run_blocks * block_size) - within_block);
+        ssize_t bytes  = hfs_read((char*)buffer + done, fork->hfs, length, (start_block * block_size) + within_block);
 
-    // Offset of the request within the start block.
-    byte_offset = (offset % fork->hfs->block_size);
+        if (bytes < 0) {
+            if (done == 0) return -1;
+            break;
+        }
 
-    // Add a block to the read if the offset is not block-aligned.
-    block_count = (size / fork->hfs->block_size) + ( ((offset + size) % fork->hfs->block_size) ? 1 : 0);
+        done += bytes;
+        if ((size_t)bytes < length) break;
+    }
 
-    // Use the calculated size instead of the passed size to account for block alignment.
-    SALLOC(read_buffer, block_count * fork->hfs->block_size);
+    // The amount we added to the buffer.
+    return done;
+}
 
-    // Fetch the data into a read buffer (it may fail).
-    read_blocks = hfs_read_fork(read_buffer, fork, block_count, start_block);
+typedef struct ForkReadAsync {
+    void*             buffer;
+    size_t            size;
+    size_t            end;          // Where the first short or failed run stopped; size if none did
+    unsigned          outstanding;  // Runs still in flight, plus one while runs are being queued
+    int               error;
+    ioengine_callback callback;
+    void*             context;
+} ForkReadAsync;
+
+typedef struct ForkReadRun {
+    ForkReadAsync* read;
+    size_t         start;           // Offset of the run within the request
+    size_t         length;
+} ForkReadRun;
+
+static void hfs_fork_read_release(ForkReadAsync* read)
+{
+    if (--read->outstanding > 0) return;
+
+    ssize_t result = read->end;
+    if ((read->end == 0) && read->error) result = -1;
+
+    errno = read->error;
+    read->callback(read->context, read->buffer, result);
+    SFREE(read);
+}
 
-    // On success, append the data to the buffer (consumers: set buffer.offset properly!).
-    if (read_blocks) {
-        memcpy(buffer, (read_buffer + byte_offset), size);
+static void hfs_fork_read_landed(void* context, void* buf, ssize_t result)
+{
+    ForkReadRun*   run  = context;
+    ForkReadAsync* read = run->read;
+    (void)buf;
+
+    if (result < 0) read->error = errno;
+    if ((result < 0) || ((size_t)result < run->length))
+        read->end = MIN(read->end, run->start + (size_t)MAX(result, 0));
+
+    SFREE(run);
+    hfs_fork_read_release(read);
+}
+
+int hfs_read_fork_range_async(IOEngine* engine, void* buffer, const HFSPlusFork* fork, size_t size, size_t offset, ioengine_callback callback, void* context)
+{
+    ForkReadAsync* read       = NULL;
+    size_t         block_size = fork->hfs->block_size;
+    size_t         done       = 0;
+
+    // Same clipping as hfs_read_fork_range.
+    if (offset > fork->logicalSize) size = 0;
+    else if ((offset + size) > fork->logicalSize) size = fork->logicalSize - offset;
+
+    SALLOC(read, sizeof(ForkReadAsync));
+    read->buffer      = buffer;
+    read->size        = size;
+    read->end         = size;
+    read->outstanding = 1;
+    read->callback    = callback;
+    read->context     = context;
+
+    while (done < size) {
+        size_t       position     = offset + done;
+        size_t       within_block = position % block_size;
+        size_t       start_block  = 0;
+        size_t       run_blocks   = 0;
+        ForkReadRun* run          = NULL;
+
+        if ( !extentlist_find(fork->extents, position / block_size, &start_block, &run_blocks) ) {
+            error("Logical block %zu not found in the extents for CNID %u.", position / block_size, fork->cnid);
+            read->end = MIN(read->end, done);
+            break;
+        }
+
+        SALLOC(run, sizeof(ForkReadRun));
+        run->read   = read;
+        run->start  = done;
+        run->length = MIN(size - done, (run_blocks * block_size) - within_block);
+
+        read->outstanding++;
+        if (ioengine_read(engine, fork->hfs->vol, (char*)buffer + done, run->length, (start_block * block_size) + within_block, hfs_fork_read_landed, run) < 0) {
+            read->outstanding--;
+            read->error = errno;
+            read->end   = MIN(read->end, done);
+            SFREE(run);
+            break;
+        }
+
+        done += run->length;
+    }
+
+    // Nothing queued at all: report the failure here rather than through the callback.
+    if ((read->outstanding == 1) && read->error && (read->end == 0)) {
+        int err = read->error;
+        SFREE(read);
+        errno = err;
+        return -1;
     }
 
-    // Clean up.
-    SFREE(read_buffer);
+    // Drop the queueing reference; if every run has already landed, this delivers the result.
+    hfs_fork_read_release(read);
 
-    // The amount we added to the buffer.
-    return size;
+    return 0;
 }
 
 #pragma mark funopen - HFSPlusFork
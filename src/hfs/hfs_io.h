@@ -10,6 +10,7 @@
 #define hfsinspect_hfs_io_h
 
 #include "hfs/types.h"
+#include "volumes/ioengine.h"
 
 extern hfs_forktype_t HFSDataForkType;
 extern hfs_forktype_t HFSResourceForkType;
@@ -31,6 +32,13 @@ void hfsfork_free        (HFSPlusFork* fork) __attribute__((nonnull));
 ssize_t hfs_read_fork       (void* buffer, const HFSPlusFork* fork, size_t block_count, size_t start_block) __attribute__((nonnull));
 ssize_t hfs_read_fork_range (void* buffer, const HFSPlusFork* fork, size_t size, size_t offset) __attribute__((nonnull));
 
+/**
+   Queues an asynchronous hfs_read_fork_range on `engine`, one read per contiguous run of the fork on disk. `callback` receives `buffer` and the
+   same result hfs_read_fork_range would have returned, once every run has landed.
+   @return Zero if the read was queued and `callback` will be called exactly once, or -1 (check errno) if it wasn't.
+ */
+int     hfs_read_fork_range_async (IOEngine* engine, void* buffer, const HFSPlusFork* fork, size_t size, size_t offset, ioengine_callback callback, void* context) __attribute__((nonnull(1,2,3,6)));
+
 FILE* fopen_hfsfork       (HFSPlusFork* fork) __attribute__((nonnull));
 
 #endif
@@ -0,0 +1,298 @@
+//
+//  hfs_iosched.c
+//  hfsinspect
+//
+//
+
+#include "hfs/hfs_iosched.h"
+
+#include "hfs/hfs_io.h"
+#include "volumes/ioengine.h"
+#include "hfs/hfs_extentlist.h"
+#include "logging/logging.h"    // console printing routines
+
+
+typedef struct IORequest {
+    const HFSPlusFork*    fork;
+    iosched_consumer_func consumer;
+    void*                 context;
+    bool                  cancelled;
+} IORequest;
+
+typedef struct IOSegment {
+    uint64_t physical;          // Byte offset on the volume
+    uint64_t logical;           // Byte offset within the fork
+    uint32_t length;            // Bytes; never more than max_read
+    uint32_t request;           // Index into the request table
+} IOSegment;
+
+// One coalesced read, from issue until its segments are delivered.
+typedef struct IORun {
+    IOSched*       sched;
+    void*          buffer;      // max_read bytes
+    size_t         first;       // Segments [first, last) are served by this read
+    size_t         last;
+    uint64_t       start;       // Byte offset on the volume
+    size_t         length;
+    ssize_t        bytes;       // Result of the read
+    bool           landed;
+    uint8_t        _reserved[7];
+} IORun;
+
+struct IOSched {
+    const HFSPlus* hfs;
+    size_t         max_read;
+    size_t         max_gap;
+
+    IOEngine*      engine;
+    IORun*         runs;        // Ring of reads in flight, delivered oldest first
+    unsigned       run_count;
+
+    IORequest*     requests;
+    size_t         request_count;
+    size_t         request_capacity;
+
+    IOSegment*     segments;
+    size_t         segment_count;
+    size_t         segment_capacity;
+
+    IOSchedStats   stats;
+};
+
+#pragma mark Queue
+
+IOSched* iosched_make(const HFSPlus* hfs, size_t max_read, size_t max_gap)
+{
+    IOSched* sched = NULL;
+    SALLOC(sched, sizeof(IOSched));
+
+    sched->hfs      = hfs;
+    sched->max_read = (max_read ? max_read : IOSCHED_DEFAULT_MAX_READ);
+    sched->max_gap  = (max_gap ? max_gap : IOSCHED_DEFAULT_MAX_GAP);
+
+    // Reads must cover at least one allocation block, and segment lengths are stored in 32 bits.
+    sched->max_read = MAX(sched->max_read, hfs->block_size);
+    sched->max_read = MIN(sched->max_read, UINT32_MAX - (UINT32_MAX % hfs->block_size));
+
+    if ((sched->engine = ioengine_make(hfs->queue_depth, kIOEngineAuto)) == NULL) {
+        SFREE(sched);
+        return NULL;
+    }
+
+    // Every read in flight needs a buffer of its own; keep their total bounded.
+    sched->run_count = MIN(ioengine_depth(sched->engine), MAX(1, IOSCHED_MAX_INFLIGHT / sched->max_read));
+    SALLOC(sched->runs, sched->run_count * sizeof(IORun));
+    for (unsigned i = 0; i < sched->run_count; i++) {
+        sched->runs[i].sched = sched;
+        SALLOC(sched->runs[i].buffer, sched->max_read);
+    }
+
+    return sched;
+}
+
+void iosched_free(IOSched* sched)
+{
+    ioengine_free(sched->engine);
+    for (unsigned i = 0; i < sched->run_count; i++)
+        SFREE(sched->runs[i].buffer);
+    SFREE(sched->runs);
+    SFREE(sched->requests);
+    SFREE(sched->segments);
+    SFREE(sched);
+}
+
+size_t iosched_pending(const IOSched* sched)
+{
+    return sched->request_count;
+}
+
+void iosched_get_stats(const IOSched* sched, IOSchedStats* stats)
+{
+    *stats = sched->stats;
+}
+
+static void iosched_push_segment(IOSched* sched, uint64_t physical, uint64_t logical, uint32_t length, uint32_t request)
+{
+    if (sched->segment_count == sched->segment_capacity) {
+        sched->segment_capacity = (sched->segment_capacity ? sched->segment_capacity * 2 : 256);
+        SREALLOC(sched->segments, sched->segment_capacity * sizeof(IOSegment));
+    }
+
+    sched->segments[sched->segment_count++] = (IOSegment){
+        .physical = physical,
+        .logical  = logical,
+        .length   = length,
+        .request  = request,
+    };
+    sched->stats.segments++;
+}
+
+int iosched_add(IOSched* sched, const HFSPlusFork* fork, size_t size, size_t offset, iosched_consumer_func consumer, void* context)
+{
+    if ((fork->extents == NULL) || (sched->request_count >= UINT32_MAX)) { errno = EINVAL; return -1; }
+
+    // Clip to the logical end of the fork.
+    if (offset >= fork->logicalSize) return 0;
+    size = MIN(size, fork->logicalSize - offset);
+    if (size == 0) return 0;
+
+    if (sched->request_count == sched->request_capacity) {
+        sched->request_capacity = (sched->request_capacity ? sched->request_capacity * 2 : 64);
+        SREALLOC(sched->requests, sched->request_capacity * sizeof(IORequest));
+    }
+
+    uint32_t request_id = (uint32_t)sched->request_count++;
+    sched->requests[request_id] = (IORequest){
+        .fork      = fork,
+        .consumer  = consumer,
+        .context   = context,
+        .cancelled = false,
+    };
+    sched->stats.requests++;
+
+    uint64_t block_size = sched->hfs->block_size;
+    uint64_t req_start  = offset;
+    uint64_t req_end    = (uint64_t)offset + size;
+
+    Extent*  e          = NULL;
+    TAILQ_FOREACH(e, fork->extents, extents) {
+        uint64_t ext_start = e->logicalStart * block_size;
+        uint64_t ext_end   = ext_start + (e->blockCount * block_size);
+
+        if ((ext_end <= req_start) || (ext_start >= req_end)) continue;
+
+        uint64_t start = MAX(ext_start, req_start);
+        uint64_t end   = MIN(ext_end, req_end);
+
+        // Split long extents so every segment fits in a single read.
+        while (start < end) {
+            uint64_t length   = MIN(end - start, sched->max_read);
+            uint64_t physical = (e->startBlock * block_size) + (start - ext_start);
+            iosched_push_segment(sched, physical, start, (uint32_t)length, request_id);
+            start += length;
+        }
+    }
+
+    return 0;
+}
+
+#pragma mark Execution
+
+static int compare_segments(const void* a, const void* b)
+{
+    const IOSegment* s1 = a;
+    const IOSegment* s2 = b;
+
+    if (s1->physical != s2->physical) return (s1->physical < s2->physical ? -1 : 1);
+    if (s1->request != s2->request) return (s1->request < s2->request ? -1 : 1);
+    if (s1->logical != s2->logical) return (s1->logical < s2->logical ? -1 : 1);
+    return 0;
+}
+
+static void iosched_landed(void* context, void* buf, ssize_t result)
+{
+    IORun* run = context;
+    (void)buf;
+
+    run->bytes  = result;
+    run->landed = true;
+}
+
+// Hands a landed read's segments to their consumers. Returns -1 if the read failed or came up short.
+static int iosched_deliver(IOSched* sched, IORun* run)
+{
+    int     result = 0;
+    ssize_t bytes  = run->bytes;
+
+    if (bytes < 0) {
+        error("read of %zu bytes at offset %llu failed", run->length, (unsigned long long)run->start);
+        result = -1;
+        bytes  = 0;
+    } else if ((size_t)bytes < run->length) {
+        error("short read: %zd of %zu bytes at offset %llu", bytes, run->length, (unsigned long long)run->start);
+        result = -1;
+    }
+    sched->stats.bytes_read += bytes;
+
+    // Deliver whatever part of each segment actually arrived.
+    for (size_t k = run->first; k < run->last; k++) {
+        const IOSegment* s   = &sched->segments[k];
+        IORequest*       req = &sched->requests[s->request];
+        uint64_t         rel = s->physical - run->start;
+
+        if (req->cancelled || (rel >= (uint64_t)bytes)) continue;
+
+        size_t length = MIN(s->length, (uint64_t)bytes - rel);
+        if (req->consumer(req->context, req->fork, (char*)run->buffer + rel, length, s->logical) < 0)
+            req->cancelled = true;
+        sched->stats.bytes_delivered += length;
+    }
+
+    return result;
+}
+
+int iosched_run(IOSched* sched)
+{
+    int      result = 0;
+    size_t   i      = 0;
+    unsigned head   = 0;    // Oldest read not yet delivered
+    unsigned issued = 0;    // Reads in the ring
+
+    qsort(sched->segments, sched->segment_count, sizeof(IOSegment), compare_segments);
+
+    while ((i < sched->segment_count) || (issued > 0)) {
+        // Deliver, in physical order, every read that has landed; wait for the oldest once the ring is full or everything is issued.
+        while (issued > 0) {
+            IORun* run = &sched->runs[head];
+
+            if ( !run->landed ) ioengine_poll(sched->engine, false);
+            if ( !run->landed ) {
+                if ((issued < sched->run_count) && (i < sched->segment_count)) break;
+                ioengine_poll(sched->engine, true);
+                continue;
+            }
+
+            if (iosched_deliver(sched, run) < 0) result = -1;
+            head = (head + 1) % sched->run_count;
+            issued--;
+        }
+
+        if (i >= sched->segment_count) continue;
+
+        // Grow a run from segment i while the next segment is close enough and the run still fits the buffer.
+        uint64_t run_start = sched->segments[i].physical;
+        uint64_t run_end   = run_start + sched->segments[i].length;
+        size_t   j         = i + 1;
+
+        for (; j < sched->segment_count; j++) {
+            const IOSegment* s   = &sched->segments[j];
+            uint64_t         end = MAX(run_end, s->physical + s->length);
+
+            if (s->physical > run_end + sched->max_gap) break;
+            if ((end - run_start) > sched->max_read) break;
+            run_end = end;
+        }
+
+        IORun* run = &sched->runs[(head + issued) % sched->run_count];
+        run->first  = i;
+        run->last   = j;
+        run->start  = run_start;
+        run->length = run_end - run_start;
+        run->bytes  = 0;
+        run->landed = false;
+        issued++;
+        sched->stats.reads++;
+
+        if (ioengine_read(sched->engine, sched->hfs->vol, run->buffer, run->length, run_start, iosched_landed, run) < 0) {
+            run->bytes  = -1;
+            run->landed = true;
+        }
+
+        i = j;
+    }
+
+    sched->segment_count = 0;
+    sched->request_count = 0;
+
+    return result;
+}
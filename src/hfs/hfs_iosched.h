@@ -0,0 +1,66 @@
+//
+//  hfs_iosched.h
+//  hfsinspect
+//
+//
+
+#ifndef hfsinspect_hfs_iosched_h
+#define hfsinspect_hfs_iosched_h
+
+#include "hfs/types.h"
+
+/*
+   Bulk fork reader. Callers queue byte ranges of any number of forks, then run the
+   schedule; the scheduler maps every range to its on-disk extents, sorts the pieces
+   by physical offset, coalesces neighbours into large reads and hands each piece to
+   its consumer. Reading a volume front-to-back this way turns thousands of small
+   scattered fork reads into a handful of sequential ones. Up to the volume's queue
+   depth of those reads are kept in flight at once, within IOSCHED_MAX_INFLIGHT bytes
+   of buffers, and their pieces are still delivered in order on the calling thread.
+ */
+
+// Default upper bound on a single coalesced read (bytes).
+#define IOSCHED_DEFAULT_MAX_READ (4 * 1024 * 1024)
+
+// Default largest hole between two pieces that is read through rather than seeked over (bytes).
+#define IOSCHED_DEFAULT_MAX_GAP  (64 * 1024)
+
+// Upper bound on the buffers held by reads in flight (bytes).
+#define IOSCHED_MAX_INFLIGHT     (32 * 1024 * 1024)
+
+/**
+   Receives one piece of a queued range. Pieces arrive in physical order, so a fork
+   with several extents may see its pieces out of logical order; `offset` is the
+   logical byte offset of `buf` within the fork.
+   Return 0 to continue, or -1 to drop the rest of this request.
+ */
+typedef int (* iosched_consumer_func)(void* context, const HFSPlusFork* fork, const void* buf, size_t size, size_t offset);
+
+typedef struct IOSchedStats {
+    uint64_t requests;          // Ranges queued
+    uint64_t segments;          // Contiguous on-disk pieces the ranges mapped to
+    uint64_t reads;             // Reads issued after coalescing
+    uint64_t bytes_read;        // Bytes read from the volume, including gaps read through
+    uint64_t bytes_delivered;   // Bytes handed to consumers
+} IOSchedStats;
+
+typedef struct IOSched IOSched;
+
+// Creates a scheduler that reads at the volume's queue depth. Zero for either limit selects the default. Returns NULL on error (check errno).
+IOSched* iosched_make      (const HFSPlus* hfs, size_t max_read, size_t max_gap) __attribute__((nonnull));
+
+// Queues `size` bytes of `fork` starting at `offset`. Ranges past the logical end of the fork are clipped; unmapped (sparse) ranges are not delivered.
+int      iosched_add       (IOSched* sched, const HFSPlusFork* fork, size_t size, size_t offset, iosched_consumer_func consumer, void* context) __attribute__((nonnull(1,2,5)));
+
+// Reads everything queued and empties the queue. Returns -1 if any read failed; consumers still receive all pieces that could be read.
+int      iosched_run       (IOSched* sched) __attribute__((nonnull));
+
+// Number of ranges waiting for the next run.
+size_t   iosched_pending   (const IOSched* sched) __attribute__((nonnull));
+
+// Cumulative counters across all runs.
+void     iosched_get_stats (const IOSched* sched, IOSchedStats* stats) __attribute__((nonnull));
+
+void     iosched_free      (IOSched* sched) __attribute__((nonnull));
+
+#endif
@@ -0,0 +1,470 @@
+//
+//  hfs/hfs_standard.c
+//  hfsinspect
+//
+//
+
+#include "hfs/hfs_standard.h"
+
+#include "hfs/hfs.h"
+#include "hfs/hfs_endian.h"
+#include "hfs/macroman.h"
+#include "hfs/btree/btree_endian.h"
+#include "volumes/volume.h"
+#include "logging/logging.h"    // console printing routines
+
+// Writes one record (key and value) in its HFS+ form. Returns the bytes written, or -1 if it's malformed or doesn't fit.
+typedef ssize_t (*hfs_standard_record_func)(char* out, size_t space, const uint8_t* raw, size_t length, int8_t kind, const BTreePtr tree);
+
+#pragma mark Volumes
+
+static HFSPlusForkData hfs_standard_fork_data(uint32_t logicalSize, uint32_t physicalSize, const HFSExtentDescriptor* extents, uint32_t blockSize)
+{
+    HFSPlusForkData fork = {
+        .logicalSize = logicalSize,
+        .totalBlocks = (blockSize ? physicalSize / blockSize : 0),
+    };
+
+    for (unsigned i = 0; i < kHFSExtentDensity; i++) {
+        fork.extents[i].startBlock = extents[i].startBlock;
+        fork.extents[i].blockCount = extents[i].blockCount;
+    }
+
+    return fork;
+}
+
+static void hfs_standard_make_header(HFSPlusVolumeHeader* vh, const HFSMasterDirectoryBlock* mdb)
+{
+    *vh = (HFSPlusVolumeHeader){
+        .signature       = kHFSSigWord,
+        .attributes      = mdb->drAtrb,
+        .createDate      = mdb->drCrDate,
+        .modifyDate      = mdb->drLsMod,
+        .backupDate      = mdb->drVolBkUp,
+        .fileCount       = mdb->drFilCnt,
+        .folderCount     = mdb->drDirCnt,
+        .blockSize       = mdb->drAlBlkSiz,
+        .totalBlocks     = mdb->drNmAlBlks,
+        .freeBlocks      = mdb->drFreeBks,
+        .nextAllocation  = mdb->drAllocPtr,
+        .rsrcClumpSize   = mdb->drClpSiz,
+        .dataClumpSize   = mdb->drClpSiz,
+        .nextCatalogID   = mdb->drNxtCNID,
+        .writeCount      = mdb->drWrCnt,
+        .encodingsBitmap = 1,   // Mac OS Roman
+        .extentsFile     = hfs_standard_fork_data(mdb->drXTFlSize, mdb->drXTFlSize, mdb->drXTExtRec, mdb->drAlBlkSiz),
+        .catalogFile     = hfs_standard_fork_data(mdb->drCTFlSize, mdb->drCTFlSize, mdb->drCTExtRec, mdb->drAlBlkSiz),
+    };
+    vh->extentsFile.clumpSize = mdb->drXTClpSiz;
+    vh->catalogFile.clumpSize = mdb->drCTClpSiz;
+
+    // Laid out like HFS+'s, but the MDB swap leaves it as it was on disk.
+    memcpy(vh->finderInfo, mdb->drFndrInfo, sizeof(vh->finderInfo));
+    HFSPlusVolumeFinderInfo* finderInfo = (void*)&vh->finderInfo;
+    Swap32(finderInfo->bootDirID);
+    Swap32(finderInfo->bootParentID);
+    Swap32(finderInfo->openWindowDirID);
+    Swap32(finderInfo->os9DirID);
+    Swap32(finderInfo->reserved);
+    Swap32(finderInfo->osXDirID);
+    Swap64(finderInfo->volID);
+}
+
+int hfs_standard_open(HFSPlus* hfs, Volume* vol)
+{
+    HFSMasterDirectoryBlock mdb    = {0};
+    Volume*                 blocks = NULL;
+    unsigned                pos    = 0;
+
+    trace("hfs (%p), vol (%p)", hfs, vol);
+
+    if ( hfs_load_mbd(vol, &mdb) < 0 )
+        return -1;
+
+    if ((mdb.drSigWord != kHFSSigWord) || (mdb.drAlBlkSiz == 0) || (mdb.drAlBlkSiz % 512)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Allocation block 0 starts drAlBlSt sectors in, often at an odd sector. A partition starting there lets
+    // the fork and block readers work in whole blocks from zero, as they do on HFS+.
+    off_t  start  = (off_t)mdb.drAlBlSt * 512;
+    size_t length = (size_t)mdb.drNmAlBlks * mdb.drAlBlkSiz;
+    if (vol->length)
+        length = ((size_t)start < vol->length ? MIN(length, vol->length - (size_t)start) : 0);
+
+    while ((pos < (sizeof(vol->partitions) / sizeof(vol->partitions[0]))) && (vol->partitions[pos] != NULL)) pos++;
+    if (pos == (sizeof(vol->partitions) / sizeof(vol->partitions[0]))) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if ((blocks = vol_make_partition(vol, pos, start, length)) == NULL)
+        return -1;
+
+    hfs_standard_make_header(&hfs->vh, &mdb);
+
+    hfs->vol         = blocks;
+    hfs->block_size  = mdb.drAlBlkSiz;
+    hfs->block_count = mdb.drNmAlBlks;
+    hfs->offset      = blocks->offset;
+    hfs->length      = length;
+
+    return 0;
+}
+
+bool hfs_is_standard(const HFSPlus* hfs)
+{
+    return (hfs->vh.signature == kHFSSigWord);
+}
+
+// The volume bitmap sits ahead of the allocation blocks, so it has no fork; read it from the volume the MDB is in.
+int hfs_standard_read_bitmap(char** data, size_t* length, const HFSPlus* hfs)
+{
+    HFSMasterDirectoryBlock mdb       = {0};
+    Volume*                 container = hfs->vol->parent_partition;
+    char*                   bitmap    = NULL;
+    size_t                  size      = (hfs->block_count + 7) / 8;
+    ssize_t                 bytes     = 0;
+
+    trace("data (%p), length (%p), hfs (%p)", data, length, hfs);
+
+    if ( hfs_load_mbd(container, &mdb) < 0 )
+        return -1;
+
+    SALLOC(bitmap, size);
+
+    if ((bytes = vol_read(container, bitmap, size, (off_t)mdb.drVBMSt * 512)) < (ssize_t)size) {
+        SFREE(bitmap);
+        if (bytes >= 0) errno = EIO;
+        return -1;
+    }
+
+    *data   = bitmap;
+    *length = size;
+
+    return 0;
+}
+
+#pragma mark B-Trees
+
+// The raw key's size, length byte and padding included. Index keys without kBTVariableIndexKeysMask are padded to the maximum.
+static size_t hfs_standard_key_size(const uint8_t* raw, int8_t kind, const BTreePtr tree)
+{
+    size_t size = raw[0];
+
+    if ((kind == kBTIndexNode) && !(tree->headerRecord.attributes & kBTVariableIndexKeysMask))
+        size = tree->headerRecord.maxKeyLength;
+
+    size += sizeof(uint8_t);
+    return size + (size % 2);
+}
+
+static ssize_t hfs_standard_catalog_record(char* out, size_t space, const uint8_t* raw, size_t length, int8_t kind, const BTreePtr tree)
+{
+    HFSCatalogKey     rawKey     = {0};
+    HFSPlusCatalogKey key        = {0};
+    size_t            keySize    = hfs_standard_key_size(raw, kind, tree);
+    size_t            valueSize  = 0;
+    size_t            nameLength = 0;
+
+    if ((raw[0] < kHFSCatalogKeyMinimumLength) || (keySize > length))
+        return -1;
+
+    memcpy(&rawKey, raw, MIN(sizeof(rawKey), (size_t)raw[0] + 1));
+    swap_HFSCatalogKey(&rawKey);
+
+    // The name can't run past the key, whatever its length byte says.
+    nameLength    = MIN(rawKey.nodeName[0], MIN(kHFSMaxFileNameChars, raw[0] - kHFSCatalogKeyMinimumLength));
+    key.parentID  = rawKey.parentID;
+    macroman_to_hfsuc(&key.nodeName, &rawKey.nodeName[1], nameLength);
+    key.keyLength = sizeof(key.parentID) + sizeof(key.nodeName.length) + (key.nodeName.length * sizeof(key.nodeName.unicode[0]));
+
+    size_t outKeySize = sizeof(key.keyLength) + key.keyLength;
+    if (outKeySize > space) return -1;
+
+    raw    += keySize;
+    length -= keySize;
+    out    += outKeySize;
+    space  -= outKeySize;
+
+    if (kind == kBTIndexNode) {
+        uint32_t pointer = 0;
+        if ((length < sizeof(pointer)) || (space < sizeof(pointer))) return -1;
+        memcpy(&pointer, raw, sizeof(pointer));
+        Swap32(pointer);
+        memcpy(out, &pointer, sizeof(pointer));
+        valueSize = sizeof(pointer);
+
+    } else {
+        int16_t type = 0;
+        if (length < sizeof(type)) return -1;
+        memcpy(&type, raw, sizeof(type));
+        Swap16(type);
+
+        switch (type) {
+            case kHFSFolderRecord:
+            {
+                HFSCatalogFolder folder = {0};
+                if (length < sizeof(folder)) return -1;
+                memcpy(&folder, raw, sizeof(folder));
+                swap_HFSCatalogFolder(&folder);
+
+                HFSPlusCatalogFolder record = {
+                    .recordType       = kHFSPlusFolderRecord,
+                    .flags            = folder.flags & (kHFSFileLockedMask | kHFSThreadExistsMask),
+                    .valence          = folder.valence,
+                    .folderID         = folder.folderID,
+                    .createDate       = folder.createDate,
+                    .contentModDate   = folder.modifyDate,
+                    .attributeModDate = folder.modifyDate,
+                    .accessDate       = folder.modifyDate,
+                    .backupDate       = folder.backupDate,
+                    .userInfo         = folder.userInfo,
+                    .finderInfo       = folder.finderInfo,
+                    .textEncoding     = kTextEncodingMacRoman,
+                };
+                valueSize = sizeof(record);
+                if (space < valueSize) return -1;
+                memcpy(out, &record, valueSize);
+                break;
+            }
+
+            case kHFSFileRecord:
+            {
+                HFSCatalogFile file      = {0};
+                uint32_t       blockSize = tree->fork->hfs->block_size;
+                if (length < sizeof(file)) return -1;
+                memcpy(&file, raw, sizeof(file));
+                swap_HFSCatalogFile(&file);
+
+                HFSPlusCatalogFile record = {
+                    .recordType       = kHFSPlusFileRecord,
+                    .flags            = file.flags & (kHFSFileLockedMask | kHFSThreadExistsMask),
+                    .fileID           = file.fileID,
+                    .createDate       = file.createDate,
+                    .contentModDate   = file.modifyDate,
+                    .attributeModDate = file.modifyDate,
+                    .accessDate       = file.modifyDate,
+                    .backupDate       = file.backupDate,
+                    .userInfo         = file.userInfo,
+                    .finderInfo       = file.finderInfo,
+                    .textEncoding     = kTextEncodingMacRoman,
+                    .dataFork         = hfs_standard_fork_data(file.dataLogicalSize, file.dataPhysicalSize, file.dataExtents, blockSize),
+                    .resourceFork     = hfs_standard_fork_data(file.rsrcLogicalSize, file.rsrcPhysicalSize, file.rsrcExtents, blockSize),
+                };
+                valueSize = sizeof(record);
+                if (space < valueSize) return -1;
+                memcpy(out, &record, valueSize);
+                break;
+            }
+
+            case kHFSFolderThreadRecord:
+            case kHFSFileThreadRecord:
+            {
+                HFSCatalogThread thread = {0};
+                if (length < sizeof(thread)) return -1;
+                memcpy(&thread, raw, sizeof(thread));
+                swap_HFSCatalogThread(&thread);
+
+                HFSPlusCatalogThread record = {
+                    .recordType = (type == kHFSFolderThreadRecord ? kHFSPlusFolderThreadRecord : kHFSPlusFileThreadRecord),
+                    .parentID   = thread.parentID,
+                };
+                macroman_to_hfsuc(&record.nodeName, &thread.nodeName[1], MIN(thread.nodeName[0], kHFSMaxFileNameChars));
+                valueSize = offsetof(HFSPlusCatalogThread, nodeName.unicode) + (record.nodeName.length * sizeof(record.nodeName.unicode[0]));
+                if (space < valueSize) return -1;
+                memcpy(out, &record, valueSize);
+                break;
+            }
+
+            default:
+            {
+                // Keep the type so the record reads as unknown rather than as a truncated something else.
+                valueSize = sizeof(type);
+                if (space < valueSize) return -1;
+                memcpy(out, &type, valueSize);
+                break;
+            }
+        }
+    }
+
+    memcpy(out - outKeySize, &key, outKeySize);
+
+    return outKeySize + valueSize;
+}
+
+static ssize_t hfs_standard_extents_record(char* out, size_t space, const uint8_t* raw, size_t length, int8_t kind, const BTreePtr tree)
+{
+    HFSExtentKey rawKey    = {0};
+    size_t       keySize   = hfs_standard_key_size(raw, kind, tree);
+    size_t       valueSize = 0;
+
+    if ((raw[0] < kHFSExtentKeyMaximumLength) || (keySize > length) || (space < sizeof(HFSPlusExtentKey)))
+        return -1;
+
+    memcpy(&rawKey, raw, sizeof(rawKey));
+    swap_HFSExtentKey(&rawKey);
+
+    HFSPlusExtentKey key = {
+        .keyLength  = kHFSPlusExtentKeyMaximumLength,
+        .forkType   = rawKey.forkType,
+        .fileID     = rawKey.fileID,
+        .startBlock = rawKey.startBlock,
+    };
+    memcpy(out, &key, sizeof(key));
+
+    raw    += keySize;
+    length -= keySize;
+    out    += sizeof(key);
+    space  -= sizeof(key);
+
+    if (kind == kBTIndexNode) {
+        uint32_t pointer = 0;
+        if ((length < sizeof(pointer)) || (space < sizeof(pointer))) return -1;
+        memcpy(&pointer, raw, sizeof(pointer));
+        Swap32(pointer);
+        memcpy(out, &pointer, sizeof(pointer));
+        valueSize = sizeof(pointer);
+
+    } else {
+        HFSExtentRecord     extents = {{0}};
+        HFSPlusExtentRecord record  = {{0}};
+        if ((length < sizeof(extents)) || (space < sizeof(record))) return -1;
+        memcpy(&extents, raw, sizeof(extents));
+        swap_HFSExtentRecord(&extents);
+
+        for (unsigned i = 0; i < kHFSExtentDensity; i++) {
+            record[i].startBlock = extents[i].startBlock;
+            record[i].blockCount = extents[i].blockCount;
+        }
+        valueSize = sizeof(record);
+        memcpy(out, &record, valueSize);
+    }
+
+    return sizeof(key) + valueSize;
+}
+
+int hfs_standard_translate_node(BTreeNodePtr node)
+{
+    const BTreePtr           tree       = node->bTree;
+    const uint8_t*           raw        = node->data;
+    size_t                   rawSize    = node->nodeSize;
+    BTNodeDescriptor         desc       = *(const BTNodeDescriptor*)raw;
+    hfs_standard_record_func translate  = NULL;
+    char*                    out        = NULL;
+    BTRecOffsetPtr           offsets    = NULL;
+    size_t                   used       = sizeof(BTNodeDescriptor);
+    size_t                   limit      = 0;
+
+    swap_BTNodeDescriptor(&desc);
+
+    if ((desc.kind != kBTIndexNode) && (desc.kind != kBTLeafNode)) { errno = EINVAL; return -1; }
+    if ((sizeof(BTNodeDescriptor) + (desc.numRecords + 1u) * sizeof(BTRecOffset)) > rawSize) { errno = EINVAL; return -1; }
+
+    translate = (tree->treeID == kHFSCatalogFileID ? hfs_standard_catalog_record : hfs_standard_extents_record);
+    limit     = HFS_STANDARD_NODE_SIZE - ((desc.numRecords + 1u) * sizeof(BTRecOffset));
+    if (limit < used) { errno = EINVAL; return -1; }
+
+    SALLOC(out, HFS_STANDARD_NODE_SIZE);
+    memcpy(out, &desc, sizeof(desc));
+
+    // Both tables run backwards from the end of the node: record 0's offset is the last word.
+    offsets = (BTRecOffsetPtr)(out + HFS_STANDARD_NODE_SIZE) - desc.numRecords - 1;
+
+    for (unsigned recNum = 0; recNum < desc.numRecords; recNum++) {
+        uint16_t start = be16toh(*(const uint16_t*)(raw + rawSize - ((recNum + 1) * sizeof(BTRecOffset))));
+        uint16_t end   = be16toh(*(const uint16_t*)(raw + rawSize - ((recNum + 2) * sizeof(BTRecOffset))));
+
+        if ((start < sizeof(BTNodeDescriptor)) || (end <= start) || (end > rawSize)) {
+            debug("Node %u record %u has bad offsets (%u-%u).", node->nodeNumber, recNum, start, end);
+            SFREE(out);
+            errno = EINVAL;
+            return -1;
+        }
+
+        ssize_t written = translate(out + used, limit - used, raw + start, end - start, desc.kind, tree);
+        if (written < 0) {
+            debug("Node %u record %u could not be translated.", node->nodeNumber, recNum);
+            SFREE(out);
+            errno = EINVAL;
+            return -1;
+        }
+
+        offsets[desc.numRecords - recNum] = used;
+        used += written;
+        used += used % 2;
+    }
+    offsets[0] = used;  // Free space
+
+    node->data        = out;
+    node->nodeSize    = HFS_STANDARD_NODE_SIZE;
+    node->dataLen     = HFS_STANDARD_NODE_SIZE;
+    node->recordCount = desc.numRecords;
+
+    return 0;
+}
+
+int hfs_standard_get_node(BTreeNodePtr* out_node, const BTreePtr bTree, bt_nodeid_t nodeNum)
+{
+    BTreeNodePtr node = NULL;
+
+    trace("out_node (%p), bTree (%p), nodeNum %u", out_node, bTree, nodeNum);
+
+    if ( btree_read_node(&node, bTree, nodeNum) < 0 )
+        return -1;
+
+    if ((node->nodeDescriptor->kind == kBTIndexNode) || (node->nodeDescriptor->kind == kBTLeafNode)) {
+        void* raw = node->data;
+        if ( hfs_standard_translate_node(node) < 0 ) {
+            error("Node %u of tree %u could not be read as an HFS node.", nodeNum, bTree->treeID);
+            btree_free_node(node);
+            return -1;
+        }
+        FREE(raw);
+
+    } else {
+        if ( swap_BTreeNode(node) < 0 ) {
+            error("node %u: byte-swap of node failed.", nodeNum);
+            btree_free_node(node);
+            errno = EINVAL;
+            return -1;
+        }
+        node->recordCount = node->nodeDescriptor->numRecords;
+    }
+
+    *out_node = node;
+
+    return 0;
+}
+
+void hfs_standard_prepare_tree(BTreePtr tree)
+{
+    tree->getNode = hfs_standard_get_node;
+
+    // Translated keys are HFS+ keys: big, and only as long as they need to be in the catalog.
+    if (tree->treeID == kHFSCatalogFileID) {
+        tree->keyCompare    = (btree_key_compare_func)hfs_standard_catalog_compare_keys;
+        tree->keyAttributes = kBTBigKeysMask | kBTVariableIndexKeysMask;
+        tree->maxKeyLength  = kHFSPlusCatalogKeyMaximumLength;
+    } else {
+        tree->keyAttributes = kBTBigKeysMask;
+        tree->maxKeyLength  = kHFSPlusExtentKeyMaximumLength;
+    }
+}
+
+int hfs_standard_catalog_compare_keys(const HFSPlusCatalogKey* key1, const HFSPlusCatalogKey* key2)
+{
+    uint8_t name1[kHFSPlusMaxFileNameChars] = {0};
+    uint8_t name2[kHFSPlusMaxFileNameChars] = {0};
+    int     result                          = 0;
+
+    if ((result = cmp(key1->parentID, key2->parentID)) != 0)
+        return result;
+
+    // Compared back in Mac OS Roman, which is the order the tree was built in.
+    size_t length1 = hfsuc_to_macroman(name1, sizeof(name1), &key1->nodeName);
+    size_t length2 = hfsuc_to_macroman(name2, sizeof(name2), &key2->nodeName);
+
+    return macroman_compare(name1, length1, name2, length2);
+}
@@ -0,0 +1,43 @@
+//
+//  hfs/hfs_standard.h
+//  hfsinspect
+//
+//
+
+#ifndef hfs_hfs_standard_h
+#define hfs_hfs_standard_h
+
+#include "hfs/types.h"
+#include "hfs/btree/btree.h"
+
+/*
+   Standard HFS (the "Mac OS Standard" format) is read through the HFS+ code: opening one synthesizes an
+   HFS+ volume header from the master directory block, and its catalog and extents nodes are rewritten
+   into their HFS+ forms as they're read, so searches, listings and extraction see HFS+ records.
+ */
+
+// Room for a 512-byte HFS node's records once rewritten in their larger HFS+ forms.
+#define HFS_STANDARD_NODE_SIZE 4096
+
+#pragma mark Volumes
+
+int  hfs_standard_open          (HFSPlus* hfs, Volume* vol) __attribute__((nonnull));
+bool hfs_is_standard            (const HFSPlus* hfs) __attribute__((nonnull));
+
+// Reads the volume bitmap, which HFS+ keeps in the allocation file. The caller frees *data.
+int  hfs_standard_read_bitmap   (char** data, size_t* length, const HFSPlus* hfs) __attribute__((nonnull));
+
+#pragma mark B-Trees
+
+// Points a freshly initialized catalog or extents tree at the translating node reader and the HFS key order.
+void hfs_standard_prepare_tree  (BTreePtr tree) __attribute__((nonnull));
+
+int  hfs_standard_get_node      (BTreeNodePtr* out_node, const BTreePtr bTree, bt_nodeid_t nodeNum) __attribute__((nonnull));
+
+// Rewrites a raw (big-endian) index or leaf node into a new HFS_STANDARD_NODE_SIZE buffer of host-order HFS+ records.
+// The node is pointed at the new buffer; the old one is left to the caller.
+int  hfs_standard_translate_node(BTreeNodePtr node) __attribute__((nonnull));
+
+int  hfs_standard_catalog_compare_keys (const HFSPlusCatalogKey* key1, const HFSPlusCatalogKey* key2) __attribute__((nonnull));
+
+#endif
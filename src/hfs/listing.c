@@ -0,0 +1,249 @@
+//
+//  listing.c
+//  hfsinspect
+//
+//
+
+#include <fnmatch.h>            // fnmatch
+
+#include "hfs/listing.h"
+#include "hfs/catalog.h"
+#include "hfs/unicode.h"
+#include "logging/logging.h"    // console printing routines
+
+// Children decoded per batch when they come from the metadata index.
+#define kListingIndexBatch 256
+
+// UTF-8 bytes for a name of `length` UTF-16 units, with its terminator.
+#define ListingNameBytes(length) ((size_t)(length) * 3 + 1)
+
+#pragma mark Decoding
+
+static void listing_reserve(HFSListing* listing, size_t entries, size_t nameBytes)
+{
+    if (listing->capacity < entries) {
+        SREALLOC(listing->entries, entries * sizeof(HFSListingEntry));
+        listing->capacity = entries;
+    }
+    if (listing->namesCapacity < nameBytes) {
+        SREALLOC(listing->names, nameBytes);
+        listing->namesCapacity = nameBytes;
+    }
+}
+
+// Writes a name as UTF-8. Most names are printable ASCII and are copied directly; the rest go through the full encoder.
+static uint16_t listing_copy_name(char* out, const HFSUniStr255* name)
+{
+    uint16_t length = MIN(name->length, 255);
+    uint16_t i      = 0;
+
+    for (; i < length; i++) {
+        uint16_t c = name->unicode[i];
+        if ((c < 0x20) || (c > 0x7e) || (c == '/')) break;
+        out[i] = (char)c;
+    }
+
+    if (i < length) {
+        hfs_str str   = "";
+        int     bytes = hfsuc_to_str(&str, name);
+        if (bytes < 0) bytes = 0;
+        i = (uint16_t)MIN((size_t)bytes, ListingNameBytes(length) - 1);
+        memcpy(out, str, i);
+    }
+
+    out[i] = '\0';
+    return i;
+}
+
+// Adds a file or folder record to the batch if it passes the filter. `used` is the number of name bytes taken so far.
+static void listing_decode(HFSListing* listing, size_t* count, size_t* used, const HFSUniStr255* name, const HFSPlusCatalogRecord* record)
+{
+    const HFSListingFilter* filter = &listing->filter;
+    HFSListingEntry*        entry  = &listing->entries[*count];
+
+    if ((record->record_type != kHFSPlusFileRecord) && (record->record_type != kHFSPlusFolderRecord)) return;
+
+    listing->scanned++;
+
+    // Files and folders share these attributes at the same locations.
+    *entry = (HFSListingEntry){
+        .cnid       = record->catalogFile.fileID,
+        .modifyDate = record->catalogFile.contentModDate,
+        .user       = record->catalogFile.bsdInfo.ownerID,
+        .group      = record->catalogFile.bsdInfo.groupID,
+        .mode       = record->catalogFile.bsdInfo.fileMode,
+        .kind       = HFSListingFile,
+    };
+
+    if (HFSPlusCatalogFolderIsHardLink(record)) {
+        entry->kind = HFSListingFolderLink;
+    } else if (HFSPlusCatalogFileIsHardLink(record)) {
+        entry->kind = HFSListingHardLink;
+    } else if (HFSPlusCatalogRecordIsSymLink(record)) {
+        entry->kind = HFSListingSymlink;
+    } else if (record->record_type == kHFSPlusFolderRecord) {
+        entry->kind = HFSListingFolder;
+    }
+
+    if (record->record_type == kHFSPlusFileRecord) {
+        entry->dataSize = record->catalogFile.dataFork.logicalSize;
+        entry->rsrcSize = record->catalogFile.resourceFork.logicalSize;
+        if (record->catalogFile.dataFork.totalBlocks) entry->forks |= HFSListingDataFork;
+        if (record->catalogFile.resourceFork.totalBlocks) entry->forks |= HFSListingResourceFork;
+    }
+
+    // The cheap filters go first so most rejected records never have their names converted.
+    if (filter->minSize && ((entry->dataSize + entry->rsrcSize) < filter->minSize)) return;
+    if (filter->newerThan && (entry->modifyDate < filter->newerThan)) return;
+
+    char* out = listing->names + *used;
+    entry->nameLength = listing_copy_name(out, name);
+
+    if (filter->pattern && (fnmatch(filter->pattern, out, 0) != 0)) return;
+
+    // The names buffer is sized for the whole batch before decoding starts, so it doesn't move under earlier entries.
+    entry->name = out;
+    *used      += entry->nameLength + 1;
+    (*count)++;
+}
+
+static int listing_next_from_index(HFSListing* listing, size_t* count)
+{
+    const HFSIndex* index = listing->hfs->index;
+
+    while (listing->indexCount) {
+        size_t batch = MIN(listing->indexCount, kListingIndexBatch);
+        size_t used  = 0;
+
+        listing_reserve(listing, batch, batch * ListingNameBytes(255));
+
+        for (size_t i = 0; i < batch; i++) {
+            FSSpec               spec   = {0};
+            HFSPlusCatalogRecord record = {0};
+            if (hfs_index_find_cnid(index, listing->indexChildren[i].cnid, &spec, &record) != 1) continue;
+            listing_decode(listing, count, &used, &spec.name, &record);
+        }
+
+        listing->indexChildren += batch;
+        listing->indexCount    -= batch;
+
+        if (*count) return 1;
+    }
+
+    return 0;
+}
+
+static int listing_next_from_catalog(HFSListing* listing, size_t* count)
+{
+    BTreeCursor* cursor = &listing->cursor;
+
+    while (cursor->node != NULL) {
+        BTRecNum start = 0;
+        size_t   used  = 0;
+        bool     done  = false;
+
+        // The thread record starts the folder; every later batch starts at the top of the next leaf.
+        if ( !listing->started ) {
+            listing->started = true;
+            start            = cursor->recordID + 1;
+        } else {
+            int status = btree_cursor_next_node(cursor);
+            if (status <= 0) return status;
+        }
+
+        BTreeNodePtr node = cursor->node;
+        listing_reserve(listing, node->recordCount, node->nodeSize * 2);
+
+        for (BTRecNum recNum = start; recNum < node->recordCount; recNum++) {
+            HFSPlusCatalogKey* key   = NULL;
+            void*              value = NULL;
+            if (btree_get_record((BTreeKeyPtr*)&key, &value, node, recNum) < 0) {
+                error("Catalog node %u: couldn't read record %u.", node->nodeNumber, recNum);
+                return -1;
+            }
+
+            // Children are keyed by their parent, so the first record for another parent ends the folder.
+            if (key->parentID != listing->folderID) { done = true; break; }
+
+            listing_decode(listing, count, &used, &key->nodeName, value);
+        }
+
+        if (done) btree_cursor_free(cursor);
+        if (*count) return 1;
+    }
+
+    return 0;
+}
+
+#pragma mark Interface
+
+int hfs_listing_open(HFSListing* listing, const HFSPlus* hfs, bt_nodeid_t folderID, const HFSListingFilter* filter)
+{
+    BTreePtr              tree   = NULL;
+    HFSPlusCatalogKey     key    = { .keyLength = kHFSPlusCatalogKeyMinimumLength, .parentID = folderID };
+    HFSPlusCatalogKey*    found  = NULL;
+    HFSPlusCatalogRecord* record = NULL;
+
+    *listing = (HFSListing){ .hfs = hfs, .folderID = folderID };
+    if (filter) listing->filter = *filter;
+
+    if (hfs->index != NULL) {
+        FSSpec spec = {0};
+        if (hfs_index_find_cnid(hfs->index, folderID, &spec, NULL) == 1) {
+            listing->folderName = spec.name;
+            listing->indexCount = hfs_index_children(hfs->index, folderID, &listing->indexChildren);
+            return 0;
+        }
+    }
+
+    if (hfsplus_get_catalog_btree(&tree, hfs) < 0) return -1;
+
+    btree_cursor_init(&listing->cursor, tree);
+    int result = btree_cursor_seek(&listing->cursor, &key);
+    if (result < 0) return -1;
+
+    if ((result == 0) || (btree_cursor_get(&listing->cursor, (BTreeKeyPtr*)&found, (void**)&record) < 0)) {
+        btree_cursor_free(&listing->cursor);
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (record->record_type != kHFSPlusFolderThreadRecord) {
+        btree_cursor_free(&listing->cursor);
+        errno = ENOTDIR;
+        return -1;
+    }
+
+    debug("Found thread record %u:%u", listing->cursor.node->nodeNumber, listing->cursor.recordID);
+    // Copy only the name's characters; a short thread record can end the node.
+    listing->folderName.length = MIN(record->catalogThread.nodeName.length, 255);
+    memcpy(listing->folderName.unicode, record->catalogThread.nodeName.unicode, listing->folderName.length * sizeof(uint16_t));
+
+    return 0;
+}
+
+int hfs_listing_next(HFSListing* listing, const HFSListingEntry** entries, size_t* count)
+{
+    int result = 0;
+
+    *count = 0;
+
+    // Only a listing read from the catalog has a tree on its cursor.
+    if (listing->cursor.tree == NULL)
+        result = listing_next_from_index(listing, count);
+    else
+        result = listing_next_from_catalog(listing, count);
+
+    *entries = listing->entries;
+
+    return result;
+}
+
+void hfs_listing_close(HFSListing* listing)
+{
+    btree_cursor_free(&listing->cursor);
+    SFREE(listing->entries);
+    SFREE(listing->names);
+    listing->capacity      = 0;
+    listing->namesCapacity = 0;
+}
@@ -0,0 +1,90 @@
+//
+//  listing.h
+//  hfsinspect
+//
+//
+
+#ifndef hfsinspect_hfs_listing_h
+#define hfsinspect_hfs_listing_h
+
+#include "hfs/types.h"
+#include "hfs/hfs_index.h"
+#include "hfs/btree/cursor.h"
+
+/*
+   Streams the children of a folder in catalog (name) order.
+
+   Opening a listing seeks a cursor to the folder's thread record once; each call to
+   hfs_listing_next then decodes the rest of the current leaf node into a batch of compact
+   entries and moves the cursor along the leaf chain (where the tree's read-ahead keeps the
+   next nodes coming). Only one batch is held at a time, so memory use doesn't depend on the
+   size of the folder.
+
+   With a metadata index attached (see hfs_index.h) the children come from its table instead.
+ */
+
+typedef enum HFSListingKind {
+    HFSListingFile = 0,
+    HFSListingFolder,
+    HFSListingHardLink,
+    HFSListingFolderLink,
+    HFSListingSymlink,
+} HFSListingKind;
+
+enum {
+    HFSListingDataFork     = 1 << 0,    // The data fork has blocks allocated
+    HFSListingResourceFork = 1 << 1,    // The resource fork has blocks allocated
+};
+
+typedef struct HFSListingEntry {
+    uint64_t    dataSize;               // Logical sizes; 0 for folders
+    uint64_t    rsrcSize;
+    const char* name;                   // UTF-8; valid until the next batch
+    hfs_cnid_t  cnid;
+    uint32_t    modifyDate;             // contentModDate (HFS time)
+    uint32_t    user;
+    uint32_t    group;
+    uint16_t    mode;
+    uint16_t    nameLength;             // Bytes, not counting the terminator
+    uint8_t     kind;                   // HFSListingKind
+    uint8_t     forks;                  // HFSListingDataFork | HFSListingResourceFork
+    uint8_t     _reserved[6];
+} HFSListingEntry;
+
+// Entries that fail a filter are dropped while the batch is decoded. Zeroed fields don't filter.
+typedef struct HFSListingFilter {
+    const char* pattern;                // fnmatch(3) pattern for the name
+    uint64_t    minSize;                // Data plus resource fork size, at least
+    uint32_t    newerThan;              // contentModDate at or after (HFS time)
+    uint32_t    _reserved;
+} HFSListingFilter;
+
+typedef struct HFSListing {
+    BTreeCursor          cursor;
+    HFSListingFilter     filter;
+    HFSUniStr255         folderName;
+    bt_nodeid_t          folderID;
+    uint32_t             _reserved;
+
+    const HFSPlus*       hfs;
+    const HFSIndexChild* indexChildren; // Remaining children from the metadata index, if any
+    size_t               indexCount;
+
+    HFSListingEntry*     entries;       // The current batch
+    char*                names;
+    size_t               capacity;      // Entries
+    size_t               namesCapacity; // Bytes
+    uint64_t             scanned;       // Child records examined, filtered or not
+    bool                 started;
+    uint8_t              _reserved2[7];
+} HFSListing;
+
+// Finds the folder's thread record. Returns -1 with errno ENOENT if the folder has none.
+int  hfs_listing_open  (HFSListing* listing, const HFSPlus* hfs, bt_nodeid_t folderID, const HFSListingFilter* filter) __attribute__((nonnull(1,2)));
+
+// Decodes the next batch of children. Returns 1 with a batch of at least one entry, 0 at the end of the folder, -1 on error.
+int  hfs_listing_next  (HFSListing* listing, const HFSListingEntry** entries, size_t* count) __attribute__((nonnull));
+
+void hfs_listing_close (HFSListing* listing) __attribute__((nonnull));
+
+#endif
@@ -0,0 +1,223 @@
+//
+//  hfs/macroman.c
+//  hfsinspect
+//
+//
+
+#include <string.h>
+
+#include "hfs/macroman.h"
+
+
+#pragma mark Tables
+
+// The upper half of Mac OS Roman (0x80-0xFF) in UTF-16, decomposed the way HFS+ names are: accented letters are a base letter and a combining mark.
+static const uint16_t kMacRomanUnicode[128][2] = {
+    { 0x0041, 0x0308 }, { 0x0041, 0x030A }, { 0x0043, 0x0327 }, { 0x0045, 0x0301 },   // 0x80
+    { 0x004E, 0x0303 }, { 0x004F, 0x0308 }, { 0x0055, 0x0308 }, { 0x0061, 0x0301 },   // 0x84
+    { 0x0061, 0x0300 }, { 0x0061, 0x0302 }, { 0x0061, 0x0308 }, { 0x0061, 0x0303 },   // 0x88
+    { 0x0061, 0x030A }, { 0x0063, 0x0327 }, { 0x0065, 0x0301 }, { 0x0065, 0x0300 },   // 0x8C
+    { 0x0065, 0x0302 }, { 0x0065, 0x0308 }, { 0x0069, 0x0301 }, { 0x0069, 0x0300 },   // 0x90
+    { 0x0069, 0x0302 }, { 0x0069, 0x0308 }, { 0x006E, 0x0303 }, { 0x006F, 0x0301 },   // 0x94
+    { 0x006F, 0x0300 }, { 0x006F, 0x0302 }, { 0x006F, 0x0308 }, { 0x006F, 0x0303 },   // 0x98
+    { 0x0075, 0x0301 }, { 0x0075, 0x0300 }, { 0x0075, 0x0302 }, { 0x0075, 0x0308 },   // 0x9C
+    { 0x2020, 0      }, { 0x00B0, 0      }, { 0x00A2, 0      }, { 0x00A3, 0      },   // 0xA0
+    { 0x00A7, 0      }, { 0x2022, 0      }, { 0x00B6, 0      }, { 0x00DF, 0      },   // 0xA4
+    { 0x00AE, 0      }, { 0x00A9, 0      }, { 0x2122, 0      }, { 0x00B4, 0      },   // 0xA8
+    { 0x00A8, 0      }, { 0x2260, 0      }, { 0x00C6, 0      }, { 0x00D8, 0      },   // 0xAC
+    { 0x221E, 0      }, { 0x00B1, 0      }, { 0x2264, 0      }, { 0x2265, 0      },   // 0xB0
+    { 0x00A5, 0      }, { 0x00B5, 0      }, { 0x2202, 0      }, { 0x2211, 0      },   // 0xB4
+    { 0x220F, 0      }, { 0x03C0, 0      }, { 0x222B, 0      }, { 0x00AA, 0      },   // 0xB8
+    { 0x00BA, 0      }, { 0x03A9, 0      }, { 0x00E6, 0      }, { 0x00F8, 0      },   // 0xBC
+    { 0x00BF, 0      }, { 0x00A1, 0      }, { 0x00AC, 0      }, { 0x221A, 0      },   // 0xC0
+    { 0x0192, 0      }, { 0x2248, 0      }, { 0x2206, 0      }, { 0x00AB, 0      },   // 0xC4
+    { 0x00BB, 0      }, { 0x2026, 0      }, { 0x00A0, 0      }, { 0x0041, 0x0300 },   // 0xC8
+    { 0x0041, 0x0303 }, { 0x004F, 0x0303 }, { 0x0152, 0      }, { 0x0153, 0      },   // 0xCC
+    { 0x2013, 0      }, { 0x2014, 0      }, { 0x201C, 0      }, { 0x201D, 0      },   // 0xD0
+    { 0x2018, 0      }, { 0x2019, 0      }, { 0x00F7, 0      }, { 0x25CA, 0      },   // 0xD4
+    { 0x0079, 0x0308 }, { 0x0059, 0x0308 }, { 0x2044, 0      }, { 0x20AC, 0      },   // 0xD8
+    { 0x2039, 0      }, { 0x203A, 0      }, { 0xFB01, 0      }, { 0xFB02, 0      },   // 0xDC
+    { 0x2021, 0      }, { 0x00B7, 0      }, { 0x201A, 0      }, { 0x201E, 0      },   // 0xE0
+    { 0x2030, 0      }, { 0x0041, 0x0302 }, { 0x0045, 0x0302 }, { 0x0041, 0x0301 },   // 0xE4
+    { 0x0045, 0x0308 }, { 0x0045, 0x0300 }, { 0x0049, 0x0301 }, { 0x0049, 0x0302 },   // 0xE8
+    { 0x0049, 0x0308 }, { 0x0049, 0x0300 }, { 0x004F, 0x0301 }, { 0x004F, 0x0302 },   // 0xEC
+    { 0xF8FF, 0      }, { 0x004F, 0x0300 }, { 0x0055, 0x0301 }, { 0x0055, 0x0302 },   // 0xF0
+    { 0x0055, 0x0300 }, { 0x0131, 0      }, { 0x02C6, 0      }, { 0x02DC, 0      },   // 0xF4
+    { 0x00AF, 0      }, { 0x02D8, 0      }, { 0x02D9, 0      }, { 0x02DA, 0      },   // 0xF8
+    { 0x00B8, 0      }, { 0x02DD, 0      }, { 0x02DB, 0      }, { 0x02C7, 0      },   // 0xFC
+};
+
+// The same characters in precomposed UTF-8, for names shown directly.
+static const char* const kMacRomanUTF8[128] = {
+    "\xC3\x84",     "\xC3\x85",     "\xC3\x87",     "\xC3\x89",  // 0x80
+    "\xC3\x91",     "\xC3\x96",     "\xC3\x9C",     "\xC3\xA1",  // 0x84
+    "\xC3\xA0",     "\xC3\xA2",     "\xC3\xA4",     "\xC3\xA3",  // 0x88
+    "\xC3\xA5",     "\xC3\xA7",     "\xC3\xA9",     "\xC3\xA8",  // 0x8C
+    "\xC3\xAA",     "\xC3\xAB",     "\xC3\xAD",     "\xC3\xAC",  // 0x90
+    "\xC3\xAE",     "\xC3\xAF",     "\xC3\xB1",     "\xC3\xB3",  // 0x94
+    "\xC3\xB2",     "\xC3\xB4",     "\xC3\xB6",     "\xC3\xB5",  // 0x98
+    "\xC3\xBA",     "\xC3\xB9",     "\xC3\xBB",     "\xC3\xBC",  // 0x9C
+    "\xE2\x80\xA0", "\xC2\xB0",     "\xC2\xA2",     "\xC2\xA3",  // 0xA0
+    "\xC2\xA7",     "\xE2\x80\xA2", "\xC2\xB6",     "\xC3\x9F",  // 0xA4
+    "\xC2\xAE",     "\xC2\xA9",     "\xE2\x84\xA2", "\xC2\xB4",  // 0xA8
+    "\xC2\xA8",     "\xE2\x89\xA0", "\xC3\x86",     "\xC3\x98",  // 0xAC
+    "\xE2\x88\x9E", "\xC2\xB1",     "\xE2\x89\xA4", "\xE2\x89\xA5",  // 0xB0
+    "\xC2\xA5",     "\xC2\xB5",     "\xE2\x88\x82", "\xE2\x88\x91",  // 0xB4
+    "\xE2\x88\x8F", "\xCF\x80",     "\xE2\x88\xAB", "\xC2\xAA",  // 0xB8
+    "\xC2\xBA",     "\xCE\xA9",     "\xC3\xA6",     "\xC3\xB8",  // 0xBC
+    "\xC2\xBF",     "\xC2\xA1",     "\xC2\xAC",     "\xE2\x88\x9A",  // 0xC0
+    "\xC6\x92",     "\xE2\x89\x88", "\xE2\x88\x86", "\xC2\xAB",  // 0xC4
+    "\xC2\xBB",     "\xE2\x80\xA6", "\xC2\xA0",     "\xC3\x80",  // 0xC8
+    "\xC3\x83",     "\xC3\x95",     "\xC5\x92",     "\xC5\x93",  // 0xCC
+    "\xE2\x80\x93", "\xE2\x80\x94", "\xE2\x80\x9C", "\xE2\x80\x9D",  // 0xD0
+    "\xE2\x80\x98", "\xE2\x80\x99", "\xC3\xB7",     "\xE2\x97\x8A",  // 0xD4
+    "\xC3\xBF",     "\xC5\xB8",     "\xE2\x81\x84", "\xE2\x82\xAC",  // 0xD8
+    "\xE2\x80\xB9", "\xE2\x80\xBA", "\xEF\xAC\x81", "\xEF\xAC\x82",  // 0xDC
+    "\xE2\x80\xA1", "\xC2\xB7",     "\xE2\x80\x9A", "\xE2\x80\x9E",  // 0xE0
+    "\xE2\x80\xB0", "\xC3\x82",     "\xC3\x8A",     "\xC3\x81",  // 0xE4
+    "\xC3\x8B",     "\xC3\x88",     "\xC3\x8D",     "\xC3\x8E",  // 0xE8
+    "\xC3\x8F",     "\xC3\x8C",     "\xC3\x93",     "\xC3\x94",  // 0xEC
+    "\xEF\xA3\xBF", "\xC3\x92",     "\xC3\x9A",     "\xC3\x9B",  // 0xF0
+    "\xC3\x99",     "\xC4\xB1",     "\xCB\x86",     "\xCB\x9C",  // 0xF4
+    "\xC2\xAF",     "\xCB\x98",     "\xCB\x99",     "\xCB\x9A",  // 0xF8
+    "\xC2\xB8",     "\xCB\x9D",     "\xCB\x9B",     "\xCB\x87",  // 0xFC
+};
+
+/*
+   Sort weights from Mac OS RelString, the order standard HFS catalogs are built in (the same table as
+   FastRelString's in xnu). ASCII letters fold to upper case, but accented letters keep their case: the
+   low byte holds the accent, with the high bit set for lower case, so Ä and ä are different keys.
+   Ligatures and ß sort as variants of their first letter, and quotes and the non-breaking space sort
+   next to their ASCII counterparts. Everything else, including most of 0xE0-0xFF, sorts by its code.
+ */
+static const uint16_t kMacRomanOrder[256] = {
+    0x0000, 0x0100, 0x0200, 0x0300, 0x0400, 0x0500, 0x0600, 0x0700,   // 0x00
+    0x0800, 0x0900, 0x0A00, 0x0B00, 0x0C00, 0x0D00, 0x0E00, 0x0F00,   // 0x08
+    0x1000, 0x1100, 0x1200, 0x1300, 0x1400, 0x1500, 0x1600, 0x1700,   // 0x10
+    0x1800, 0x1900, 0x1A00, 0x1B00, 0x1C00, 0x1D00, 0x1E00, 0x1F00,   // 0x18
+    0x2000, 0x2100, 0x2200, 0x2300, 0x2400, 0x2500, 0x2600, 0x2700,   // 0x20
+    0x2800, 0x2900, 0x2A00, 0x2B00, 0x2C00, 0x2D00, 0x2E00, 0x2F00,   // 0x28
+    0x3000, 0x3100, 0x3200, 0x3300, 0x3400, 0x3500, 0x3600, 0x3700,   // 0x30
+    0x3800, 0x3900, 0x3A00, 0x3B00, 0x3C00, 0x3D00, 0x3E00, 0x3F00,   // 0x38
+    0x4000, 0x4100, 0x4200, 0x4300, 0x4400, 0x4500, 0x4600, 0x4700,   // 0x40
+    0x4800, 0x4900, 0x4A00, 0x4B00, 0x4C00, 0x4D00, 0x4E00, 0x4F00,   // 0x48
+    0x5000, 0x5100, 0x5200, 0x5300, 0x5400, 0x5500, 0x5600, 0x5700,   // 0x50
+    0x5800, 0x5900, 0x5A00, 0x5B00, 0x5C00, 0x5D00, 0x5E00, 0x5F00,   // 0x58
+    0x4180, 0x4100, 0x4200, 0x4300, 0x4400, 0x4500, 0x4600, 0x4700,   // 0x60; RelString sorts ` among the a's
+    0x4800, 0x4900, 0x4A00, 0x4B00, 0x4C00, 0x4D00, 0x4E00, 0x4F00,   // 0x68
+    0x5000, 0x5100, 0x5200, 0x5300, 0x5400, 0x5500, 0x5600, 0x5700,   // 0x70
+    0x5800, 0x5900, 0x5A00, 0x7B00, 0x7C00, 0x7D00, 0x7E00, 0x7F00,   // 0x78
+    0x4108, 0x410C, 0x4310, 0x4502, 0x4E0A, 0x4F08, 0x5508, 0x4182,   // 0x80
+    0x4184, 0x4186, 0x4188, 0x418A, 0x418C, 0x4390, 0x4582, 0x4584,   // 0x88
+    0x4586, 0x4588, 0x4982, 0x4984, 0x4986, 0x4988, 0x4E8A, 0x4F82,   // 0x90
+    0x4F84, 0x4F86, 0x4F88, 0x4F8A, 0x5582, 0x5584, 0x5586, 0x5588,   // 0x98
+    0xA000, 0xA100, 0xA200, 0xA300, 0xA400, 0xA500, 0xA600, 0x5382,   // 0xA0
+    0xA800, 0xA900, 0xAA00, 0xAB00, 0xAC00, 0xAD00, 0x4114, 0x4F0E,   // 0xA8
+    0xB000, 0xB100, 0xB200, 0xB300, 0xB400, 0xB500, 0xB600, 0xB700,   // 0xB0
+    0xB800, 0xB900, 0xBA00, 0x4192, 0x4F92, 0xBD00, 0x4194, 0x4F8E,   // 0xB8
+    0xC000, 0xC100, 0xC200, 0xC300, 0xC400, 0xC500, 0xC600, 0x2206,   // 0xC0
+    0x2208, 0xC900, 0x2000, 0x4104, 0x410A, 0x4F0A, 0x4F14, 0x4F94,   // 0xC8
+    0xD000, 0xD100, 0x2202, 0x2204, 0x2702, 0x2704, 0xD600, 0xD700,   // 0xD0
+    0x5988, 0xD900, 0xDA00, 0xDB00, 0xDC00, 0xDD00, 0xDE00, 0xDF00,   // 0xD8
+    0xE000, 0xE100, 0xE200, 0xE300, 0xE400, 0xE500, 0xE600, 0xE700,   // 0xE0
+    0xE800, 0xE900, 0xEA00, 0xEB00, 0xEC00, 0xED00, 0xEE00, 0xEF00,   // 0xE8
+    0xF000, 0xF100, 0xF200, 0xF300, 0xF400, 0xF500, 0xF600, 0xF700,   // 0xF0
+    0xF800, 0xF900, 0xFA00, 0xFB00, 0xFC00, 0xFD00, 0xFE00, 0xFF00,   // 0xF8
+};
+
+#pragma mark Mac OS Roman conversions
+
+// Returns the Mac OS Roman code for a character (and optional combining mark), or -1 if it has none.
+static int macroman_find(uint16_t c, uint16_t mark)
+{
+    if ((c < 0x80) && (mark == 0)) return c;
+
+    for (unsigned i = 0; i < 128; i++) {
+        if ((kMacRomanUnicode[i][0] == c) && (kMacRomanUnicode[i][1] == mark)) return 0x80 + i;
+    }
+
+    return -1;
+}
+
+int macroman_to_hfsuc(HFSUniStr255* hfs, const uint8_t* name, size_t length)
+{
+    uint16_t count = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = name[i];
+
+        if (c < 0x80) {
+            if (count >= kHFSPlusMaxFileNameChars) break;
+            hfs->unicode[count++] = c;
+            continue;
+        }
+
+        const uint16_t* chars = kMacRomanUnicode[c - 0x80];
+        if ((count + (chars[1] ? 2 : 1)) > kHFSPlusMaxFileNameChars) break;
+
+        hfs->unicode[count++] = chars[0];
+        if (chars[1]) hfs->unicode[count++] = chars[1];
+    }
+
+    hfs->length = count;
+    return count;
+}
+
+size_t hfsuc_to_macroman(uint8_t* name, size_t size, const HFSUniStr255* hfs)
+{
+    size_t   count  = 0;
+    unsigned length = MIN(hfs->length, kHFSPlusMaxFileNameChars);
+
+    for (unsigned i = 0; (i < length) && (count < size); i++) {
+        uint16_t c    = hfs->unicode[i];
+        uint16_t mark = 0;
+        int      code = -1;
+
+        if (((i + 1) < length) && (hfs->unicode[i + 1] >= 0x0300) && (hfs->unicode[i + 1] <= 0x036F))
+            mark = hfs->unicode[i + 1];
+
+        // Take the mark along with its letter if Mac OS Roman has the pair; otherwise it stands on its own.
+        if (mark && ((code = macroman_find(c, mark)) >= 0)) i++;
+        else code = macroman_find(c, 0);
+
+        name[count++] = (code < 0 ? '?' : (uint8_t)code);
+    }
+
+    return count;
+}
+
+size_t macroman_to_utf8(char* str, size_t size, const uint8_t* name, size_t length)
+{
+    size_t used = 0;
+
+    if (size == 0) return 0;
+
+    for (size_t i = 0; i < length; i++) {
+        const char* bytes = (name[i] < 0x80 ? NULL : kMacRomanUTF8[name[i] - 0x80]);
+        size_t      n     = (bytes ? strlen(bytes) : 1);
+
+        if ((used + n) >= size) break;
+
+        if (bytes) memcpy(str + used, bytes, n);
+        else str[used] = (char)name[i];
+        used += n;
+    }
+
+    str[used] = '\0';
+    return used;
+}
+
+#pragma mark Ordering
+
+int macroman_compare(const uint8_t* name1, size_t length1, const uint8_t* name2, size_t length2)
+{
+    size_t length = MIN(length1, length2);
+    int    result = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        if ((result = cmp(kMacRomanOrder[name1[i]], kMacRomanOrder[name2[i]])) != 0) return result;
+    }
+
+    // The shared prefix sorted the same, so the shorter one wins.
+    return cmp(length1, length2);
+}
@@ -0,0 +1,34 @@
+//
+//  hfs/macroman.h
+//  hfsinspect
+//
+//
+
+#ifndef hfs_macroman_h
+#define hfs_macroman_h
+
+#include <stdint.h>         // uint*
+#include "hfs/types.h"      // HFSUniStr255
+
+/*
+   Standard HFS stores names as Mac OS Roman Pascal strings. These convert them through precomputed
+   tables, and order them the way the HFS catalog does.
+ */
+
+#pragma mark Mac OS Roman conversions
+
+// Decodes to UTF-16 in the decomposed form HFS+ stores names in. Returns the length in UTF-16 units.
+int    macroman_to_hfsuc  (HFSUniStr255* hfs, const uint8_t* name, size_t length) __attribute__((nonnull));
+
+// Encodes back to Mac OS Roman, recomposing accented letters; characters with no equivalent become '?'. Returns bytes written.
+size_t hfsuc_to_macroman  (uint8_t* name, size_t size, const HFSUniStr255* hfs) __attribute__((nonnull));
+
+// Writes a NUL-terminated, precomposed UTF-8 copy. Returns its length, not counting the NUL.
+size_t macroman_to_utf8   (char* str, size_t size, const uint8_t* name, size_t length) __attribute__((nonnull));
+
+#pragma mark Ordering
+
+// The HFS catalog's name order (RelString): ASCII case-insensitive, diacritic- and accented-case-sensitive, shorter names first on a tie.
+int    macroman_compare   (const uint8_t* name1, size_t length1, const uint8_t* name2, size_t length2) __attribute__((nonnull));
+
+#endif
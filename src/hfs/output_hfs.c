@@ -10,6 +10,7 @@
 #include "volumes/output.h"
 #include "memdmp/memdmp.h"
 #include "hfs/unicode.h"
+#include "hfs/macroman.h"
 #include "hfs/types.h"
 #include "hfs/catalog.h"
 #include "hfs/hfs.h"
@@ -71,6 +72,8 @@ void PrintVolumeInfo(out_ctx* ctx, const HFSPlus* hfs)
         BeginSection(ctx, "HFS+ Volume Format (v%d)", hfs->vh.version);
     else if (hfs->vh.signature == kHFSXSigWord)
         BeginSection(ctx, "HFSX Volume Format (v%d)", hfs->vh.version);
+    else if (hfs->vh.signature == kHFSSigWord)
+        BeginSection(ctx, "HFS Volume Format");
     else
         BeginSection(ctx, "Unknown Volume Format"); // Curious.
 
@@ -115,7 +118,8 @@ void PrintHFSMasterDirectoryBlock(out_ctx* ctx, const HFSMasterDirectoryBlock* v
     PrintUI(ctx, vcb, drNxtCNID);
     PrintUI(ctx, vcb, drFreeBks);
 
-    char name[32]; memset(name, '\0', 32); memcpy(name, vcb->drVN, 31);
+    char name[128] = "";
+    macroman_to_utf8(name, sizeof(name), &vcb->drVN[1], MIN(vcb->drVN[0], sizeof(vcb->drVN) - 1));
     PrintAttribute(ctx, "drVN", "%s", name);
 
     PrintHFSTimestamp(ctx, vcb, drVolBkUp);
@@ -644,12 +648,12 @@ void PrintHFSPlusCatalogFile(out_ctx* ctx, const HFSPlusCatalogFile* record)
     PrintUI                 (ctx, record, reserved2);
 
     BeginSection(ctx, "Data Fork");
-    PrintHFSPlusForkData(ctx, &record->dataFork, kHFSCatalogFileID, HFSDataForkType);
+    PrintHFSPlusForkData(ctx, &record->dataFork, record->fileID, HFSDataForkType);
     EndSection(ctx);
 
     if (record->resourceFork.logicalSize) {
         BeginSection(ctx, "Resource Fork");
-        PrintHFSPlusForkData(ctx, &record->resourceFork, kHFSCatalogFileID, HFSResourceForkType);
+        PrintHFSPlusForkData(ctx, &record->resourceFork, record->fileID, HFSResourceForkType);
         EndSection(ctx);
     }
 }
@@ -903,155 +907,6 @@ void PrintNode(out_ctx* ctx, const BTreeNodePtr node)
     EndSection(ctx);
 }
 
-void PrintFolderListing(out_ctx* ctx, uint32_t folderID)
-{
-    debug("Printing listing for folder ID %d", folderID);
-
-    // CNID kind mode user group data rsrc name
-    char         lineStr[110] = {0};
-    memset(lineStr, '-', 100);
-    char*        headerFormat = "%-9s %-10s %-10s %-9s %-9s %-15s %-15s %s";
-    char*        rowFormat    = "%-9u %-10s %-10s %-9d %-9d %-15s %-15s %s";
-
-    // Search for thread record
-    FSSpec       spec         = { .parentID = folderID };
-    BTreeNodePtr node         = NULL;
-    BTRecNum     recordID     = 0;
-
-    if (hfsplus_catalog_find_record(&node, &recordID, spec) < 0) {
-        error("No thread record for %d found.", folderID);
-        return;
-    }
-
-    debug("Found thread record %d:%d", node->nodeNumber, recordID);
-
-    // Get thread record
-    HFSPlusCatalogKey*    recordKey     = NULL;
-    HFSPlusCatalogRecord* catalogRecord = NULL;
-    btree_get_record((void*)&recordKey, (void*)&catalogRecord, node, recordID);
-
-    uint32_t              threadID      = recordKey->parentID;
-    hfs_str               name          = "";
-    hfsuc_to_str(&name, &catalogRecord->catalogThread.nodeName);
-
-    __attribute__((aligned(8))) struct {
-        uint64_t fileCount;
-        uint64_t folderCount;
-        uint64_t hardLinkCount;
-        uint64_t symlinkCount;
-        uint64_t dataForkCount;
-        uint64_t dataForkSize;
-        uint64_t rsrcForkCount;
-        uint64_t rsrcForkSize;
-    } folderStats = {0};
-
-    // Start output
-    BeginSection(ctx, "Listing for %s", name);
-    Print(ctx, headerFormat, "CNID", "kind", "mode", "user", "group", "data", "rsrc", "name");
-
-    // Loop over siblings until NULL
-    while (1) {
-        // Locate next record, even if it's in the next node.
-        if (++recordID >= node->recordCount) {
-            debug("Done with records in node %d", node->nodeNumber);
-            bt_nodeid_t nextNode = node->nodeDescriptor->fLink;
-            BTreePtr    tree     = node->bTree;
-            btree_free_node(node);
-            if ( BTGetNode(&node, tree, nextNode) < 0) { error("couldn't get the next catalog node"); return; }
-            recordID = 0;
-        }
-
-        btree_get_record((void*)&recordKey, (void*)&catalogRecord, node, recordID);
-
-        if (threadID == recordKey->parentID) {
-            debug("Looking at record %d", recordID);
-
-            if ((catalogRecord->record_type == kHFSPlusFileRecord) || (catalogRecord->record_type == kHFSPlusFolderRecord)) {
-                uint32_t cnid         = 0;
-                char     kind[10];
-                char     mode[11];
-                int      user         = -1, group = -1;
-                char     dataSize[20] = {'-', '\0'};
-                char     rsrcSize[20] = {'-', '\0'};
-
-                hfsuc_to_str(&name, &recordKey->nodeName);
-
-                if ( HFSPlusCatalogFolderIsHardLink(catalogRecord)) {
-                    folderStats.hardLinkCount++;
-                    (void)strlcpy(kind, "dir link", 10);
-                } else if (HFSPlusCatalogFileIsHardLink(catalogRecord)) {
-                    folderStats.hardLinkCount++;
-                    (void)strlcpy(kind, "hard link", 10);
-                } else if (HFSPlusCatalogRecordIsSymLink(catalogRecord)) {
-                    folderStats.symlinkCount++;
-                    (void)strlcpy(kind, "symlink", 10);
-                } else if (catalogRecord->record_type == kHFSPlusFolderRecord) {
-                    folderStats.folderCount++;
-                    (void)strlcpy(kind, "folder", 10);
-                } else {
-                    folderStats.fileCount++;
-                    (void)strlcpy(kind, "file", 10);
-                }
-
-                // Files and folders share these attributes at the same locations.
-                cnid  = catalogRecord->catalogFile.fileID;
-                user  = catalogRecord->catalogFile.bsdInfo.ownerID;
-                group = catalogRecord->catalogFile.bsdInfo.groupID;
-                _genModeString(mode, catalogRecord->catalogFile.bsdInfo.fileMode);
-
-                if (catalogRecord->record_type == kHFSPlusFileRecord) {
-                    if (catalogRecord->catalogFile.dataFork.logicalSize)
-                        (void)format_size(ctx, dataSize, catalogRecord->catalogFile.dataFork.logicalSize, 50);
-
-                    if (catalogRecord->catalogFile.resourceFork.logicalSize)
-                        (void)format_size(ctx, rsrcSize, catalogRecord->catalogFile.resourceFork.logicalSize, 50);
-
-                    if (catalogRecord->catalogFile.dataFork.totalBlocks > 0) {
-                        folderStats.dataForkCount++;
-                        folderStats.dataForkSize += catalogRecord->catalogFile.dataFork.logicalSize;
-                    }
-
-                    if (catalogRecord->catalogFile.resourceFork.totalBlocks > 0) {
-                        folderStats.rsrcForkCount++;
-                        folderStats.rsrcForkSize += catalogRecord->catalogFile.resourceFork.logicalSize;
-                    }
-                }
-
-                Print(ctx, rowFormat, cnid, kind, mode, user, group, dataSize, rsrcSize, name);
-            }
-        } else {
-            break;
-        } // parentID == parentID
-    }     // while(1)
-
-    char dataTotal[50];
-    char rsrcTotal[50];
-
-    format_size(ctx, dataTotal, folderStats.dataForkSize, 50);
-    format_size(ctx, rsrcTotal, folderStats.rsrcForkCount, 50);
-
-    Print(ctx, "%s", lineStr);
-    Print(ctx, headerFormat, "", "", "", "", "", dataTotal, rsrcTotal, "");
-
-    Print(ctx, "   Folders: %-10llu Data Forks: %-10llu Hard Links: %-10llu",
-          folderStats.folderCount,
-          folderStats.dataForkCount,
-          folderStats.hardLinkCount
-          );
-
-    Print(ctx, "     Files: %-10llu RSRC Forks: %-10llu   Symlinks: %-10llu",
-          folderStats.fileCount,
-          folderStats.rsrcForkCount,
-          folderStats.symlinkCount
-          );
-
-    btree_free_node(node);
-
-    EndSection(ctx);
-
-    debug("Done listing.");
-}
-
 void PrintNodeRecord(out_ctx* ctx, const BTreeNodePtr node, int recordNumber)
 {
     debug("PrintNodeRecord");
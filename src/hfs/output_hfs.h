@@ -57,7 +57,6 @@ void VisualizeHFSBTreeNodeRecord    (out_ctx* ctx, const char* label, BTHeaderRe
 
 void PrintTreeNode                  (out_ctx* ctx, const BTreePtr tree, uint32_t nodeID) _NONNULL;
 void PrintNode                      (out_ctx* ctx, const BTreeNodePtr node) _NONNULL;
-void PrintFolderListing             (out_ctx* ctx, uint32_t folderID) _NONNULL;
 void PrintNodeRecord                (out_ctx* ctx, const BTreeNodePtr node, int recordNumber) _NONNULL;
 
 void PrintHFSPlusExtentRecord       (out_ctx* ctx, const HFSPlusExtentRecord* record) _NONNULL;
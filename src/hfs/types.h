@@ -22,6 +22,9 @@ typedef uint8_t  hfs_str[1024];
 
 typedef int (* hfs_compare_keys)(const void*, const void*);
 
+// The B-trees a volume's node cache budget is split between (catalog, extents, attributes, hotfiles).
+#define kHFSNodeCacheTrees 4
+
 typedef struct HFSPlus     HFSPlus;
 typedef struct HFSPlusFork HFSPlusFork;
 
@@ -32,6 +35,14 @@ struct HFSPlus {
     size_t              length;             // Partition length, if known/needed (bytes)
     size_t              block_size;         // Allocation block size. (bytes)
     size_t              block_count;        // Number of blocks. (blocks of block_size size)
+    struct HFSIndex*    index;              // Optional metadata sidecar (see hfs_index.h)
+    size_t              node_cache_size;    // Bytes of B-tree node cache for the volume; 0 for the default. Set after hfs_open.
+    unsigned            threads;            // Workers for whole-volume scans; 0 for one per CPU. Set after hfs_open.
+    unsigned            queue_depth;        // Reads bulk readers keep in flight at once; 0 for the default. Set after hfs_open.
+    BTreePtr            catalogTree;        // Loaded on first use; freed by hfs_close
+    BTreePtr            extentsTree;
+    BTreePtr            attributesTree;
+    BTreePtr            hotfilesTree;
 };
 
 struct HFSPlusFork {
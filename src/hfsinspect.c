@@ -10,6 +10,8 @@
 #include <getopt.h>            // getopt_long
 #include <libgen.h>            // basename
 #include <locale.h>            // setlocale
+#include <time.h>              // strptime, timegm
+#include <ctype.h>             // toupper
 
 #if defined(BSD)
     #include <sys/mount.h>     //statfs
@@ -18,7 +20,9 @@
 #include "logging/logging.h"   // console printing routines
 #include "volumes/volumes.h"
 #include "volumes/utilities.h" // commonly-used utility functions
+#include "volumes/ioengine.h"  // IOENGINE_MAX_DEPTH
 #include "hfs/hfs.h"
+#include "hfs/hfs_index.h"
 #include "hfs/output_hfs.h"
 #include "hfs/unicode.h"
 #include "hfsplus/hfsplus.h"
@@ -48,6 +52,21 @@ static char PROGRAM_NAME[PATH_MAX];
 
 #define EMPTY_STRING(x) ((x) == NULL || strlen((x)) == 0)
 
+// Bytes, or with a K, M, G or T suffix (powers of 1024).
+static bool parse_size(const char* string, uint64_t* size)
+{
+    char*              end   = NULL;
+    unsigned long long value = strtoull(string, &end, 10);
+    const char*        units = "KMGT";
+    const char*        unit  = (*end ? strchr(units, toupper(*end)) : NULL);
+
+    if ((end == string) || (*end && ((unit == NULL) || (end[1] != '\0')))) return false;
+    if (unit) value <<= 10 * (unit - units + 1);
+
+    *size = value;
+    return true;
+}
+
 char* deviceAtPath(char* path)
 {
 #if defined(BSD)
@@ -172,7 +191,6 @@ void show_version()
 /* hfsdebug-lite args remaining...
    -0,        --freespace     display all free extents on the volume
    -e,        --examples      display some usage examples
-   -f,        --fragmentation display all fragmented files on the volume
    -H,        --hotfiles      display the hottest files on the volume; requires
                                 the -t (--top=TOP) option for the number to list
    -l TYPE,   --list=TYPE     specify an HFS+ B-Tree's leaf nodes' type, where
@@ -185,10 +203,6 @@ void show_version()
                                  type supported for the Attributes B-Tree
    -m,        --mountdata     display a mounted volume's in-memory data
    -S,        --summary_rsrc  calculate and display volume usage summary
-   -t TOP,    --top=TOP       specify the number of most fragmented files
-                                 to display (when used with the --fragmentation
-                                 option), or the number of largest files to display
-                                 (when used with the --summary option)
    -x FILTERDYLIB, --filter=FILTERDYLIB
                              run the filter implemented in the dynamic library
                                  whose path is FILTERDYLIB. Alternatively,
@@ -201,8 +215,10 @@ void show_version()
 
 void print_usage()
 {
-    char* help = "[-hv] [-d path | -p path | -V fspath] [-0DjlrSs] [-b btree [-n nid]] [-P path] [-F parent:name] [-o file] path";
+    char* help = "[-hv] [-d path | -p path | -V fspath] [-0DfjlrSs] [--du] [-t top] [--json] [--sort key] [--limit n] [--match glob] [--larger size] [--newer date] [-b btree [-n nid]] [-P path] [-F parent:name] [-o file] [--hash[=algo]] [--verify-btree[=btree]] [--check-allocation] [--block-owner list [--block-index file]] [--index file] [--memory size] [--queue-depth n] path";
+    char* batch = "--batch [-s] [--verify-btree[=btree]] [-y dir] [--threads n] [--memory size] [--queue-depth n] source ...";
     fprintf(stderr, "usage: %s %s\n", PROGRAM_NAME, help);
+    fprintf(stderr, "       %s %s\n", PROGRAM_NAME, batch);
 }
 
 void print_help()
@@ -225,9 +241,18 @@ void print_help()
                  "    By default, hfsinspect will just show you the volume header and quit.  Use the following options to get more specific data.\n"
                  "\n"
                  "    -l,         --list          If the specified FSOB is a folder, list the contents. \n"
+                 "                --sort KEY      Order the -l listing by name (catalog order, the default), size (largest first) or date (newest first).\n"
+                 "                --limit N       List at most N children with -l.\n"
+                 "                --match GLOB    List only children whose names match the shell pattern GLOB.\n"
+                 "                --larger SIZE   List only children with at least SIZE bytes in their forks (K, M, G and T suffixes allowed).\n"
+                 "                --newer DATE    List only children whose contents changed on or after DATE (YYYY-MM-DD, GMT).\n"
                  "    -D,         --disk-info     Show any available information about the disk, including partitions and volume headers.\n"
                  "    -0,         --freespace     Show a summary of the used/free space and extent count based on the allocation file.\n"
                  "    -s,         --summary       Show a summary of the files on the disk.\n"
+                 "    -f,         --fragmentation Rank the most fragmented forks by extent count, average extent size and seek distance.\n"
+                 "                --du            Total the size of every folder recursively and list the heaviest.\n"
+                 "    -t TOP,     --top TOP       Number of entries in each ranking of -f, -s or --du (default 10).\n"
+                 "                --json          Print the summary (-s) as JSON.\n"
                  "    -r,         --volumeheader  Dump the volume header. \n"
                  "    -j,         --journal       Dump the volume's journal info block structure. \n"
                  "    -b NAME,    --btree NAME    Specify which HFS+ B-Tree to work with. Supported options: attributes, catalog, extents, or hotfiles. \n"
@@ -236,6 +261,21 @@ void print_help()
                  "    -F FSSpec   --fsspec FSSpec Locate a record by Carbon-style FSSpec (parent:name).\n"
                  "    -P path     --fs-path path  Locate a record by path on the given device's filesystem.\n"
                  "    -y DIR      --yank          Yank all the filesystem files and put then in the specified directory.\n"
+                 "                --hash[=ALGO]   Print a digest of every file's forks, reading the volume in physical order. ALGO is sha256 (default), crc32c or crc32.\n"
+                 "                --verify-btree[=NAME]  Check the structure of a B-Tree (attributes, catalog, extents, or hotfiles); by default, the catalog, extents and attributes trees.\n"
+                 "                --check-allocation  Compare the allocation file with the extents of every fork, reporting leaked, unallocated and multiply-claimed blocks.\n"
+                 "                --block-owner LIST  Show which file owns each block in LIST (numbers or first-last ranges, separated by commas; \"-\" reads stdin, \"@path\" reads a file).\n"
+                 "                --block-index PATH  Keep the block owner index in PATH, reusing it until the volume changes.\n"
+                 "                --index PATH        Answer catalog, extent and node map lookups from a metadata index in PATH, building it first if it is missing or out of date.\n"
+                 "                --memory SIZE       Bytes of B-tree node cache to use, split between the trees (K, M, G and T suffixes allowed).\n"
+                 "                --queue-depth N     Reads to keep in flight at once during catalog scans, read-ahead, hashing and extraction (1-1024, default 32).\n"
+                 "\n"
+                 "BATCH: \n"
+                 "    --batch SOURCE ...      Open every SOURCE (images, devices, shell patterns, or @FILE for a list of sources, one per line) and run the\n"
+                 "                            summary (-s, the default), B-Tree verification (--verify-btree) and metadata export (-y DIR) on each, printing\n"
+                 "                            a JSON array with an object per source. Exits with 1 if any source failed or had B-Tree problems.\n"
+                 "    --threads N             Sources to work on at once (default: one per CPU).\n"
+                 "    --memory SIZE           With --batch, the node cache budget for all the sources open at once.\n"
                  "\n"
                  "OUTPUT: \n"
                  "    You can optionally have hfsinspect dump any fork it finds as the result of an operation. This includes B-Trees or file forks.\n"
@@ -250,6 +290,7 @@ void print_help()
 int main (int argc, char* const* argv)
 {
     bool      use_decimal = false;
+    int       exit_status = 0;
     HIOptions options     = {0};
 
 #if defined(GC_ENABLED)         // GC_ENABLED
@@ -257,6 +298,7 @@ int main (int argc, char* const* argv)
 #endif                          // GC_ENABLED
 
     SALLOC(options.hfs, sizeof(struct HFSPlus));
+    options.top = 10;
 
     (void)strlcpy(PROGRAM_NAME, basename(argv[0]), PATH_MAX);
 
@@ -283,19 +325,38 @@ int main (int argc, char* const* argv)
         { "disk-info",      no_argument,            NULL,                   'D' },
         { "freespace",      no_argument,            NULL,                   '0' },
         { "summary",        no_argument,            NULL,                   's' },
+        { "fragmentation",  no_argument,            NULL,                   'f' },
+        { "top",            required_argument,      NULL,                   't' },
+        { "du",             no_argument,            NULL,                   'U' },
         { "btree",          required_argument,      NULL,                   'b' },
         { "node",           required_argument,      NULL,                   'n' },
         { "cnid",           required_argument,      NULL,                   'c' },
         { "fsspec",         required_argument,      NULL,                   'F' },
         { "fs-path",        required_argument,      NULL,                   'P' },
         { "yank",           required_argument,      NULL,                   'y' },
+        { "hash",           optional_argument,      NULL,                   'a' },
+        { "verify-btree",   optional_argument,      NULL,                   'k' },
+        { "check-allocation", no_argument,          NULL,                   'A' },
+        { "block-owner",    required_argument,      NULL,                   'O' },
+        { "block-index",    required_argument,      NULL,                   'I' },
+        { "index",          required_argument,      NULL,                   'X' },
+        { "json",           no_argument,            NULL,                   'J' },
+        { "sort",           required_argument,      NULL,                   'R' },
+        { "limit",          required_argument,      NULL,                   'T' },
+        { "match",          required_argument,      NULL,                   'M' },
+        { "larger",         required_argument,      NULL,                   'G' },
+        { "newer",          required_argument,      NULL,                   'N' },
+        { "batch",          no_argument,            NULL,                   'W' },
+        { "threads",        required_argument,      NULL,                   'w' },
+        { "memory",         required_argument,      NULL,                   'm' },
+        { "queue-depth",    required_argument,      NULL,                   'Q' },
 
         { "output",         required_argument,      NULL,                   'o' },
         { NULL,             0,                      NULL,                   0   }
     };
 
     /* short options */
-    char*         shortopts = "0ShvjlrsDd:n:b:p:P:F:V:c:o:y:L";
+    char*         shortopts = "0ShvjlrsfDd:n:b:p:P:F:V:c:o:y:t:L";
 
     int           opt;
     while ((opt = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
@@ -471,6 +532,152 @@ int main (int argc, char* const* argv)
                 break;
             }
 
+            case 'a':
+            {
+                set_mode(&options, HIModeHashFiles);
+                if ((optarg == NULL) || (strcmp(optarg, HashOptionSHA256) == 0)) options.hash_algorithm = HIHashSHA256;
+                else if (strcmp(optarg, HashOptionCRC32C) == 0) options.hash_algorithm = HIHashCRC32C;
+                else if (strcmp(optarg, HashOptionCRC32) == 0) options.hash_algorithm = HIHashCRC32;
+                else fatal("option --hash must be one of: sha256, crc32c or crc32 (not %s).", optarg);
+                break;
+            }
+
+            case 'k':
+            {
+                set_mode(&options, HIModeVerifyBTree);
+                if (optarg == NULL) options.verify_trees |= (1 << BTreeTypeCatalog) | (1 << BTreeTypeExtents) | (1 << BTreeTypeAttributes);
+                else if (strcmp(optarg, BTreeOptionAttributes) == 0) options.verify_trees |= (1 << BTreeTypeAttributes);
+                else if (strcmp(optarg, BTreeOptionCatalog) == 0) options.verify_trees |= (1 << BTreeTypeCatalog);
+                else if (strcmp(optarg, BTreeOptionExtents) == 0) options.verify_trees |= (1 << BTreeTypeExtents);
+                else if (strcmp(optarg, BTreeOptionHotfiles) == 0) options.verify_trees |= (1 << BTreeTypeHotfiles);
+                else fatal("option --verify-btree must be one of: attributes, catalog, extents, or hotfiles (not %s).", optarg);
+                break;
+            }
+
+            case 'A':
+            {
+                set_mode(&options, HIModeCheckAllocation);
+                break;
+            }
+
+            case 'O':
+            {
+                set_mode(&options, HIModeBlockOwners);
+                options.block_list = optarg;
+                break;
+            }
+
+            case 'I':
+            {
+                set_mode(&options, HIModeBlockOwners);
+                (void)strlcpy(options.block_index_path, optarg, PATH_MAX);
+                break;
+            }
+
+            case 'f':
+            {
+                set_mode(&options, HIModeFragmentation);
+                break;
+            }
+
+            case 'U':
+            {
+                set_mode(&options, HIModeFolderSizes);
+                break;
+            }
+
+            case 't':
+            {
+                char* end = NULL;
+                long  top = strtol(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (top < 1) || (top > UINT32_MAX)) fatal("option -t/--top must be a positive number (not %s).", optarg);
+                options.top = (uint32_t)top;
+                break;
+            }
+
+            case 'X':
+            {
+                (void)strlcpy(options.index_path, optarg, PATH_MAX);
+                break;
+            }
+
+            case 'J':
+            {
+                options.json = true;
+                break;
+            }
+
+            case 'R':
+            {
+                if (strcmp(optarg, "name") == 0) options.list_sort = HIListingSortName;
+                else if (strcmp(optarg, "size") == 0) options.list_sort = HIListingSortSize;
+                else if (strcmp(optarg, "date") == 0) options.list_sort = HIListingSortDate;
+                else fatal("option --sort must be name, size or date (not %s).", optarg);
+                break;
+            }
+
+            case 'T':
+            {
+                char* end   = NULL;
+                long  limit = strtol(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (limit < 1) || (limit > UINT32_MAX)) fatal("option --limit must be a positive number (not %s).", optarg);
+                options.list_limit = (uint32_t)limit;
+                break;
+            }
+
+            case 'M':
+            {
+                options.list_pattern = optarg;
+                break;
+            }
+
+            case 'G':
+            {
+                if ( !parse_size(optarg, &options.list_min_size) ) fatal("option --larger must be a size in bytes, optionally with a K, M, G or T suffix (not %s).", optarg);
+                break;
+            }
+
+            case 'W':
+            {
+                set_mode(&options, HIModeBatch);
+                break;
+            }
+
+            case 'w':
+            {
+                char* end     = NULL;
+                long  threads = strtol(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (threads < 1) || (threads > 1024)) fatal("option --threads must be a number from 1 to 1024 (not %s).", optarg);
+                options.batch_threads = (uint32_t)threads;
+                break;
+            }
+
+            case 'm':
+            {
+                if ( !parse_size(optarg, &options.memory_budget) ) fatal("option --memory must be a size in bytes, optionally with a K, M, G or T suffix (not %s).", optarg);
+                break;
+            }
+
+            case 'Q':
+            {
+                char* end   = NULL;
+                long  depth = strtol(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (depth < 1) || (depth > IOENGINE_MAX_DEPTH)) fatal("option --queue-depth must be a number from 1 to %d (not %s).", IOENGINE_MAX_DEPTH, optarg);
+                options.queue_depth = (uint32_t)depth;
+                break;
+            }
+
+            case 'N':
+            {
+                struct tm date = {0};
+                char*     end  = strptime(optarg, "%Y-%m-%d", &date);
+                if ((end == NULL) || (*end != '\0')) fatal("option --newer must be a date as YYYY-MM-DD (not %s).", optarg);
+                time_t    when = timegm(&date);
+                if ((when < 0) || ((uint64_t)when + MAC_GMT_FACTOR > UINT32_MAX)) fatal("option --newer is out of range for HFS+ dates (%s).", optarg);
+                options.list_newer = (uint32_t)(when + MAC_GMT_FACTOR);
+                break;
+            }
+
             case '?':  // Unknown option/Missing argument
             case ':':  // Value set or index returned
             case 0:
@@ -483,6 +690,16 @@ int main (int argc, char* const* argv)
         }
     }
 
+#pragma mark Batch
+
+    // Many sources at once: -s (the default), --verify-btree and -y for each, as JSON.
+    if (check_mode(&options, HIModeBatch)) {
+        if ( !check_mode(&options, HIModeShowSummary) && !check_mode(&options, HIModeVerifyBTree) && !check_mode(&options, HIModeYankFS) )
+            set_mode(&options, HIModeShowSummary);
+
+        exit(runBatch(&options, argc - optind, &argv[optind]) ? 1 : 0);
+    }
+
 #pragma mark Prepare Input and Outputs
 
     // If no device path was given, use the volume of the CWD.
@@ -549,6 +766,12 @@ OPEN:
     if (hfs_open(options.hfs, vol) < 0) {
         die(1, "hfs_open");
     }
+    options.hfs->node_cache_size = options.memory_budget;
+    options.hfs->queue_depth     = options.queue_depth;
+
+    if ((options.index_path[0] != '\0') && (hfs_index_open(options.hfs, options.index_path) < 0)) {
+        die(1, "Could not open or build the metadata index %s", options.index_path);
+    }
 
     out_ctx* ctx = options.hfs->vol->ctx;
     ctx->decimal_sizes = use_decimal;
@@ -558,7 +781,10 @@ OPEN:
 
     // If extracting, determine the UID to become by checking the owner of the output directory (so we can create any requested files later).
     if (check_mode(&options, HIModeExtractFile) || check_mode(&options, HIModeYankFS)) {
-        char* dir = strdup(dirname(options.extract_path));
+        // dirname(3) may modify its argument, so give it a copy.
+        char* path = strdup(options.extract_path);
+        char* dir  = strdup(dirname(path));
+        SFREE(path);
         if ( !strlen(dir) ) {
             die(1, "Output file directory does not exist: %s", dir);
         }
@@ -708,8 +934,8 @@ NOPE:
 
 #pragma mark Volume Requests
 
-    // Always detail what volume we're working on at the very least
-    PrintVolumeInfo(ctx, options.hfs);
+    // Always detail what volume we're working on at the very least (except in machine-readable output)
+    if ( !options.json ) PrintVolumeInfo(ctx, options.hfs);
 
     // Default to volume info if there are no other specifiers.
     if (options.mode == 0) set_mode(&options, HIModeShowVolumeInfo);
@@ -717,14 +943,22 @@ NOPE:
     // Volume summary
     if (check_mode(&options, HIModeShowSummary)) {
         debug("Printing summary.");
-        VolumeSummary summary = generateVolumeSummary(&options);
-        PrintVolumeSummary(ctx, &summary);
+        VolumeSummary summary = {0};
+        if (generateVolumeSummary(&summary, &options) < 0)
+            die(1, "Could not summarize the volume.");
+        if (options.json) PrintVolumeSummaryJSON(stdout, options.hfs, &summary);
+        else PrintVolumeSummary(ctx, options.hfs, &summary);
+        freeVolumeSummary(&summary);
     }
 
     // Show volume info
     if (check_mode(&options, HIModeShowVolumeInfo)) {
         debug("Printing volume header.");
-        PrintVolumeHeader(ctx, &options.hfs->vh);
+        HFSMasterDirectoryBlock mdb = {0};
+        if (hfs_is_standard(options.hfs) && hfs_get_HFSMasterDirectoryBlock(&mdb, options.hfs))
+            PrintHFSMasterDirectoryBlock(ctx, &mdb);
+        else
+            PrintVolumeHeader(ctx, &options.hfs->vh);
     }
 
     // Journal info
@@ -754,6 +988,36 @@ NOPE:
         showFreeSpace(&options);
     }
 
+    // Hash every fork on the volume
+    if (check_mode(&options, HIModeHashFiles)) {
+        debug("Hash files.");
+        hashFiles(&options);
+    }
+
+    // Cross-check the allocation file against every fork's extents
+    if (check_mode(&options, HIModeCheckAllocation)) {
+        debug("Check allocation.");
+        if (checkAllocation(&options) > 0) exit_status = 1;
+    }
+
+    // Recursive folder sizes
+    if (check_mode(&options, HIModeFolderSizes)) {
+        debug("Show folder sizes.");
+        showFolderSizes(&options);
+    }
+
+    // Rank fragmented forks
+    if (check_mode(&options, HIModeFragmentation)) {
+        debug("Show fragmentation.");
+        showFragmentation(&options);
+    }
+
+    // Look up the owners of allocation blocks
+    if (check_mode(&options, HIModeBlockOwners)) {
+        debug("Show block owners.");
+        showBlockOwners(&options);
+    }
+
 #pragma mark Catalog Requests
 
     // Show a path's series of records
@@ -788,6 +1052,14 @@ NOPE:
 
 #pragma mark B-Tree Requests
 
+    // Check the structure of whole B-Trees
+    if (check_mode(&options, HIModeVerifyBTree)) {
+        debug("Verify B-Trees.");
+        int problems = verifyBTrees(&options);
+        if (problems < 0) die(1, "Could not verify the B-trees.");
+        if (problems > 0) exit_status = 1;
+    }
+
     // Show B-Tree info
     if (check_mode(&options, HIModeShowBTreeInfo)) {
         debug("Printing tree info.");
@@ -843,7 +1115,7 @@ NOPE:
             off_t  offset = length * options.node_id;
             void*  buf    = NULL;
             SALLOC(buf, length);
-            fpread(options.tree->fp, buf, length, offset);
+            hfs_read_fork_range(buf, options.tree->fork, length, offset);
             VisualizeData(buf, length);
             SFREE(buf);
 
@@ -882,6 +1154,6 @@ NOPE:
 
     debug("Clean exit.");
 
-    return 0;
+    return exit_status;
 }
 
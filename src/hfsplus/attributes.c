@@ -18,13 +18,13 @@
 
 int hfs_get_attribute_btree(BTreePtr* tree, const HFSPlus* hfs)
 {
-    static BTreePtr cachedTree = NULL;
+    HFSPlus* volume = (HFSPlus*)hfs;
 
     debug("Getting attribute B-Tree");
 
-    if (cachedTree == NULL) {
-        HFSPlusFork* fork = NULL;
-        FILE*        fp   = NULL;
+    if (volume->attributesTree == NULL) {
+        HFSPlusFork* fork       = NULL;
+        BTreePtr     cachedTree = NULL;
 
         debug("Creating attribute B-Tree");
 
@@ -35,14 +35,15 @@ int hfs_get_attribute_btree(BTreePtr* tree, const HFSPlus* hfs)
             return -1;
         }
 
-        fp                     = fopen_hfsfork(fork);
-        btree_init(cachedTree, fp);
+        btree_init(cachedTree, fork);
         cachedTree->treeID     = kHFSAttributesFileID;
         cachedTree->keyCompare = (btree_key_compare_func)hfs_attributes_compare_keys;
         cachedTree->getNode    = hfs_attributes_get_node;
+
+        volume->attributesTree = cachedTree;
     }
 
-    *tree = cachedTree;
+    *tree = volume->attributesTree;
 
     return 0;
 }
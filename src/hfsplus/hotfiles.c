@@ -14,16 +14,16 @@
 
 int hfs_get_hotfiles_btree(BTreePtr* tree, const HFSPlus* hfs)
 {
-    static BTreePtr cachedTree;
+    HFSPlus* volume = (HFSPlus*)hfs;
 
     debug("Getting hotfiles B-Tree");
 
-    if (cachedTree == NULL) {
+    if (volume->hotfilesTree == NULL) {
+        BTreePtr     cachedTree    = NULL;
         BTreeNodePtr node          = NULL;
         BTreeKeyPtr  recordKey     = NULL;
         void*        recordValue   = NULL;
         HFSPlusFork* fork          = NULL;
-        FILE*        fp            = NULL;
         BTRecNum     recordID      = 0;
         bt_nodeid_t  parentfolder  = kHFSRootFolderID;
         FSSpec       spec          = { .hfs = hfs, .parentID = parentfolder, .name = {0} };
@@ -46,20 +46,21 @@ int hfs_get_hotfiles_btree(BTreePtr* tree, const HFSPlus* hfs)
 
         SALLOC(cachedTree, sizeof(struct _BTree));
 
-        fp = fopen_hfsfork(fork);
-        if (fp == NULL) return -1;
-
-        if (btree_init(cachedTree, fp) < 0) {
+        if (btree_init(cachedTree, fork) < 0) {
             error("Error initializing hotfiles btree.");
+            hfsfork_free(fork);
+            SFREE(cachedTree);
             return -1;
         }
         cachedTree->treeID  = record->catalogFile.fileID;
         cachedTree->getNode = hfs_hotfiles_get_node;
+
+        volume->hotfilesTree = cachedTree;
     }
 
     // Copy the cached tree out.
     // Note this copies a reference to the same extent list in the HFSPlusFork struct so NEVER free that fork.
-    *tree = cachedTree;
+    *tree = volume->hotfilesTree;
 
     return 0;
 }
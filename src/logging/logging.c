@@ -214,7 +214,7 @@ int PrintLine(enum LogLevel level, const char* file, const char* function, unsig
 
     term_width -= 10; // Account for prefix.
 
-    SALLOC(out_line, term_width);
+    SALLOC(out_line, term_width + 1);   // Room for the terminator written below.
     SALLOC(in_line, term_width);
 
     // Fill the line with spaces.
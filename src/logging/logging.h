@@ -57,6 +57,6 @@ int LogLine(enum LogLevel level, const char* format, ...)
 __attribute__((format(printf, 2, 3)));
 
 int PrintLine(enum LogLevel level, const char* file, const char* function, unsigned int line, const char* format, ...)
-__attribute__((format(printf, 5, 6), nonnull));
+__attribute__((format(printf, 5, 6), nonnull(2, 3, 5)));    // Not the arguments: trace() logs pointers that may be NULL
 
 #endif
@@ -0,0 +1,366 @@
+//
+//  batch.c
+//  hfsinspect
+//
+//
+
+#include <sys/time.h>           // gettimeofday
+#include <fcntl.h>              // open
+#include <glob.h>               // glob
+#include <libgen.h>             // basename
+#include <pthread.h>
+
+#include "operations.h"
+#include "hfs/hfs_io.h"
+#include "hfsplus/hfsplus.h"
+#include "volumes/volumes.h"
+#include "volumes/workqueue.h"
+
+/*
+   Runs the summary (-s), B-tree verification (--verify-btree) and metadata export (-y) on many
+   images in one process. Every source is opened as its own volume with its own B-trees and node
+   caches, and each one is a single job on a shared pool of worker threads; a volume's own scans
+   stay on that job's thread, so the pool size is the whole machine's worth of parallelism. The
+   memory budget (--memory) is divided evenly between the volumes that can be open at once.
+
+   The results are one JSON array with an object per source, written as each source finishes.
+ */
+
+#define BATCH_COPY_SIZE (1024 * 1024)   // Bytes per read when exporting metadata files
+
+typedef struct BatchRun {
+    const HIOptions* options;
+    size_t           cacheSize;         // Node cache bytes for each volume
+    pthread_mutex_t  lock;              // Guards the fields below and stdout
+    size_t           emitted;
+    unsigned         failures;
+    uint8_t          _reserved[4];
+} BatchRun;
+
+typedef struct BatchImage {
+    BatchRun* run;
+    char*     source;
+    size_t    index;
+} BatchImage;
+
+#pragma mark Sources
+
+static void batch_add_source(char*** sources, size_t* count, const char* source)
+{
+    SREALLOC(*sources, (*count + 1) * sizeof(char*));
+    (*sources)[(*count)++] = strdup(source);
+}
+
+// Expands shell patterns (for patterns too long for the shell) and @file lists of sources, one per line.
+static int batch_expand_source(char*** sources, size_t* count, const char* source)
+{
+    if (source[0] == '@') {
+        FILE*   fp     = fopen(&source[1], "r");
+        char*   line   = NULL;
+        size_t  size   = 0;
+        ssize_t length = 0;
+
+        if (fp == NULL) return -1;
+
+        while ( (length = getline(&line, &size, fp)) > 0 ) {
+            while (length && ((line[length - 1] == '\n') || (line[length - 1] == '\r'))) line[--length] = '\0';
+            if ((length == 0) || (line[0] == '#')) continue;
+            batch_add_source(sources, count, line);
+        }
+
+        SFREE(line);
+        fclose(fp);
+        return 0;
+    }
+
+    glob_t matches = {0};
+    if (glob(source, GLOB_NOCHECK, NULL, &matches) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < matches.gl_pathc; i++)
+        batch_add_source(sources, count, matches.gl_pathv[i]);
+
+    globfree(&matches);
+    return 0;
+}
+
+#pragma mark Export
+
+static int batch_export_fork(const HFSPlus* hfs, HFSPlusForkData forkData, bt_nodeid_t cnid, const char* dir, const char* name)
+{
+    HFSPlusFork* fork            = NULL;
+    char*        buffer          = NULL;
+    char         path[PATH_MAX]  = "";
+    int          fd              = -1;
+    int          result          = -1;
+
+    if (forkData.logicalSize == 0) return 0;
+
+    (void)snprintf(path, PATH_MAX, "%s/%s", dir, name);
+
+    if ( hfsfork_make(&fork, hfs, forkData, HFSDataForkType, cnid) < 0 ) return -1;
+    if ( (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 ) goto OUT;
+
+    SALLOC(buffer, BATCH_COPY_SIZE);
+
+    for (size_t offset = 0; offset < fork->logicalSize; ) {
+        size_t  size  = MIN(BATCH_COPY_SIZE, fork->logicalSize - offset);
+        ssize_t bytes = hfs_read_fork_range(buffer, fork, size, offset);
+        if (bytes <= 0) goto OUT;
+
+        for (ssize_t written = 0, n = 0; written < bytes; written += n) {
+            if ( (n = write(fd, buffer + written, bytes - written)) < 0 ) goto OUT;
+        }
+        offset += bytes;
+    }
+    result = 1;
+
+OUT:
+    if (fd >= 0) close(fd);
+    SFREE(buffer);
+    hfsfork_free(fork);
+    return result;
+}
+
+// Writes the same files as -y to their own directory; returns the number written, or -1.
+static int batch_export(const HFSPlus* hfs, const char* dir)
+{
+    int   files  = 0;
+    int   result = 0;
+    char* buffer = NULL;
+    char  path[PATH_MAX] = "";
+
+    if ((mkdir(dir, 0777) < 0) && (errno != EEXIST)) return -1;
+
+    // Volume header blocks; a standard volume's reads start past its MDB, so take them from the volume it was opened on.
+    Volume* vol  = (hfs_is_standard(hfs) ? hfs->vol->parent_partition : hfs->vol);
+    size_t  size = vol->sector_size * 16;
+    SALLOC(buffer, size);
+    (void)snprintf(path, PATH_MAX, "%s/header.block", dir);
+
+    FILE*  fp   = NULL;
+    if ((vol_read(vol, buffer, size, 0) < 0) || ((fp = fopen(path, "w")) == NULL)) {
+        SFREE(buffer);
+        return -1;
+    }
+    (void)fwrite(buffer, 1, size, fp);
+    fclose(fp);
+    SFREE(buffer);
+    files++;
+
+    const struct {
+        HFSPlusForkData forkData;
+        bt_nodeid_t     cnid;
+        const char*     name;
+    } special[] = {
+        { hfs->vh.extentsFile,    kHFSExtentsFileID,    "extents.btree" },
+        { hfs->vh.catalogFile,    kHFSCatalogFileID,    "catalog.btree" },
+        { hfs->vh.allocationFile, kHFSAllocationFileID, "allocation.bmap" },
+        { hfs->vh.startupFile,    kHFSStartupFileID,    "startupFile" },
+        { hfs->vh.attributesFile, kHFSAttributesFileID, "attributes.btree" },
+    };
+
+    for (unsigned i = 0; i < (sizeof(special) / sizeof(special[0])); i++) {
+        if ( (result = batch_export_fork(hfs, special[i].forkData, special[i].cnid, dir, special[i].name)) < 0 ) return -1;
+        files += result;
+    }
+
+    const struct {
+        const char* path;
+        const char* name;
+    } named[] = {
+        { "/.hotfiles.btree",     "hotfiles.btree" },
+        { "/.journal_info_block", "journal.block" },
+        { "/.journal",            "journal.buf" },
+    };
+
+    for (unsigned i = 0; i < (sizeof(named) / sizeof(named[0])); i++) {
+        HFSPlusCatalogRecord record = {0};
+        if ( HFSPlusGetCatalogInfoByPath(NULL, &record, named[i].path, hfs) < 0 ) continue;
+        if ( (result = batch_export_fork(hfs, record.catalogFile.dataFork, record.catalogFile.fileID, dir, named[i].name)) < 0 ) return -1;
+        files += result;
+    }
+
+    return files;
+}
+
+#pragma mark Jobs
+
+static void batch_volume_json(FILE* fp, const HFSPlus* hfs)
+{
+    hfs_str name = "";
+    (void)HFSPlusGetCNIDName(&name, (FSSpec){ .hfs = hfs, .parentID = kHFSRootFolderID });
+
+    fputs(",\n  \"volume\": {\"name\": ", fp);
+    PrintJSONString(fp, (char*)name);
+    fprintf(fp, ", \"signature\": \"%s\"", (hfs->vh.signature == kHFSXSigWord ? "HX" : (hfs->vh.signature == kHFSSigWord ? "BD" : "H+")));
+    fprintf(fp, ", \"blockSize\": %u, \"totalBlocks\": %u, \"freeBlocks\": %u",
+            hfs->vh.blockSize, hfs->vh.totalBlocks, hfs->vh.freeBlocks);
+    fprintf(fp, ", \"fileCount\": %u, \"folderCount\": %u}", hfs->vh.fileCount, hfs->vh.folderCount);
+}
+
+static void batch_image(void* context)
+{
+    BatchImage*    image    = context;
+    BatchRun*      run      = image->run;
+    HIOptions      options  = *run->options;
+    HFSPlus*       hfs      = NULL;
+    Volume*        vol      = NULL;
+    Volume*        fs       = NULL;
+    BTreePtr       tree     = NULL;
+    const char*    failed   = NULL;         // What went wrong, if anything
+    int            error    = 0;            // And the errno that went with it
+    int            problems = 0;
+    char*          text     = NULL;
+    size_t         length   = 0;
+    FILE*          fp       = open_memstream(&text, &length);
+    struct timeval started  = {0}, finished = {0};
+
+    gettimeofday(&started, NULL);
+
+    SALLOC(hfs, sizeof(struct HFSPlus));
+    options.hfs   = hfs;
+    options.quiet = true;
+
+    fputs("{\"source\": ", fp);
+    PrintJSONString(fp, image->source);
+    fprintf(fp, ", \"index\": %zu", image->index);
+
+    if ( (vol = vol_qopen(image->source)) == NULL )                     { failed = "could not open the source"; error = errno; goto DONE; }
+    if (volumes_load(vol) < 0)                                          { failed = "could not read the partition map"; error = errno; goto DONE; }
+    if ( (fs = hfsplus_find(vol)) == NULL )                             { failed = "no HFS+ filesystem found"; goto DONE; }
+    if (hfs_open(hfs, fs) < 0)                                          { failed = "could not open the filesystem"; error = errno; fs = NULL; goto DONE; }
+
+    hfs->node_cache_size = run->cacheSize;
+    hfs->threads         = 1;
+    hfs->queue_depth     = options.queue_depth;
+
+    if ((hfsplus_get_extents_btree(&tree, hfs) < 0) || (hfsplus_get_catalog_btree(&tree, hfs) < 0)) {
+        failed = "could not load the catalog and extents B-trees";
+        error  = errno;
+        goto DONE;
+    }
+
+    batch_volume_json(fp, hfs);
+
+    if (check_mode(&options, HIModeShowSummary)) {
+        VolumeSummary summary = {0};
+        if (generateVolumeSummary(&summary, &options) < 0) {
+            failed = "could not summarize the catalog";
+            error  = errno;
+            goto DONE;
+        }
+
+        fputs(",\n  \"summary\": ", fp);
+        PrintVolumeSummaryJSON(fp, hfs, &summary);
+        freeVolumeSummary(&summary);
+        fseeko(fp, -1, SEEK_CUR);           // Drop the summary's trailing newline
+    }
+
+    if (check_mode(&options, HIModeVerifyBTree)) {
+        if ((problems = verifyBTrees(&options)) < 0) {
+            failed   = "could not verify the B-trees";
+            error    = errno;
+            problems = 0;
+            goto DONE;
+        }
+
+        fprintf(fp, ",\n  \"verify\": {\"problems\": %d}", problems);
+    }
+
+    if (check_mode(&options, HIModeYankFS)) {
+        char dir[PATH_MAX] = "";
+        char base[PATH_MAX] = "";
+        (void)strlcpy(base, image->source, PATH_MAX);
+        if (snprintf(dir, PATH_MAX, "%s/%04zu-%s", options.extract_path, image->index, basename(base)) >= PATH_MAX) {
+            failed = "export path is too long";
+            error  = ENAMETOOLONG;
+            goto DONE;
+        }
+
+        int  files          = batch_export(hfs, dir);
+        fputs(",\n  \"export\": {\"path\": ", fp);
+        PrintJSONString(fp, dir);
+        fprintf(fp, ", \"files\": %d}", MAX(files, 0));
+        if (files < 0) { failed = "could not export the metadata files"; error = errno; }
+    }
+
+DONE:
+    if (failed != NULL) {
+        char message[256] = "";
+        if (error) (void)snprintf(message, sizeof(message), "%s: %s", failed, strerror(error));
+        else (void)strlcpy(message, failed, sizeof(message));
+
+        fputs(",\n  \"status\": \"error\", \"error\": ", fp);
+        PrintJSONString(fp, message);
+    } else {
+        fputs(",\n  \"status\": \"ok\"", fp);
+    }
+
+    // Closing the filesystem closes its partition; the rest of the source goes with its root.
+    if (fs != NULL)  hfs_close(hfs);
+    if ((vol != NULL) && (vol != fs)) vol_close(vol);
+    SFREE(hfs);
+
+    gettimeofday(&finished, NULL);
+    double seconds = (finished.tv_sec - started.tv_sec) + ((finished.tv_usec - started.tv_usec) / 1000000.);
+    fprintf(fp, ", \"seconds\": %0.3f}", seconds);
+    fclose(fp);
+
+    pthread_mutex_lock(&run->lock);
+    fputs((run->emitted++ ? ",\n" : "[\n"), stdout);
+    fwrite(text, 1, length, stdout);
+    fflush(stdout);
+    if ((failed != NULL) || (problems > 0)) run->failures++;
+    pthread_mutex_unlock(&run->lock);
+
+    free(text);
+    SFREE(image->source);
+    SFREE(image);
+}
+
+#pragma mark Driver
+
+int runBatch(HIOptions* options, int argc, char* const* argv)
+{
+    char**     sources = NULL;
+    size_t     count   = 0;
+    BatchRun   run     = { .options = options };
+    WorkQueue* queue   = NULL;
+
+    if (options->device_path[0] != '\0') batch_add_source(&sources, &count, options->device_path);
+
+    for (int i = 0; i < argc; i++) {
+        if (batch_expand_source(&sources, &count, argv[i]) < 0) die(1, "Could not read the source list %s", argv[i]);
+    }
+    if (count == 0) die(1, "No sources given for --batch.");
+
+    if (check_mode(options, HIModeYankFS) && (mkdir(options->extract_path, 0777) < 0) && (errno != EEXIST))
+        die(1, "Could not create %s", options->extract_path);
+
+    if ((queue = workqueue_make(options->batch_threads)) == NULL)
+        die(1, "Could not start batch threads.");
+
+    // Every worker may have a volume open at once; each gets an equal share of the budget.
+    run.cacheSize = options->memory_budget / workqueue_threads(queue);
+    pthread_mutex_init(&run.lock, NULL);
+
+    for (size_t i = 0; i < count; i++) {
+        BatchImage* image = NULL;
+        SALLOC(image, sizeof(BatchImage));
+        image->run    = &run;
+        image->source = sources[i];
+        image->index  = i;
+        workqueue_add(queue, batch_image, image);
+    }
+
+    workqueue_free(queue);
+    fputs((run.emitted ? "\n]\n" : "[]\n"), stdout);
+
+    pthread_mutex_destroy(&run.lock);
+    SFREE(sources);
+
+    return (int)run.failures;
+}
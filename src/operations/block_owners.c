@@ -0,0 +1,391 @@
+//
+//  block_owners.c
+//  hfsinspect
+//
+//
+
+#include <ctype.h>              // isspace
+
+#include "operations.h"
+
+/*
+   Answers "who owns block N" for many blocks at once.
+
+   The reverse map is every extent on the volume (see collectExtentOwners) sorted by physical
+   start. Extents normally never overlap, but a damaged volume can have two owners for one
+   block, so a running maximum of the extent ends rides alongside the array: a lookup binary
+   searches for the last extent starting before the query ends, then steps back only while
+   earlier extents can still reach it.
+
+   Building the map means reading the whole catalog, extents and attributes trees. It can be
+   saved to a sidecar file and reused for as long as the volume has not been written to.
+ */
+
+#define BLOCK_INDEX_SIGNATURE "HIBLKMAP"
+#define BLOCK_INDEX_VERSION   1
+
+// Sidecar file header, followed by `count` ExtentOwner entries in host byte order.
+typedef struct BlockIndexHeader {
+    char     signature[8];
+    uint32_t version;
+    uint32_t entrySize;         // sizeof(ExtentOwner)
+    uint32_t blockSize;
+    uint32_t totalBlocks;
+    uint32_t createDate;        // These identify the volume and its state when the index was built.
+    uint32_t modifyDate;
+    uint32_t writeCount;
+    uint32_t _reserved;
+    uint64_t count;
+} BlockIndexHeader;
+
+typedef struct BlockIndex {
+    ExtentOwner* owners;        // Sorted by startBlock
+    uint64_t*    maxEnd;        // maxEnd[i]: largest extent end among owners[0...i]
+    size_t       count;
+} BlockIndex;
+
+#pragma mark Index
+
+static int compare_owners_physical(const void* a, const void* b)
+{
+    const ExtentOwner* A = a;
+    const ExtentOwner* B = b;
+    int                result;
+
+    if ((result = cmp(A->startBlock, B->startBlock)) != 0) return result;
+    if ((result = cmp(A->cnid, B->cnid)) != 0) return result;
+    return cmp(A->kind, B->kind);
+}
+
+static void block_index_header(BlockIndexHeader* header, const HFSPlus* hfs, uint64_t count)
+{
+    *header = (BlockIndexHeader){
+        .version     = BLOCK_INDEX_VERSION,
+        .entrySize   = sizeof(ExtentOwner),
+        .blockSize   = hfs->vh.blockSize,
+        .totalBlocks = hfs->vh.totalBlocks,
+        .createDate  = hfs->vh.createDate,
+        .modifyDate  = hfs->vh.modifyDate,
+        .writeCount  = hfs->vh.writeCount,
+        .count       = count,
+    };
+    memcpy(header->signature, BLOCK_INDEX_SIGNATURE, sizeof(header->signature));
+}
+
+// Loads a sidecar if it exists and describes the volume as it is now. Returns 1 if loaded, 0 if missing or stale, -1 on error.
+static int block_index_load(BlockIndex* index, const HFSPlus* hfs, const char* path)
+{
+    BlockIndexHeader expected = {0}, header = {0};
+    FILE*            fp       = NULL;
+    struct stat      st       = {0};
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        if (errno == ENOENT) return 0;
+        return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1) {
+        fclose(fp);
+        info("Block index %s is truncated; rebuilding.", path);
+        return 0;
+    }
+
+    block_index_header(&expected, hfs, header.count);
+    if (memcmp(&header, &expected, sizeof(header)) != 0) {
+        fclose(fp);
+        info("Block index %s is out of date; rebuilding.", path);
+        return 0;
+    }
+
+    // The entries must fill the rest of the file exactly; don't size an allocation from a damaged count.
+    if ((fstat(fileno(fp), &st) < 0) || (st.st_size < (off_t)sizeof(header)) ||
+        (header.count != ((uint64_t)st.st_size - sizeof(header)) / sizeof(ExtentOwner)) ||
+        (((uint64_t)st.st_size - sizeof(header)) % sizeof(ExtentOwner) != 0)) {
+        fclose(fp);
+        info("Block index %s is the wrong size for its entries; rebuilding.", path);
+        return 0;
+    }
+
+    SALLOC(index->owners, MAX(header.count, 1) * sizeof(ExtentOwner));
+    if (fread(index->owners, sizeof(ExtentOwner), header.count, fp) != header.count) {
+        fclose(fp);
+        SFREE(index->owners);
+        info("Block index %s is truncated; rebuilding.", path);
+        return 0;
+    }
+    fclose(fp);
+
+    index->count = header.count;
+    return 1;
+}
+
+// Writes the sidecar next to its final name and renames it into place, so readers never see half a file.
+static int block_index_save(const BlockIndex* index, const HFSPlus* hfs, const char* path)
+{
+    BlockIndexHeader header          = {0};
+    char             temp[PATH_MAX]  = "";
+    FILE*            fp              = NULL;
+
+    (void)snprintf(temp, PATH_MAX, "%s.tmp", path);
+    if ((fp = fopen(temp, "wb")) == NULL) return -1;
+
+    block_index_header(&header, hfs, index->count);
+    if ((fwrite(&header, sizeof(header), 1, fp) != 1) ||
+        (fwrite(index->owners, sizeof(ExtentOwner), index->count, fp) != index->count)) {
+        fclose(fp);
+        (void)unlink(temp);
+        return -1;
+    }
+
+    if (fclose(fp) != 0) { (void)unlink(temp); return -1; }
+    if (rename(temp, path) < 0) { (void)unlink(temp); return -1; }
+
+    return 0;
+}
+
+static void block_index_prepare(BlockIndex* index)
+{
+    uint64_t maxEnd = 0;
+
+    SALLOC(index->maxEnd, MAX(index->count, 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < index->count; i++) {
+        maxEnd           = MAX(maxEnd, (uint64_t)index->owners[i].startBlock + index->owners[i].blockCount);
+        index->maxEnd[i] = maxEnd;
+    }
+}
+
+static void block_index_free(BlockIndex* index)
+{
+    SFREE(index->owners);
+    SFREE(index->maxEnd);
+}
+
+// Collects the owners overlapping [start, end) into `found`, ordered by physical start. Returns the number found.
+static size_t block_index_lookup(const BlockIndex* index, uint64_t start, uint64_t end, const ExtentOwner*** found, size_t* capacity)
+{
+    size_t lo = 0, hi = index->count, count = 0;
+
+    // First extent starting at or after the end of the query.
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index->owners[mid].startBlock < end) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (size_t i = lo; (i > 0) && (index->maxEnd[i - 1] > start); i--) {
+        const ExtentOwner* owner = &index->owners[i - 1];
+        if (((uint64_t)owner->startBlock + owner->blockCount) <= start) continue;
+
+        if (count == *capacity) {
+            *capacity = (*capacity ? *capacity * 2 : 16);
+            SREALLOC(*found, *capacity * sizeof(ExtentOwner*));
+        }
+        (*found)[count++] = owner;
+    }
+
+    // Found back to front; put them in physical order.
+    for (size_t i = 0; i < count / 2; i++) {
+        const ExtentOwner* swap = (*found)[i];
+        (*found)[i]             = (*found)[count - 1 - i];
+        (*found)[count - 1 - i] = swap;
+    }
+
+    return count;
+}
+
+#pragma mark Queries
+
+static const char* block_owner_name(char* name, size_t length, const HFSPlus* hfs, const ExtentOwner* owner)
+{
+    static const char* special[] = {
+        [kHFSExtentsFileID]       = "Extents B-Tree",
+        [kHFSCatalogFileID]       = "Catalog B-Tree",
+        [kHFSBadBlockFileID]      = "Bad Blocks File",
+        [kHFSAllocationFileID]    = "Allocation File",
+        [kHFSStartupFileID]       = "Startup File",
+        [kHFSAttributesFileID]    = "Attributes B-Tree",
+        [kHFSRepairCatalogFileID] = "Repair Catalog File",
+        [kHFSBogusExtentFileID]   = "Bogus Extent File",
+    };
+
+    if (owner->kind == ExtentOwnerReserved) return "Volume Header";
+
+    if (owner->cnid < kHFSFirstUserCatalogNodeID) {
+        if ((owner->cnid < (sizeof(special) / sizeof(special[0]))) && special[owner->cnid]) return special[owner->cnid];
+        return "?";
+    }
+
+    hfs_str str = "";
+    if (HFSPlusGetCNIDName(&str, (FSSpec){ .hfs = hfs, .parentID = owner->cnid }) < 0) return "?";
+    (void)strlcpy(name, (char*)str, length);
+    return name;
+}
+
+static void block_print_range(char* out, size_t length, uint64_t start, uint64_t end)
+{
+    if (end - start == 1)
+        (void)snprintf(out, length, "%llu", (unsigned long long)start);
+    else
+        (void)snprintf(out, length, "%llu-%llu", (unsigned long long)start, (unsigned long long)(end - 1));
+}
+
+static void block_query(out_ctx* ctx, const HFSPlus* hfs, const BlockIndex* index, uint64_t start, uint64_t end, const ExtentOwner*** found, size_t* capacity)
+{
+    char   range[48] = "";
+    size_t count     = block_index_lookup(index, start, end, found, capacity);
+
+    // Walk the query, printing owned pieces and the gaps between them.
+    uint64_t position = start;
+    for (size_t i = 0; i < count; i++) {
+        const ExtentOwner* owner      = (*found)[i];
+        uint64_t           pieceStart = MAX(start, owner->startBlock);
+        uint64_t           pieceEnd   = MIN(end, (uint64_t)owner->startBlock + owner->blockCount);
+        uint64_t           offset     = ((uint64_t)owner->logicalBlock + (pieceStart - owner->startBlock)) * hfs->block_size;
+        char               name[PATH_MAX] = "";
+
+        if (pieceStart > position) {
+            block_print_range(range, sizeof(range), position, pieceStart);
+            Print(ctx, "%-24s %-10s %-13s %-16s %s", range, "-", "-", "-", "(unowned)");
+        }
+
+        block_print_range(range, sizeof(range), pieceStart, pieceEnd);
+        Print(ctx, "%-24s %-10u %-13s %-16llu %s", range, owner->cnid, ExtentOwnerKindName(owner->kind), offset,
+              block_owner_name(name, PATH_MAX, hfs, owner));
+
+        position = MAX(position, pieceEnd);
+    }
+
+    if (position < end) {
+        block_print_range(range, sizeof(range), position, end);
+        Print(ctx, "%-24s %-10s %-13s %-16s %s", range, "-", "-", "-", "(unowned)");
+    }
+}
+
+// Reads a block list: numbers or ranges (first-last) separated by commas or whitespace.
+static int block_parse_list(const char* list, uint64_t totalBlocks, uint64_t** ranges, size_t* count)
+{
+    size_t      capacity = 0;
+    const char* p        = list;
+
+    *count = 0;
+
+    while (*p) {
+        char*              next  = NULL;
+        unsigned long long first = 0, last = 0;
+
+        if (isspace((unsigned char)*p) || (*p == ',')) { p++; continue; }
+
+        first = strtoull(p, &next, 0);
+        if (next == p) { errno = EINVAL; return -1; }
+        last  = first;
+        p     = next;
+
+        if (*p == '-') {
+            p++;
+            last = strtoull(p, &next, 0);
+            if ((next == p) || (last < first)) { errno = EINVAL; return -1; }
+            p = next;
+        }
+
+        if ((*p != '\0') && (*p != ',') && !isspace((unsigned char)*p)) { errno = EINVAL; return -1; }
+
+        if (first >= totalBlocks) {
+            warning("Block %llu is past the end of the volume (%llu blocks).", (unsigned long long)first, (unsigned long long)totalBlocks);
+            continue;
+        }
+        last = MIN(last, totalBlocks - 1);
+
+        if (*count == capacity) {
+            capacity = (capacity ? capacity * 2 : 64);
+            SREALLOC(*ranges, capacity * 2 * sizeof(uint64_t));
+        }
+        (*ranges)[(*count * 2)]     = first;
+        (*ranges)[(*count * 2) + 1] = last + 1;
+        (*count)++;
+    }
+
+    return 0;
+}
+
+// A list of "-" is read from stdin and "@path" from a file; anything else is the list itself.
+static char* block_read_list(const char* list)
+{
+    FILE*  fp       = NULL;
+    char*  buffer   = NULL;
+    size_t length   = 0;
+    size_t capacity = 0;
+
+    if (strcmp(list, "-") == 0) fp = stdin;
+    else if (list[0] == '@') fp = fopen(list + 1, "r");
+    else return strdup(list);
+
+    if (fp == NULL) return NULL;
+
+    do {
+        if (capacity - length < 4096) {
+            capacity = (capacity ? capacity * 2 : 65536);
+            SREALLOC(buffer, capacity);
+        }
+        length += fread(buffer + length, 1, capacity - length - 1, fp);
+    } while (!feof(fp) && !ferror(fp));
+    buffer[length] = '\0';
+
+    if (fp != stdin) fclose(fp);
+
+    return buffer;
+}
+
+void showBlockOwners(HIOptions* options)
+{
+    HFSPlus*   hfs    = options->hfs;
+    out_ctx*   ctx    = hfs->vol->ctx;
+    BlockIndex index  = {0};
+    int        loaded = 0;
+
+    if (options->block_index_path[0] != '\0') {
+        if ((loaded = block_index_load(&index, hfs, options->block_index_path)) < 0)
+            die(errno, "Could not read the block index %s", options->block_index_path);
+    }
+
+    if (!loaded) {
+        if (collectExtentOwners(hfs, &index.owners, &index.count) < 0)
+            die(1, "Could not collect the volume's extents.");
+        qsort(index.owners, index.count, sizeof(ExtentOwner), compare_owners_physical);
+
+        if (options->block_index_path[0] != '\0') {
+            if (block_index_save(&index, hfs, options->block_index_path) < 0)
+                error("Could not write the block index %s: %s", options->block_index_path, strerror(errno));
+            else
+                info("Saved a block index of %zu extents to %s.", index.count, options->block_index_path);
+        }
+    }
+
+    block_index_prepare(&index);
+
+    if (options->block_list != NULL) {
+        char*     list   = NULL;
+        uint64_t* ranges = NULL;
+        size_t    count  = 0;
+
+        if ((list = block_read_list(options->block_list)) == NULL)
+            die(errno, "Could not read the block list %s", options->block_list);
+        if (block_parse_list(list, hfs->vh.totalBlocks, &ranges, &count) < 0)
+            die(1, "Could not parse the block list; expected numbers or ranges (first-last) separated by commas or spaces.");
+
+        const ExtentOwner** found    = NULL;
+        size_t              capacity = 0;
+
+        BeginSection(ctx, "Block Owners");
+        Print(ctx, "%-24s %-10s %-13s %-16s %s", "Blocks", "CNID", "Fork", "Offset", "Name");
+        for (size_t i = 0; i < count; i++)
+            block_query(ctx, hfs, &index, ranges[i * 2], ranges[(i * 2) + 1], &found, &capacity);
+        EndSection(ctx);
+
+        SFREE(found);
+        SFREE(ranges);
+        SFREE(list);
+    }
+
+    block_index_free(&index);
+}
+
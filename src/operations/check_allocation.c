@@ -0,0 +1,374 @@
+//
+//  check_allocation.c
+//  hfsinspect
+//
+//
+
+#include <sys/time.h>           // gettimeofday
+
+#include "operations.h"
+#include "volumes/workqueue.h"
+
+/*
+   Cross-checks the allocation file against the extents that actually claim blocks:
+
+   1. Every extent on the volume is collected with its owner (see collectExtentOwners).
+   2. Slices of that list are painted into an owner bitmap on the work queue. The bitmap uses
+      the allocation file's layout (one bit per block, most significant bit first) and is split
+      into chunks that are only allocated once something lands in them, so a 2^32-block volume
+      costs memory in proportion to what is in use. Bits are set atomically; a bit that was
+      already set also goes into a second, equally sparse, conflict bitmap.
+   3. The owner bitmap is compared with the allocation file 64 bits at a time. Only words
+      that differ (or have conflicts) are looked at block by block, yielding runs of blocks
+      that are in use but owned by nothing (leaked), owned but marked free, or owned twice.
+   4. The extents touching each reported run are looked up once more to name their owners.
+ */
+
+#define CHECK_CHUNK_BLOCKS  (1u << 21)                  // Blocks per bitmap chunk (256 KiB of bitmap)
+#define CHECK_CHUNK_BYTES   (CHECK_CHUNK_BLOCKS / 8)
+#define CHECK_SLICE_EXTENTS 65536                       // Extents handed to a worker at once
+#define CHECK_MAX_REPORTED  100                         // Runs printed per kind of problem
+#define CHECK_RUN_OWNERS    4                           // Owners named per run
+
+typedef enum CheckProblem {
+    CheckLeaked = 0,            // Marked in use, owned by nothing
+    CheckUnallocated,           // Owned, marked free
+    CheckShared,                // Owned more than once
+    CheckProblemCount
+} CheckProblem;
+
+typedef struct BlockMap {
+    uint8_t** chunks;
+    size_t    chunkCount;
+} BlockMap;
+
+typedef struct CheckRun {
+    uint32_t    start;
+    uint32_t    count;
+    uint32_t    ownerCount;     // Distinct owners found; only the first CHECK_RUN_OWNERS are kept
+    uint32_t    _reserved;
+    ExtentOwner owners[CHECK_RUN_OWNERS];
+} CheckRun;
+
+typedef struct CheckRuns {
+    CheckRun  reported[CHECK_MAX_REPORTED];
+    size_t    reportedCount;
+    uint64_t  runs;             // All runs, reported or not
+    uint64_t  blocks;
+    uint32_t  openStart;
+    bool      open;
+    uint8_t   _reserved[3];
+} CheckRuns;
+
+typedef struct CheckSlice {
+    const ExtentOwner* owners;
+    size_t             count;
+    BlockMap*          owned;
+    BlockMap*          conflicts;
+} CheckSlice;
+
+#pragma mark Block Maps
+
+static void block_map_init(BlockMap* map, uint32_t totalBlocks)
+{
+    map->chunkCount = ((uint64_t)totalBlocks + CHECK_CHUNK_BLOCKS - 1) / CHECK_CHUNK_BLOCKS;
+    SALLOC(map->chunks, MAX(map->chunkCount, 1) * sizeof(uint8_t*));
+}
+
+static void block_map_free(BlockMap* map)
+{
+    for (size_t i = 0; i < map->chunkCount; i++) SFREE(map->chunks[i]);
+    SFREE(map->chunks);
+}
+
+// Returns the chunk holding `block`, allocating it if this is the first bit set there.
+static uint8_t* block_map_chunk(BlockMap* map, uint32_t block)
+{
+    uint8_t** slot  = &map->chunks[block / CHECK_CHUNK_BLOCKS];
+    uint8_t*  chunk = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    if (chunk == NULL) {
+        uint8_t* fresh = NULL;
+        SALLOC(fresh, CHECK_CHUNK_BYTES);
+        if (__atomic_compare_exchange_n(slot, &chunk, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            chunk = fresh;
+        else
+            SFREE(fresh);   // Another worker got there first; `chunk` now holds theirs.
+    }
+
+    return chunk;
+}
+
+// Sets the bits for [start, start + count) and returns the bits that were already set, per byte, via `conflicts`.
+static void block_map_set(BlockMap* map, BlockMap* conflicts, uint32_t start, uint32_t count)
+{
+    uint64_t block = start;
+    uint64_t end   = (uint64_t)start + count;
+
+    while (block < end) {
+        uint8_t* chunk  = block_map_chunk(map, (uint32_t)block);
+        uint64_t offset = block % CHECK_CHUNK_BLOCKS;
+        uint64_t stop   = MIN(end, block - offset + CHECK_CHUNK_BLOCKS);
+
+        while (block < stop) {
+            unsigned bit  = block % 8;
+            unsigned bits = (unsigned)MIN(8 - bit, stop - block);
+            uint8_t  mask = (uint8_t)((0xFF >> bit) & (0xFF << (8 - bit - bits)));
+            uint8_t* byte = &chunk[(block % CHECK_CHUNK_BLOCKS) / 8];
+            uint8_t  old  = __atomic_fetch_or(byte, mask, __ATOMIC_RELAXED);
+
+            if (old & mask) {
+                uint8_t* other = block_map_chunk(conflicts, (uint32_t)block);
+                __atomic_fetch_or(&other[(block % CHECK_CHUNK_BLOCKS) / 8], (uint8_t)(old & mask), __ATOMIC_RELAXED);
+            }
+
+            block += bits;
+        }
+    }
+}
+
+static bool block_map_test(const BlockMap* map, uint32_t block)
+{
+    const uint8_t* chunk = map->chunks[block / CHECK_CHUNK_BLOCKS];
+    if (chunk == NULL) return false;
+    return (chunk[(block % CHECK_CHUNK_BLOCKS) / 8] & (0x80 >> (block % 8))) != 0;
+}
+
+// Copies eight bytes of a chunk (or zeros for a chunk never touched).
+static uint64_t block_map_word(const BlockMap* map, size_t chunk, size_t offset)
+{
+    uint64_t word = 0;
+    if (map->chunks[chunk] != NULL) memcpy(&word, map->chunks[chunk] + offset, sizeof(word));
+    return word;
+}
+
+static void check_fill(void* context)
+{
+    CheckSlice* slice = context;
+
+    for (size_t i = 0; i < slice->count; i++)
+        block_map_set(slice->owned, slice->conflicts, slice->owners[i].startBlock, slice->owners[i].blockCount);
+}
+
+#pragma mark Runs
+
+static void check_run_extend(CheckRuns* runs, uint32_t block, bool hit)
+{
+    if (hit) {
+        if (!runs->open) { runs->open = true; runs->openStart = block; }
+        runs->blocks++;
+        return;
+    }
+
+    if (!runs->open) return;
+
+    runs->open = false;
+    runs->runs++;
+    if (runs->reportedCount < CHECK_MAX_REPORTED)
+        runs->reported[runs->reportedCount++] = (CheckRun){ .start = runs->openStart, .count = block - runs->openStart };
+}
+
+static void check_run_add_owner(CheckRun* run, const ExtentOwner* owner)
+{
+    unsigned kept = MIN(run->ownerCount, CHECK_RUN_OWNERS);
+    for (unsigned i = 0; i < kept; i++)
+        if ((run->owners[i].cnid == owner->cnid) && (run->owners[i].kind == owner->kind)) return;
+
+    if (run->ownerCount < CHECK_RUN_OWNERS) run->owners[run->ownerCount] = *owner;
+    run->ownerCount++;
+}
+
+// Names the owners of each reported run. Runs of one kind never overlap and are in block order.
+static void check_name_owners(CheckRuns* runs, const ExtentOwner* owners, size_t count)
+{
+    if (runs->reportedCount == 0) return;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t start = owners[i].startBlock;
+        uint64_t end   = start + owners[i].blockCount;
+
+        // First run ending after this extent starts.
+        size_t lo = 0, hi = runs->reportedCount;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (((uint64_t)runs->reported[mid].start + runs->reported[mid].count) <= start) lo = mid + 1;
+            else hi = mid;
+        }
+
+        for (size_t r = lo; (r < runs->reportedCount) && (runs->reported[r].start < end); r++)
+            check_run_add_owner(&runs->reported[r], &owners[i]);
+    }
+}
+
+static void check_print_runs(out_ctx* ctx, const CheckRuns* runs, const char* label, const char* verb)
+{
+    for (size_t i = 0; i < runs->reportedCount; i++) {
+        const CheckRun* run        = &runs->reported[i];
+        char            names[256] = "";
+
+        for (unsigned o = 0; o < MIN(run->ownerCount, CHECK_RUN_OWNERS); o++) {
+            char name[48] = "";
+            if (run->owners[o].kind == ExtentOwnerReserved)
+                (void)snprintf(name, sizeof(name), "%s%s", (o ? ", " : " "), ExtentOwnerKindName(run->owners[o].kind));
+            else
+                (void)snprintf(name, sizeof(name), "%sCNID %u (%s)", (o ? ", " : " "), run->owners[o].cnid, ExtentOwnerKindName(run->owners[o].kind));
+            (void)strlcat(names, name, sizeof(names));
+        }
+        if (run->ownerCount > CHECK_RUN_OWNERS) {
+            char more[48] = "";
+            (void)snprintf(more, sizeof(more), " and %u more", run->ownerCount - CHECK_RUN_OWNERS);
+            (void)strlcat(names, more, sizeof(names));
+        }
+
+        Print(ctx, "%-12s blocks %u-%u (%u) %s%s", label, run->start, run->start + run->count - 1, run->count, verb, names);
+    }
+
+    if (runs->runs > runs->reportedCount)
+        Print(ctx, "%-12s ... and %llu more run(s)", label, runs->runs - runs->reportedCount);
+}
+
+#pragma mark Check
+
+int checkAllocation(HIOptions* options)
+{
+    HFSPlus*       hfs         = options->hfs;
+    out_ctx*       ctx         = hfs->vol->ctx;
+    uint32_t       totalBlocks = hfs->vh.totalBlocks;
+    ExtentOwner*   owners      = NULL;
+    size_t         ownerCount  = 0;
+    char*          allocation  = NULL;
+    size_t         allocLength = 0;
+    BlockMap       owned       = {0};
+    BlockMap       conflicts   = {0};
+    CheckRuns*     runs        = NULL;
+    uint64_t       problems    = 0;
+    uint64_t       ownedBlocks = 0;
+    uint64_t       usedBlocks  = 0;
+    struct timeval started     = {0}, finished = {0};
+
+    gettimeofday(&started, NULL);
+
+    if ((allocation = readAllocationFile(hfs, &allocLength)) == NULL)
+        die(errno, "error reading allocation file");
+
+    if (collectExtentOwners(hfs, &owners, &ownerCount) < 0)
+        die(1, "Could not collect the volume's extents.");
+
+    SALLOC(runs, CheckProblemCount * sizeof(CheckRuns));
+
+    BeginSection(ctx, "Allocation Check");
+
+    // Extents reaching past the end of the volume are reported and clipped before anything is marked.
+    for (size_t i = 0; i < ownerCount; i++) {
+        ExtentOwner* owner = &owners[i];
+        uint64_t     end   = (uint64_t)owner->startBlock + owner->blockCount;
+        if (end <= totalBlocks) continue;
+
+        Print(ctx, "%-12s CNID %u (%s) extent %u+%u ends %llu block(s) past the end of the volume", "Out of range",
+              owner->cnid, ExtentOwnerKindName(owner->kind), owner->startBlock, owner->blockCount, end - totalBlocks);
+        owner->blockCount = (owner->startBlock < totalBlocks ? totalBlocks - owner->startBlock : 0);
+        problems++;
+    }
+
+    block_map_init(&owned, totalBlocks);
+    block_map_init(&conflicts, totalBlocks);
+
+    WorkQueue* queue   = workqueue_make(hfs->threads);
+    if (queue == NULL) die(1, "Could not start checking threads.");
+    unsigned   threads = workqueue_threads(queue);
+
+    size_t      sliceCount = (ownerCount + CHECK_SLICE_EXTENTS - 1) / CHECK_SLICE_EXTENTS;
+    CheckSlice* slices     = NULL;
+    SALLOC(slices, MAX(sliceCount, 1) * sizeof(CheckSlice));
+    for (size_t i = 0; i < sliceCount; i++) {
+        slices[i] = (CheckSlice){
+            .owners    = &owners[i * CHECK_SLICE_EXTENTS],
+            .count     = MIN(CHECK_SLICE_EXTENTS, ownerCount - (i * CHECK_SLICE_EXTENTS)),
+            .owned     = &owned,
+            .conflicts = &conflicts,
+        };
+        workqueue_add(queue, check_fill, &slices[i]);
+    }
+    workqueue_wait(queue);
+    workqueue_free(queue);
+    SFREE(slices);
+
+    // Walk the volume a word at a time; only words where something disagrees are expanded.
+    for (uint64_t block = 0; block < totalBlocks; block += 64) {
+        size_t   chunk    = block / CHECK_CHUNK_BLOCKS;
+        size_t   offset   = (block % CHECK_CHUNK_BLOCKS) / 8;
+        uint64_t own      = block_map_word(&owned, chunk, offset);
+        uint64_t conflict = block_map_word(&conflicts, chunk, offset);
+        uint64_t alloc    = 0;
+
+        if ((block / 8) < allocLength)
+            memcpy(&alloc, allocation + (block / 8), MIN(sizeof(alloc), allocLength - (block / 8)));
+
+        uint64_t limit = MIN(64, totalBlocks - block);
+        if (limit < 64) {
+            // Bits past the last block are ignored. The words are still in disk byte order, so clear whole bytes and bits within the last.
+            uint8_t bytes[8] = {0};
+            memcpy(bytes, &alloc, 8);
+            for (unsigned b = 0; b < 8; b++) {
+                if ((b * 8) >= limit) bytes[b] = 0;
+                else if ((b * 8 + 8) > limit) bytes[b] &= (uint8_t)(0xFF << (8 - (limit - b * 8)));
+            }
+            memcpy(&alloc, bytes, 8);
+        }
+
+        ownedBlocks += __builtin_popcountll(own);
+        usedBlocks  += __builtin_popcountll(alloc);
+
+        if (((own ^ alloc) | conflict) == 0) {
+            for (unsigned p = 0; p < CheckProblemCount; p++) check_run_extend(&runs[p], (uint32_t)block, false);
+            continue;
+        }
+
+        for (uint64_t b = block; b < block + limit; b++) {
+            bool isOwned  = block_map_test(&owned, (uint32_t)b);
+            bool isUsed   = BTIsBlockUsed(b, allocation, allocLength);
+            bool isShared = block_map_test(&conflicts, (uint32_t)b);
+
+            check_run_extend(&runs[CheckLeaked], (uint32_t)b, (isUsed && !isOwned));
+            check_run_extend(&runs[CheckUnallocated], (uint32_t)b, (isOwned && !isUsed));
+            check_run_extend(&runs[CheckShared], (uint32_t)b, isShared);
+        }
+    }
+    for (unsigned p = 0; p < CheckProblemCount; p++) check_run_extend(&runs[p], totalBlocks, false);
+
+    check_name_owners(&runs[CheckUnallocated], owners, ownerCount);
+    check_name_owners(&runs[CheckShared], owners, ownerCount);
+
+    check_print_runs(ctx, &runs[CheckLeaked], "Leaked", "are marked in use but no fork owns them");
+    check_print_runs(ctx, &runs[CheckUnallocated], "Unallocated", "are marked free but belong to");
+    check_print_runs(ctx, &runs[CheckShared], "Shared", "are claimed more than once by");
+
+    for (unsigned p = 0; p < CheckProblemCount; p++) problems += runs[p].runs;
+
+    gettimeofday(&finished, NULL);
+    double seconds = (finished.tv_sec - started.tv_sec) + ((finished.tv_usec - started.tv_usec) / 1000000.0);
+
+    if (problems) Print(ctx, "%s", "");
+    PrintAttribute(ctx, "Extents", "%zu", ownerCount);
+    _PrintHFSBlocks(ctx, "Allocated Blocks", usedBlocks);
+    _PrintHFSBlocks(ctx, "Owned Blocks", ownedBlocks);
+    _PrintHFSBlocks(ctx, "Leaked Blocks", runs[CheckLeaked].blocks);
+    _PrintHFSBlocks(ctx, "Owned Free Blocks", runs[CheckUnallocated].blocks);
+    _PrintHFSBlocks(ctx, "Shared Blocks", runs[CheckShared].blocks);
+    PrintAttribute(ctx, "Threads", "%u", threads);
+    PrintAttribute(ctx, "Elapsed", "%0.2f seconds", seconds);
+    if (problems)
+        PrintAttribute(ctx, "Result", "%llu problem(s)", problems);
+    else
+        PrintAttribute(ctx, "Result", "OK");
+    EndSection(ctx);
+
+    block_map_free(&owned);
+    block_map_free(&conflicts);
+    SFREE(runs);
+    SFREE(owners);
+    SFREE(allocation);
+
+    return (int)MIN(problems, INT_MAX);
+}
+
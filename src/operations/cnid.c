@@ -37,7 +37,7 @@ void showCatalogRecord(HIOptions* options, FSSpec spec, bool followThreads)
 
         } else {
             if ((type == kHFSPlusFolderThreadRecord) && check_mode(options, HIModeListFolder)) {
-                PrintFolderListing(ctx, spec.parentID);
+                showFolderListing(options, spec.parentID);
             } else {
                 BTreeNodePtr node = NULL; BTRecNum recordID = 0;
                 hfsplus_catalog_find_record(&node, &recordID, spec);
@@ -66,7 +66,7 @@ void showCatalogRecord(HIOptions* options, FSSpec spec, bool followThreads)
 
     } else if (type == kHFSPlusFolderRecord) {
         if (check_mode(options, HIModeListFolder)) {
-            PrintFolderListing(ctx, catalogRecord.catalogFolder.folderID);
+            showFolderListing(options, catalogRecord.catalogFolder.folderID);
         } else {
             BTreeNodePtr node = NULL; BTRecNum recordID = 0;
             hfsplus_catalog_find_record(&node, &recordID, spec);
@@ -6,16 +6,280 @@
 //  Copyright (c) 2014 Adam Knight. All rights reserved.
 //
 
+#include <fcntl.h>
+
+#if defined(__linux__)
+    #include <sys/sendfile.h>
+#endif
+
 #include "operations.h"
+#include "hfs/hfs_extentlist.h"
 
-ssize_t extractFork(const HFSPlusFork* fork, const char* extractPath)
+#pragma mark Direct Copy
+
+static bool buffer_is_zero(const char* buf, size_t length)
+{
+    return (length == 0) || ((buf[0] == 0) && (memcmp(buf, buf + 1, length - 1) == 0));
+}
+
+// Copies `length` bytes between two descriptors at explicit offsets with the cheapest mechanism available. Returns the bytes copied, which is short only at the end of the source, or -1 on error.
+static ssize_t copy_range(int fd_in, off_t off_in, int fd_out, off_t off_out, size_t length)
+{
+    size_t copied = 0;
+
+#if defined(__linux__)
+    // Remembered across calls so an unsupported pair of filesystems only costs one failed syscall.
+    static bool noCopyFileRange = false;
+    static bool noSendfile      = false;
+
+    // In-kernel copy; may share extents (reflink) or offload the copy on filesystems that support it.
+    while (!noCopyFileRange && (copied < length)) {
+        loff_t  in  = off_in + copied;
+        loff_t  out = off_out + copied;
+        ssize_t n   = copy_file_range(fd_in, &in, fd_out, &out, length - copied, 0);
+        if (n > 0) { copied += n; continue; }
+        if (n == 0) return copied;
+        if (errno == EINTR) continue;
+        if ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP) || (errno == EBADF)) {
+            debug("copy_file_range unavailable (%s); trying sendfile", strerror(errno));
+            noCopyFileRange = true;
+            break;
+        }
+        return -1;
+    }
+
+    // sendfile(2) writes at the output's file position, so position it first.
+    if (!noSendfile && (copied < length) && (lseek(fd_out, off_out + copied, SEEK_SET) >= 0)) {
+        while (copied < length) {
+            off_t   in = off_in + copied;
+            ssize_t n  = sendfile(fd_out, fd_in, &in, length - copied);
+            if (n > 0) { copied += n; continue; }
+            if (n == 0) return copied;
+            if (errno == EINTR) continue;
+            if ((errno == ENOSYS) || (errno == EINVAL) || (errno == EOPNOTSUPP)) {
+                debug("sendfile unavailable (%s); using read/write", strerror(errno));
+                noSendfile = true;
+                break;
+            }
+            return -1;
+        }
+    }
+#endif
+
+    // Portable path. Blocks of zeroes are skipped so they become holes in the output.
+    if (copied < length) {
+        size_t chunkSize = 1024*1024;
+        char*  chunk     = NULL;
+        SALLOC(chunk, chunkSize);
+
+        while (copied < length) {
+            ssize_t n = pread(fd_in, chunk, MIN(chunkSize, length - copied), off_in + copied);
+            if ((n < 0) && (errno == EINTR)) continue;
+            if (n < 0) { SFREE(chunk); return -1; }
+            if (n == 0) break;
+
+            if ( !buffer_is_zero(chunk, n) && (pwrite(fd_out, chunk, n, off_out + copied) != n) ) {
+                SFREE(chunk);
+                return -1;
+            }
+            copied += n;
+        }
+
+        SFREE(chunk);
+    }
+
+    return copied;
+}
+
+/*
+   Copies a fork straight from the source image to the output, one extent at a time, bypassing the
+   fork stream and its bounce buffers. Only possible when the volume lives in a regular file without a
+   block map or disk image backend, so that allocation blocks map to fixed file offsets. Logical ranges with no extent and the slack past
+   logicalSize are never written; the final ftruncate leaves them as holes.
+   Returns the bytes copied, or -1 if the caller should fall back to the stream copy.
+ */
+static ssize_t extractForkDirect(const HFSPlusFork* fork, int fd_out, const char* extractPath)
+{
+    const Volume* vol           = fork->hfs->vol;
+    out_ctx*      ctx           = vol->ctx;
+    size_t        blockSize     = fork->hfs->block_size;
+    size_t        totalBytes    = fork->logicalSize;
+    size_t        bytes         = 0;
+    char          totalStr[100] = {0};
+    char          bytesStr[100] = {0};
+
+    if ( !S_ISREG(vol->mode) || (vol->map != NULL) || (vol->source_ops != NULL) || (fork->extents == NULL) ) return -1;
+
+    format_size(ctx, totalStr, totalBytes, 100);
+
+    Extent* e = NULL;
+    TAILQ_FOREACH(e, fork->extents, extents) {
+        size_t logicalStart = e->logicalStart * blockSize;
+        if (logicalStart >= totalBytes) break;
+
+        size_t length       = MIN(e->blockCount * blockSize, totalBytes - logicalStart);
+        off_t  volumeOffset = e->startBlock * blockSize;
+
+        // Same clipping vol_read applies.
+        if (vol->length && ((size_t)volumeOffset >= vol->length)) continue;
+        if (vol->length) length = MIN(length, vol->length - volumeOffset);
+
+        ssize_t copied = copy_range(vol->fd, vol->offset + volumeOffset, fd_out, logicalStart, length);
+        if (copied < 0) {
+            // Nothing is lost by retrying from scratch with the stream copy.
+            warning("direct copy of CNID %u failed: %s", fork->cnid, strerror(errno));
+            return -1;
+        }
+        bytes += copied;
+
+        format_size(ctx, bytesStr, bytes, 100);
+        fprintf(stdout, "\rCopying CNID %u to %s: %s of %s copied                ",
+                fork->cnid,
+                extractPath,
+                bytesStr,
+                totalStr);
+        fflush(stdout);
+    }
+
+    if (ftruncate(fd_out, totalBytes) < 0) {
+        warning("ftruncate: %s", strerror(errno));
+        return -1;
+    }
+
+    return bytes;
+}
+
+#pragma mark Queued Copy
+
+// Bytes of the fork held by reads in flight at once.
+#define kExtractMaxInflight (32 * 1024 * 1024)
+
+typedef struct ExtractCopy {
+    const HFSPlusFork* fork;
+    const char*        extractPath;
+    int                fd_out;
+    bool               failed;
+    uint8_t            _reserved[3];
+    size_t             bytes;
+    char               totalStr[100];
+} ExtractCopy;
+
+typedef struct ExtractChunk {
+    ExtractCopy* copy;
+    void*        buffer;
+    size_t       offset;
+    size_t       length;
+    bool         busy;
+    uint8_t      _reserved[7];
+} ExtractChunk;
+
+static void extract_chunk_landed(void* context, void* buf, ssize_t result)
+{
+    ExtractChunk* chunk          = context;
+    ExtractCopy*  copy           = chunk->copy;
+    char          bytesStr[100]  = {0};
+
+    chunk->busy = false;
+
+    if ((result < 0) || ((size_t)result < chunk->length)) {
+        warning("read of CNID %u at offset %zu failed", copy->fork->cnid, chunk->offset);
+        copy->failed = true;
+        return;
+    }
+
+    // Chunks land in any order; each is written at its own offset.
+    if (pwrite(copy->fd_out, buf, chunk->length, chunk->offset) != (ssize_t)chunk->length) {
+        warning("write to %s failed: %s", copy->extractPath, strerror(errno));
+        copy->failed = true;
+        return;
+    }
+    copy->bytes += chunk->length;
+
+    format_size(copy->fork->hfs->vol->ctx, bytesStr, copy->bytes, 100);
+    fprintf(stdout, "\rCopying CNID %u to %s: %s of %s copied                ",
+            copy->fork->cnid,
+            copy->extractPath,
+            bytesStr,
+            copy->totalStr);
+    fflush(stdout);
+}
+
+/*
+   Copies a fork through the volume, for sources the direct copy can't handle (disk images, mapped
+   volumes, devices). Keeps up to the volume's queue depth of chunk reads in flight, so image chunks
+   expand in parallel and devices see more than one request at a time.
+   A failed read stops new reads from being queued, but the ones already in flight still land and are
+   written before this returns -1. extractFork then truncates the output and copies the whole fork
+   again through the stream, so a failure here costs a second full read of the fork.
+ */
+static ssize_t extractForkQueued(const HFSPlusFork* fork, int fd_out, const char* extractPath)
+{
+    IOEngine*     engine     = NULL;
+    ExtractChunk* chunks     = NULL;
+    ExtractCopy   copy       = { .fork = fork, .fd_out = fd_out, .extractPath = extractPath };
+    size_t        chunkSize  = fork->hfs->block_size*256;    //1-2MB, generally.
+    size_t        totalBytes = fork->logicalSize;
+    unsigned      count      = 0;
+
+    if ((engine = ioengine_make(fork->hfs->queue_depth, kIOEngineAuto)) == NULL) return -1;
+
+    count = MIN(ioengine_depth(engine), MAX(1, kExtractMaxInflight / chunkSize));
+    SALLOC(chunks, count * sizeof(ExtractChunk));
+    for (unsigned i = 0; i < count; i++) {
+        chunks[i].copy = &copy;
+        SALLOC(chunks[i].buffer, chunkSize);
+    }
+
+    format_size(fork->hfs->vol->ctx, copy.totalStr, totalBytes, 100);
+
+    for (size_t offset = 0; (offset < totalBytes) && !copy.failed; offset += chunkSize) {
+        ExtractChunk* chunk = NULL;
+
+        // Take the first idle buffer, waiting for a read to land if they're all busy.
+        while (chunk == NULL) {
+            for (unsigned i = 0; (i < count) && (chunk == NULL); i++)
+                if ( !chunks[i].busy ) chunk = &chunks[i];
+            if (chunk == NULL) ioengine_poll(engine, true);
+        }
+
+        chunk->offset = offset;
+        chunk->length = MIN(chunkSize, totalBytes - offset);
+        chunk->busy   = true;
+
+        if (hfs_read_fork_range_async(engine, chunk->buffer, fork, chunk->length, offset, extract_chunk_landed, chunk) < 0) {
+            chunk->busy = false;
+            copy.failed = true;
+        }
+    }
+
+    ioengine_free(engine);
+
+    for (unsigned i = 0; i < count; i++)
+        SFREE(chunks[i].buffer);
+    SFREE(chunks);
+
+    if (copy.failed) return -1;
+
+    if (ftruncate(fd_out, totalBytes) < 0) {
+        warning("ftruncate: %s", strerror(errno));
+        return -1;
+    }
+
+    return copy.bytes;
+}
+
+#pragma mark Stream Copy
+
+/*
+   Copies a fork through the fork stream with sequential writes. Used for outputs that can't be
+   written at offsets or truncated (pipes, character devices), and when the other copies fail.
+ */
+static ssize_t extractForkStream(const HFSPlusFork* fork, FILE* f_out, const char* extractPath)
 {
-    FILE*    f_out         = NULL;
     FILE*    f_in          = NULL;
-    off_t    offset        = 0;
     size_t   chunkSize     = 0;
     void*    chunk         = NULL;
-    ssize_t  nbytes        = 0;
+    size_t   nbytes        = 0;
     size_t   totalBytes    = 0;
     size_t   bytes         = 0;
     char     totalStr[100] = {0};
@@ -23,18 +287,7 @@ ssize_t extractFork(const HFSPlusFork* fork, const char* extractPath)
 
     out_ctx* ctx           = fork->hfs->vol->ctx;
 
-    set_hfs_volume(fork->hfs);
-
-    Print(ctx, "Extracting CNID %u to %s", fork->cnid, extractPath);
-    PrintHFSPlusForkData(ctx, &fork->forkData, fork->cnid, fork->forkType);
-
-    // Open output stream
-    f_out = fopen(extractPath, "w");
-    if (f_out == NULL) {
-        die(1, "could not open %s", extractPath);
-    }
-
-    f_in       = fopen_hfsfork((HFSPlusFork*)fork);
+    if ( (f_in = fopen_hfsfork((HFSPlusFork*)fork)) == NULL ) return -1;
     fseeko(f_in, 0, SEEK_SET);
 
     chunkSize  = fork->hfs->block_size*256;    //1-2MB, generally.
@@ -61,11 +314,58 @@ ssize_t extractFork(const HFSPlusFork* fork, const char* extractPath)
     SFREE(chunk);
 
     fflush(f_out);
-    fclose(f_out);
     fclose(f_in);
 
+    if (ferror(f_out)) return -1;
+
+    return bytes;
+}
+
+#pragma mark Extraction
+
+ssize_t extractFork(const HFSPlusFork* fork, const char* extractPath)
+{
+    FILE*    f_out         = NULL;
+    ssize_t  nbytes        = -1;
+    struct stat st         = {0};
+
+    out_ctx* ctx           = fork->hfs->vol->ctx;
+
+    set_hfs_volume(fork->hfs);
+
+    Print(ctx, "Extracting CNID %u to %s", fork->cnid, extractPath);
+    PrintHFSPlusForkData(ctx, &fork->forkData, fork->cnid, fork->forkType);
+
+    // Open output stream
+    f_out = fopen(extractPath, "w");
+    if (f_out == NULL) {
+        die(1, "could not open %s", extractPath);
+    }
+
+    // The direct and queued copies write at offsets and truncate, so they need a regular file.
+    // Each failure resets the output and falls through to the next copy; the stream copy is the last resort.
+    if ( (fstat(fileno(f_out), &st) == 0) && S_ISREG(st.st_mode) ) {
+        if ( (nbytes = extractForkDirect(fork, fileno(f_out), extractPath)) < 0 ) {
+            if ( (ftruncate(fileno(f_out), 0) < 0) || (fseeko(f_out, 0, SEEK_SET) < 0) ) {
+                die(1, "could not reset %s", extractPath);
+            }
+            if ( (nbytes = extractForkQueued(fork, fileno(f_out), extractPath)) < 0 )
+                warning("queued copy of CNID %u failed; copying it again through the fork stream", fork->cnid);
+        }
+        if ( (nbytes < 0) && ((ftruncate(fileno(f_out), 0) < 0) || (fseeko(f_out, 0, SEEK_SET) < 0)) ) {
+            die(1, "could not reset %s", extractPath);
+        }
+    }
+
+    if ( (nbytes < 0) && ((nbytes = extractForkStream(fork, f_out, extractPath)) < 0) )
+        warning("stream copy of CNID %u to %s failed", fork->cnid, extractPath);
+
+    fclose(f_out);
+
+    if (nbytes < 0) return -1;
+
     Print(ctx, "\nCopy complete.");
-    return offset;
+    return nbytes;
 }
 
 void extractHFSPlusCatalogFile(const HFSPlus* hfs, const HFSPlusCatalogFile* file, const char* extractPath)
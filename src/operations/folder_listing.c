@@ -0,0 +1,371 @@
+//
+//  folder_listing.c
+//  hfsinspect
+//
+//
+
+#include "operations.h"
+#include "hfs/listing.h"
+#include "volumes/topk.h"
+
+/*
+   Prints a folder's children (-l) from the batches of hfs_listing_next.
+
+   Rows are assembled by hand into an output buffer that is printed once per batch, with
+   sizes in bytes and dates as YYYY-MM-DD, so a listing costs no more per child than the
+   decoding does. Human-readable sizes are only worked out for the totals.
+
+   In name (catalog) order the rows stream straight through. Sorting by size or date needs
+   every match first: with --limit the best N are kept in a bounded heap, otherwise each
+   match is kept as a compact entry (no catalog record) until the end of the folder.
+ */
+
+#define kListingOutputSize (64 * 1024)
+#define kListingRowMax     1024
+
+typedef struct ListingOutput {
+    out_ctx* ctx;
+    char*    buffer;
+    size_t   length;
+} ListingOutput;
+
+typedef struct ListingTotals {
+    uint64_t rows;
+    uint64_t files;
+    uint64_t folders;
+    uint64_t hardLinks;
+    uint64_t symlinks;
+    uint64_t dataForks;
+    uint64_t dataSize;
+    uint64_t rsrcForks;
+    uint64_t rsrcSize;
+} ListingTotals;
+
+typedef struct ListedEntry {
+    HFSListingEntry entry;
+    uint64_t        order;      // Position in catalog order; breaks ties
+    size_t          nameOffset; // Into the name arena, when sorting everything
+} ListedEntry;
+
+typedef struct RankedEntry {
+    ListedEntry listed;
+    char        name[768];      // Room for 255 UTF-16 units as UTF-8
+} RankedEntry;
+
+static const char* kListingHeaderFormat = "%-9s %-10s %-10s %-9s %-9s %15s %15s %-10s %s";
+
+#pragma mark Row Formatting
+
+static char* listing_put(char* p, const char* str, size_t length, size_t width)
+{
+    memcpy(p, str, length);
+    p += length;
+    while (length++ < width) *p++ = ' ';
+    return p;
+}
+
+static char* listing_put_uint(char* p, uint64_t value, size_t width, bool right)
+{
+    char   digits[20];
+    size_t count = 0;
+
+    do {
+        digits[count++] = '0' + (value % 10);
+        value          /= 10;
+    } while (value);
+
+    if (right) for (size_t i = count; i < width; i++) *p++ = ' ';
+    for (size_t i = count; i > 0; i--) *p++ = digits[i - 1];
+    if ( !right) for (size_t i = count; i < width; i++) *p++ = ' ';
+
+    return p;
+}
+
+static char* listing_put_mode(char* p, uint16_t mode, uint8_t kind)
+{
+    static const char types[16] = "?pc?d?b?-?l?s?w?";
+    static const char rwx[9]    = "rwxrwxrwx";
+
+    if ((mode & S_IFMT) == 0)
+        *p++ = (kind == HFSListingFolder ? 'd' : '-');
+    else
+        *p++ = types[(mode & S_IFMT) >> 12];
+
+    for (unsigned i = 0; i < 9; i++) p[i] = (mode & (0400 >> i)) ? rwx[i] : '-';
+
+    if (mode & S_ISUID) p[2] = (mode & S_IXUSR) ? 's' : 'S';
+    if (mode & S_ISGID) p[5] = (mode & S_IXGRP) ? 's' : 'S';
+    if (mode & S_ISVTX) p[8] = (mode & S_IXOTH) ? 't' : 'T';
+
+    return p + 9;
+}
+
+// YYYY-MM-DD from an HFS timestamp, using the proleptic Gregorian day count rather than gmtime.
+static char* listing_put_date(char* p, uint32_t hfsTime)
+{
+    if (hfsTime < MAC_GMT_FACTOR) return listing_put(p, "-", 1, 10);
+
+    int64_t  days = (int64_t)(hfsTime - MAC_GMT_FACTOR) / 86400 + 719468;
+    int64_t  era  = days / 146097;
+    unsigned doe  = (unsigned)(days - era * 146097);
+    unsigned yoe  = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy  = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp   = (5 * doy + 2) / 153;
+    unsigned day  = doy - (153 * mp + 2) / 5 + 1;
+    unsigned mon  = (mp < 10 ? mp + 3 : mp - 9);
+    uint64_t year = (uint64_t)(yoe + era * 400 + (mon <= 2));
+
+    p    = listing_put_uint(p, year, 4, true);
+    *p++ = '-';
+    *p++ = '0' + mon / 10;
+    *p++ = '0' + mon % 10;
+    *p++ = '-';
+    *p++ = '0' + day / 10;
+    *p++ = '0' + day % 10;
+
+    return p;
+}
+
+static void listing_flush(ListingOutput* out)
+{
+    if (out->length) (void)PrintLines(out->ctx, out->buffer, out->length);
+    out->length = 0;
+}
+
+static void listing_print_row(ListingOutput* out, const HFSListingEntry* e, ListingTotals* totals)
+{
+    static const struct { const char* name; size_t length; } kinds[] = {
+        [HFSListingFile]       = { "file",      4 },
+        [HFSListingFolder]     = { "folder",    6 },
+        [HFSListingHardLink]   = { "hard link", 9 },
+        [HFSListingFolderLink] = { "dir link",  8 },
+        [HFSListingSymlink]    = { "symlink",   7 },
+    };
+
+    if ((out->length + kListingRowMax) > kListingOutputSize) listing_flush(out);
+
+    char* start = out->buffer + out->length;
+    char* p     = listing_put_uint(start, e->cnid, 9, false);
+    *p++ = ' ';
+    p    = listing_put(p, kinds[e->kind].name, kinds[e->kind].length, 10);
+    *p++ = ' ';
+    p    = listing_put_mode(p, e->mode, e->kind);
+    *p++ = ' ';
+    p    = listing_put_uint(p, e->user, 9, false);
+    *p++ = ' ';
+    p    = listing_put_uint(p, e->group, 9, false);
+    *p++ = ' ';
+    if (e->kind == HFSListingFolder) {
+        p = listing_put(p, "              -               -", 31, 31);
+    } else {
+        p    = listing_put_uint(p, e->dataSize, 15, true);
+        *p++ = ' ';
+        p    = listing_put_uint(p, e->rsrcSize, 15, true);
+    }
+    *p++ = ' ';
+    p    = listing_put_date(p, e->modifyDate);
+    *p++ = ' ';
+    p    = listing_put(p, e->name, e->nameLength, 0);
+    *p++ = '\n';
+
+    out->length += (size_t)(p - start);
+
+    totals->rows++;
+    switch (e->kind) {
+        case HFSListingFolder:                                  totals->folders++; break;
+        case HFSListingFolderLink: case HFSListingHardLink:     totals->hardLinks++; break;
+        case HFSListingSymlink:                                 totals->symlinks++; break;
+        default:                                                totals->files++; break;
+    }
+    if (e->forks & HFSListingDataFork) { totals->dataForks++; totals->dataSize += e->dataSize; }
+    if (e->forks & HFSListingResourceFork) { totals->rsrcForks++; totals->rsrcSize += e->rsrcSize; }
+}
+
+#pragma mark Sorting
+
+static int listing_rank(const ListedEntry* a, const ListedEntry* b, uint8_t sort)
+{
+    int result = 0;
+
+    if (sort == HIListingSortSize)
+        result = cmp(a->entry.dataSize + a->entry.rsrcSize, b->entry.dataSize + b->entry.rsrcSize);
+    else
+        result = cmp(a->entry.modifyDate, b->entry.modifyDate);
+
+    return (result ? result : cmp(b->order, a->order));
+}
+
+static int listing_rank_size(const void* a, const void* b) { return listing_rank(a, b, HIListingSortSize); }
+static int listing_rank_date(const void* a, const void* b) { return listing_rank(a, b, HIListingSortDate); }
+
+// qsort puts lower first, so the ranking is flipped for a best-first order.
+static int listing_sort_size(const void* a, const void* b) { return listing_rank(b, a, HIListingSortSize); }
+static int listing_sort_date(const void* a, const void* b) { return listing_rank(b, a, HIListingSortDate); }
+
+#pragma mark Listing
+
+// Streams rows in catalog order. Returns -1 on error.
+static int listing_stream(ListingOutput* out, HFSListing* listing, uint32_t limit, ListingTotals* totals)
+{
+    const HFSListingEntry* entries = NULL;
+    size_t                 count   = 0;
+    int                    result  = 0;
+
+    while ((result = hfs_listing_next(listing, &entries, &count)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            listing_print_row(out, &entries[i], totals);
+            if (limit && (totals->rows == limit)) break;
+        }
+        listing_flush(out);
+        if (limit && (totals->rows == limit)) break;
+    }
+
+    return (result < 0 ? -1 : 0);
+}
+
+// Keeps the best `limit` matches in a heap, then prints them.
+static int listing_top(ListingOutput* out, HFSListing* listing, uint8_t sort, uint32_t limit, ListingTotals* totals)
+{
+    TopK*                  topk    = topk_make(limit, sizeof(RankedEntry), (sort == HIListingSortSize ? listing_rank_size : listing_rank_date));
+    RankedEntry            ranked  = {0};
+    const HFSListingEntry* entries = NULL;
+    size_t                 count   = 0;
+    uint64_t               order   = 0;
+    int                    result  = 0;
+
+    while ((result = hfs_listing_next(listing, &entries, &count)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            ranked.listed = (ListedEntry){ .entry = entries[i], .order = order++ };
+
+            // Most entries lose to the current minimum; only copy the names of the ones that get in.
+            const void* min = topk_min(topk);
+            if (min && (listing_rank(&ranked.listed, min, sort) <= 0)) continue;
+
+            memcpy(ranked.name, entries[i].name, entries[i].nameLength + 1);
+            (void)topk_insert(topk, &ranked);
+        }
+    }
+
+    if (result >= 0) {
+        size_t             ranks = 0;
+        const RankedEntry* best  = topk_finish(topk, &ranks);
+
+        for (size_t i = 0; i < ranks; i++) {
+            HFSListingEntry entry = best[i].listed.entry;
+            entry.name = best[i].name;
+            listing_print_row(out, &entry, totals);
+        }
+        listing_flush(out);
+    }
+
+    topk_free(topk);
+    return (result < 0 ? -1 : 0);
+}
+
+// Keeps every match as a compact entry with its name in an arena, then sorts and prints them.
+static int listing_sort_all(ListingOutput* out, HFSListing* listing, uint8_t sort, ListingTotals* totals)
+{
+    ListedEntry*           listed      = NULL;
+    char*                  arena       = NULL;
+    size_t                 listedCount = 0, listedCapacity = 0;
+    size_t                 arenaLength = 0, arenaCapacity = 0;
+    const HFSListingEntry* entries     = NULL;
+    size_t                 count       = 0;
+    int                    result      = 0;
+
+    while ((result = hfs_listing_next(listing, &entries, &count)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (listedCount == listedCapacity) {
+                listedCapacity = MAX(listedCapacity * 2, 1024);
+                SREALLOC(listed, listedCapacity * sizeof(ListedEntry));
+            }
+            if ((arenaLength + entries[i].nameLength + 1) > arenaCapacity) {
+                arenaCapacity = MAX(arenaCapacity * 2, 64 * 1024);
+                SREALLOC(arena, arenaCapacity);
+            }
+
+            listed[listedCount] = (ListedEntry){ .entry = entries[i], .order = listedCount, .nameOffset = arenaLength };
+            memcpy(arena + arenaLength, entries[i].name, entries[i].nameLength + 1);
+            arenaLength += entries[i].nameLength + 1;
+            listedCount++;
+        }
+    }
+
+    if (result >= 0) {
+        if (listedCount) qsort(listed, listedCount, sizeof(ListedEntry), (sort == HIListingSortSize ? listing_sort_size : listing_sort_date));
+
+        for (size_t i = 0; i < listedCount; i++) {
+            listed[i].entry.name = arena + listed[i].nameOffset;
+            listing_print_row(out, &listed[i].entry, totals);
+        }
+        listing_flush(out);
+    }
+
+    SFREE(listed);
+    SFREE(arena);
+    return (result < 0 ? -1 : 0);
+}
+
+void showFolderListing(HIOptions* options, bt_nodeid_t folderID)
+{
+    HFSPlus*         hfs          = options->hfs;
+    out_ctx*         ctx          = hfs->vol->ctx;
+    HFSListing       listing      = {0};
+    ListingTotals    totals       = {0};
+    ListingOutput    out          = {0};
+    hfs_str          name         = "";
+    char             lineStr[121] = {0};
+    HFSListingFilter filter       = {
+        .pattern   = options->list_pattern,
+        .minSize   = options->list_min_size,
+        .newerThan = options->list_newer,
+    };
+    int              result       = 0;
+
+    debug("Printing listing for folder ID %u", folderID);
+
+    if (hfs_listing_open(&listing, hfs, folderID, &filter) < 0) {
+        if (errno == ENOTDIR) error("CNID %u is not a folder.", folderID);
+        else error("No thread record for %u found.", folderID);
+        return;
+    }
+
+    hfsuc_to_str(&name, &listing.folderName);
+    BeginSection(ctx, "Listing for %s", name);
+    Print(ctx, kListingHeaderFormat, "CNID", "kind", "mode", "user", "group", "data", "rsrc", "modified", "name");
+
+    SALLOC(out.buffer, kListingOutputSize);
+    out.ctx = ctx;
+
+    if (options->list_sort == HIListingSortName)
+        result = listing_stream(&out, &listing, options->list_limit, &totals);
+    else if (options->list_limit)
+        result = listing_top(&out, &listing, options->list_sort, options->list_limit, &totals);
+    else
+        result = listing_sort_all(&out, &listing, options->list_sort, &totals);
+
+    if (result < 0) error("Couldn't read the catalog for folder %u.", folderID);
+
+    char dataTotal[50];
+    char rsrcTotal[50];
+
+    format_size(ctx, dataTotal, totals.dataSize, 50);
+    format_size(ctx, rsrcTotal, totals.rsrcSize, 50);
+
+    memset(lineStr, '-', 120);
+    Print(ctx, "%s", lineStr);
+    Print(ctx, kListingHeaderFormat, "", "", "", "", "", dataTotal, rsrcTotal, "", "");
+
+    Print(ctx, "   Folders: %-10llu Data Forks: %-10llu Hard Links: %-10llu", totals.folders, totals.dataForks, totals.hardLinks);
+    Print(ctx, "     Files: %-10llu RSRC Forks: %-10llu   Symlinks: %-10llu", totals.files, totals.rsrcForks, totals.symlinks);
+
+    if (options->list_pattern || options->list_min_size || options->list_newer || options->list_limit)
+        Print(ctx, "    Listed: %llu of %llu children examined", totals.rows, listing.scanned);
+
+    EndSection(ctx);
+
+    SFREE(out.buffer);
+    hfs_listing_close(&listing);
+
+    debug("Done listing.");
+}
@@ -0,0 +1,325 @@
+//
+//  folder_sizes.c
+//  hfsinspect
+//
+//
+
+#include <sys/time.h>           // gettimeofday
+#include <pthread.h>
+
+#include "operations.h"
+#include "volumes/topk.h"
+
+/*
+   A du-style rollup: the recursive size of every folder on the volume, from one parallel scan
+   of the catalog's leaf nodes.
+
+   Catalog keys sort by parent ID, so the records of one folder's children sit next to each
+   other in a leaf node. Each node's run of children per parent is added up into a single
+   contribution, and every folder record is kept as a small table entry. Memory therefore
+   grows with the number of folders and leaf nodes, not with the number of files.
+
+   Once the scan is done, contributions are merged into the folder table and totals are
+   rolled up the parent chain bottom-up: a folder passes its totals to its parent once every
+   one of its own subfolders has done so. Folders caught in a parent cycle (a damaged catalog)
+   never become ready and are reported instead.
+ */
+
+typedef struct FolderTotals {
+    uint64_t dataBytes;
+    uint64_t resourceBytes;
+    uint64_t blocks;            // Allocated, both forks
+    uint64_t files;
+    uint64_t folders;
+} FolderTotals;
+
+typedef struct FolderEntry {
+    hfs_cnid_t   folderID;
+    hfs_cnid_t   parentID;
+    uint32_t     parentIndex;   // In the folder table, or UINT32_MAX if the parent isn't in it
+    uint32_t     pending;       // Subfolders not yet rolled up
+    FolderTotals totals;        // This folder's children, then everything below it
+} FolderEntry;
+
+typedef struct FolderContribution {
+    hfs_cnid_t   parentID;
+    uint32_t     _reserved;
+    FolderTotals totals;
+} FolderContribution;
+
+// A growing array shared by the scan's workers.
+typedef struct FolderBuffer {
+    void*  items;
+    size_t count;
+    size_t capacity;
+} FolderBuffer;
+
+typedef struct FolderScan {
+    pthread_mutex_t lock;
+    FolderBuffer    folders;        // FolderEntry
+    FolderBuffer    contributions;  // FolderContribution
+} FolderScan;
+
+typedef struct FolderRank {
+    uint64_t blocks;
+    uint32_t index;
+    uint32_t folderID;
+} FolderRank;
+
+#define NO_PARENT UINT32_MAX
+
+#pragma mark Scanning
+
+static void folder_buffer_append(FolderBuffer* buffer, const void* items, size_t count, size_t itemSize)
+{
+    if (count == 0) return;
+
+    if (buffer->count + count > buffer->capacity) {
+        buffer->capacity = MAX(buffer->count + count, (buffer->capacity ? buffer->capacity * 2 : 4096));
+        SREALLOC(buffer->items, buffer->capacity * itemSize);
+    }
+
+    memcpy((char*)buffer->items + (buffer->count * itemSize), items, count * itemSize);
+    buffer->count += count;
+}
+
+static inline void folder_totals_add(FolderTotals* into, const FolderTotals* from)
+{
+    into->dataBytes     += from->dataBytes;
+    into->resourceBytes += from->resourceBytes;
+    into->blocks        += from->blocks;
+    into->files         += from->files;
+    into->folders       += from->folders;
+}
+
+static int folder_scan_node(void* context, const BTreeNodePtr node)
+{
+    FolderScan*         scan              = context;
+    FolderEntry*        folders           = NULL;
+    FolderContribution* contributions     = NULL;
+    size_t              folderCount       = 0;
+    size_t              contributionCount = 0;
+
+    SALLOC(folders, MAX(node->recordCount, 1) * sizeof(FolderEntry));
+    SALLOC(contributions, MAX(node->recordCount, 1) * sizeof(FolderContribution));
+
+    for (unsigned recNum = 0; recNum < node->recordCount; recNum++) {
+        BTreeKeyPtr recordKey   = NULL;
+        void*       recordValue = NULL;
+        if (btree_get_record(&recordKey, &recordValue, node, recNum) < 0) continue;
+
+        const HFSPlusCatalogKey*    key    = (HFSPlusCatalogKey*)recordKey;
+        const HFSPlusCatalogRecord* record = recordValue;
+        FolderTotals                totals = {0};
+
+        switch (record->record_type) {
+            case kHFSPlusFileRecord:
+            {
+                const HFSPlusCatalogFile* file = &record->catalogFile;
+                totals.dataBytes     = file->dataFork.logicalSize;
+                totals.resourceBytes = file->resourceFork.logicalSize;
+                totals.blocks        = (uint64_t)file->dataFork.totalBlocks + file->resourceFork.totalBlocks;
+                totals.files         = 1;
+                break;
+            }
+
+            case kHFSPlusFolderRecord:
+            {
+                folders[folderCount++] = (FolderEntry){
+                    .folderID = record->catalogFolder.folderID,
+                    .parentID = key->parentID,
+                };
+                totals.folders = 1;
+                break;
+            }
+
+            default:
+                continue;
+        }
+
+        // Siblings are adjacent in key order; fold them into one contribution.
+        if ((contributionCount == 0) || (contributions[contributionCount - 1].parentID != key->parentID))
+            contributions[contributionCount++] = (FolderContribution){ .parentID = key->parentID };
+        folder_totals_add(&contributions[contributionCount - 1].totals, &totals);
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    folder_buffer_append(&scan->folders, folders, folderCount, sizeof(FolderEntry));
+    folder_buffer_append(&scan->contributions, contributions, contributionCount, sizeof(FolderContribution));
+    pthread_mutex_unlock(&scan->lock);
+
+    SFREE(folders);
+    SFREE(contributions);
+
+    return 0;
+}
+
+#pragma mark Rollup
+
+static int compare_folder_entries(const void* a, const void* b)
+{
+    return cmp(((const FolderEntry*)a)->folderID, ((const FolderEntry*)b)->folderID);
+}
+
+static int compare_folder_contributions(const void* a, const void* b)
+{
+    return cmp(((const FolderContribution*)a)->parentID, ((const FolderContribution*)b)->parentID);
+}
+
+static int compare_folder_ranks(const void* a, const void* b)
+{
+    const FolderRank* A      = a;
+    const FolderRank* B      = b;
+    int               result = cmp(A->blocks, B->blocks);
+
+    return (result ? result : cmp(B->folderID, A->folderID));
+}
+
+static uint32_t folder_find(const FolderEntry* folders, size_t count, hfs_cnid_t folderID)
+{
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (folders[mid].folderID < folderID) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return ((lo < count) && (folders[lo].folderID == folderID) ? (uint32_t)lo : NO_PARENT);
+}
+
+#pragma mark Output
+
+static void folder_path(const HFSPlus* hfs, const FolderEntry* folders, uint32_t index, char* path, size_t length)
+{
+    uint32_t chain[256];
+    unsigned depth = 0;
+
+    // Walk up to the root, then print down from it.
+    for (uint32_t i = index; (i != NO_PARENT) && (depth < 256); i = folders[i].parentIndex) {
+        if (folders[i].folderID == kHFSRootFolderID) break;
+        chain[depth++] = i;
+    }
+
+    path[0] = '\0';
+    if (depth == 0) { (void)strlcpy(path, "/", length); return; }
+
+    while (depth--) {
+        hfs_str name = "";
+        if (HFSPlusGetCNIDName(&name, (FSSpec){ .hfs = hfs, .parentID = folders[chain[depth]].folderID }) < 0)
+            (void)snprintf((char*)name, sizeof(name), "<%u>", folders[chain[depth]].folderID);
+
+        (void)strlcat(path, "/", length);
+        (void)strlcat(path, (char*)name, length);
+    }
+}
+
+void showFolderSizes(HIOptions* options)
+{
+    HFSPlus*       hfs       = options->hfs;
+    out_ctx*       ctx       = hfs->vol->ctx;
+    FolderScan     scan      = {0};
+    TopK*          heaviest  = topk_make(MAX(options->top, 1), sizeof(FolderRank), compare_folder_ranks);
+    uint32_t*      queue     = NULL;
+    uint64_t       orphans   = 0;
+    size_t         processed = 0;
+    struct timeval started   = {0}, finished = {0};
+
+    gettimeofday(&started, NULL);
+
+    pthread_mutex_init(&scan.lock, NULL);
+    if (hfsplus_catalog_scan_parallel(hfs, folder_scan_node, &scan) < 0)
+        die(1, "Could not scan the catalog.");
+    pthread_mutex_destroy(&scan.lock);
+
+    FolderEntry*        folders           = scan.folders.items;
+    size_t              folderCount       = scan.folders.count;
+    FolderContribution* contributions     = scan.contributions.items;
+    size_t              contributionCount = scan.contributions.count;
+
+    if (folderCount >= NO_PARENT) die(1, "Too many folders to roll up (%zu).", folderCount);
+
+    // Merge each parent's contributions into its entry; both tables are sorted by CNID so this is one pass.
+    qsort(folders, folderCount, sizeof(FolderEntry), compare_folder_entries);
+    qsort(contributions, contributionCount, sizeof(FolderContribution), compare_folder_contributions);
+
+    for (size_t f = 0, c = 0; c < contributionCount; c++) {
+        while ((f < folderCount) && (folders[f].folderID < contributions[c].parentID)) f++;
+
+        if ((f < folderCount) && (folders[f].folderID == contributions[c].parentID))
+            folder_totals_add(&folders[f].totals, &contributions[c].totals);
+        else if (contributions[c].parentID != kHFSRootParentID)
+            orphans += contributions[c].totals.files + contributions[c].totals.folders;
+    }
+    SFREE(scan.contributions.items);
+
+    // Link each folder to its parent and count the subfolders each has to wait for.
+    for (size_t i = 0; i < folderCount; i++) {
+        folders[i].parentIndex = folder_find(folders, folderCount, folders[i].parentID);
+        if (folders[i].parentIndex != NO_PARENT) folders[folders[i].parentIndex].pending++;
+    }
+
+    // Bottom-up: start from folders without subfolders; a parent is ready once all of its subfolders have passed their totals up.
+    SALLOC(queue, MAX(folderCount, 1) * sizeof(uint32_t));
+    size_t tail = 0;
+    for (size_t i = 0; i < folderCount; i++)
+        if (folders[i].pending == 0) queue[tail++] = (uint32_t)i;
+
+    for (processed = 0; processed < tail; processed++) {
+        uint32_t     i      = queue[processed];
+        FolderEntry* folder = &folders[i];
+
+        FolderRank   rank   = { .blocks = folder->totals.blocks, .index = i, .folderID = folder->folderID };
+        (void)topk_insert(heaviest, &rank);
+
+        if (folder->parentIndex == NO_PARENT) continue;
+
+        FolderEntry* parent = &folders[folder->parentIndex];
+        folder_totals_add(&parent->totals, &folder->totals);
+        if (--parent->pending == 0) queue[tail++] = folder->parentIndex;
+    }
+
+    gettimeofday(&finished, NULL);
+    double seconds = (finished.tv_sec - started.tv_sec) + ((finished.tv_usec - started.tv_usec) / 1000000.0);
+
+    BeginSection(ctx, "Folder Sizes");
+
+    uint32_t root = folder_find(folders, folderCount, kHFSRootFolderID);
+    if (root != NO_PARENT) {
+        const FolderTotals* totals = &folders[root].totals;
+        PrintAttribute(ctx, "Files", "%llu", totals->files);
+        PrintAttribute(ctx, "Folders", "%llu", totals->folders);
+        _PrintDataLength(ctx, "Data Size", totals->dataBytes);
+        _PrintDataLength(ctx, "Resource Size", totals->resourceBytes);
+        _PrintHFSBlocks(ctx, "Allocated", totals->blocks);
+    }
+    if (orphans)
+        PrintAttribute(ctx, "Orphans", "%llu record(s) whose parent folder is missing", orphans);
+    if (processed < folderCount)
+        PrintAttribute(ctx, "Cycles", "%zu folder(s) in parent loops were not rolled up", folderCount - processed);
+    PrintAttribute(ctx, "Elapsed", "%0.2f seconds", seconds);
+
+    size_t            count = 0;
+    const FolderRank* ranks = topk_finish(heaviest, &count);
+
+    BeginSection(ctx, "Heaviest Folders");
+    Print(ctx, "%-4s %12s %12s %10s %10s %10s %s", "#", "Allocated", "Size", "Files", "Folders", "CNID", "Path");
+    for (size_t r = 0; r < count; r++) {
+        const FolderEntry* folder         = &folders[ranks[r].index];
+        char               allocated[50]  = "", size[50] = "";
+        char               path[PATH_MAX] = "";
+
+        (void)format_size(ctx, allocated, folder->totals.blocks * hfs->block_size, 50);
+        (void)format_size(ctx, size, folder->totals.dataBytes + folder->totals.resourceBytes, 50);
+        folder_path(hfs, folders, ranks[r].index, path, PATH_MAX);
+
+        Print(ctx, "%-4zu %12s %12s %10llu %10llu %10u %s", r + 1, allocated, size, folder->totals.files, folder->totals.folders, folder->folderID, path);
+    }
+    EndSection(ctx);
+
+    EndSection(ctx);
+
+    topk_free(heaviest);
+    SFREE(queue);
+    SFREE(scan.folders.items);
+}
@@ -0,0 +1,274 @@
+//
+//  fragmentation.c
+//  hfsinspect
+//
+//
+
+#include <sys/time.h>           // gettimeofday
+#include <pthread.h>
+
+#include "operations.h"
+#include "hfs/extents.h"
+#include "hfsplus/hfsplus.h"
+#include "volumes/topk.h"
+#include "volumes/workqueue.h"
+
+/*
+   Ranks the volume's fragmented forks three ways:
+
+   - by extent count,
+   - by average extent size (smallest first; many tiny extents are the worst case for reads), and
+   - by seek distance: the sum of the gaps, in blocks, between each extent and the next.
+
+   The extents overflow file is loaded into a table first, then the catalog's leaf nodes are
+   scanned in parallel. Each node's forks are measured without any locking; the node's
+   fragmented forks are then offered to three bounded heaps under a single lock.
+ */
+
+typedef struct FragmentedFork {
+    uint64_t seek;              // Sum of the gaps between consecutive extents, in blocks
+    uint32_t cnid;
+    uint32_t extents;
+    uint32_t blocks;
+    uint8_t  forkType;
+    uint8_t  _reserved[3];
+} FragmentedFork;
+
+typedef struct FragmentationStats {
+    uint64_t forks;
+    uint64_t fragmentedForks;
+    uint64_t extents;
+    uint64_t fragmentedExtents;
+    uint32_t mostExtents;
+    uint32_t _reserved;
+} FragmentationStats;
+
+typedef struct FragmentationScan {
+    const HFSPlusExtentEntry* overflow;
+    size_t                    overflowCount;
+    pthread_mutex_t           lock;
+    TopK*                     byExtents;
+    TopK*                     byAverage;
+    TopK*                     bySeek;
+    FragmentationStats        stats;
+} FragmentationScan;
+
+#pragma mark Ranking
+
+// Ties go to the lower CNID (then the data fork) so the report doesn't depend on thread timing.
+static int fragmentation_tiebreak(const FragmentedFork* a, const FragmentedFork* b)
+{
+    int result = cmp(b->cnid, a->cnid);
+    if (result == 0) result = cmp(b->forkType, a->forkType);
+    return result;
+}
+
+static int fragmentation_compare_extents(const void* a, const void* b)
+{
+    const FragmentedFork* A      = a;
+    const FragmentedFork* B      = b;
+    int                   result = cmp(A->extents, B->extents);
+
+    if (result == 0) result = cmp(A->seek, B->seek);
+    return (result ? result : fragmentation_tiebreak(A, B));
+}
+
+static int fragmentation_compare_average(const void* a, const void* b)
+{
+    const FragmentedFork* A      = a;
+    const FragmentedFork* B      = b;
+
+    // A smaller blocks/extents ranks higher; cross-multiplied to stay in integers.
+    int                   result = cmp((uint64_t)B->blocks * A->extents, (uint64_t)A->blocks * B->extents);
+
+    if (result == 0) result = cmp(A->extents, B->extents);
+    return (result ? result : fragmentation_tiebreak(A, B));
+}
+
+static int fragmentation_compare_seek(const void* a, const void* b)
+{
+    const FragmentedFork* A      = a;
+    const FragmentedFork* B      = b;
+    int                   result = cmp(A->seek, B->seek);
+
+    if (result == 0) result = cmp(A->extents, B->extents);
+    return (result ? result : fragmentation_tiebreak(A, B));
+}
+
+#pragma mark Scanning
+
+static void fragmentation_measure_record(FragmentedFork* fork, const HFSPlusExtentDescriptor* record, uint64_t* end)
+{
+    for (unsigned i = 0; i < kHFSPlusExtentDensity; i++) {
+        if (record[i].blockCount == 0) break;
+
+        if (fork->extents) {
+            uint64_t start = record[i].startBlock;
+            fork->seek += (start > *end ? start - *end : *end - start);
+        }
+
+        fork->extents++;
+        fork->blocks += record[i].blockCount;
+        *end          = (uint64_t)record[i].startBlock + record[i].blockCount;
+    }
+}
+
+// Measures a fork from its inline extents and, if they don't cover it, its overflow records. Returns false for empty forks.
+static bool fragmentation_measure_fork(FragmentedFork* fork, const FragmentationScan* scan, hfs_cnid_t cnid, const HFSPlusForkData* forkData, hfs_forktype_t forkType)
+{
+    uint64_t end = 0;
+
+    if (forkData->totalBlocks == 0) return false;
+
+    *fork = (FragmentedFork){ .cnid = cnid, .forkType = forkType };
+    fragmentation_measure_record(fork, forkData->extents, &end);
+
+    if (fork->blocks < forkData->totalBlocks) {
+        const HFSPlusExtentEntry* entries = NULL;
+        size_t                    count   = hfsplus_extents_fork_entries(scan->overflow, scan->overflowCount, cnid, forkType, &entries);
+        for (size_t i = 0; i < count; i++) fragmentation_measure_record(fork, entries[i].extents, &end);
+    }
+
+    return true;
+}
+
+static int fragmentation_scan_node(void* context, const BTreeNodePtr node)
+{
+    FragmentationScan* scan      = context;
+    FragmentedFork*    forks     = NULL;
+    size_t             forkCount = 0;
+    FragmentationStats stats     = {0};
+
+    SALLOC(forks, MAX(node->recordCount, 1) * 2 * sizeof(FragmentedFork));
+
+    for (unsigned recNum = 0; recNum < node->recordCount; recNum++) {
+        BTreeKeyPtr recordKey   = NULL;
+        void*       recordValue = NULL;
+        if (btree_get_record(&recordKey, &recordValue, node, recNum) < 0) continue;
+
+        const HFSPlusCatalogRecord* record = recordValue;
+        if (record->record_type != kHFSPlusFileRecord) continue;
+
+        const HFSPlusCatalogFile* file = &record->catalogFile;
+        const struct {
+            const HFSPlusForkData* data;
+            hfs_forktype_t         type;
+        } sides[] = {
+            { &file->dataFork,     HFSDataForkType },
+            { &file->resourceFork, HFSResourceForkType },
+        };
+
+        for (unsigned s = 0; s < 2; s++) {
+            FragmentedFork* fork = &forks[forkCount];
+            if ( !fragmentation_measure_fork(fork, scan, file->fileID, sides[s].data, sides[s].type) ) continue;
+
+            stats.forks++;
+            stats.extents += fork->extents;
+            if (fork->extents < 2) continue;
+
+            stats.fragmentedForks++;
+            stats.fragmentedExtents += fork->extents;
+            stats.mostExtents        = MAX(stats.mostExtents, fork->extents);
+            forkCount++;
+        }
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    for (size_t i = 0; i < forkCount; i++) {
+        (void)topk_insert(scan->byExtents, &forks[i]);
+        (void)topk_insert(scan->byAverage, &forks[i]);
+        (void)topk_insert(scan->bySeek, &forks[i]);
+    }
+    scan->stats.forks             += stats.forks;
+    scan->stats.fragmentedForks   += stats.fragmentedForks;
+    scan->stats.extents           += stats.extents;
+    scan->stats.fragmentedExtents += stats.fragmentedExtents;
+    scan->stats.mostExtents        = MAX(scan->stats.mostExtents, stats.mostExtents);
+    pthread_mutex_unlock(&scan->lock);
+
+    SFREE(forks);
+
+    return 0;
+}
+
+#pragma mark Output
+
+static void fragmentation_print_ranking(out_ctx* ctx, const HFSPlus* hfs, const char* title, TopK* topk)
+{
+    size_t                count = 0;
+    const FragmentedFork* forks = topk_finish(topk, &count);
+
+    BeginSection(ctx, "%s", title);
+
+    if (count == 0) {
+        Print(ctx, "%s", "No fragmented forks.");
+        EndSection(ctx);
+        return;
+    }
+
+    Print(ctx, "%-4s %-10s %-5s %8s %10s %12s %12s %s", "#", "CNID", "Fork", "Extents", "Size", "Avg Extent", "Seek", "Name");
+
+    for (size_t i = 0; i < count; i++) {
+        const FragmentedFork* fork     = &forks[i];
+        char                  size[50] = "", average[50] = "";
+        hfs_str               name     = "";
+
+        (void)format_size(ctx, size, (size_t)fork->blocks * hfs->block_size, 50);
+        (void)format_size(ctx, average, (size_t)((uint64_t)fork->blocks * hfs->block_size / fork->extents), 50);
+        if (HFSPlusGetCNIDName(&name, (FSSpec){ .hfs = hfs, .parentID = fork->cnid }) < 0) (void)strlcpy((char*)name, "?", sizeof(name));
+
+        Print(ctx, "%-4zu %-10u %-5s %8u %10s %12s %12llu %s", i + 1, fork->cnid, (fork->forkType == HFSResourceForkType ? "rsrc" : "data"),
+              fork->extents, size, average, fork->seek, name);
+    }
+
+    EndSection(ctx);
+}
+
+void showFragmentation(HIOptions* options)
+{
+    HFSPlus*            hfs      = options->hfs;
+    out_ctx*            ctx      = hfs->vol->ctx;
+    HFSPlusExtentEntry* overflow = NULL;
+    FragmentationScan   scan     = {0};
+    size_t              top      = MAX(options->top, 1);
+    struct timeval      started  = {0}, finished = {0};
+
+    gettimeofday(&started, NULL);
+
+    if (hfsplus_extents_read_all(&overflow, &scan.overflowCount, hfs) < 0)
+        die(1, "Could not read the extents overflow file.");
+
+    scan.overflow  = overflow;
+    scan.byExtents = topk_make(top, sizeof(FragmentedFork), fragmentation_compare_extents);
+    scan.byAverage = topk_make(top, sizeof(FragmentedFork), fragmentation_compare_average);
+    scan.bySeek    = topk_make(top, sizeof(FragmentedFork), fragmentation_compare_seek);
+    pthread_mutex_init(&scan.lock, NULL);
+
+    if (hfsplus_catalog_scan_parallel(hfs, fragmentation_scan_node, &scan) < 0)
+        die(1, "Could not scan the catalog.");
+
+    gettimeofday(&finished, NULL);
+    double              seconds = (finished.tv_sec - started.tv_sec) + ((finished.tv_usec - started.tv_usec) / 1000000.0);
+    FragmentationStats* stats   = &scan.stats;
+
+    BeginSection(ctx, "Fragmentation");
+    PrintAttribute(ctx, "Forks", "%llu", stats->forks);
+    PrintAttribute(ctx, "Fragmented Forks", "%llu (%0.2f%%)", stats->fragmentedForks,
+                   (stats->forks ? (100.0 * stats->fragmentedForks / stats->forks) : 0.0));
+    PrintAttribute(ctx, "Extents", "%llu", stats->extents);
+    if (stats->fragmentedForks)
+        PrintAttribute(ctx, "Extents per Fork", "%0.2f (fragmented forks; at most %u)", (double)stats->fragmentedExtents / stats->fragmentedForks, stats->mostExtents);
+    PrintAttribute(ctx, "Overflow Records", "%zu", scan.overflowCount);
+    PrintAttribute(ctx, "Elapsed", "%0.2f seconds", seconds);
+
+    fragmentation_print_ranking(ctx, hfs, "Most Extents", scan.byExtents);
+    fragmentation_print_ranking(ctx, hfs, "Smallest Average Extent", scan.byAverage);
+    fragmentation_print_ranking(ctx, hfs, "Longest Seek Distance", scan.bySeek);
+    EndSection(ctx);
+
+    pthread_mutex_destroy(&scan.lock);
+    topk_free(scan.byExtents);
+    topk_free(scan.byAverage);
+    topk_free(scan.bySeek);
+    SFREE(overflow);
+}
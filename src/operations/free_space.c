@@ -9,42 +9,44 @@
 #include "operations.h"
 
 
-void showFreeSpace(HIOptions* options)
+char* readAllocationFile(const HFSPlus* hfs, size_t* length)
 {
+    if (hfs_is_standard(hfs)) {
+        char* bitmap = NULL;
+        return (hfs_standard_read_bitmap(&bitmap, length, hfs) < 0 ? NULL : bitmap);
+    }
+
     HFSPlusFork* fork = NULL;
-    if ( hfsplus_get_special_fork(&fork, options->hfs, kHFSAllocationFileID) < 0 )
-        die(1, "Couldn't get a reference to the volume allocation file.");
+    if ( hfsplus_get_special_fork(&fork, hfs, kHFSAllocationFileID) < 0 )
+        return NULL;
 
-    char*        data = NULL;
+    char*        data   = NULL;
+    size_t       offset = 0;
+    ssize_t      bytes  = 0;
     SALLOC(data, fork->logicalSize);
-    {
-        size_t  block_size = 128*1024, offset = 0;
-        ssize_t bytes      = 0;
-        void*   block      = NULL;
-        SALLOC(block, block_size);
-        while ( (bytes = hfs_read_fork_range(block, fork, block_size, offset)) > 0 ) {
-            memcpy(data+offset, block, bytes);
-            offset += bytes;
-            if (offset >= fork->logicalSize) break;
-        }
-        SFREE(block);
 
-        if (offset == 0) {
-            SFREE(data);
+    while ( (offset < fork->logicalSize) && (bytes = hfs_read_fork_range(data+offset, fork, fork->logicalSize - offset, offset)) > 0 )
+        offset += bytes;
 
-            // We didn't read anything.
-            if (bytes < 0) {
-                // Error
-                die(errno, "error reading allocation file");
-            }
+    hfsfork_free(fork);
 
-            return;
-        }
+    if (offset == 0) {
+        // We didn't read anything.
+        SFREE(data);
+        if (bytes == 0) errno = EIO;
+        return NULL;
     }
 
-    size_t total_used    = 0;
-    size_t total_free    = 0;
-    size_t total_extents = 0;
+    *length = offset;
+    return data;
+}
+
+int generateFreeSpaceStats(FreeSpaceStats* stats, const HFSPlus* hfs)
+{
+    size_t length = 0;
+    char*  data   = readAllocationFile(hfs, &length);
+    if (data == NULL)
+        return -1;
 
     struct extent {
         size_t  start;
@@ -53,38 +55,46 @@ void showFreeSpace(HIOptions* options)
         uint8_t _reserved[7];
     };
 
+    *stats = (FreeSpaceStats){ .bitmapBytes = length };
+
     // The first allocation block is used by the VH.
     struct extent currentExtent = {1,0,1};
 
-    for (size_t i = 0; i < options->hfs->vh.totalBlocks; i++) {
-        bool used = BTIsBlockUsed(i, data, fork->logicalSize);
-        if ((used == currentExtent.used) && (i != (options->hfs->vh.totalBlocks - 1))) {
+    for (size_t i = 0; i < hfs->vh.totalBlocks; i++) {
+        bool used = BTIsBlockUsed(i, data, length);
+        if ((used == currentExtent.used) && (i != (hfs->vh.totalBlocks - 1))) {
             currentExtent.length++;
             continue;
         }
 
-        total_extents += 1;
+        stats->segments += 1;
 
         if (currentExtent.used)
-            total_used += currentExtent.length;
+            stats->usedBlocks += currentExtent.length;
         else
-            total_free += currentExtent.length;
+            stats->freeBlocks += currentExtent.length;
 
         currentExtent.used   = used;
         currentExtent.start  = i;
         currentExtent.length = 1;
     }
 
-    out_ctx* ctx = fork->hfs->vol->ctx;
+    SFREE(data);
+    return 0;
+}
+
+void showFreeSpace(HIOptions* options)
+{
+    FreeSpaceStats stats = {0};
+    if (generateFreeSpaceStats(&stats, options->hfs) < 0)
+        die(errno, "error reading allocation file");
+
+    out_ctx* ctx = options->hfs->vol->ctx;
 
     BeginSection(ctx, "Allocation File Statistics");
-    PrintAttribute(ctx, "Segments", "%zu", total_extents);
-    _PrintHFSBlocks(ctx, "Used Blocks", total_used);
-    _PrintHFSBlocks(ctx, "Free Blocks", total_free);
-    _PrintHFSBlocks(ctx, "Total Blocks", total_used + total_free);
+    PrintAttribute(ctx, "Segments", "%zu", stats.segments);
+    _PrintHFSBlocks(ctx, "Used Blocks", stats.usedBlocks);
+    _PrintHFSBlocks(ctx, "Free Blocks", stats.freeBlocks);
+    _PrintHFSBlocks(ctx, "Total Blocks", stats.usedBlocks + stats.freeBlocks);
     EndSection(ctx);
-
-    SFREE(data);
-    hfsfork_free(fork);
 }
-
@@ -0,0 +1,430 @@
+//
+//  hash_files.c
+//  hfsinspect
+//
+//
+
+#include <sys/time.h>           // gettimeofday
+
+#include "operations.h"
+#include "hfs/hfs_io.h"
+#include "hfs/hfs_iosched.h"
+#include "volumes/workqueue.h"
+#include "volumes/sha256/sha256.h"
+#include "volumes/crc32/crc32.h"
+
+/*
+   Every fork on the volume is hashed in one pass over the disk:
+
+   1. A catalog scan records each file (forks, parent, name) and each folder thread (for paths).
+   2. Batches of fork windows are queued on the I/O scheduler, which reads them in physical order.
+   3. Each window is hashed on the work queue while the next batch is being read.
+
+   A fork is never more than one window ahead of its digest, and only two batches exist at a time,
+   so memory use is bounded by 2 * HASH_BATCH_BUDGET no matter how large the files are. Windows of
+   the same fork land in successive batches, and a batch is only hashed once the previous batch has
+   finished, so every digest sees its fork's bytes in logical order.
+ */
+
+#define HASH_WINDOW_SIZE  (8 * 1024 * 1024)     // Largest piece of one fork in a batch
+#define HASH_BATCH_BUDGET (64 * 1024 * 1024)    // Fork data read per batch
+
+char* HashOptionSHA256 = "sha256";
+char* HashOptionCRC32C = "crc32c";
+char* HashOptionCRC32  = "crc32";
+
+typedef struct HashFolder {
+    hfs_cnid_t cnid;
+    hfs_cnid_t parentID;
+    char*      name;
+} HashFolder;
+
+typedef struct HashFile {
+    hfs_cnid_t      cnid;
+    hfs_cnid_t      parentID;
+    char*           name;
+    HFSPlusForkData dataFork;
+    HFSPlusForkData resourceFork;
+} HashFile;
+
+typedef struct HashCatalog {
+    HashFolder* folders;
+    size_t      folderCount;
+    size_t      folderCapacity;
+    HashFile*   files;
+    size_t      fileCount;
+    size_t      fileCapacity;
+} HashCatalog;
+
+typedef struct HashJob {
+    const HashFile* file;
+    HFSPlusFork*    fork;
+    HIHashAlgorithm algorithm;
+    bool            failed;
+    uint8_t         _reserved[3];
+    size_t          queued;         // Bytes of the fork placed in a batch so far
+    size_t          hashed;         // Bytes of the fork fed to the digest so far
+    sha256_ctx      sha256;
+    uint32_t        crc;            // CRC-32C or CRC-32
+    uint8_t         _reserved2[4];
+} HashJob;
+
+typedef struct HashItem {
+    HashJob* job;
+    char*    buffer;                // Points into the batch arena
+    size_t   start;                 // Logical offset of the window within the fork
+    size_t   length;
+    size_t   delivered;             // Bytes the scheduler handed us for this window
+} HashItem;
+
+typedef struct HashBatch {
+    char*     arena;
+    size_t    used;
+    HashItem* items;
+    size_t    itemCount;
+    size_t    itemCapacity;
+} HashBatch;
+
+#pragma mark Catalog Scan
+
+static int compare_hash_folders(const void* a, const void* b)
+{
+    const HashFolder* A = a;
+    const HashFolder* B = b;
+    return cmp(A->cnid, B->cnid);
+}
+
+static char* hash_name_copy(const HFSUniStr255* name)
+{
+    hfs_str str = {0};
+    hfsuc_to_str(&str, name);
+    return strdup((char*)str);
+}
+
+static int hash_scan_record(void* context, const HFSPlusCatalogKey* key, const HFSPlusCatalogRecord* record)
+{
+    HashCatalog* catalog = context;
+
+    switch (record->record_type) {
+        case kHFSPlusFolderThreadRecord:
+        {
+            if (catalog->folderCount == catalog->folderCapacity) {
+                catalog->folderCapacity = (catalog->folderCapacity ? catalog->folderCapacity * 2 : 1024);
+                SREALLOC(catalog->folders, catalog->folderCapacity * sizeof(HashFolder));
+            }
+
+            HashFolder* folder = &catalog->folders[catalog->folderCount++];
+            folder->cnid     = key->parentID;
+            folder->parentID = record->catalogThread.parentID;
+            folder->name     = hash_name_copy(&record->catalogThread.nodeName);
+            break;
+        }
+
+        case kHFSPlusFileRecord:
+        {
+            // Hard link stubs carry no data; their inode files are hashed under the metadata folder.
+            if (HFSPlusCatalogFileIsHardLink(record)) break;
+
+            if (catalog->fileCount == catalog->fileCapacity) {
+                catalog->fileCapacity = (catalog->fileCapacity ? catalog->fileCapacity * 2 : 1024);
+                SREALLOC(catalog->files, catalog->fileCapacity * sizeof(HashFile));
+            }
+
+            HashFile* file = &catalog->files[catalog->fileCount++];
+            file->cnid         = record->catalogFile.fileID;
+            file->parentID     = key->parentID;
+            file->name         = hash_name_copy(&key->nodeName);
+            file->dataFork     = record->catalogFile.dataFork;
+            file->resourceFork = record->catalogFile.resourceFork;
+            break;
+        }
+
+        default:
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// Builds the full path of a file from the folder thread table.
+static void hash_file_path(char* path, size_t length, const HashCatalog* catalog, const HashFile* file)
+{
+    const char* components[256] = {0};
+    unsigned    depth           = 0;
+    hfs_cnid_t  parent          = file->parentID;
+
+    components[depth++] = file->name;
+
+    while ((parent != kHFSRootFolderID) && (parent != kHFSRootParentID) && (depth < 256)) {
+        HashFolder  search = { .cnid = parent };
+        HashFolder* folder = bsearch(&search, catalog->folders, catalog->folderCount, sizeof(HashFolder), compare_hash_folders);
+        if (folder == NULL) {
+            components[depth++] = "?";
+            break;
+        }
+        components[depth++] = folder->name;
+        parent              = folder->parentID;
+    }
+
+    path[0] = '\0';
+    while (depth--) {
+        (void)strlcat(path, "/", length);
+        (void)strlcat(path, components[depth], length);
+    }
+}
+
+#pragma mark Hashing
+
+static int hash_consume(void* context, const HFSPlusFork* fork, const void* buf, size_t size, size_t offset)
+{
+    HashItem* item = context;
+
+    (void)fork;
+
+    memcpy(item->buffer + (offset - item->start), buf, size);
+    item->delivered += size;
+
+    return 0;
+}
+
+static void hash_item(void* context)
+{
+    HashItem* item = context;
+    HashJob*  job  = item->job;
+
+    if (job->algorithm == HIHashCRC32C)
+        job->crc = crc32c_fast(job->crc, item->buffer, item->length);
+    else if (job->algorithm == HIHashCRC32)
+        job->crc = crc32(job->crc, item->buffer, item->length);
+    else
+        sha256_update(&job->sha256, item->buffer, item->length);
+
+    job->hashed += item->length;
+}
+
+static void hash_job_print(out_ctx* ctx, const HashCatalog* catalog, HashJob* job)
+{
+    char digest[(SHA256_DIGEST_LENGTH * 2) + 1] = {0};
+    char path[PATH_MAX]                         = {0};
+
+    if (job->failed) {
+        (void)strlcpy(digest, "-", sizeof(digest));
+
+    } else if ((job->algorithm == HIHashCRC32C) || (job->algorithm == HIHashCRC32)) {
+        (void)snprintf(digest, sizeof(digest), "%08x", job->crc);
+
+    } else {
+        uint8_t bytes[SHA256_DIGEST_LENGTH] = {0};
+        sha256_final(&job->sha256, bytes);
+        for (unsigned i = 0; i < SHA256_DIGEST_LENGTH; i++)
+            (void)snprintf(&digest[i * 2], 3, "%02x", bytes[i]);
+    }
+
+    hash_file_path(path, PATH_MAX, catalog, job->file);
+
+    Print(ctx, "%-10u %-4s %s  %s", job->file->cnid, (job->fork->forkType == HFSDataForkType ? "data" : "rsrc"), digest, path);
+}
+
+static HashJob* hash_job_make(const HFSPlus* hfs, const HashFile* file, hfs_forktype_t forkType, HIHashAlgorithm algorithm)
+{
+    HashJob* job = NULL;
+    SALLOC(job, sizeof(HashJob));
+
+    job->file      = file;
+    job->algorithm = algorithm;
+    sha256_init(&job->sha256);
+
+    const HFSPlusForkData forkData = (forkType == HFSDataForkType ? file->dataFork : file->resourceFork);
+    if (hfsfork_make(&job->fork, hfs, forkData, forkType, file->cnid) < 0) {
+        SFREE(job);
+        return NULL;
+    }
+
+    return job;
+}
+
+static void hash_job_free(HashJob* job)
+{
+    hfsfork_free(job->fork);
+    SFREE(job);
+}
+
+static void hash_batch_add(HashBatch* batch, HashJob* job, size_t length)
+{
+    if (batch->itemCount == batch->itemCapacity) {
+        batch->itemCapacity = (batch->itemCapacity ? batch->itemCapacity * 2 : 64);
+        SREALLOC(batch->items, batch->itemCapacity * sizeof(HashItem));
+    }
+
+    batch->items[batch->itemCount++] = (HashItem){
+        .job    = job,
+        .buffer = batch->arena + batch->used,
+        .start  = job->queued,
+        .length = length,
+    };
+
+    batch->used += length;
+    job->queued += length;
+}
+
+void hashFiles(HIOptions* options)
+{
+    HFSPlus*       hfs       = options->hfs;
+    out_ctx*       ctx       = hfs->vol->ctx;
+    HashCatalog    catalog   = {0};
+    HashBatch      batches[2] = {{0}};
+    HashJob**      active    = NULL;    // Jobs with fork data not yet placed in a batch
+    size_t         activeCount = 0;
+    size_t         activeCapacity = 0;
+    size_t         nextFile  = 0;
+    unsigned       nextFork  = 0;       // 0: data fork of files[nextFile]; 1: its resource fork
+    uint64_t       forkCount = 0;
+    uint64_t       byteCount = 0;
+    struct timeval started   = {0}, finished = {0};
+
+    gettimeofday(&started, NULL);
+
+    if (hfsplus_catalog_scan(hfs, hash_scan_record, &catalog) < 0)
+        die(1, "Could not scan the catalog.");
+
+    qsort(catalog.folders, catalog.folderCount, sizeof(HashFolder), compare_hash_folders);
+
+    IOSched*   sched = iosched_make(hfs, 0, 0);
+    if (sched == NULL) die(1, "Could not start the read scheduler.");
+    WorkQueue* queue = workqueue_make(hfs->threads);
+    if (queue == NULL) die(1, "Could not start hashing threads.");
+
+    SALLOC(batches[0].arena, HASH_BATCH_BUDGET);
+    SALLOC(batches[1].arena, HASH_BATCH_BUDGET);
+
+    const char* algorithmNames[] = { [HIHashSHA256] = "SHA-256", [HIHashCRC32C] = "CRC-32C", [HIHashCRC32] = "CRC-32" };
+    BeginSection(ctx, "File Digests (%s)", algorithmNames[options->hash_algorithm]);
+
+    HashBatch* hashing = NULL;          // Batch currently on the work queue
+    unsigned   current = 0;
+
+    while (1) {
+        HashBatch* batch = &batches[current];
+        batch->used      = 0;
+        batch->itemCount = 0;
+
+        // Continue forks already in progress first, then start new ones while the budget allows.
+        size_t kept = 0;
+        for (size_t i = 0; i < activeCount; i++) {
+            HashJob* job       = active[i];
+            size_t   remaining = job->fork->logicalSize - job->queued;
+            size_t   length    = MIN(MIN(remaining, HASH_WINDOW_SIZE), HASH_BATCH_BUDGET - batch->used);
+            if (length) hash_batch_add(batch, job, length);
+            if (job->queued < job->fork->logicalSize) active[kept++] = job;
+        }
+        activeCount = kept;
+
+        while ((batch->used < HASH_BATCH_BUDGET) && (nextFile < catalog.fileCount)) {
+            const HashFile* file     = &catalog.files[nextFile];
+            hfs_forktype_t  forkType = (nextFork == 0 ? HFSDataForkType : HFSResourceForkType);
+            uint64_t        size     = (nextFork == 0 ? file->dataFork.logicalSize : file->resourceFork.logicalSize);
+
+            if (nextFork++ == 1) { nextFork = 0; nextFile++; }
+
+            // Every file gets a data fork digest; resource forks only when present.
+            if ((forkType == HFSResourceForkType) && (size == 0)) continue;
+
+            HashJob* job = hash_job_make(hfs, file, forkType, options->hash_algorithm);
+            if (job == NULL) {
+                error("Could not load the extents for CNID %u", file->cnid);
+                continue;
+            }
+            forkCount++;
+
+            if (size == 0) {
+                hash_job_print(ctx, &catalog, job);
+                hash_job_free(job);
+                continue;
+            }
+
+            size_t length = MIN(MIN(size, HASH_WINDOW_SIZE), HASH_BATCH_BUDGET - batch->used);
+            hash_batch_add(batch, job, length);
+
+            if (job->queued < job->fork->logicalSize) {
+                if (activeCount == activeCapacity) {
+                    activeCapacity = (activeCapacity ? activeCapacity * 2 : 16);
+                    SREALLOC(active, activeCapacity * sizeof(HashJob*));
+                }
+                active[activeCount++] = job;
+            }
+        }
+
+        // Read this batch in physical order while the previous one hashes.
+        for (size_t i = 0; i < batch->itemCount; i++) {
+            HashItem* item = &batch->items[i];
+            iosched_add(sched, item->job->fork, item->length, item->start, hash_consume, item);
+        }
+        if (iosched_run(sched) < 0)
+            warning("Some reads failed; affected files are marked with '-'.");
+
+        for (size_t i = 0; i < batch->itemCount; i++) {
+            HashItem* item = &batch->items[i];
+            if (item->delivered != item->length) item->job->failed = true;
+            byteCount += item->delivered;
+        }
+
+        // Finish the previous batch, reporting any forks it completed.
+        if (hashing != NULL) {
+            workqueue_wait(queue);
+            for (size_t i = 0; i < hashing->itemCount; i++) {
+                HashJob* job = hashing->items[i].job;
+                if (job->hashed == job->fork->logicalSize) {
+                    hash_job_print(ctx, &catalog, job);
+                    hash_job_free(job);
+                }
+            }
+            hashing = NULL;
+        }
+
+        if (batch->itemCount == 0) break;
+
+        for (size_t i = 0; i < batch->itemCount; i++)
+            workqueue_add(queue, hash_item, &batch->items[i]);
+        hashing = batch;
+        current = !current;
+    }
+
+    gettimeofday(&finished, NULL);
+    double seconds = (finished.tv_sec - started.tv_sec) + ((finished.tv_usec - started.tv_usec) / 1000000.0);
+
+    IOSchedStats stats = {0};
+    iosched_get_stats(sched, &stats);
+
+    EndSection(ctx);
+
+    BeginSection(ctx, "Hash Summary");
+    PrintAttribute(ctx, "Files", "%zu", catalog.fileCount);
+    PrintAttribute(ctx, "Forks", "%llu", forkCount);
+    _PrintDataLength(ctx, "Data Hashed", byteCount);
+    PrintAttribute(ctx, "Reads", "%llu (%llu extents)", stats.reads, stats.segments);
+    PrintAttribute(ctx, "Threads", "%u", workqueue_threads(queue));
+    PrintAttribute(ctx, "Elapsed", "%0.2f seconds", seconds);
+    if (seconds > 0) {
+        char size[128] = {0};
+        (void)format_size(ctx, size, (size_t)(byteCount / seconds), 128);
+        PrintAttribute(ctx, "Throughput", "%s/s", size);
+    }
+    EndSection(ctx);
+
+    workqueue_free(queue);
+    iosched_free(sched);
+
+    SFREE(batches[0].items);
+    SFREE(batches[1].items);
+    SFREE(batches[0].arena);
+    SFREE(batches[1].arena);
+    SFREE(active);
+
+    for (size_t i = 0; i < catalog.folderCount; i++) SFREE(catalog.folders[i].name);
+    for (size_t i = 0; i < catalog.fileCount; i++) SFREE(catalog.files[i].name);
+    SFREE(catalog.folders);
+    SFREE(catalog.files);
+}
+
@@ -6,147 +6,460 @@
 //  Copyright (c) 2014 Adam Knight. All rights reserved.
 //
 
+#include <pthread.h>
+
 #include "operations.h"
 #include "volumes/utilities.h"     // commonly-used utility functions
+#include "volumes/topk.h"
+
+/*
+   The catalog's leaf nodes are scanned in parallel. Each worker thread keeps its own partial
+   summary (counts and top-K heaps) so nothing is locked while records are processed; the
+   partials are merged once the scan is done.
+ */
+
+// One per worker thread.
+typedef struct SummaryPartial {
+    VolumeSummary          summary;
+    TopK*                  rankings[SummaryRankingCount];
+    struct SummaryPartial* next;
+} SummaryPartial;
+
+typedef struct SummaryScan {
+    const HFSPlusExtentEntry* overflow;
+    size_t                    overflowCount;
+    size_t                    top;
+    uint64_t                  leafRecords;  // From the tree header, for the status line
+    uint32_t                  modifyDate;   // The volume's; file ages are measured from it
+    bool                      quiet;        // No status line (machine-readable output)
+    uint8_t                   _reserved[3];
+    uint64_t                  records;      // Processed so far (atomic)
+    pthread_key_t             key;          // The calling thread's SummaryPartial
+    pthread_mutex_t           lock;         // Guards partials
+    SummaryPartial*           partials;
+} SummaryScan;
+
+static const struct {
+    const char* title;
+    const char* key;                // For JSON
+    const char* measure;
+    bool        lowestFirst;
+} SummaryRankingInfo[SummaryRankingCount] = {
+    [SummaryLargestFiles]        = { "Largest Files",         "largestFiles",        "Size",     false },
+    [SummaryMostFragmentedFiles] = { "Most Fragmented Files", "mostFragmentedFiles", "Extents",  false },
+    [SummaryLargestFolders]      = { "Largest Folders",       "largestFolders",      "Items",    false },
+    [SummaryOldestFiles]         = { "Oldest Files",          "oldestFiles",         "Modified", true  },
+    [SummaryNewestFiles]         = { "Newest Files",          "newestFiles",         "Modified", false },
+};
+
+#define DAY (24 * 60 * 60)
+
+// Upper bounds (exclusive) of the SummaryFileAges buckets; the last bucket holds files modified after the volume was.
+static const struct {
+    uint64_t    limit;
+    const char* label;
+} SummaryAgeBuckets[] = {
+    { DAY,               "< 1 day"     },
+    { 7 * DAY,           "< 1 week"    },
+    { 30 * DAY,          "< 1 month"   },
+    { 91 * DAY,          "< 3 months"  },
+    { 182 * DAY,         "< 6 months"  },
+    { 365 * DAY,         "< 1 year"    },
+    { 2 * 365 * DAY,     "< 2 years"   },
+    { 5 * 365 * DAY,     "< 5 years"   },
+    { 10 * 365 * DAY,    "< 10 years"  },
+    { UINT64_MAX,        ">= 10 years" },
+    { 0,                 "future"      },
+};
+#define kSummaryAgeBucketCount (sizeof(SummaryAgeBuckets) / sizeof(SummaryAgeBuckets[0]))
+
+#define kSummaryNameLengthStep 16
+
+typedef enum HistogramScale {
+    HistogramLog2 = 0,              // Bucket 0 holds 0; bucket n holds [2^(n-1), 2^n)
+    HistogramAge,                   // SummaryAgeBuckets
+    HistogramLinear,                // Bucket n holds [n * kSummaryNameLengthStep, (n + 1) * kSummaryNameLengthStep)
+} HistogramScale;
+
+static const struct {
+    const char*    title;
+    const char*    key;             // For JSON
+    HistogramScale scale;
+    bool           bytes;           // Log2 bucket bounds are sizes
+} SummaryHistogramInfo[SummaryHistogramCount] = {
+    [SummaryFileSizes]      = { "File Sizes",          "fileSizes",      HistogramLog2,   true  },
+    [SummaryFileAges]       = { "File Ages",           "fileAges",       HistogramAge,    false },
+    [SummaryExtentsPerFork] = { "Extents per Fork",    "extentsPerFork", HistogramLog2,   false },
+    [SummaryNamesPerFolder] = { "Names per Folder",    "namesPerFolder", HistogramLog2,   false },
+    [SummaryNameLengths]    = { "Name Lengths",        "nameLengths",    HistogramLinear, false },
+    [SummaryHardLinkFanOut] = { "Hard Link Fan-Out",   "hardLinkFanOut", HistogramLog2,   false },
+};
+
+#pragma mark Histograms
+
+static inline unsigned histogram_log2_bucket(uint64_t value)
+{
+    return (value ? (64 - __builtin_clzll(value)) : 0);
+}
+
+static inline void summary_count(SummaryPartial* partial, SummaryHistogram histogram, unsigned bucket)
+{
+    partial->summary.histograms[histogram].buckets[MIN(bucket, kSummaryHistogramBuckets - 1)]++;
+}
+
+static unsigned summary_age_bucket(const SummaryScan* scan, uint32_t date)
+{
+    if (date > scan->modifyDate) return kSummaryAgeBucketCount - 1;
+
+    uint64_t age = scan->modifyDate - date;
+    unsigned i   = 0;
+    while (age >= SummaryAgeBuckets[i].limit) i++;
+    return i;
+}
+
+static unsigned histogram_bucket_count(SummaryHistogram histogram)
+{
+    switch (SummaryHistogramInfo[histogram].scale) {
+        case HistogramAge:    return kSummaryAgeBucketCount;
+        case HistogramLinear: return (256 + kSummaryNameLengthStep - 1) / kSummaryNameLengthStep;
+        default:              return kSummaryHistogramBuckets;
+    }
+}
+
+// The inclusive value range of a bucket (not meaningful for age buckets).
+static void histogram_bucket_range(SummaryHistogram histogram, unsigned bucket, uint64_t* min, uint64_t* max)
+{
+    switch (SummaryHistogramInfo[histogram].scale) {
+        case HistogramLinear:
+            *min = (uint64_t)bucket * kSummaryNameLengthStep;
+            *max = *min + kSummaryNameLengthStep - 1;
+            break;
+
+        case HistogramLog2:
+            *min = (bucket ? (1ULL << (bucket - 1)) : 0);
+            *max = (bucket ? ((bucket == 64) ? UINT64_MAX : (1ULL << bucket) - 1) : 0);
+            break;
+
+        default:
+            *min = *max = 0;
+            break;
+    }
+}
+
+static void histogram_bucket_label(out_ctx* ctx, SummaryHistogram histogram, unsigned bucket, char* label, size_t length)
+{
+    uint64_t min = 0, max = 0;
+
+    if (SummaryHistogramInfo[histogram].scale == HistogramAge) {
+        (void)strlcpy(label, SummaryAgeBuckets[bucket].label, length);
+        return;
+    }
 
+    histogram_bucket_range(histogram, bucket, &min, &max);
 
-int compare_ranked_files(const void* a, const void* b)
+    if (min == max) {
+        (void)snprintf(label, length, "%llu", (unsigned long long)min);
+
+    } else if (SummaryHistogramInfo[histogram].bytes) {
+        char low[50] = "", high[50] = "";
+        (void)format_size(ctx, low, min, 50);
+        (void)format_size(ctx, high, max + 1, 50);
+        (void)snprintf(label, length, "%s - < %s", low, high);
+
+    } else {
+        (void)snprintf(label, length, "%llu - %llu", (unsigned long long)min, (unsigned long long)max);
+    }
+}
+
+#pragma mark Ranking
+
+// Ties go to the lower CNID so the rankings don't depend on thread timing.
+static int compare_ranks_highest(const void* a, const void* b)
 {
     const Rank* A      = (Rank*)a;
     const Rank* B      = (Rank*)b;
 
     int         result = cmp(A->measure, B->measure);
 
-    return result;
+    return (result ? result : cmp(B->cnid, A->cnid));
 }
 
-VolumeSummary generateVolumeSummary(HIOptions* options)
+static int compare_ranks_lowest(const void* a, const void* b)
 {
-    /*
-       Walk the leaf catalog nodes and gather various stats about the volume as a whole.
-     */
+    const Rank* A      = (Rank*)a;
+    const Rank* B      = (Rank*)b;
 
-    VolumeSummary summary = {0};
-    HFSPlus*      hfs     = options->hfs;
+    int         result = cmp(B->measure, A->measure);
 
-    BTreePtr      catalog = NULL;
-    hfsplus_get_catalog_btree(&catalog, hfs);
-    hfs_cnid_t    cnid    = catalog->headerRecord.firstLeafNode;
+    return (result ? result : cmp(B->cnid, A->cnid));
+}
 
-    while (1) {
-        BTreeNodePtr node = NULL;
-        if ( BTGetNode(&node, catalog, cnid) < 0) {
-            perror("get node");
-            die(1, "There was an error fetching node %d", cnid);
-        }
+static void summary_make_rankings(TopK** rankings, size_t top)
+{
+    for (unsigned i = 0; i < SummaryRankingCount; i++)
+        rankings[i] = topk_make(top, sizeof(Rank), (SummaryRankingInfo[i].lowestFirst ? compare_ranks_lowest : compare_ranks_highest));
+}
 
-        // Process node
-        debug("Processing node %d", cnid); summary.nodeCount++;
+static inline void summary_rank(SummaryPartial* partial, SummaryRanking ranking, uint64_t measure, hfs_cnid_t cnid)
+{
+    Rank rank = { .measure = measure, .cnid = cnid };
+    (void)topk_insert(partial->rankings[ranking], &rank);
+}
 
-        for(unsigned recNum = 0; recNum < node->nodeDescriptor->numRecords; recNum++) {
-            summary.recordCount++;
+#pragma mark Merging
 
-            BTreeKeyPtr           recordKey   = NULL;
-            void*                 recordValue = NULL;
-            btree_get_record(&recordKey, &recordValue, node, recNum);
+static void merge_fork_summary(ForkSummary* into, const ForkSummary* from)
+{
+    into->count                     += from->count;
+    into->fragmentedCount           += from->fragmentedCount;
+    into->blockCount                += from->blockCount;
+    into->logicalSpace              += from->logicalSpace;
+    into->extentRecords             += from->extentRecords;
+    into->extentDescriptors         += from->extentDescriptors;
+    into->overflowExtentRecords     += from->overflowExtentRecords;
+    into->overflowExtentDescriptors += from->overflowExtentDescriptors;
+}
 
-            HFSPlusCatalogRecord* record      = (HFSPlusCatalogRecord*)recordValue;
-            switch (record->record_type) {
-                case kHFSPlusFileRecord:
-                {
-                    summary.fileCount++;
+static void merge_volume_summary(VolumeSummary* into, const VolumeSummary* from)
+{
+    into->nodeCount           += from->nodeCount;
+    into->recordCount         += from->recordCount;
+    into->fileCount           += from->fileCount;
+    into->folderCount         += from->folderCount;
+    into->aliasCount          += from->aliasCount;
+    into->hardLinkFileCount   += from->hardLinkFileCount;
+    into->hardLinkFolderCount += from->hardLinkFolderCount;
+    into->symbolicLinkCount   += from->symbolicLinkCount;
+    into->invisibleFileCount  += from->invisibleFileCount;
+    into->emptyFileCount      += from->emptyFileCount;
+    into->emptyDirectoryCount += from->emptyDirectoryCount;
+
+    merge_fork_summary(&into->dataFork, &from->dataFork);
+    merge_fork_summary(&into->resourceFork, &from->resourceFork);
+
+    for (unsigned h = 0; h < SummaryHistogramCount; h++)
+        for (unsigned b = 0; b < kSummaryHistogramBuckets; b++)
+            into->histograms[h].buckets[b] += from->histograms[h].buckets[b];
+}
+
+#pragma mark Scanning
+
+static SummaryPartial* summary_partial(SummaryScan* scan)
+{
+    SummaryPartial* partial = pthread_getspecific(scan->key);
+    if (partial != NULL) return partial;
+
+    SALLOC(partial, sizeof(SummaryPartial));
+    summary_make_rankings(partial->rankings, scan->top);
+    pthread_setspecific(scan->key, partial);
+
+    pthread_mutex_lock(&scan->lock);
+    partial->next  = scan->partials;
+    scan->partials = partial;
+    pthread_mutex_unlock(&scan->lock);
+
+    return partial;
+}
 
-                    HFSPlusCatalogFile* file = &record->catalogFile;
+static void summary_scan_record(SummaryScan* scan, SummaryPartial* partial, const HFSPlusCatalogKey* key, const HFSPlusCatalogRecord* record)
+{
+    VolumeSummary* summary = &partial->summary;
 
-                    // hard links
-                    if (HFSPlusCatalogFileIsHardLink(record)) { summary.hardLinkFileCount++; continue; }
-                    if (HFSPlusCatalogFolderIsHardLink(record)) { summary.hardLinkFolderCount++; continue; }
+    summary->recordCount++;
 
-                    // symlink
-                    if (HFSPlusCatalogRecordIsSymLink(record)) { summary.symbolicLinkCount++; continue; }
+    switch (record->record_type) {
+        case kHFSPlusFileRecord:
+        {
+            summary->fileCount++;
 
-                    // alias
-                    if (file->userInfo.fdFlags & kIsAlias) { summary.aliasCount++; continue; }
+            const HFSPlusCatalogFile* file = &record->catalogFile;
 
-                    // invisible
-                    if (file->userInfo.fdFlags & kIsInvisible) { summary.invisibleFileCount++; continue; }
+            summary_count(partial, SummaryNameLengths, key->nodeName.length / kSummaryNameLengthStep);
 
-                    // file sizes
-                    if ((file->dataFork.logicalSize == 0) && (file->resourceFork.logicalSize == 0)) { summary.emptyFileCount++; continue; }
+            // Hard link inodes (not the links to them) carry the link count.
+            if ((file->flags & kHFSHasLinkChainMask) && !HFSPlusCatalogRecordIsHardLink(record))
+                summary_count(partial, SummaryHardLinkFanOut, histogram_log2_bucket(file->bsdInfo.special.linkCount));
 
-                    if (file->dataFork.logicalSize)
-                        generateForkSummary(options, &summary.dataFork, file, &file->dataFork, HFSDataForkType);
+            // hard links
+            if (HFSPlusCatalogFileIsHardLink(record)) { summary->hardLinkFileCount++; return; }
+            if (HFSPlusCatalogFolderIsHardLink(record)) { summary->hardLinkFolderCount++; return; }
 
-                    if (file->resourceFork.logicalSize)
-                        generateForkSummary(options, &summary.resourceFork, file, &file->resourceFork, HFSResourceForkType);
+            // Distributions cover every file that isn't a link to another record.
+            summary_count(partial, SummaryFileSizes, histogram_log2_bucket(file->dataFork.logicalSize + file->resourceFork.logicalSize));
+            summary_count(partial, SummaryFileAges, summary_age_bucket(scan, file->contentModDate));
 
-                    size_t fileSize = file->dataFork.logicalSize + file->resourceFork.logicalSize;
+            // symlink
+            if (HFSPlusCatalogRecordIsSymLink(record)) { summary->symbolicLinkCount++; return; }
 
-                    if (summary.largestFiles[0].measure < fileSize) {
-                        summary.largestFiles[0].measure = fileSize;
-                        summary.largestFiles[0].cnid    = file->fileID;
-                        qsort(summary.largestFiles, 10, sizeof(Rank), compare_ranked_files);
-                    }
+            // alias
+            if (file->userInfo.fdFlags & kIsAlias) { summary->aliasCount++; return; }
 
-                    break;
-                }
+            // invisible
+            if (file->userInfo.fdFlags & kIsInvisible) { summary->invisibleFileCount++; return; }
 
-                case kHFSPlusFolderRecord:
-                {
-                    summary.folderCount++;
+            // file sizes
+            if ((file->dataFork.logicalSize == 0) && (file->resourceFork.logicalSize == 0)) { summary->emptyFileCount++; return; }
 
-                    HFSPlusCatalogFolder* folder = &record->catalogFolder;
-                    if (folder->valence == 0) summary.emptyDirectoryCount++;
+            uint32_t extents = 0;
 
-                    break;
-                }
+            if (file->dataFork.logicalSize) {
+                uint32_t forkExtents = generateForkSummary(&summary->dataFork, scan->overflow, scan->overflowCount, file, &file->dataFork, HFSDataForkType);
+                summary_count(partial, SummaryExtentsPerFork, histogram_log2_bucket(forkExtents));
+                extents += forkExtents;
+            }
 
-                default:
-                {
-                    break;
-                }
+            if (file->resourceFork.logicalSize) {
+                uint32_t forkExtents = generateForkSummary(&summary->resourceFork, scan->overflow, scan->overflowCount, file, &file->resourceFork, HFSResourceForkType);
+                summary_count(partial, SummaryExtentsPerFork, histogram_log2_bucket(forkExtents));
+                extents += forkExtents;
             }
 
+            summary_rank(partial, SummaryLargestFiles, file->dataFork.logicalSize + file->resourceFork.logicalSize, file->fileID);
+            if (extents > 1) summary_rank(partial, SummaryMostFragmentedFiles, extents, file->fileID);
+            summary_rank(partial, SummaryOldestFiles, file->contentModDate, file->fileID);
+            summary_rank(partial, SummaryNewestFiles, file->contentModDate, file->fileID);
+
+            break;
         }
 
-        // Follow link
-        cnid = node->nodeDescriptor->fLink;
-        if (cnid == 0)   break;        // End Of Line
+        case kHFSPlusFolderRecord:
+        {
+            summary->folderCount++;
+
+            const HFSPlusCatalogFolder* folder = &record->catalogFolder;
+            summary_count(partial, SummaryNameLengths, key->nodeName.length / kSummaryNameLengthStep);
+            summary_count(partial, SummaryNamesPerFolder, histogram_log2_bucket(folder->valence));
+            if (folder->flags & kHFSHasLinkChainMask)
+                summary_count(partial, SummaryHardLinkFanOut, histogram_log2_bucket(folder->bsdInfo.special.linkCount));
+
+            if (folder->valence == 0) summary->emptyDirectoryCount++;
+            else summary_rank(partial, SummaryLargestFolders, folder->valence, folder->folderID);
 
-        // Console Status
-        static int      count     = 0; // count of records so far
-        static unsigned iter_size = 0; // update the status after this many records
-        if (iter_size == 0) {
-            iter_size = (catalog->headerRecord.leafRecords/100000);
-            if (iter_size == 0) iter_size = 100;
+            break;
         }
 
-        count += node->nodeDescriptor->numRecords;
-        //        if (count >= 100000) break;
-
-        if ((count % iter_size) == 0) {
-            // Update status
-            size_t space     = summary.dataFork.logicalSpace + summary.resourceFork.logicalSpace;
-            char   size[128] = {0};
-            (void)format_size(options->hfs->vol->ctx, size, space, 128);
-
-            fprintf(stdout, "\r%0.2f%% (files: %ju; directories: %ju; size: %s)",
-                    ((float)count / (float)catalog->headerRecord.leafRecords) * 100.,
-                    (intmax_t)summary.fileCount,
-                    (intmax_t)summary.folderCount,
-                    size
-                    );
-            fflush(stdout);
+        default:
+        {
+            break;
         }
+    }
+}
+
+static int summary_scan_node(void* context, const BTreeNodePtr node)
+{
+    SummaryScan*    scan    = context;
+    SummaryPartial* partial = summary_partial(scan);
 
-        btree_free_node(node);
+    // Process node
+    debug("Processing node %d", node->nodeNumber); partial->summary.nodeCount++;
+
+    for (unsigned recNum = 0; recNum < node->recordCount; recNum++) {
+        BTreeKeyPtr recordKey   = NULL;
+        void*       recordValue = NULL;
+        if (btree_get_record(&recordKey, &recordValue, node, recNum) < 0) continue;
+
+        summary_scan_record(scan, partial, (HFSPlusCatalogKey*)recordKey, (HFSPlusCatalogRecord*)recordValue);
+    }
+
+    // Console Status: roughly every 1% of the catalog, from whichever thread crosses the mark.
+    uint64_t step   = MAX(scan->leafRecords / 100, 100);
+    uint64_t before = __atomic_fetch_add(&scan->records, node->recordCount, __ATOMIC_RELAXED);
+    uint64_t after  = before + node->recordCount;
+    if ( !scan->quiet && ((before / step) != (after / step)) ) {
+        fprintf(stdout, "\r%0.2f%% (records: %ju)", MIN(((float)after / (float)MAX(scan->leafRecords, 1)) * 100., 100.), (uintmax_t)after);
+        fflush(stdout);
     }
 
-    return summary;
+    return 0;
 }
 
-void generateForkSummary(HIOptions* options, ForkSummary* forkSummary, const HFSPlusCatalogFile* file, const HFSPlusForkData* fork, hfs_forktype_t type)
+int generateVolumeSummary(VolumeSummary* summary, HIOptions* options)
 {
+    /*
+       Walk the leaf catalog nodes and gather various stats about the volume as a whole.
+     */
+
+    HFSPlus*            hfs      = options->hfs;
+    BTreePtr            catalog  = NULL;
+    HFSPlusExtentEntry* overflow = NULL;
+    SummaryScan         scan     = {0};
+    TopK*               rankings[SummaryRankingCount];
+    int                 result   = 0;
+    int                 failure  = 0;
+
+    *summary = (VolumeSummary){0};
+
+    if (hfsplus_get_catalog_btree(&catalog, hfs) < 0) {
+        error("Could not get the catalog B-tree.");
+        return -1;
+    }
+
+    if (hfsplus_extents_read_all(&overflow, &scan.overflowCount, hfs) < 0) {
+        error("Could not read the extents overflow file.");
+        return -1;
+    }
+
+    scan.overflow    = overflow;
+    scan.top         = MAX(options->top, 1);
+    scan.leafRecords = catalog->headerRecord.leafRecords;
+    scan.modifyDate  = hfs->vh.modifyDate;
+    scan.quiet       = (options->json || options->quiet);
+    if ((failure = pthread_key_create(&scan.key, NULL)) != 0) {
+        error("Could not create summary thread state.");
+        SFREE(overflow);
+        errno = failure;
+        return -1;
+    }
+    pthread_mutex_init(&scan.lock, NULL);
+
+    if (hfsplus_catalog_scan_parallel(hfs, summary_scan_node, &scan) < 0) {
+        failure = errno;
+        error("There was an error fetching the catalog's leaf nodes.");
+        result  = -1;
+    }
+
+    // Merge the per-thread partials (freeing them even when the scan stopped early).
+    summary_make_rankings(rankings, scan.top);
+    for (SummaryPartial* partial = scan.partials, * next = NULL; partial != NULL; partial = next) {
+        next = partial->next;
+
+        merge_volume_summary(summary, &partial->summary);
+        for (unsigned i = 0; i < SummaryRankingCount; i++) {
+            topk_merge(rankings[i], partial->rankings[i]);
+            topk_free(partial->rankings[i]);
+        }
+        SFREE(partial);
+    }
+
+    for (unsigned i = 0; i < SummaryRankingCount; i++) {
+        size_t      count = 0;
+        const Rank* ranks = topk_finish(rankings[i], &count);
+
+        summary->rankings[i].count = count;
+        if (count) {
+            SALLOC(summary->rankings[i].ranks, count * sizeof(Rank));
+            memcpy(summary->rankings[i].ranks, ranks, count * sizeof(Rank));
+        }
+        topk_free(rankings[i]);
+    }
+
+    pthread_key_delete(scan.key);
+    pthread_mutex_destroy(&scan.lock);
+    SFREE(overflow);
+
+    if (result < 0) {
+        freeVolumeSummary(summary);
+        errno = failure;
+    }
+
+    return result;
+}
+
+uint32_t generateForkSummary(ForkSummary* forkSummary, const HFSPlusExtentEntry* overflow, size_t overflowCount, const HFSPlusCatalogFile* file, const HFSPlusForkData* fork, hfs_forktype_t type)
+{
+    uint32_t extents = 0;
+    uint64_t blocks  = 0;
+
     forkSummary->count++;
 
     forkSummary->blockCount   += fork->totalBlocks;
@@ -157,33 +470,104 @@ void generateForkSummary(HIOptions* options, ForkSummary* forkSummary, const HFS
     if (fork->extents[1].blockCount > 0) forkSummary->fragmentedCount++;
 
     for (unsigned i = 0; i < kHFSPlusExtentDensity; i++) {
-        if (fork->extents[i].blockCount > 0) forkSummary->extentDescriptors++; else break;
+        if (fork->extents[i].blockCount == 0) break;
+        forkSummary->extentDescriptors++;
+        extents++;
+        blocks += fork->extents[i].blockCount;
     }
 
-    HFSPlusFork* hfsfork;
-    if ( hfsfork_make(&hfsfork, options->hfs, *fork, type, file->fileID) < 0 ) {
-        die(1, "Could not create fork reference for fileID %u", file->fileID);
+    // The overflow file only holds the rest of forks the inline extents don't cover.
+    if (blocks < fork->totalBlocks) {
+        const HFSPlusExtentEntry* entries = NULL;
+        size_t                    count   = hfsplus_extents_fork_entries(overflow, overflowCount, file->fileID, type, &entries);
+
+        for (size_t r = 0; r < count; r++) {
+            forkSummary->overflowExtentRecords++;
+            for (unsigned i = 0; i < kHFSPlusExtentDensity; i++) {
+                if (entries[r].extents[i].blockCount == 0) break;
+                forkSummary->overflowExtentDescriptors++;
+                extents++;
+            }
+        }
     }
 
-    ExtentList* extents = hfsfork->extents;
+    return extents;
+}
 
-    unsigned    counter = 1;
+void freeVolumeSummary(VolumeSummary* summary)
+{
+    for (unsigned i = 0; i < SummaryRankingCount; i++) {
+        SFREE(summary->rankings[i].ranks);
+        summary->rankings[i].count = 0;
+    }
+}
 
-    Extent*     e       = NULL;
-    TAILQ_FOREACH(e, extents, extents) {
-        forkSummary->overflowExtentDescriptors++;
-        if (counter && (counter == kHFSPlusExtentDensity) ) {
-            forkSummary->overflowExtentRecords++;
-            counter = 1;
-        } else {
-            counter++;
+#pragma mark Output
+
+static void PrintSummaryRanking(out_ctx* ctx, const HFSPlus* hfs, SummaryRanking ranking, const Ranking* ranks)
+{
+    BeginSection(ctx, "%s", SummaryRankingInfo[ranking].title);
+    Print(ctx, "%-4s %24s %10s %s", "#", SummaryRankingInfo[ranking].measure, "CNID", "Name");
+
+    for (size_t i = 0; i < ranks->count; i++) {
+        const Rank* rank        = &ranks->ranks[i];
+        char        measure[50] = "";
+        hfs_str     name        = "";
+
+        switch (ranking) {
+            case SummaryLargestFiles:
+                (void)format_size(ctx, measure, rank->measure, 50);
+                break;
+
+            case SummaryOldestFiles:
+            case SummaryNewestFiles:
+                (void)format_hfs_timestamp(ctx, measure, (uint32_t)rank->measure, 50);
+                break;
+
+            default:
+                (void)snprintf(measure, 50, "%llu", (unsigned long long)rank->measure);
+                break;
         }
+
+        HFSPlusGetCNIDName(&name, (FSSpec){ .hfs = hfs, .parentID = rank->cnid });
+        Print(ctx, "%-4zu %24s %10u %s", i + 1, measure, rank->cnid, name);
     }
 
-    hfsfork_free(hfsfork);
+    EndSection(ctx);
 }
 
-void PrintVolumeSummary(out_ctx* ctx, const VolumeSummary* summary)
+static void PrintSummaryHistogram(out_ctx* ctx, SummaryHistogram histogram, const Histogram* counts)
+{
+    unsigned buckets = histogram_bucket_count(histogram);
+    unsigned first   = buckets, last = 0;
+    uint64_t total   = 0, peak = 0;
+
+    for (unsigned b = 0; b < buckets; b++) {
+        if (counts->buckets[b] == 0) continue;
+        first  = MIN(first, b);
+        last   = b;
+        total += counts->buckets[b];
+        peak   = MAX(peak, counts->buckets[b]);
+    }
+
+    BeginSection(ctx, "%s", SummaryHistogramInfo[histogram].title);
+
+    // Only the span between the first and last used buckets.
+    for (unsigned b = first; (total != 0) && (b <= last); b++) {
+        char     label[100] = "";
+        char     bar[41]    = "";
+        uint64_t count      = counts->buckets[b];
+        size_t   width      = (size_t)((count * 40 + peak - 1) / peak);
+
+        histogram_bucket_label(ctx, histogram, b, label, 100);
+        memset(bar, '#', width);
+        Print(ctx, "%-28s %12llu %7.2f%% %s", label, (unsigned long long)count, (100.0 * count) / total, bar);
+    }
+
+    EndSection(ctx);
+}
+
+void PrintVolumeSummary(out_ctx* ctx, const HFSPlus* hfs, const VolumeSummary* summary)
 {
     BeginSection  (ctx, "Volume Summary");
     PrintUI             (ctx, summary, nodeCount);
@@ -206,18 +590,11 @@ void PrintVolumeSummary(out_ctx* ctx, const VolumeSummary* summary)
     PrintForkSummary    (ctx, &summary->resourceFork);
     EndSection(ctx);
 
-    BeginSection  (ctx, "Largest Files");
-    print("# %10s %10s", "Size", "CNID");
-    for (unsigned i = 9; i > 0; i--) {
-        if (summary->largestFiles[i].cnid == 0) continue;
+    for (unsigned i = 0; i < SummaryRankingCount; i++)
+        PrintSummaryRanking(ctx, hfs, i, &summary->rankings[i]);
 
-        char    size[50];
-        (void)format_size(ctx, size, summary->largestFiles[i].measure, 50);
-        hfs_str name = "";
-        HFSPlusGetCNIDName(&name, (FSSpec){get_hfs_volume(), summary->largestFiles[i].cnid});
-        print("%d %10s %10u %s", 10-i, size, summary->largestFiles[i].cnid, name);
-    }
-    EndSection(ctx); // largest files
+    for (unsigned i = 0; i < SummaryHistogramCount; i++)
+        PrintSummaryHistogram(ctx, i, &summary->histograms[i]);
 
     EndSection(ctx); // volume summary
 }
@@ -235,3 +612,110 @@ void PrintForkSummary(out_ctx* ctx, const ForkSummary* summary)
     PrintUI             (ctx, summary, overflowExtentDescriptors);
 }
 
+#pragma mark JSON Output
+
+void PrintJSONString(FILE* fp, const char* string)
+{
+    fputc('"', fp);
+    for (const unsigned char* c = (const unsigned char*)string; *c; c++) {
+        switch (*c) {
+            case '"':  fputs("\\\"", fp); break;
+            case '\\': fputs("\\\\", fp); break;
+            case '\n': fputs("\\n", fp); break;
+            case '\r': fputs("\\r", fp); break;
+            case '\t': fputs("\\t", fp); break;
+            default:
+                if (*c < 0x20) fprintf(fp, "\\u%04x", *c);
+                else fputc(*c, fp);
+                break;
+        }
+    }
+    fputc('"', fp);
+}
+
+static void json_fork_summary(FILE* fp, const char* key, const ForkSummary* summary)
+{
+    fprintf(fp, "  \"%s\": {", key);
+    fprintf(fp, "\"count\": %llu, ", (unsigned long long)summary->count);
+    fprintf(fp, "\"fragmentedCount\": %llu, ", (unsigned long long)summary->fragmentedCount);
+    fprintf(fp, "\"blockCount\": %llu, ", (unsigned long long)summary->blockCount);
+    fprintf(fp, "\"logicalSpace\": %llu, ", (unsigned long long)summary->logicalSpace);
+    fprintf(fp, "\"extentRecords\": %llu, ", (unsigned long long)summary->extentRecords);
+    fprintf(fp, "\"extentDescriptors\": %llu, ", (unsigned long long)summary->extentDescriptors);
+    fprintf(fp, "\"overflowExtentRecords\": %llu, ", (unsigned long long)summary->overflowExtentRecords);
+    fprintf(fp, "\"overflowExtentDescriptors\": %llu},\n", (unsigned long long)summary->overflowExtentDescriptors);
+}
+
+void PrintVolumeSummaryJSON(FILE* fp, const HFSPlus* hfs, const VolumeSummary* summary)
+{
+    const struct {
+        const char* key;
+        uint64_t    value;
+    } counts[] = {
+        { "nodeCount",           summary->nodeCount },
+        { "recordCount",         summary->recordCount },
+        { "fileCount",           summary->fileCount },
+        { "folderCount",         summary->folderCount },
+        { "aliasCount",          summary->aliasCount },
+        { "hardLinkFileCount",   summary->hardLinkFileCount },
+        { "hardLinkFolderCount", summary->hardLinkFolderCount },
+        { "symbolicLinkCount",   summary->symbolicLinkCount },
+        { "invisibleFileCount",  summary->invisibleFileCount },
+        { "emptyFileCount",      summary->emptyFileCount },
+        { "emptyDirectoryCount", summary->emptyDirectoryCount },
+    };
+
+    fputs("{\n", fp);
+    for (unsigned i = 0; i < (sizeof(counts) / sizeof(counts[0])); i++)
+        fprintf(fp, "  \"%s\": %llu,\n", counts[i].key, (unsigned long long)counts[i].value);
+
+    json_fork_summary(fp, "dataFork", &summary->dataFork);
+    json_fork_summary(fp, "resourceFork", &summary->resourceFork);
+
+    fputs("  \"rankings\": {\n", fp);
+    for (unsigned r = 0; r < SummaryRankingCount; r++) {
+        const Ranking* ranking = &summary->rankings[r];
+
+        fprintf(fp, "    \"%s\": [", SummaryRankingInfo[r].key);
+        for (size_t i = 0; i < ranking->count; i++) {
+            hfs_str name = "";
+            HFSPlusGetCNIDName(&name, (FSSpec){ .hfs = hfs, .parentID = ranking->ranks[i].cnid });
+
+            fprintf(fp, "%s\n      {\"cnid\": %u, \"measure\": %llu, \"name\": ", (i ? "," : ""),
+                    ranking->ranks[i].cnid, (unsigned long long)ranking->ranks[i].measure);
+            PrintJSONString(fp, (char*)name);
+            fputc('}', fp);
+        }
+        fprintf(fp, "%s]%s\n", (ranking->count ? "\n    " : ""), ((r + 1) < SummaryRankingCount ? "," : ""));
+    }
+    fputs("  },\n", fp);
+
+    fputs("  \"histograms\": {\n", fp);
+    for (unsigned h = 0; h < SummaryHistogramCount; h++) {
+        const Histogram* histogram = &summary->histograms[h];
+        unsigned         buckets   = histogram_bucket_count(h);
+
+        // Log2 and linear histograms stop after the last used bucket; age buckets are always listed.
+        if (SummaryHistogramInfo[h].scale != HistogramAge)
+            while ((buckets > 1) && (histogram->buckets[buckets - 1] == 0)) buckets--;
+
+        fprintf(fp, "    \"%s\": [", SummaryHistogramInfo[h].key);
+        for (unsigned b = 0; b < buckets; b++) {
+            if (SummaryHistogramInfo[h].scale == HistogramAge) {
+                fprintf(fp, "%s\n      {\"label\": ", (b ? "," : ""));
+                PrintJSONString(fp, SummaryAgeBuckets[b].label);
+                fprintf(fp, ", \"count\": %llu}", (unsigned long long)histogram->buckets[b]);
+
+            } else {
+                uint64_t min = 0, max = 0;
+                histogram_bucket_range(h, b, &min, &max);
+                fprintf(fp, "%s\n      {\"min\": %llu, \"max\": %llu, \"count\": %llu}", (b ? "," : ""),
+                        (unsigned long long)min, (unsigned long long)max, (unsigned long long)histogram->buckets[b]);
+            }
+        }
+        fprintf(fp, "\n    ]%s\n", ((h + 1) < SummaryHistogramCount ? "," : ""));
+    }
+    fputs("  }\n", fp);
+
+    fputs("}\n", fp);
+}
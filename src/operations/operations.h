@@ -14,6 +14,7 @@
 #include "hfs/hfs.h"
 #include "hfs/types.h"
 #include "hfs/catalog.h"
+#include "hfs/extents.h"
 #include "hfs/output_hfs.h"
 #include "hfs/unicode.h"
 #include "logging/logging.h"    // console printing routines
@@ -23,6 +24,10 @@ extern char* BTreeOptionExtents;
 extern char* BTreeOptionAttributes;
 extern char* BTreeOptionHotfiles;
 
+extern char* HashOptionSHA256;
+extern char* HashOptionCRC32C;
+extern char* HashOptionCRC32;
+
 typedef enum BTreeTypes {
     BTreeTypeCatalog = 0,
     BTreeTypeExtents,
@@ -30,6 +35,18 @@ typedef enum BTreeTypes {
     BTreeTypeHotfiles
 } BTreeTypes;
 
+typedef enum HIHashAlgorithm {
+    HIHashSHA256 = 0,
+    HIHashCRC32C,
+    HIHashCRC32
+} HIHashAlgorithm;
+
+typedef enum HIListingSort {
+    HIListingSortName = 0,          // Catalog order
+    HIListingSortSize,              // Largest first
+    HIListingSortDate               // Newest first
+} HIListingSort;
+
 enum HIModes {
     HIModeShowVolumeInfo = 0,
     HIModeShowJournalInfo,
@@ -44,6 +61,13 @@ enum HIModes {
     HIModeShowDiskInfo,
     HIModeYankFS,
     HIModeFreeSpace,
+    HIModeHashFiles,
+    HIModeVerifyBTree,
+    HIModeCheckAllocation,
+    HIModeBlockOwners,
+    HIModeFragmentation,
+    HIModeFolderSizes,
+    HIModeBatch,
 };
 
 // Configuration context
@@ -59,11 +83,27 @@ typedef struct HIOptions {
     bt_nodeid_t         cnid;
     bt_nodeid_t         node_id;
     BTreeTypes          tree_type;
+    HIHashAlgorithm     hash_algorithm;
+    uint32_t            verify_trees;       // Bit (1 << BTreeTypes) for each tree to verify
+    char*               block_list;         // Blocks to look up (see showBlockOwners)
+    uint32_t            top;                // Length of ranked lists (see showFragmentation, showFolderSizes, generateVolumeSummary)
+    bool                json;               // Machine-readable output where supported (--json)
+    bool                quiet;              // Print nothing; results only come back from the operation (see runBatch)
+    uint8_t             list_sort;          // HIListingSort for -l (--sort)
+    uint32_t            list_limit;         // Rows listed by -l; 0 for all (--limit)
+    uint32_t            list_newer;         // Only list children modified since this HFS timestamp (--newer)
+    uint64_t            list_min_size;      // Only list children at least this large (--larger)
+    char*               list_pattern;       // Only list children with names matching this fnmatch(3) pattern (--match)
+    uint32_t            batch_threads;      // Sources processed at once by --batch; 0 for one per CPU (--threads)
+    uint64_t            memory_budget;      // Bytes of B-tree node cache shared by every open volume; 0 for the default (--memory)
+    uint32_t            queue_depth;        // Reads kept in flight by bulk readers; 0 for the default (--queue-depth)
 
     char                device_path[PATH_MAX];
     char                file_path[PATH_MAX];
     char                record_filename[PATH_MAX];
     char                extract_path[PATH_MAX];
+    char                block_index_path[PATH_MAX];
+    char                index_path[PATH_MAX];
 } HIOptions;
 
 void set_mode (HIOptions* options, int mode);
@@ -72,13 +112,51 @@ bool check_mode (HIOptions* options, int mode);
 
 void die(int val, char* format, ...) __attribute__(( noreturn ));
 
+// Runs of used and free blocks in the allocation bitmap (--freespace)
+typedef struct FreeSpaceStats {
+    size_t segments;
+    size_t usedBlocks;
+    size_t freeBlocks;
+    size_t bitmapBytes;
+} FreeSpaceStats;
+
+char*   readAllocationFile(const HFSPlus* hfs, size_t* length) __attribute__((nonnull));
+int     generateFreeSpaceStats(FreeSpaceStats* stats, const HFSPlus* hfs) __attribute__((nonnull));
 void    showFreeSpace(HIOptions* options);
+void    hashFiles(HIOptions* options);
+int     verifyBTrees(HIOptions* options);
+int     checkAllocation(HIOptions* options);
+void    showBlockOwners(HIOptions* options);
+void    showFragmentation(HIOptions* options);
+void    showFolderSizes(HIOptions* options);
+int     runBatch(HIOptions* options, int argc, char* const* argv);
+void    showFolderListing(HIOptions* options, bt_nodeid_t folderID);
 void    showPathInfo(HIOptions* options);
 void    showCatalogRecord(HIOptions* options, FSSpec spec, bool followThreads);
 ssize_t extractFork(const HFSPlusFork* fork, const char* extractPath);
 void    extractHFSPlusCatalogFile(const HFSPlus* hfs, const HFSPlusCatalogFile* file, const char* extractPath);
 
 
+// For block ownership
+typedef enum ExtentOwnerKind {
+    ExtentOwnerReserved = 0,        // Volume headers; cnid is 0
+    ExtentOwnerDataFork,
+    ExtentOwnerResourceFork,
+    ExtentOwnerAttribute,           // Fork data of an extended attribute
+} ExtentOwnerKind;
+
+typedef struct ExtentOwner {
+    uint32_t startBlock;
+    uint32_t blockCount;
+    uint32_t cnid;
+    uint32_t logicalBlock;          // Offset of the extent within its fork, in allocation blocks
+    uint8_t  kind;                  // ExtentOwnerKind
+    uint8_t  _reserved[3];
+} ExtentOwner;
+
+int         collectExtentOwners (const HFSPlus* hfs, ExtentOwner** owners, size_t* count) __attribute__((nonnull));
+const char* ExtentOwnerKindName (uint8_t kind);
+
 // For volume statistics
 typedef struct Rank {
     uint64_t measure;
@@ -86,6 +164,37 @@ typedef struct Rank {
     uint32_t _reserved;
 } Rank;
 
+typedef struct Ranking {
+    Rank*  ranks;                   // Best first
+    size_t count;
+} Ranking;
+
+typedef enum SummaryRanking {
+    SummaryLargestFiles = 0,        // By combined fork size
+    SummaryMostFragmentedFiles,     // By extent count
+    SummaryLargestFolders,          // By valence
+    SummaryOldestFiles,             // By content modification date
+    SummaryNewestFiles,
+    SummaryRankingCount
+} SummaryRanking;
+
+// Fixed buckets, so histograms from different threads merge by adding them up.
+#define kSummaryHistogramBuckets 65
+
+typedef struct Histogram {
+    uint64_t buckets[kSummaryHistogramBuckets];
+} Histogram;
+
+typedef enum SummaryHistogram {
+    SummaryFileSizes = 0,           // log2 buckets of data + resource bytes
+    SummaryFileAges,                // Time from content modification to the volume's last modification
+    SummaryExtentsPerFork,          // log2 buckets
+    SummaryNamesPerFolder,          // log2 buckets of valence
+    SummaryNameLengths,             // 16-character steps
+    SummaryHardLinkFanOut,          // log2 buckets of the link count of each hard link inode
+    SummaryHistogramCount
+} SummaryHistogram;
+
 typedef struct ForkSummary {
     uint64_t count;
     uint64_t fragmentedCount;
@@ -110,17 +219,20 @@ typedef struct VolumeSummary {
     uint64_t    emptyFileCount;
     uint64_t    emptyDirectoryCount;
 
-    Rank        largestFiles[10];
-    Rank        mostFragmentedFiles[10];
+    Ranking     rankings[SummaryRankingCount];     // Top -t of each
+    Histogram   histograms[SummaryHistogramCount];
 
     ForkSummary dataFork;
     ForkSummary resourceFork;
 } VolumeSummary;
 
 
-VolumeSummary generateVolumeSummary(HIOptions* options);
-void          generateForkSummary(HIOptions* options, ForkSummary* forkSummary, const HFSPlusCatalogFile* file, const HFSPlusForkData* fork, hfs_forktype_t type);
-void          PrintVolumeSummary             (out_ctx* ctx, const VolumeSummary* summary) _NONNULL;
+int           generateVolumeSummary(VolumeSummary* summary, HIOptions* options);
+uint32_t      generateForkSummary(ForkSummary* forkSummary, const HFSPlusExtentEntry* overflow, size_t overflowCount, const HFSPlusCatalogFile* file, const HFSPlusForkData* fork, hfs_forktype_t type);
+void          freeVolumeSummary(VolumeSummary* summary);
+void          PrintVolumeSummary             (out_ctx* ctx, const HFSPlus* hfs, const VolumeSummary* summary) _NONNULL;
+void          PrintVolumeSummaryJSON         (FILE* fp, const HFSPlus* hfs, const VolumeSummary* summary) _NONNULL;
 void          PrintForkSummary               (out_ctx* ctx, const ForkSummary* summary) _NONNULL;
+void          PrintJSONString                (FILE* fp, const char* string) _NONNULL;
 
 #endif
@@ -0,0 +1,686 @@
+//
+//  verify_btree.c
+//  hfsinspect
+//
+//
+
+#include <sys/time.h>           // gettimeofday
+#include <stdarg.h>
+
+#include "operations.h"
+#include "hfs/hfs_io.h"
+#include "hfs/hfs_endian.h"
+#include "hfs/extents.h"
+#include "hfsplus/hfsplus.h"
+#include "volumes/workqueue.h"
+
+/*
+   Checks a whole B-tree in two passes:
+
+   1. The tree file is read front to back in large chunks and each chunk is validated on the
+      work queue. Workers look at one node at a time, straight from the on-disk bytes (nothing
+      goes through the node cache or the byte-swapping in btree_get_node, which assume a sane
+      node), and boil each node down to a small summary: links, kind, height, record count,
+      any problems found, and host-order copies of the keys the second pass needs.
+   2. The main thread walks the summaries to check what no single node can tell: the index
+      reaches every node once at the right height, index keys match their children, sibling
+      links agree in both directions, keys ascend across siblings, the leaf chain accounts for
+      every leaf record, and the node map agrees with what the tree actually uses.
+ */
+
+#define VERIFY_CHUNK_SIZE (1024 * 1024)     // Bytes of the tree file handed to a worker at once
+
+typedef enum VerifyNodeProblem {
+    VerifyUnreadable    = 1 << 0,
+    VerifySentinel      = 1 << 1,
+    VerifyKind          = 1 << 2,
+    VerifyHeight        = 1 << 3,
+    VerifyRecordCount   = 1 << 4,
+    VerifyOffsets       = 1 << 5,
+    VerifyKeyLength     = 1 << 6,
+    VerifyKeyOrder      = 1 << 7,
+    VerifyChildPointer  = 1 << 8,
+} VerifyNodeProblem;
+
+static const struct {
+    uint32_t    problem;
+    const char* message;
+} VerifyNodeProblemMessages[] = {
+    { VerifyUnreadable,   "could not be read" },
+    { VerifySentinel,     "is not a B-tree node (bad record offset sentinel)" },
+    { VerifyKind,         "has an invalid node kind" },
+    { VerifyHeight,       "has a height that doesn't fit its kind or the tree depth" },
+    { VerifyRecordCount,  "has a record count that doesn't fit the node" },
+    { VerifyOffsets,      "has record offsets out of range or out of order" },
+    { VerifyKeyLength,    "has a key that is malformed or longer than its record" },
+    { VerifyKeyOrder,     "has keys out of order" },
+    { VerifyChildPointer, "has an index record pointing outside the tree" },
+};
+
+typedef struct NodeSummary {
+    bt_nodeid_t  fLink;
+    bt_nodeid_t  bLink;
+    uint32_t     problems;      // VerifyNodeProblem bits from the first pass
+    uint16_t     numRecords;
+    int8_t       kind;
+    uint8_t      height;
+    bool         blank;         // All zeroes (a free node)
+    bool         reached;       // Found by the second pass
+    bool         used;          // Allocated in the tree's node map
+    uint8_t      _reserved;
+    BTreeKey*    firstKey;      // Host-order copies; NULL if the tree has no comparator
+    BTreeKey*    lastKey;
+    bt_nodeid_t* children;      // Index nodes: the child pointer of each record
+    BTreeKey**   childKeys;     // Index nodes: the key of each record
+} NodeSummary;
+
+typedef struct VerifyChunk {
+    BTreePtr     tree;
+    NodeSummary* summaries;
+    char*        buffer;
+    bt_nodeid_t  start;
+    bt_nodeid_t  count;
+} VerifyChunk;
+
+typedef struct VerifyReport {
+    out_ctx* ctx;
+    uint64_t problems;
+    bool     quiet;             // Count problems without printing them
+    uint8_t  _reserved[7];
+} VerifyReport;
+
+#pragma mark Node Validation
+
+static inline uint16_t raw16(const char* p)
+{
+    uint16_t value = 0;
+    memcpy(&value, p, sizeof(value));
+    return be16toh(value);
+}
+
+static inline uint32_t raw32(const char* p)
+{
+    uint32_t value = 0;
+    memcpy(&value, p, sizeof(value));
+    return be32toh(value);
+}
+
+// Copies a big-endian key (length field included) and swaps it for the tree's comparator.
+// Returns NULL if the key is too short for its own contents.
+static BTreeKey* verify_copy_key(const BTreePtr tree, const char* raw, size_t length)
+{
+    switch (tree->treeID) {
+        case kHFSCatalogFileID:
+        {
+            // keyLength, parentID, nodeName.length, then the name itself.
+            if ((length < 8) || ((size_t)(8 + raw16(raw + 6) * 2) > length) || (raw16(raw + 6) > 255)) return NULL;
+            break;
+        }
+
+        case kHFSExtentsFileID:
+        {
+            if (length < sizeof(HFSPlusExtentKey)) return NULL;
+            break;
+        }
+
+        case kHFSAttributesFileID:
+        {
+            // keyLength, pad, fileID, startBlock, attrNameLen, then the name.
+            if ((length < 14) || ((size_t)(14 + raw16(raw + 12) * 2) > length) || (raw16(raw + 12) > kHFSMaxAttrNameLen)) return NULL;
+            break;
+        }
+
+        default:
+            return NULL;
+    }
+
+    BTreeKey* key = ALLOC(length);
+    if (key == NULL) return NULL;
+    memcpy(key, raw, length);
+    key->length16 = be16toh(key->length16);
+
+    switch (tree->treeID) {
+        case kHFSCatalogFileID:    swap_HFSPlusCatalogKey((HFSPlusCatalogKey*)key); break;
+        case kHFSExtentsFileID:    swap_HFSPlusExtentKey((HFSPlusExtentKey*)key); break;
+        case kHFSAttributesFileID: swap_HFSPlusAttrKey((HFSPlusAttrKey*)key); break;
+    }
+
+    return key;
+}
+
+static void verify_node(const BTreePtr tree, const char* raw, NodeSummary* summary)
+{
+    const BTHeaderRec* header   = &tree->headerRecord;
+    size_t             nodeSize = header->nodeSize;
+
+    // Free nodes are zero-filled.
+    summary->blank = true;
+    for (size_t i = 0; i < nodeSize; i++) {
+        if (raw[i] != 0) { summary->blank = false; break; }
+    }
+    if (summary->blank) return;
+
+    // The last offset in every node points just past the descriptor.
+    if (raw16(raw + nodeSize - sizeof(BTRecOffset)) != sizeof(BTNodeDescriptor)) {
+        summary->problems |= VerifySentinel;
+        return;
+    }
+
+    const BTNodeDescriptor* desc = (const void*)raw;
+    summary->fLink      = raw32((const char*)&desc->fLink);
+    summary->bLink      = raw32((const char*)&desc->bLink);
+    summary->kind       = desc->kind;
+    summary->height     = desc->height;
+    summary->numRecords = raw16((const char*)&desc->numRecords);
+
+    switch (summary->kind) {
+        case kBTLeafNode:
+            if (summary->height != 1) summary->problems |= VerifyHeight;
+            break;
+
+        case kBTIndexNode:
+            if ((summary->height < 2) || (summary->height > header->treeDepth)) summary->problems |= VerifyHeight;
+            break;
+
+        case kBTHeaderNode:
+        case kBTMapNode:
+            if (summary->height != 0) summary->problems |= VerifyHeight;
+            break;
+
+        default:
+            summary->problems |= VerifyKind;
+            return;
+    }
+
+    // Record offsets, stored backwards from the end of the node, with one extra for the free space.
+    size_t numRecords = summary->numRecords;
+    if ((sizeof(BTNodeDescriptor) + ((numRecords + 1) * sizeof(BTRecOffset))) > nodeSize) {
+        summary->problems |= VerifyRecordCount;
+        return;
+    }
+
+    size_t   limit   = nodeSize - ((numRecords + 1) * sizeof(BTRecOffset));
+    uint16_t offsets[numRecords + 1];
+    for (size_t i = 0; i <= numRecords; i++) {
+        offsets[i] = raw16(raw + nodeSize - ((i + 1) * sizeof(BTRecOffset)));
+        if ((offsets[i] < sizeof(BTNodeDescriptor)) || (offsets[i] > limit) || (offsets[i] % 2) || ((i != 0) && (offsets[i] <= offsets[i - 1]))) {
+            summary->problems |= VerifyOffsets;
+            return;
+        }
+    }
+
+    if ((summary->kind != kBTIndexNode) && (summary->kind != kBTLeafNode)) return;
+
+    if (numRecords == 0) {
+        summary->problems |= VerifyRecordCount;
+        return;
+    }
+
+    // Keyed records.
+    bool      bigKeys      = (header->attributes & kBTBigKeysMask);
+    bool      variableKeys = ((summary->kind == kBTLeafNode) || (header->attributes & kBTVariableIndexKeysMask));
+    bool      copyKeys     = (bigKeys && (tree->keyCompare != NULL));
+    BTreeKey* previous     = NULL;
+
+    if (summary->kind == kBTIndexNode) {
+        SALLOC(summary->children, numRecords * sizeof(bt_nodeid_t));
+        if (copyKeys) SALLOC(summary->childKeys, numRecords * sizeof(BTreeKey*));
+    }
+
+    for (size_t i = 0; i < numRecords; i++) {
+        const char* record      = raw + offsets[i];
+        size_t      recordLen   = offsets[i + 1] - offsets[i];
+        size_t      lengthField = (bigKeys ? sizeof(uint16_t) : sizeof(uint8_t));
+        size_t      keyLength   = (bigKeys ? raw16(record) : (uint8_t)record[0]);
+        size_t      keySize     = lengthField + (variableKeys ? keyLength : header->maxKeyLength);
+        keySize += (keySize % 2);
+
+        if ((keyLength > header->maxKeyLength) || (keySize > recordLen)) {
+            summary->problems |= VerifyKeyLength;
+            break;
+        }
+
+        if (summary->kind == kBTIndexNode) {
+            if ((keySize + sizeof(bt_nodeid_t)) > recordLen) {
+                summary->problems |= VerifyChildPointer;
+                break;
+            }
+            bt_nodeid_t child = raw32(record + keySize);
+            if ((child == 0) || (child >= header->totalNodes)) summary->problems |= VerifyChildPointer;
+            summary->children[i] = child;
+        }
+
+        if ( !copyKeys ) continue;
+
+        BTreeKey* key = verify_copy_key(tree, record, lengthField + keyLength);
+        if (key == NULL) {
+            summary->problems |= VerifyKeyLength;
+            break;
+        }
+
+        if ((previous != NULL) && (tree->keyCompare(previous, key) >= 0))
+            summary->problems |= VerifyKeyOrder;
+
+        // Index nodes keep every key; leaves only need the ends.
+        if (summary->kind == kBTIndexNode) {
+            summary->childKeys[i] = key;
+        } else if (previous != summary->firstKey) {
+            SFREE(previous);
+        }
+
+        if (i == 0) summary->firstKey = key;
+        summary->lastKey = key;
+        previous         = key;
+    }
+}
+
+static void verify_chunk(void* context)
+{
+    VerifyChunk* chunk    = context;
+    size_t       nodeSize = chunk->tree->headerRecord.nodeSize;
+
+    for (bt_nodeid_t i = 0; i < chunk->count; i++)
+        verify_node(chunk->tree, chunk->buffer + (i * nodeSize), &chunk->summaries[chunk->start + i]);
+
+    SFREE(chunk->buffer);
+    SFREE(chunk);
+}
+
+static void verify_summary_free(NodeSummary* summary)
+{
+    if (summary->childKeys != NULL) {
+        for (unsigned i = 0; i < summary->numRecords; i++) SFREE(summary->childKeys[i]);
+        SFREE(summary->childKeys);
+    } else {
+        if (summary->lastKey != summary->firstKey) SFREE(summary->lastKey);
+        SFREE(summary->firstKey);
+    }
+    SFREE(summary->children);
+}
+
+#pragma mark Tree Checks
+
+static void verify_report(VerifyReport* report, bt_nodeid_t nodeNumber, const char* format, ...) __attribute__((format(printf, 3, 4)));
+static void verify_report(VerifyReport* report, bt_nodeid_t nodeNumber, const char* format, ...)
+{
+    char    message[256] = "";
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if ( !report->quiet ) Print(report->ctx, "node %-10u %s", nodeNumber, message);
+    report->problems++;
+}
+
+// Whether the second pass can follow a node: it must be an index or leaf node whose layout could be parsed.
+static bool verify_is_keyed(const NodeSummary* summary)
+{
+    uint32_t unusable = (VerifyUnreadable | VerifySentinel | VerifyKind | VerifyRecordCount | VerifyOffsets);
+
+    return ( !summary->blank && ((summary->problems & unusable) == 0) && ((summary->kind == kBTIndexNode) || (summary->kind == kBTLeafNode)) );
+}
+
+// Descends from the root, marking every node the index reaches and checking each parent/child pair.
+static void verify_index(VerifyReport* report, const BTreePtr tree, NodeSummary* summaries)
+{
+    const BTHeaderRec* header   = &tree->headerRecord;
+    bt_nodeid_t*       stack    = NULL;
+    size_t             depth    = 0;
+    size_t             capacity = 0;
+
+    if (header->treeDepth == 0) {
+        if (header->rootNode != 0)    verify_report(report, 0, "header says the tree is empty but names root node %u", header->rootNode);
+        if (header->leafRecords != 0) verify_report(report, 0, "header says the tree is empty but counts %u leaf records", header->leafRecords);
+        return;
+    }
+
+    if ((header->rootNode == 0) || (header->rootNode >= header->totalNodes)) {
+        verify_report(report, 0, "root node %u is outside the tree", header->rootNode);
+        return;
+    }
+
+    NodeSummary* root = &summaries[header->rootNode];
+    root->reached = true;
+    if ( !verify_is_keyed(root) ) {
+        verify_report(report, header->rootNode, "is the root node, but is not a usable index or leaf node");
+        return;
+    }
+    if (root->height != header->treeDepth)
+        verify_report(report, header->rootNode, "is the root node at height %u, but the tree depth is %u", root->height, header->treeDepth);
+    if ((root->fLink != 0) || (root->bLink != 0))
+        verify_report(report, header->rootNode, "is the root node, but has siblings (%u, %u)", root->bLink, root->fLink);
+
+    SALLOC(stack, sizeof(bt_nodeid_t) * 64);
+    capacity       = 64;
+    stack[depth++] = header->rootNode;
+
+    while (depth) {
+        bt_nodeid_t  parentID = stack[--depth];
+        NodeSummary* parent   = &summaries[parentID];
+
+        if (parent->kind != kBTIndexNode) continue;
+
+        for (unsigned i = 0; i < parent->numRecords; i++) {
+            bt_nodeid_t  childID = parent->children[i];
+            if ((childID == 0) || (childID >= header->totalNodes)) continue;  // Reported in the first pass
+
+            NodeSummary* child   = &summaries[childID];
+            if (child->reached) {
+                verify_report(report, childID, "is referenced more than once (again from index node %u)", parentID);
+                continue;
+            }
+            child->reached = true;
+
+            if ( !verify_is_keyed(child) ) {
+                verify_report(report, childID, "is referenced by index node %u, but is not a usable index or leaf node", parentID);
+                continue;
+            }
+
+            if (child->height != (parent->height - 1))
+                verify_report(report, childID, "is at height %u, but its parent %u is at height %u", child->height, parentID, parent->height);
+
+            if ((parent->childKeys != NULL) && (child->firstKey != NULL) && (tree->keyCompare(parent->childKeys[i], child->firstKey) != 0))
+                verify_report(report, childID, "starts with a different key than index record %u in node %u", i, parentID);
+
+            if (depth == capacity) {
+                capacity *= 2;
+                SREALLOC(stack, sizeof(bt_nodeid_t) * capacity);
+            }
+            stack[depth++] = childID;
+        }
+    }
+
+    SFREE(stack);
+}
+
+static void verify_siblings(VerifyReport* report, const BTreePtr tree, const NodeSummary* summaries)
+{
+    bt_nodeid_t totalNodes = tree->headerRecord.totalNodes;
+
+    for (bt_nodeid_t n = 1; n < totalNodes; n++) {
+        const NodeSummary* node = &summaries[n];
+        if ( !node->reached || !verify_is_keyed(node) ) continue;
+
+        if (node->fLink != 0) {
+            const NodeSummary* next = ((node->fLink < totalNodes) ? &summaries[node->fLink] : NULL);
+
+            if ((next == NULL) || !next->reached) {
+                verify_report(report, n, "links forward to node %u, which is not in the tree", node->fLink);
+            } else {
+                if (next->bLink != n)
+                    verify_report(report, n, "links forward to node %u, which links back to node %u", node->fLink, next->bLink);
+                if (next->height != node->height)
+                    verify_report(report, n, "links forward to node %u on a different level (%u vs %u)", node->fLink, next->height, node->height);
+                else if ((node->lastKey != NULL) && (next->firstKey != NULL) && (tree->keyCompare(node->lastKey, next->firstKey) >= 0))
+                    verify_report(report, n, "has keys that overlap the keys in its right sibling %u", node->fLink);
+            }
+        }
+
+        if (node->bLink != 0) {
+            const NodeSummary* prev = ((node->bLink < totalNodes) ? &summaries[node->bLink] : NULL);
+
+            if ((prev == NULL) || !prev->reached)
+                verify_report(report, n, "links back to node %u, which is not in the tree", node->bLink);
+            else if (prev->fLink != n)
+                verify_report(report, n, "links back to node %u, which links forward to node %u", node->bLink, prev->fLink);
+        }
+    }
+}
+
+static void verify_leaf_chain(VerifyReport* report, const BTreePtr tree, const NodeSummary* summaries, uint64_t reachedLeaves)
+{
+    const BTHeaderRec* header  = &tree->headerRecord;
+    uint64_t           records = 0;
+    uint64_t           leaves  = 0;
+    bt_nodeid_t        last    = 0;
+
+    if (header->treeDepth == 0) return;
+
+    for (bt_nodeid_t n = header->firstLeafNode; n != 0; n = summaries[n].fLink) {
+        if ((n >= header->totalNodes) || !summaries[n].reached || (summaries[n].kind != kBTLeafNode)) {
+            verify_report(report, n, "is in the leaf chain (after node %u), but is not a leaf node in the tree", last);
+            break;
+        }
+        if (leaves++ > reachedLeaves) {
+            verify_report(report, n, "is in a loop in the leaf chain");
+            break;
+        }
+        if ((last == 0) && (summaries[n].bLink != 0))
+            verify_report(report, n, "is the first leaf node, but links back to node %u", summaries[n].bLink);
+
+        records += summaries[n].numRecords;
+        last     = n;
+    }
+
+    if (last != header->lastLeafNode)
+        verify_report(report, 0, "header names node %u as the last leaf, but the chain ends at node %u", header->lastLeafNode, last);
+    if (leaves != reachedLeaves)
+        verify_report(report, 0, "leaf chain visits %llu nodes, but the index reaches %llu leaf nodes", (unsigned long long)leaves, (unsigned long long)reachedLeaves);
+    if (records != header->leafRecords)
+        verify_report(report, 0, "header counts %u leaf records, but the leaf chain holds %llu", header->leafRecords, (unsigned long long)records);
+}
+
+// Map nodes hang off the header node's forward link.
+static void verify_map_nodes(VerifyReport* report, const BTreePtr tree, NodeSummary* summaries)
+{
+    bt_nodeid_t totalNodes = tree->headerRecord.totalNodes;
+    bt_nodeid_t count      = 0;
+
+    summaries[0].reached = true;
+
+    for (bt_nodeid_t n = summaries[0].fLink; n != 0; n = summaries[n].fLink) {
+        if ((n >= totalNodes) || (summaries[n].kind != kBTMapNode) || summaries[n].reached || (count++ > totalNodes)) {
+            verify_report(report, n, "is in the node map chain, but is not a map node");
+            break;
+        }
+        summaries[n].reached = true;
+    }
+}
+
+static void verify_node_map(VerifyReport* report, const BTreePtr tree, const NodeSummary* summaries)
+{
+    const BTHeaderRec* header = &tree->headerRecord;
+    uint32_t           free   = 0;
+
+    for (bt_nodeid_t n = 0; n < header->totalNodes; n++) {
+        if ( !summaries[n].used ) free++;
+
+        if (summaries[n].reached && !summaries[n].used)
+            verify_report(report, n, "is in use by the tree, but free in the node map");
+        else if (summaries[n].used && summaries[n].blank)
+            verify_report(report, n, "is allocated in the node map, but blank");
+        else if (summaries[n].used && !summaries[n].reached)
+            verify_report(report, n, "is allocated in the node map, but not reachable from the tree");
+    }
+
+    if (free != header->freeNodes)
+        verify_report(report, 0, "header counts %u free nodes, but the node map has %u", header->freeNodes, free);
+}
+
+#pragma mark Driver
+
+static int verifyBTree(HIOptions* options, BTreePtr tree, const char* name)
+{
+    out_ctx*           ctx       = options->hfs->vol->ctx;
+    const BTHeaderRec* header    = &tree->headerRecord;
+    size_t             nodeSize  = header->nodeSize;
+    bt_nodeid_t        total     = header->totalNodes;
+    NodeSummary*       summaries = NULL;
+    VerifyReport       report    = { .ctx = ctx, .quiet = options->quiet };
+    struct timeval     started   = {0}, finished = {0};
+
+    gettimeofday(&started, NULL);
+
+    if ( !report.quiet ) BeginSection(ctx, "B-Tree Verification (%s)", name);
+
+    if ((nodeSize < 512) || (nodeSize > 32768) || (nodeSize & (nodeSize - 1))) {
+        verify_report(&report, 0, "header has an invalid node size: %zu", nodeSize);
+        if ( !report.quiet ) EndSection(ctx);
+        return 1;
+    }
+
+    if (((uint64_t)total * nodeSize) > tree->fork->logicalSize)
+        verify_report(&report, 0, "header counts %u nodes, but the tree file only holds %llu", total, (unsigned long long)(tree->fork->logicalSize / nodeSize));
+
+    total = MIN(total, tree->fork->logicalSize / nodeSize);
+    SALLOC(summaries, MAX(total, 1) * sizeof(NodeSummary));
+
+    // Pass 1: read the file in order and validate nodes on the work queue.
+    WorkQueue*  queue    = workqueue_make(options->hfs->threads);
+    if (queue == NULL) {
+        error("Could not start verification threads.");
+        SFREE(summaries);
+        if ( !report.quiet ) EndSection(ctx);
+        return -1;
+    }
+
+    bt_nodeid_t perChunk = MAX(1, VERIFY_CHUNK_SIZE / nodeSize);
+    unsigned    inflight = 0;
+
+    for (bt_nodeid_t start = 0; start < total; start += perChunk) {
+        VerifyChunk* chunk  = NULL;
+        SALLOC(chunk, sizeof(VerifyChunk));
+        chunk->tree      = tree;
+        chunk->summaries = summaries;
+        chunk->start     = start;
+        chunk->count     = MIN(perChunk, total - start);
+        SALLOC(chunk->buffer, chunk->count * nodeSize);
+
+        ssize_t bytes = hfs_read_fork_range(chunk->buffer, tree->fork, chunk->count * nodeSize, (size_t)start * nodeSize);
+        if (bytes < (ssize_t)(chunk->count * nodeSize)) {
+            bt_nodeid_t readable = (bytes > 0 ? (bytes / nodeSize) : 0);
+            for (bt_nodeid_t n = readable; n < chunk->count; n++) summaries[start + n].problems |= VerifyUnreadable;
+            chunk->count = readable;
+        }
+
+        workqueue_add(queue, verify_chunk, chunk);
+
+        // Bound the memory held by chunks waiting for a worker.
+        if (++inflight >= (2 * workqueue_threads(queue))) {
+            workqueue_wait(queue);
+            inflight = 0;
+        }
+    }
+    workqueue_wait(queue);
+
+    if ((total == 0) || (summaries[0].kind != kBTHeaderNode) || summaries[0].blank) {
+        verify_report(&report, 0, "is not a header node");
+
+    } else {
+        // Pass 2: cross-node invariants from the summaries.
+        bt_nodeid_t totalNodes = header->totalNodes;
+        tree->headerRecord.totalNodes = total;  // Never follow links past what was read
+
+        verify_map_nodes(&report, tree, summaries);
+
+        // Problems found inside individual nodes, in node order. Free nodes may hold stale data; that's not a problem.
+        for (bt_nodeid_t n = 0; n < total; n++) {
+            summaries[n].used = BTIsNodeUsed(tree, n);
+            if ( !summaries[n].used && !summaries[n].reached ) continue;
+
+            for (unsigned i = 0; i < (sizeof(VerifyNodeProblemMessages) / sizeof(VerifyNodeProblemMessages[0])); i++) {
+                if (summaries[n].problems & VerifyNodeProblemMessages[i].problem)
+                    verify_report(&report, n, "%s", VerifyNodeProblemMessages[i].message);
+            }
+        }
+
+        verify_index(&report, tree, summaries);
+        verify_siblings(&report, tree, summaries);
+
+        uint64_t leaves = 0;
+        for (bt_nodeid_t n = 0; n < total; n++)
+            if (summaries[n].reached && (summaries[n].kind == kBTLeafNode)) leaves++;
+
+        verify_leaf_chain(&report, tree, summaries, leaves);
+        verify_node_map(&report, tree, summaries);
+
+        tree->headerRecord.totalNodes = totalNodes;
+    }
+
+    unsigned threads   = workqueue_threads(queue);
+    uint64_t counts[4] = {0};                   // index, leaf, map, free
+    for (bt_nodeid_t n = 0; n < total; n++) {
+        if ( !summaries[n].reached )                 counts[3]++;
+        else if (summaries[n].kind == kBTIndexNode)  counts[0]++;
+        else if (summaries[n].kind == kBTLeafNode)   counts[1]++;
+        else if (summaries[n].kind == kBTMapNode)    counts[2]++;
+        verify_summary_free(&summaries[n]);
+    }
+
+    workqueue_free(queue);
+    SFREE(summaries);
+
+    if (report.quiet) return (report.problems > INT_MAX ? INT_MAX : (int)report.problems);
+
+    gettimeofday(&finished, NULL);
+    double seconds = (finished.tv_sec - started.tv_sec) + ((finished.tv_usec - started.tv_usec) / 1000000.);
+
+    if (report.problems) Print(ctx, "%s", "");
+    PrintAttribute(ctx, "Nodes", "%u (%zu bytes each)", header->totalNodes, nodeSize);
+    PrintAttribute(ctx, "Index nodes", "%llu", counts[0]);
+    PrintAttribute(ctx, "Leaf nodes", "%llu", counts[1]);
+    PrintAttribute(ctx, "Map nodes", "%llu", counts[2]);
+    PrintAttribute(ctx, "Unused nodes", "%llu", counts[3]);
+    PrintAttribute(ctx, "Leaf records", "%u", header->leafRecords);
+    PrintAttribute(ctx, "Threads", "%u", threads);
+    PrintAttribute(ctx, "Elapsed", "%0.2f seconds", seconds);
+    if (report.problems)
+        PrintAttribute(ctx, "Result", "%llu problem(s)", report.problems);
+    else
+        PrintAttribute(ctx, "Result", "OK");
+
+    EndSection(ctx);
+
+    return (report.problems > INT_MAX ? INT_MAX : (int)report.problems);
+}
+
+// Returns the number of problems found in the selected trees, or -1 if one couldn't be checked.
+int verifyBTrees(HIOptions* options)
+{
+    HFSPlus* hfs      = options->hfs;
+    int      problems = 0;
+
+    static const struct {
+        BTreeTypes type;
+        char**     name;
+    } trees[] = {
+        { BTreeTypeCatalog,    &BTreeOptionCatalog },
+        { BTreeTypeExtents,    &BTreeOptionExtents },
+        { BTreeTypeAttributes, &BTreeOptionAttributes },
+        { BTreeTypeHotfiles,   &BTreeOptionHotfiles },
+    };
+
+    for (unsigned i = 0; i < (sizeof(trees) / sizeof(trees[0])); i++) {
+        BTreePtr tree = NULL;
+
+        if ((options->verify_trees & (1 << trees[i].type)) == 0) continue;
+
+        switch (trees[i].type) {
+            case BTreeTypeCatalog:
+                if ( hfsplus_get_catalog_btree(&tree, hfs) < 0) { error("Could not get Catalog B-Tree!"); return -1; }
+                break;
+
+            case BTreeTypeExtents:
+                if ( hfsplus_get_extents_btree(&tree, hfs) < 0) { error("Could not get Extents B-Tree!"); return -1; }
+                break;
+
+            case BTreeTypeAttributes:
+                if (hfs->vh.attributesFile.logicalSize == 0) { info("This volume has no attributes B-Tree."); continue; }
+                if ( hfs_get_attribute_btree(&tree, hfs) < 0) { error("Could not get Attribute B-Tree!"); return -1; }
+                break;
+
+            case BTreeTypeHotfiles:
+                if ( hfs_get_hotfiles_btree(&tree, hfs) < 0) { info("This volume has no hotfiles B-Tree."); continue; }
+                break;
+        }
+
+        int result = verifyBTree(options, tree, *trees[i].name);
+        if (result < 0) return -1;
+        problems += result;
+    }
+
+    return problems;
+}
+
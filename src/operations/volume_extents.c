@@ -0,0 +1,183 @@
+//
+//  volume_extents.c
+//  hfsinspect
+//
+//
+
+#include "operations.h"
+#include "hfs/extents.h"
+#include "hfs/btree/cursor.h"
+#include "hfsplus/hfsplus.h"
+
+/*
+   Gathers every extent on the volume along with what owns it:
+
+   - the inline extents of the special files in the volume header,
+   - the inline data and resource fork extents of every catalog file record,
+   - every record in the extents overflow tree (which also holds the bad block file),
+   - the fork data and overflow extents of extended attributes, and
+   - the blocks holding the volume header and its alternate.
+
+   Each extent is listed once per claim, so a block owned twice shows up in two entries.
+ */
+
+typedef struct OwnerList {
+    ExtentOwner* owners;
+    size_t       count;
+    size_t       capacity;
+} OwnerList;
+
+const char* ExtentOwnerKindName(uint8_t kind)
+{
+    switch (kind) {
+        case ExtentOwnerReserved:     return "volume header";
+        case ExtentOwnerDataFork:     return "data";
+        case ExtentOwnerResourceFork: return "rsrc";
+        case ExtentOwnerAttribute:    return "attribute";
+        default:                      return "unknown";
+    }
+}
+
+static void owner_list_add(OwnerList* list, uint32_t startBlock, uint32_t blockCount, uint32_t cnid, uint32_t logicalBlock, ExtentOwnerKind kind)
+{
+    if (blockCount == 0) return;
+
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity ? list->capacity * 2 : 4096);
+        SREALLOC(list->owners, list->capacity * sizeof(ExtentOwner));
+    }
+
+    list->owners[list->count++] = (ExtentOwner){
+        .startBlock   = startBlock,
+        .blockCount   = blockCount,
+        .cnid         = cnid,
+        .logicalBlock = logicalBlock,
+        .kind         = kind,
+    };
+}
+
+// Adds the descriptors of an extent record, stopping at the first empty one.
+static void owner_list_add_record(OwnerList* list, const HFSPlusExtentDescriptor* record, uint32_t cnid, uint32_t logicalBlock, ExtentOwnerKind kind)
+{
+    for (unsigned i = 0; i < kHFSPlusExtentDensity; i++) {
+        if (record[i].blockCount == 0) break;
+        owner_list_add(list, record[i].startBlock, record[i].blockCount, cnid, logicalBlock, kind);
+        logicalBlock += record[i].blockCount;
+    }
+}
+
+static int owner_scan_record(void* context, const HFSPlusCatalogKey* key, const HFSPlusCatalogRecord* record)
+{
+    OwnerList* list = context;
+
+    (void)key;
+
+    if (record->record_type != kHFSPlusFileRecord) return 0;
+
+    const HFSPlusCatalogFile* file = &record->catalogFile;
+    owner_list_add_record(list, file->dataFork.extents, file->fileID, 0, ExtentOwnerDataFork);
+    owner_list_add_record(list, file->resourceFork.extents, file->fileID, 0, ExtentOwnerResourceFork);
+
+    return 0;
+}
+
+static int owner_scan_extents(OwnerList* list, const HFSPlus* hfs)
+{
+    BTreePtr    tree   = NULL;
+    BTreeCursor cursor = {0};
+    int         result = 0;
+
+    if (hfsplus_get_extents_btree(&tree, hfs) < 0) return -1;
+
+    btree_cursor_init(&cursor, tree);
+    for (result = btree_cursor_first(&cursor); result == 1; result = btree_cursor_next(&cursor)) {
+        HFSPlusExtentKey* key   = NULL;
+        void*             value = NULL;
+
+        if (btree_cursor_get(&cursor, (BTreeKeyPtr*)&key, &value) < 0) { result = -1; break; }
+        if (key->keyLength != kHFSPlusExtentKeyMaximumLength) continue;
+
+        ExtentOwnerKind kind = (key->forkType == HFSResourceForkType ? ExtentOwnerResourceFork : ExtentOwnerDataFork);
+        owner_list_add_record(list, value, key->fileID, key->startBlock, kind);
+    }
+    btree_cursor_free(&cursor);
+
+    return (result < 0 ? -1 : 0);
+}
+
+static int owner_scan_attributes(OwnerList* list, const HFSPlus* hfs)
+{
+    BTreePtr    tree   = NULL;
+    BTreeCursor cursor = {0};
+    int         result = 0;
+
+    if (hfs->vh.attributesFile.logicalSize == 0) return 0;
+    if (hfs_get_attribute_btree(&tree, hfs) < 0) return -1;
+
+    btree_cursor_init(&cursor, tree);
+    for (result = btree_cursor_first(&cursor); result == 1; result = btree_cursor_next(&cursor)) {
+        HFSPlusAttrKey*    key    = NULL;
+        HFSPlusAttrRecord* record = NULL;
+
+        if (btree_cursor_get(&cursor, (BTreeKeyPtr*)&key, (void**)&record) < 0) { result = -1; break; }
+
+        switch (record->recordType) {
+            case kHFSPlusAttrForkData:
+                owner_list_add_record(list, record->forkData.theFork.extents, key->fileID, 0, ExtentOwnerAttribute);
+                break;
+
+            case kHFSPlusAttrExtents:
+                owner_list_add_record(list, record->overflowExtents.extents, key->fileID, key->startBlock, ExtentOwnerAttribute);
+                break;
+
+            default:
+                break;
+        }
+    }
+    btree_cursor_free(&cursor);
+
+    return (result < 0 ? -1 : 0);
+}
+
+int collectExtentOwners(const HFSPlus* hfs, ExtentOwner** owners, size_t* count)
+{
+    const HFSPlusVolumeHeader* vh   = &hfs->vh;
+    OwnerList                  list = {0};
+
+    // The volume header lives 1024 bytes in; the alternate sits 1024 bytes before the end of the volume.
+    uint64_t volumeEnd = (uint64_t)vh->totalBlocks * hfs->block_size;
+    uint32_t headEnd   = (uint32_t)((1024 + sizeof(HFSPlusVolumeHeader) - 1) / hfs->block_size);
+    uint32_t tailStart = (uint32_t)((volumeEnd - 1024) / hfs->block_size);
+    // Standard HFS keeps its MDB (and alternate) outside the allocation blocks.
+    if (!hfs_is_standard(hfs)) {
+        owner_list_add(&list, 0, headEnd + 1, 0, 0, ExtentOwnerReserved);
+        if (tailStart > headEnd)
+            owner_list_add(&list, tailStart, vh->totalBlocks - tailStart, 0, 0, ExtentOwnerReserved);
+    }
+
+    const struct {
+        const HFSPlusForkData* fork;
+        hfs_cnid_t             cnid;
+    } special[] = {
+        { &vh->extentsFile,    kHFSExtentsFileID },
+        { &vh->catalogFile,    kHFSCatalogFileID },
+        { &vh->allocationFile, kHFSAllocationFileID },
+        { &vh->startupFile,    kHFSStartupFileID },
+        { &vh->attributesFile, kHFSAttributesFileID },
+    };
+    for (unsigned i = 0; i < (sizeof(special) / sizeof(special[0])); i++)
+        owner_list_add_record(&list, special[i].fork->extents, special[i].cnid, 0, ExtentOwnerDataFork);
+
+    if (hfsplus_catalog_scan(hfs, owner_scan_record, &list) < 0) goto ERROR;
+    if (owner_scan_extents(&list, hfs) < 0) goto ERROR;
+    if (owner_scan_attributes(&list, hfs) < 0) goto ERROR;
+
+    *owners = list.owners;
+    *count  = list.count;
+    return 0;
+
+ERROR:
+    SFREE(list.owners);
+    return -1;
+}
+
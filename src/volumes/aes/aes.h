@@ -0,0 +1,29 @@
+//
+//  aes.h
+//  volumes
+//
+//
+
+// FIPS 197 AES with the XTS mode (IEEE 1619) Core Storage encrypts its metadata in. Byte-oriented and
+// dependency-free: it only ever sees a few dozen metadata blocks, so it doesn't need to be fast.
+
+#ifndef volumes_aes_h
+#define volumes_aes_h
+
+#define AES_BLOCK_LENGTH 16
+
+typedef struct aes_ctx {
+    unsigned rounds;
+    uint8_t  round_keys[15 * AES_BLOCK_LENGTH];
+} aes_ctx;
+
+// Expands a 16, 24 or 32-byte key. Returns -1 with errno EINVAL for any other length.
+int  aes_init          (aes_ctx* ctx, const void* key, size_t key_length);
+
+void aes_encrypt_block (const aes_ctx* ctx, uint8_t out[AES_BLOCK_LENGTH], const uint8_t in[AES_BLOCK_LENGTH]);
+void aes_decrypt_block (const aes_ctx* ctx, uint8_t out[AES_BLOCK_LENGTH], const uint8_t in[AES_BLOCK_LENGTH]);
+
+// Decrypts one XTS data unit in place. `unit` is the unit's number (the tweak); `length` must be a multiple of AES_BLOCK_LENGTH.
+void aes_xts_decrypt   (const aes_ctx* data_key, const aes_ctx* tweak_key, uint64_t unit, void* buf, size_t length);
+
+#endif
@@ -200,6 +200,8 @@ int apm_load(Volume* vol)
         size_t  length      = header.partition_length * sector_size;
 
         Volume* partition   = vol_make_partition(vol, partitionID - 1, offset, length);
+        if (partition == NULL) return -1;
+
         partition->sector_size  = sector_size;
         partition->sector_count = header.partition_length;
 
@@ -12,7 +12,9 @@
 
 #include "memdmp/memdmp.h"
 
-#include "crc32c/crc32c.h"
+#include "volumes/_endian.h"
+#include "volumes/crc32/crc32.h"
+#include "volumes/aes/aes.h"
 #include "logging/logging.h"    // console printing routines
 #include "memdmp/memdmp.h"
 
@@ -22,7 +24,8 @@ void cs_dump_all_blocks(Volume* vol, CSVolumeHeader* vh);
 uint32_t cs_crc32c(uint32_t seed, const void* base, uint32_t length)
 {
     // All CRCs exempt the first 8 bytes as they hold the seed and CRC themselves.
-    return crc32c(seed, ((char*)base+8), (length-8));
+    // CS starts from the seed as-is and doesn't invert the result; crc32c_fast inverts both, so undo that.
+    return ~crc32c_fast(~seed, ((char*)base+8), (length-8));
 }
 
 int cs_verify_block(const CSVolumeHeader* vh, const void* block, size_t nbytes)
@@ -34,7 +37,8 @@ int cs_verify_block(const CSVolumeHeader* vh, const void* block, size_t nbytes)
         if (bh->version == 0) return -1;
         if (bh->checksum == 0) return 0;
 
-        nbytes = bh->block_size;
+        // The volume header's checksum only covers its own 512 bytes, though it claims the whole block.
+        nbytes = MIN(nbytes, bh->block_size);
         crc    = cs_crc32c(bh->checksum_seed, block, nbytes);
 
         if (crc != bh->checksum) {
@@ -86,7 +90,7 @@ READ:
 
     if (bh->block_size > buf_size) {
         buf_size = bh->block_size;
-        SREALLOC(buf, buf_size);
+        SREALLOC(*buf, buf_size);
         goto READ;
     }
 
@@ -108,6 +112,289 @@ int cs_test(Volume* vol)
     return 0;
 }
 
+#pragma mark Loading
+
+// The newest copy of each encrypted metadata block the loader needs.
+typedef struct CSObjects {
+    uint8_t** blocks;                       // kCSEncryptedBlockSize bytes each, decrypted
+    size_t    count;
+    size_t    capacity;
+} CSObjects;
+
+static const CSBlockHeader* cs_find_object(const CSObjects* objects, uint64_t object_id, uint16_t block_type)
+{
+    for (size_t i = 0; i < objects->count; i++) {
+        const CSBlockHeader* bh = (const CSBlockHeader*)objects->blocks[i];
+        if ((bh->object_id == object_id) && (bh->block_type == block_type)) return bh;
+    }
+
+    return NULL;
+}
+
+static void cs_keep_object(CSObjects* objects, const uint8_t* block)
+{
+    const CSBlockHeader* bh = (const CSBlockHeader*)block;
+
+    for (size_t i = 0; i < objects->count; i++) {
+        CSBlockHeader* old = (CSBlockHeader*)objects->blocks[i];
+
+        // Transactions write new copies of the objects they change rather than updating them.
+        if ((old->object_id == bh->object_id) && (old->block_type == bh->block_type)) {
+            if (bh->generation > old->generation) memcpy(old, block, kCSEncryptedBlockSize);
+            return;
+        }
+    }
+
+    if (objects->count == objects->capacity) {
+        objects->capacity = (objects->capacity ? objects->capacity * 2 : 16);
+        SREALLOC(objects->blocks, objects->capacity * sizeof(uint8_t*));
+    }
+
+    SALLOC(objects->blocks[objects->count], kCSEncryptedBlockSize);
+    memcpy(objects->blocks[objects->count], block, kCSEncryptedBlockSize);
+    objects->count++;
+}
+
+static void cs_free_objects(CSObjects* objects)
+{
+    for (size_t i = 0; i < objects->count; i++) SFREE(objects->blocks[i]);
+    SFREE(objects->blocks);
+    objects->count = objects->capacity = 0;
+}
+
+// Copies the <string> following <key>name</key> in a block's plist. Returns false if there isn't one.
+static bool cs_plist_string(char* out, size_t size, const void* block, uint32_t offset, uint32_t length, const char* name)
+{
+    char        key[128] = "";
+    char*       xml      = NULL;
+    const char* p        = NULL;
+    const char* end      = NULL;
+    bool        found    = false;
+
+    if ((offset > kCSEncryptedBlockSize) || (length > (kCSEncryptedBlockSize - offset))) return false;
+
+    SALLOC(xml, length + 1);
+    memcpy(xml, (const char*)block + offset, length);
+
+    snprintf(key, sizeof(key), "<key>%s</key><string>", name);
+    if (((p = strstr(xml, key)) != NULL) && ((end = strstr(p, "</string>")) != NULL)) {
+        p    += strlen(key);
+        (void)strlcpy(out, p, MIN(size, (size_t)(end - p) + 1));
+        found = true;
+    }
+
+    SFREE(xml);
+
+    return found;
+}
+
+/*
+   The logical volumes are described in the encrypted metadata, whether or not the volumes themselves are
+   encrypted. It's AES-XTS keyed with the physical volume header's key data and the physical volume's UUID,
+   and each kCSEncryptedBlockSize block is a data unit numbered from the start of the copy.
+ */
+static int cs_read_encrypted_metadata(CSObjects* objects, const Volume* vol, const CSVolumeHeader* header, uint64_t start_block, uint64_t size)
+{
+    aes_ctx  data_key  = {0};
+    aes_ctx  tweak_key = {0};
+    uint8_t* block     = NULL;
+    off_t    start     = (start_block & kCSBlockNumberMask) * header->md_block_size;
+    uint64_t units     = (size * header->md_block_size) / kCSEncryptedBlockSize;
+    unsigned valid     = 0;
+
+    if ((header->encryption_key_algo != 2) || (aes_init(&data_key, header->encryption_key_data, header->encryption_key_size) < 0)) {
+        error("Unsupported CS metadata cipher (%u with a %u-byte key).", header->encryption_key_algo, header->encryption_key_size);
+        errno = ENOTSUP;
+        return -1;
+    }
+    aes_init(&tweak_key, header->physical_volume_uuid, sizeof(uuid_t));
+
+    SALLOC(block, kCSEncryptedBlockSize);
+
+    for (uint64_t unit = 0; unit < units; unit++) {
+        const CSBlockHeader* bh    = (const CSBlockHeader*)block;
+        ssize_t              bytes = vol_read(vol, block, kCSEncryptedBlockSize, start + (off_t)(unit * kCSEncryptedBlockSize));
+
+        if (bytes < kCSEncryptedBlockSize) break;
+
+        // Space the metadata hasn't grown into yet was never written.
+        if ((block[0] == 0) && (memcmp(block, block + 1, kCSEncryptedBlockSize - 1) == 0)) continue;
+
+        aes_xts_decrypt(&data_key, &tweak_key, unit, block, kCSEncryptedBlockSize);
+
+        if ((bh->version != 1) || (bh->block_size != kCSEncryptedBlockSize) || (cs_verify_block(header, block, kCSEncryptedBlockSize) < 0)) {
+            debug("CS encrypted metadata block %ju isn't valid", (uintmax_t)unit);
+            continue;
+        }
+        valid++;
+
+        switch (bh->block_type) {
+            case kCSLogicalVolumeFamilyBlock:
+            case kCSLogicalVolumeBlock:
+            case kCSSegmentMapBlock:
+                cs_keep_object(objects, block);
+                break;
+        }
+    }
+
+    SFREE(block);
+
+    if (valid == 0) { errno = EIO; return -1; }
+
+    debug("CS encrypted metadata: %u valid blocks, %zu kept", valid, objects->count);
+
+    return 0;
+}
+
+// Adds a logical volume as a mapped sub-volume. Returns -1 (check errno) if it can't be read from here.
+static int cs_map_logical_volume(Volume* vol, uint16_t pos, const CSVolumeHeader* header, const CSObjects* objects, const CSLogicalVolumeBlock* lv)
+{
+    const CSLogicalVolumeFamilyBlock* family        = (const void*)cs_find_object(objects, lv->family_object, kCSLogicalVolumeFamilyBlock);
+    const CSSegmentMapBlock*          segments      = (const void*)cs_find_object(objects, lv->segment_map_object, kCSSegmentMapBlock);
+    char                              name[128]     = "";
+    char                              algorithm[32] = "";
+    VolumeMap*                        map           = NULL;
+    Volume*                           p             = NULL;
+
+    cs_plist_string(name, sizeof(name), lv, lv->plist_offset, lv->plist_size, "com.apple.corestorage.lv.name");
+
+    if ((segments == NULL) || (segments->segment_count == 0)) {
+        warning("CS logical volume '%s' has no segment map.", name);
+        errno = ENOENT;
+        return -1;
+    }
+
+    // FileVault volumes need a password to unwrap their key; only volumes stored in the clear are mapped.
+    if ((family != NULL) &&
+        cs_plist_string(algorithm, sizeof(algorithm), family, family->plist_offset, family->plist_size, "BlockAlgorithm") &&
+        (strcmp(algorithm, "None") != 0)) {
+        warning("CS logical volume '%s' is encrypted (%s); skipping it.", name, algorithm);
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if (segments->segment_count > ((kCSEncryptedBlockSize - offsetof(CSSegmentMapBlock, segments)) / sizeof(CSSegment))) {
+        warning("CS logical volume '%s' has more segments (%u) than its map block holds.", name, segments->segment_count);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map = volmap_make(header->md_block_size);
+    for (uint32_t i = 0; i < segments->segment_count; i++) {
+        const CSSegment* segment = &segments->segments[i];
+
+        // Fusion and other multi-disk groups: the rest of the volume is on a disk we weren't given.
+        if (segment->physical_block & ~kCSBlockNumberMask) {
+            warning("CS logical volume '%s' continues on another physical volume; skipping it.", name);
+            volmap_free(map);
+            errno = ENOTSUP;
+            return -1;
+        }
+
+        volmap_add(map, segment->logical_block, segment->physical_block, segment->block_count);
+    }
+
+    if (volmap_finish(map) < 0) {
+        volmap_free(map);
+        return -1;
+    }
+
+    if ((p = vol_make_mapped(vol, pos, map)) == NULL)
+        return -1;
+
+    p->type = kVolTypeUserData;
+    (void)strlcpy(p->desc, name, sizeof(p->desc));
+    (void)strlcpy(p->native_desc, "Core Storage Logical Volume", sizeof(p->native_desc));
+
+    debug("CS logical volume '%s': %u segments, %zu bytes", name, segments->segment_count, p->length);
+
+    return 0;
+}
+
+int cs_load(Volume* vol)
+{
+    CSVolumeHeader           header  = {0};
+    CSVolumeGroupsDescriptor vgd     = {0};
+    CSObjects                objects = {0};
+    void*                    buf     = NULL;
+    uint64_t                 label   = 0;
+    uint64_t                 newest  = 0;
+    uint32_t                 vgd_off = 0;
+    uint16_t                 mapped  = 0;
+
+    debug("CS load");
+
+    if (cs_get_volume_header(vol, &header) < 0) return -1;
+
+    if (header.md_block_size == 0) { errno = EINVAL; return -1; }
+
+    vol->type    = kVolTypePartitionMap;
+    vol->subtype = kPMCoreStorage;
+    strlcpy(vol->native_desc, "Core Storage Physical Volume", sizeof(vol->native_desc));
+
+    // Each metadata copy starts with a disk label; use the newest one that checks out.
+    SALLOC(buf, header.md_block_size);
+    for (unsigned i = 0; i < MIN(header.md_count, 8); i++) {
+        const CSMetadataBlockType11* md = NULL;
+
+        if (header.md_blocks[i] == 0) continue;
+        if (cs_get_metadata_block(&buf, vol, &header, header.md_blocks[i]) < 0) {
+            warning("CS metadata block %u (%#jx) is unreadable", i, (uintmax_t)header.md_blocks[i]);
+            continue;
+        }
+
+        md = buf;
+        if (md->block_header.block_type != kCSDiskLabelBlock) continue;
+        if (label && (md->block_header.generation <= newest)) continue;
+
+        label   = header.md_blocks[i];
+        newest  = md->block_header.generation;
+        vgd_off = md->vol_grps_desc_off;
+    }
+    SFREE(buf);
+
+    if (label == 0) {
+        error("No readable CS metadata blocks.");
+        errno = EIO;
+        return -1;
+    }
+
+    if ((vgd_off == 0) || (((uint64_t)vgd_off + sizeof(vgd)) > header.md_size)) {
+        error("The CS disk label has no volume groups descriptor.");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (vol_read(vol, &vgd, sizeof(vgd), (off_t)(label * header.md_block_size) + vgd_off) < (ssize_t)sizeof(vgd)) {
+        error("Can't read the CS volume groups descriptor.");
+        errno = EIO;
+        return -1;
+    }
+
+    // There are two copies of the encrypted metadata; the second is only needed if the first is damaged.
+    for (unsigned copy = 0; copy < MIN(vgd.encrypted_md_count, 2); copy++) {
+        if (cs_read_encrypted_metadata(&objects, vol, &header, vgd.encrypted_md_blocks[copy], vgd.encrypted_md_size) == 0) break;
+        warning("CS encrypted metadata copy %u (%#jx) is unreadable", copy, (uintmax_t)vgd.encrypted_md_blocks[copy]);
+    }
+
+    for (size_t i = 0; (i < objects.count) && (mapped < 128); i++) {
+        const CSLogicalVolumeBlock* lv = (const void*)objects.blocks[i];
+
+        if (lv->block_header.block_type != kCSLogicalVolumeBlock) continue;
+        if (cs_map_logical_volume(vol, mapped, &header, &objects, lv) == 0) mapped++;
+    }
+
+    cs_free_objects(&objects);
+
+    if (mapped == 0) {
+        error("No readable logical volumes in this Core Storage volume.");
+        errno = ENOENT;
+        return -1;
+    }
+
+    return 0;
+}
+
 void PrintCSBlockHeader(out_ctx* ctx, CSBlockHeader* header)
 {
     BeginSection(ctx, "CS Block Header");
@@ -120,7 +407,7 @@ void PrintCSBlockHeader(out_ctx* ctx, CSBlockHeader* header)
     PrintUIHex      (ctx, header, field_5);
     PrintUIHex      (ctx, header, generation);
     PrintUIHex      (ctx, header, field_7);
-    PrintUIHex      (ctx, header, field_8);
+    PrintUIHex      (ctx, header, object_id);
     PrintUIHex      (ctx, header, field_9);
 
     PrintDataLength (ctx, header, block_size);
@@ -341,5 +628,5 @@ PartitionOps cs_ops = {
     .name = "Core Storage",
     .test = cs_test,
     .dump = cs_dump,
-    .load = NULL,
+    .load = cs_load,
 };
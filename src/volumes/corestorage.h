@@ -15,10 +15,21 @@
 #pragma mark - Structures
 
 enum CSBlockTypes {
-    kCSVolumeHeaderBlock = 0x10,
-    kCSDiskLabelBlock    = 0x11,
+    kCSVolumeHeaderBlock        = 0x10,
+    kCSDiskLabelBlock           = 0x11,
+
+    // Only found in the encrypted metadata
+    kCSLogicalVolumeFamilyBlock = 0x19,
+    kCSLogicalVolumeBlock       = 0x1a,
+    kCSSegmentMapBlock          = 0x305,
 };
 
+// Encrypted metadata is kept in blocks of this size, each its own AES-XTS data unit.
+#define kCSEncryptedBlockSize 8192
+
+// Block numbers in the metadata keep the index of the physical volume they're on in their top 16 bits.
+#define kCSBlockNumberMask    0x0000FFFFFFFFFFFFULL
+
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpacked"
@@ -35,7 +46,7 @@ struct CSBlockHeader
     uint32_t field_5;               // 12; sequence number?
     uint64_t generation;            // 16; revision number? counter?
     uint64_t field_7;               // 24; some block number
-    uint64_t field_8;               // 32; this block number?
+    uint64_t object_id;             // 32; in the encrypted metadata; this block number elsewhere?
     uint64_t field_9;               // 40; some block number
 
     uint32_t block_size;            // 48
@@ -100,14 +111,66 @@ struct CSMetadataBlockType11
 typedef struct CSVolumeGroupsDescriptor CSVolumeGroupsDescriptor;
 struct CSVolumeGroupsDescriptor {
     uint64_t field_1;                           // 0
-    uint64_t field_2;                           // 8
+    uint64_t encrypted_md_size;                 // 8; in volume header blocks (md_block_size)
     uint64_t field_3;                           // 16
-    uint64_t field_4;                           // 24
-    uint64_t field_5;                           // 32
-    uint64_t field_6;                           // 40
+    uint64_t encrypted_md_count;                // 24; copies of the encrypted metadata
+    uint64_t encrypted_md_blocks[2];            // 32
     char     plist[4];                          // 48
 } __attribute__((aligned(2), packed));
 
+// The blocks below are only found in the encrypted metadata.
+
+// A set of logical volumes sharing an encryption context, which is in the plist.
+typedef struct CSLogicalVolumeFamilyBlock CSLogicalVolumeFamilyBlock;
+struct CSLogicalVolumeFamilyBlock {
+    CSBlockHeader block_header;                 // 0
+
+    uint64_t      field_1;                      // 64
+    uint64_t      field_2;                      // 72
+    uint64_t      field_3;                      // 80; some object ID (0x605)
+    uint64_t      field_4;                      // 88; some object ID (0x205)
+    uint64_t      field_5;                      // 96
+    uint32_t      plist_size;                   // 104
+    uint32_t      plist_size_copy;              // 108
+    uint32_t      plist_offset;                 // 112
+    uint32_t      field_9;                      // 116; the plist size again?
+} __attribute__((aligned(2), packed));
+
+// One logical volume; its properties (name, size, UUID) are in the plist.
+typedef struct CSLogicalVolumeBlock CSLogicalVolumeBlock;
+struct CSLogicalVolumeBlock {
+    CSBlockHeader block_header;                 // 0
+
+    uint64_t      family_object;                // 64; the logical volume family (0x19)
+    uint64_t      segment_map_object;           // 72; where its blocks are (0x305)
+    uint64_t      field_3;                      // 80
+    uint64_t      field_4;                      // 88
+    uint64_t      field_5;                      // 96; some object ID (0x21)
+    uint64_t      field_6;                      // 104; some object ID (0x505)
+    uint64_t      field_7;                      // 112
+    uint32_t      plist_size;                   // 120
+    uint32_t      plist_size_copy;              // 124
+    uint32_t      plist_offset;                 // 128
+    uint32_t      field_11;                     // 132; the plist size again?
+} __attribute__((aligned(2), packed));
+
+// A run of a logical volume's blocks. Block numbers are in volume header blocks (md_block_size).
+typedef struct CSSegment CSSegment;
+struct CSSegment {
+    uint64_t logical_block;                     // 0
+    uint64_t physical_block;                    // 8; with the physical volume's index in the top 16 bits
+    uint64_t block_count;                       // 16
+} __attribute__((aligned(2), packed));
+
+typedef struct CSSegmentMapBlock CSSegmentMapBlock;
+struct CSSegmentMapBlock {
+    CSBlockHeader block_header;                 // 0
+
+    uint32_t      segment_count;                // 64
+    uint32_t      field_2;                      // 68
+    CSSegment     segments[1];                  // 72
+} __attribute__((aligned(2), packed));
+
 #pragma GCC diagnostic pop
 
 
@@ -126,7 +189,9 @@ int cs_test(Volume* vol) __attribute__((nonnull));
 int cs_get_volume_header(Volume* vol, CSVolumeHeader* header) __attribute__((nonnull));
 
 /**
-   Updates a volume with sub-volumes for any defined partitions.
+   Marks a volume as a CS physical volume and adds its logical volumes as mapped sub-volumes, decrypting
+   the metadata that describes them. Logical volumes that reach onto other physical volumes (Fusion
+   drives) or whose contents are encrypted (FileVault) are skipped.
    @return Returns -1 on error (check errno), 0 for success.
  */
 int cs_load(Volume* vol) __attribute__((nonnull));
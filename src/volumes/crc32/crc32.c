@@ -6,7 +6,14 @@
 //  Copyright (c) 2014 Adam Knight. All rights reserved.
 //
 
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>          // _mm_clmulepi64_si128, _mm_crc32_*
+#endif
+
 #include "crc32.h"
+#include "crc32c/crc32c.h"
 
 // Generated with makecrc.c, like everyone else.  Thanks, Mark.
 static const uint32_t crc32_table_enet[256] = {
@@ -64,7 +71,201 @@ static const uint32_t crc32_table_enet[256] = {
     0x2d02ef8dL
 };
 
-uint32_t crc32 (uint32_t crc, const void* buf, size_t len)
+#pragma mark Slice-by-8
+
+// crc32_slices[k][n] is the CRC of byte n followed by k zero bytes, so eight table lookups consume eight bytes at once.
+static uint32_t       crc32_slices[8][256];
+static crc32_func     crc32_impl  = crc32_bytewise;
+static crc32_func     crc32c_impl = crc32c;
+static bool           crc32_clmul = false;
+static pthread_once_t crc32_once  = PTHREAD_ONCE_INIT;
+
+static void crc32_make_slices(void)
+{
+    for (unsigned n = 0; n < 256; n++) crc32_slices[0][n] = crc32_table_enet[n];
+
+    for (unsigned k = 1; k < 8; k++)
+        for (unsigned n = 0; n < 256; n++)
+            crc32_slices[k][n] = (crc32_slices[k - 1][n] >> 8) ^ crc32_table_enet[crc32_slices[k - 1][n] & 0xff];
+}
+
+// The little-endian loads are spelled out a byte at a time; compilers turn them into single loads where that's legal.
+static inline uint32_t crc32_load_le32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32_slice8_raw(uint32_t crc, const uint8_t* p, size_t len)
+{
+    while (len >= 8) {
+        uint32_t one = crc32_load_le32(p) ^ crc;
+        uint32_t two = crc32_load_le32(p + 4);
+        crc = crc32_slices[7][one & 0xff] ^
+              crc32_slices[6][(one >> 8) & 0xff] ^
+              crc32_slices[5][(one >> 16) & 0xff] ^
+              crc32_slices[4][one >> 24] ^
+              crc32_slices[3][two & 0xff] ^
+              crc32_slices[2][(two >> 8) & 0xff] ^
+              crc32_slices[1][(two >> 16) & 0xff] ^
+              crc32_slices[0][two >> 24];
+        p   += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = crc32_table_enet[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#pragma mark Carry-less Multiply
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+   Folds four 128-bit lanes at a time with PCLMULQDQ, then reduces to 32 bits with a Barrett
+   reduction (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ", 2009).
+   The constants are powers of x modulo the bit-reflected IEEE polynomial.
+ */
+
+static const uint64_t crc32_k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+static const uint64_t crc32_k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+static const uint64_t crc32_k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+static const uint64_t crc32_poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+// Takes and returns the uncomplemented register. `len` must be a multiple of 16 and at least 64.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_raw(uint32_t crc, const uint8_t* p, size_t len)
+{
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i*)crc32_k1k2);
+    p   += 64;
+    len -= 64;
+
+    // Four lanes, 64 bytes per round.
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+        y6 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+        y7 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+        y8 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        p   += 64;
+        len -= 64;
+    }
+
+    // Fold the four lanes into one.
+    x0 = _mm_load_si128((const __m128i*)crc32_k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Any remaining 16-byte blocks.
+    while (len >= 16) {
+        x2   = _mm_loadu_si128((const __m128i*)p);
+        x5   = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1   = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1   = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        p   += 16;
+        len -= 16;
+    }
+
+    // 128 bits to 64.
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i*)crc32_k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32.
+    x0 = _mm_load_si128((const __m128i*)crc32_poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const void* buf, size_t len)
+{
+    const uint8_t* p = buf;
+
+    crc = ~crc;
+
+    while (len && ((uintptr_t)p & 7)) { crc = _mm_crc32_u8(crc, *p++); len--; }
+
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p    += 8;
+        len  -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+
+    while (len >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc  = _mm_crc32_u32(crc, word);
+        p   += 4;
+        len -= 4;
+    }
+
+    while (len--) crc = _mm_crc32_u8(crc, *p++);
+
+    return ~crc;
+}
+
+#endif
+
+#pragma mark Dispatch
+
+static void crc32_init(void)
+{
+    crc32_make_slices();
+    crc32_impl = crc32_slice8;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    crc32_clmul = (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"));
+    if (crc32_clmul) crc32_impl = crc32_pclmul;
+    if (__builtin_cpu_supports("sse4.2")) crc32c_impl = crc32c_sse42;
+#endif
+}
+
+uint32_t crc32_bytewise(uint32_t crc, const void* buf, size_t len)
 {
     const uint8_t* buf_p   = buf;
     const uint8_t* buf_end = buf_p + len;
@@ -76,3 +277,43 @@ uint32_t crc32 (uint32_t crc, const void* buf, size_t len)
     return ~crc;
 }
 
+uint32_t crc32_slice8(uint32_t crc, const void* buf, size_t len)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return ~crc32_slice8_raw(~crc, buf, len);
+}
+
+uint32_t crc32_pclmul(uint32_t crc, const void* buf, size_t len)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const uint8_t* p    = buf;
+    size_t         bulk = len & ~(size_t)15;
+
+    pthread_once(&crc32_once, crc32_init);
+
+    if ((bulk < 64) || !crc32_clmul) return crc32_slice8(crc, buf, len);
+
+    crc = crc32_pclmul_raw(~crc, p, bulk);
+    return ~crc32_slice8_raw(crc, p + bulk, len - bulk);
+#else
+    return crc32_slice8(crc, buf, len);
+#endif
+}
+
+const char* crc32_implementation(void)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return (crc32_impl == crc32_pclmul ? "pclmul" : "slice-by-8");
+}
+
+uint32_t crc32(uint32_t crc, const void* buf, size_t len)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32_impl(crc, buf, len);
+}
+
+uint32_t crc32c_fast(uint32_t crc, const void* buf, size_t len)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32c_impl(crc, buf, len);
+}
@@ -11,6 +11,23 @@
 #ifndef volumes_crc32_h
 #define volumes_crc32_h
 
-uint32_t crc32 (uint32_t crc, const void* buf, size_t len);
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t (* crc32_func)(uint32_t crc, const void* buf, size_t len);
+
+// IEEE CRC-32, using the fastest implementation the CPU supports (picked on first use).
+uint32_t    crc32                (uint32_t crc, const void* buf, size_t len);
+
+// The implementations crc32 picks from; all give the same results. crc32_pclmul falls back to slice-by-8 on CPUs without it.
+uint32_t    crc32_bytewise       (uint32_t crc, const void* buf, size_t len);
+uint32_t    crc32_slice8         (uint32_t crc, const void* buf, size_t len);
+uint32_t    crc32_pclmul         (uint32_t crc, const void* buf, size_t len);
+
+// Name of the implementation crc32 uses.
+const char* crc32_implementation (void);
+
+// CRC-32C (Castagnoli) using the SSE 4.2 crc32 instruction when available, and the vendored crc32c otherwise.
+uint32_t    crc32c_fast          (uint32_t crc, const void* buf, size_t len);
 
 #endif
@@ -50,7 +50,7 @@ const char* _gpt_partition_type_str(uuid_t uuid, VolType* hint)
         }
     }
 
-    static uuid_string_t string;
+    static __thread uuid_string_t string;   // Per thread; volumes may load in parallel
     uuid_unparse(uuid, string);
     return string;
 }
@@ -0,0 +1,499 @@
+//
+//  ioengine.c
+//  volumes
+//
+//
+
+#include "ioengine.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#if defined (__linux__) && defined (__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define IOENGINE_URING 1
+        #include <linux/io_uring.h>
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+        #include <sys/uio.h>
+    #endif
+#endif
+
+#include "workqueue.h"
+#include "logging/logging.h"    // console printing routines
+
+#define kIOSlotNone          UINT32_MAX
+
+// More threads than this stop adding throughput and start adding contention; deeper queues wait in the pool's FIFO.
+#define kIOEngineMaxThreads  64
+
+typedef struct IOSlot {
+    IOEngine*         engine;
+    const Volume*     vol;
+    char*             buf;
+    size_t            size;
+    size_t            done;                 // Bytes landed so far (kernel reads may arrive in pieces)
+    off_t             offset;               // Within the volume for pool reads; within the source file for kernel reads
+    ssize_t           result;
+    int               error;
+    int               fd;
+    ioengine_callback callback;
+    void*             context;
+    uint32_t          next;                 // Link in the free or finished list
+    uint32_t          index;
+#if defined (IOENGINE_URING)
+    struct iovec      iov;
+#endif
+} IOSlot;
+
+struct IOEngine {
+    unsigned        depth;
+    unsigned        pending;                // Slots handed out whose callbacks haven't run
+    unsigned        kernel_pending;         // ... of which are still with the kernel
+    unsigned        pool_pending;           // ... of which are still with the pool (guarded by lock)
+    IOSlot*         slots;
+    uint32_t        free_head;              // Owner thread only
+
+    pthread_mutex_t lock;
+    pthread_cond_t  finished;               // Signalled when a pool read finishes
+    uint32_t        finished_head;          // Reads waiting for their callbacks, oldest first (guarded by lock)
+    uint32_t        finished_tail;
+    WorkQueue*      pool;                   // Started with the first read that the kernel can't take
+
+    IOEngineStats   stats;
+
+#if defined (IOENGINE_URING)
+    int                  ring_fd;           // -1 if the kernel isn't used
+    unsigned*            sq_tail;
+    unsigned*            sq_mask;
+    unsigned*            sq_array;
+    unsigned*            cq_head;
+    unsigned*            cq_tail;
+    unsigned*            cq_mask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void*                sq_ring;
+    void*                cq_ring;
+    size_t               sq_ring_size;
+    size_t               cq_ring_size;
+    size_t               sqes_size;
+#endif
+};
+
+// Queues a finished read for delivery. Safe from any thread.
+static void ioengine_finish(IOEngine* engine, IOSlot* slot, ssize_t result, int error, bool pooled)
+{
+    pthread_mutex_lock(&engine->lock);
+
+    slot->result = result;
+    slot->error  = error;
+    slot->next   = kIOSlotNone;
+
+    if (engine->finished_tail == kIOSlotNone)
+        engine->finished_head = slot->index;
+    else
+        engine->slots[engine->finished_tail].next = slot->index;
+    engine->finished_tail = slot->index;
+
+    if (pooled) {
+        engine->pool_pending--;
+        pthread_cond_signal(&engine->finished);
+    }
+
+    pthread_mutex_unlock(&engine->lock);
+}
+
+#pragma mark io_uring
+
+#if defined (IOENGINE_URING)
+
+static int ioengine_uring_setup(IOEngine* engine)
+{
+    struct io_uring_params p  = {0};
+    int                    fd = (int)syscall(__NR_io_uring_setup, engine->depth, &p);
+
+    if (fd < 0) return -1;
+
+    engine->ring_fd      = fd;
+    engine->sq_ring_size = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+    engine->cq_ring_size = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+    engine->sqes_size    = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings with one call.
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        engine->sq_ring_size = engine->cq_ring_size = MAX(engine->sq_ring_size, engine->cq_ring_size);
+    }
+
+    engine->sq_ring = mmap(NULL, engine->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (engine->sq_ring == MAP_FAILED) goto FAIL;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        engine->cq_ring = engine->sq_ring;
+    } else {
+        engine->cq_ring = mmap(NULL, engine->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (engine->cq_ring == MAP_FAILED) goto FAIL;
+    }
+
+    engine->sqes = mmap(NULL, engine->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (engine->sqes == MAP_FAILED) goto FAIL;
+
+    engine->sq_tail  = (unsigned*)((char*)engine->sq_ring + p.sq_off.tail);
+    engine->sq_mask  = (unsigned*)((char*)engine->sq_ring + p.sq_off.ring_mask);
+    engine->sq_array = (unsigned*)((char*)engine->sq_ring + p.sq_off.array);
+    engine->cq_head  = (unsigned*)((char*)engine->cq_ring + p.cq_off.head);
+    engine->cq_tail  = (unsigned*)((char*)engine->cq_ring + p.cq_off.tail);
+    engine->cq_mask  = (unsigned*)((char*)engine->cq_ring + p.cq_off.ring_mask);
+    engine->cqes     = (struct io_uring_cqe*)((char*)engine->cq_ring + p.cq_off.cqes);
+
+    return 0;
+
+FAIL:
+    {
+        int err = errno;
+        if ((engine->cq_ring != NULL) && (engine->cq_ring != MAP_FAILED) && (engine->cq_ring != engine->sq_ring)) munmap(engine->cq_ring, engine->cq_ring_size);
+        if ((engine->sq_ring != NULL) && (engine->sq_ring != MAP_FAILED)) munmap(engine->sq_ring, engine->sq_ring_size);
+        engine->sq_ring = engine->cq_ring = NULL;
+        engine->sqes    = NULL;
+        close(fd);
+        engine->ring_fd = -1;
+        errno           = err;
+        return -1;
+    }
+}
+
+static void ioengine_uring_teardown(IOEngine* engine)
+{
+    if (engine->ring_fd < 0) return;
+
+    munmap(engine->sqes, engine->sqes_size);
+    if (engine->cq_ring != engine->sq_ring) munmap(engine->cq_ring, engine->cq_ring_size);
+    munmap(engine->sq_ring, engine->sq_ring_size);
+    close(engine->ring_fd);
+    engine->ring_fd = -1;
+}
+
+static int ioengine_uring_enter(IOEngine* engine, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, engine->ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Hands the unread part of a slot to the kernel. Returns -1 if the kernel wouldn't take it.
+static int ioengine_uring_submit(IOEngine* engine, IOSlot* slot)
+{
+    // Only this thread moves the tail; the kernel moves the head, and never past the tail.
+    unsigned             tail  = *engine->sq_tail;
+    unsigned             index = tail & *engine->sq_mask;
+    struct io_uring_sqe* sqe   = &engine->sqes[index];
+
+    slot->iov.iov_base = slot->buf + slot->done;
+    slot->iov.iov_len  = slot->size - slot->done;
+
+    // READV rather than READ: it goes back to the first kernels with io_uring.
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = slot->fd;
+    sqe->addr      = (uintptr_t)&slot->iov;
+    sqe->len       = 1;
+    sqe->off       = slot->offset + slot->done;
+    sqe->user_data = slot->index;
+
+    engine->sq_array[index] = index;
+    __atomic_store_n(engine->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while (ioengine_uring_enter(engine, 1, 0, 0) < 0) {
+        if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) continue;
+
+        // The kernel rejected the call outright, so it never looked at the entry; take it back.
+        __atomic_store_n(engine->sq_tail, tail, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    engine->kernel_pending++;
+    return 0;
+}
+
+// Moves completions from the ring to the finished list, waiting for at least one if asked.
+static void ioengine_uring_reap(IOEngine* engine, bool wait)
+{
+    if (wait) {
+        while ((ioengine_uring_enter(engine, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno == EINTR)) ;
+    }
+
+    unsigned head = *engine->cq_head;
+    unsigned tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        const struct io_uring_cqe* cqe  = &engine->cqes[head & *engine->cq_mask];
+        IOSlot*                    slot = &engine->slots[cqe->user_data];
+        int                        res  = cqe->res;
+
+        __atomic_store_n(engine->cq_head, ++head, __ATOMIC_RELEASE);
+        engine->kernel_pending--;
+
+        // Finish short reads like fdpread does: keep going until the data runs out.
+        if (res > 0) slot->done += res;
+        bool retry = ((res > 0) && (slot->done < slot->size)) || (res == -EINTR) || (res == -EAGAIN);
+        if (retry && (ioengine_uring_submit(engine, slot) == 0)) continue;
+
+        if ((res < 0) && (slot->done == 0))
+            ioengine_finish(engine, slot, -1, -res, false);
+        else
+            ioengine_finish(engine, slot, slot->done, 0, false);
+    }
+}
+
+#endif
+
+#pragma mark Thread Pool
+
+static void ioengine_pool_read(void* context)
+{
+    IOSlot* slot  = context;
+    ssize_t bytes = vol_read(slot->vol, slot->buf, slot->size, slot->offset);
+
+    ioengine_finish(slot->engine, slot, bytes, (bytes < 0 ? errno : 0), true);
+}
+
+#pragma mark Engine
+
+IOEngine* ioengine_make(unsigned depth, IOEngineBackend backend)
+{
+    IOEngine* engine = NULL;
+
+    if (depth == 0) depth = IOENGINE_DEFAULT_DEPTH;
+    if (depth > IOENGINE_MAX_DEPTH) { errno = EINVAL; return NULL; }
+
+    SALLOC(engine, sizeof(IOEngine));
+    SALLOC(engine->slots, depth * sizeof(IOSlot));
+
+    engine->depth         = depth;
+    engine->finished_head = kIOSlotNone;
+    engine->finished_tail = kIOSlotNone;
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->finished, NULL);
+
+    for (uint32_t i = 0; i < depth; i++) {
+        engine->slots[i].engine = engine;
+        engine->slots[i].index  = i;
+        engine->slots[i].next   = ((i + 1) < depth ? i + 1 : kIOSlotNone);
+    }
+    engine->free_head = 0;
+
+#if defined (IOENGINE_URING)
+    engine->ring_fd = -1;
+    if ((backend != kIOEngineThreads) && (ioengine_uring_setup(engine) < 0)) {
+        // Old kernels say ENOSYS; container sandboxes often say EPERM.
+        debug("io_uring unavailable (%s); reading on threads.", strerror(errno));
+    }
+    if ((backend == kIOEngineURing) && (engine->ring_fd < 0)) {
+        ioengine_free(engine);
+        errno = ENOSYS;
+        return NULL;
+    }
+#else
+    if (backend == kIOEngineURing) {
+        ioengine_free(engine);
+        errno = ENOSYS;
+        return NULL;
+    }
+#endif
+
+    return engine;
+}
+
+void ioengine_free(IOEngine* engine)
+{
+    ioengine_wait(engine);
+
+    if (engine->pool != NULL) workqueue_free(engine->pool);
+
+#if defined (IOENGINE_URING)
+    ioengine_uring_teardown(engine);
+#endif
+
+    pthread_cond_destroy(&engine->finished);
+    pthread_mutex_destroy(&engine->lock);
+    SFREE(engine->slots);
+    SFREE(engine);
+}
+
+unsigned ioengine_depth(const IOEngine* engine)
+{
+    return engine->depth;
+}
+
+unsigned ioengine_pending(const IOEngine* engine)
+{
+    return engine->pending;
+}
+
+const char* ioengine_name(const IOEngine* engine)
+{
+#if defined (IOENGINE_URING)
+    if (engine->ring_fd >= 0) return "io_uring";
+#endif
+    return "threads";
+}
+
+void ioengine_get_stats(const IOEngine* engine, IOEngineStats* stats)
+{
+    *stats = engine->stats;
+}
+
+// Runs the callbacks of finished reads, first waiting for one if `block` is set and nothing has finished yet.
+static unsigned ioengine_reap(IOEngine* engine, bool block)
+{
+    unsigned count = 0;
+
+    pthread_mutex_lock(&engine->lock);
+    bool     idle  = (engine->finished_head == kIOSlotNone) && (engine->pool_pending == 0);
+    pthread_mutex_unlock(&engine->lock);
+
+#if defined (IOENGINE_URING)
+    // Sleep in the kernel only when nothing else can finish in the meantime.
+    if (engine->kernel_pending) ioengine_uring_reap(engine, block && idle);
+#else
+    (void)idle;
+#endif
+
+    pthread_mutex_lock(&engine->lock);
+
+    while (block && (engine->finished_head == kIOSlotNone) && (engine->pool_pending > 0)) {
+        if (engine->kernel_pending == 0) {
+            pthread_cond_wait(&engine->finished, &engine->lock);
+        } else {
+            // Reads are out with both the kernel and the pool, and there's no way to sleep on both; check back shortly.
+            struct timespec deadline = {0};
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 1000 * 1000;
+            if (deadline.tv_nsec >= 1000 * 1000 * 1000) { deadline.tv_sec++; deadline.tv_nsec -= 1000 * 1000 * 1000; }
+            pthread_cond_timedwait(&engine->finished, &engine->lock, &deadline);
+            break;
+        }
+    }
+
+    uint32_t next = engine->finished_head;
+    engine->finished_head = kIOSlotNone;
+    engine->finished_tail = kIOSlotNone;
+
+    pthread_mutex_unlock(&engine->lock);
+
+    while (next != kIOSlotNone) {
+        IOSlot*           slot     = &engine->slots[next];
+        ioengine_callback callback = slot->callback;
+        void*             context  = slot->context;
+        void*             buf      = slot->buf;
+        ssize_t           result   = slot->result;
+        int               error    = slot->error;
+
+        // Free the slot first so the callback can queue another read in it.
+        next              = slot->next;
+        slot->next        = engine->free_head;
+        engine->free_head = slot->index;
+        engine->pending--;
+
+        if (result > 0) engine->stats.bytes += result;
+
+        errno = error;
+        callback(context, buf, result);
+        count++;
+    }
+
+    return count;
+}
+
+unsigned ioengine_poll(IOEngine* engine, bool wait)
+{
+    unsigned count = ioengine_reap(engine, false);
+
+    while (wait && (count == 0) && (engine->pending > 0))
+        count = ioengine_reap(engine, true);
+
+    return count;
+}
+
+void ioengine_wait(IOEngine* engine)
+{
+    while (engine->pending > 0)
+        ioengine_reap(engine, true);
+}
+
+int ioengine_read(IOEngine* engine, const Volume* vol, void* buf, size_t size, off_t offset, ioengine_callback callback, void* context)
+{
+    if (offset < 0) { errno = EINVAL; return -1; }
+
+    if (engine->free_head == kIOSlotNone) engine->stats.stalls++;
+    while (engine->free_head == kIOSlotNone)
+        ioengine_reap(engine, true);
+
+    IOSlot* slot = &engine->slots[engine->free_head];
+    engine->free_head = slot->next;
+    engine->pending++;
+    engine->stats.reads++;
+
+    slot->vol      = vol;
+    slot->buf      = buf;
+    slot->size     = size;
+    slot->done     = 0;
+    slot->offset   = offset;
+    slot->callback = callback;
+    slot->context  = context;
+
+    // Same range checks as vol_read.
+    if (vol->length && ((size_t)offset >= vol->length)) size = 0;
+    else if (vol->length && ((offset + size) > vol->length)) size = vol->length - offset;
+
+    if (size == 0) {
+        ioengine_finish(engine, slot, 0, 0, false);
+        return 0;
+    }
+
+    // Headers read while probing are already in memory.
+    if (vol->probe && (((size_t)offset + size) <= vol->probe_size)) {
+        memcpy(buf, vol->probe + offset, size);
+        ioengine_finish(engine, slot, size, 0, false);
+        return 0;
+    }
+
+#if defined (IOENGINE_URING)
+    // The kernel can only serve volumes that are one run of the source file.
+    if ((engine->ring_fd >= 0) && (vol->source_ops == NULL) && (vol->map == NULL)) {
+        slot->fd     = vol->fd;
+        slot->size   = size;
+        slot->offset = vol->offset + offset;
+        if (ioengine_uring_submit(engine, slot) == 0) {
+            engine->stats.kernel_reads++;
+            return 0;
+        }
+        debug("io_uring submit failed (%s); reading on a thread.", strerror(errno));
+        slot->offset = offset;
+    }
+#endif
+
+    if ((engine->pool == NULL) && ((engine->pool = workqueue_make(MIN(engine->depth, kIOEngineMaxThreads))) == NULL))
+        goto FAIL;
+
+    pthread_mutex_lock(&engine->lock);
+    engine->pool_pending++;
+    pthread_mutex_unlock(&engine->lock);
+
+    if (workqueue_add(engine->pool, ioengine_pool_read, slot) < 0) {
+        pthread_mutex_lock(&engine->lock);
+        engine->pool_pending--;
+        pthread_mutex_unlock(&engine->lock);
+        goto FAIL;
+    }
+
+    return 0;
+
+FAIL:
+    {
+        int err = errno;
+        slot->next        = engine->free_head;
+        engine->free_head = slot->index;
+        engine->pending--;
+        engine->stats.reads--;
+        errno             = err;
+        return -1;
+    }
+}
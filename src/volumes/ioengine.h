@@ -0,0 +1,80 @@
+//
+//  ioengine.h
+//  volumes
+//
+//
+
+/*
+   Asynchronous volume reads. Callers queue reads with a completion callback and the engine keeps
+   up to `depth` of them in flight at once, which is what it takes to reach the IOPS of an NVMe
+   drive or a network block device.
+
+   On Linux, reads of plain files and devices are handed to the kernel through an io_uring. Reads
+   the kernel can't serve on its own (disk images, mapped volumes) and every read on systems without
+   io_uring go through vol_read on a pool of threads instead.
+
+   Callbacks always run on the thread that owns the engine, from inside ioengine_read (when it has
+   to wait for a free slot), ioengine_poll or ioengine_wait, so callers need no locking of their own.
+   A callback may queue more reads; it must not call ioengine_poll, ioengine_wait or ioengine_free.
+   An engine must only be used from one thread at a time.
+ */
+
+#ifndef volumes_ioengine_h
+#define volumes_ioengine_h
+
+#include "volume.h"
+
+#define IOENGINE_DEFAULT_DEPTH 32
+#define IOENGINE_MAX_DEPTH     1024
+
+typedef enum IOEngineBackend {
+    kIOEngineAuto = 0,                      // io_uring where the kernel has it, the thread pool otherwise
+    kIOEngineURing,                         // io_uring only; ioengine_make fails with ENOSYS without it
+    kIOEngineThreads,                       // Thread pool only
+} IOEngineBackend;
+
+/**
+   Receives a finished read.
+   @param buf The buffer passed to ioengine_read.
+   @param result Bytes read, short only at the end of the volume, or -1 with errno set.
+ */
+typedef void (* ioengine_callback)(void* context, void* buf, ssize_t result);
+
+typedef struct IOEngineStats {
+    uint64_t reads;                         // Reads queued
+    uint64_t kernel_reads;                  // ... of which the kernel served directly
+    uint64_t bytes;                         // Bytes delivered to callbacks
+    uint64_t stalls;                        // Times a reader had to wait for a free slot
+} IOEngineStats;
+
+typedef struct IOEngine IOEngine;
+
+// Creates an engine with `depth` slots (0 for the default; at most IOENGINE_MAX_DEPTH).
+IOEngine*   ioengine_make      (unsigned depth, IOEngineBackend backend);
+
+/**
+   Queues a read of `size` bytes at `offset` within the volume, clipped to its length like vol_read. Waits for a free slot if all are busy.
+   @return Zero if the read was queued and `callback` will be called exactly once, or -1 (check errno) if it wasn't.
+ */
+int         ioengine_read      (IOEngine* engine, const Volume* vol, void* buf, size_t size, off_t offset, ioengine_callback callback, void* context) __attribute__((nonnull(1,2,3,6)));
+
+// Runs the callbacks of reads that have finished. With `wait`, first blocks until at least one has (unless none are pending). Returns how many ran.
+unsigned    ioengine_poll      (IOEngine* engine, bool wait) __attribute__((nonnull));
+
+// Blocks until every queued read has finished and its callback has run.
+void        ioengine_wait      (IOEngine* engine) __attribute__((nonnull));
+
+unsigned    ioengine_depth     (const IOEngine* engine) __attribute__((nonnull));
+
+// Reads queued whose callbacks haven't run yet.
+unsigned    ioengine_pending   (const IOEngine* engine) __attribute__((nonnull));
+
+// "io_uring" or "threads".
+const char* ioengine_name      (const IOEngine* engine) __attribute__((nonnull));
+
+void        ioengine_get_stats (const IOEngine* engine, IOEngineStats* stats) __attribute__((nonnull));
+
+// Waits for outstanding reads, then releases the engine.
+void        ioengine_free      (IOEngine* engine) __attribute__((nonnull));
+
+#endif
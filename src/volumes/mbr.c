@@ -61,6 +61,7 @@ int mbr_load(Volume* vol)
             length = p.sector_count * vol->sector_size;
 
             v      = vol_make_partition(vol, i, offset, length);
+            if (v == NULL) return -1;
 
             char const* name = mbr_partition_type_str(p.type, &hint);
             if (name != NULL) {
@@ -74,7 +75,7 @@ int mbr_load(Volume* vol)
 
 const char* mbr_partition_type_str(uint16_t type, VolType* hint)
 {
-    static char type_str[100];
+    static __thread char type_str[100];     // Per thread; volumes may load in parallel
 
     for(unsigned i = 0; i < 22; i++) {
         if (mbr_partition_types[i].type == type) {
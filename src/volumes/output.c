@@ -74,6 +74,25 @@ int Print(out_ctx* ctx, const char* format, ...)
     return bytes;
 }
 
+int PrintLines(out_ctx* ctx, const char* lines, size_t length)
+{
+    const char* end   = lines + length;
+    int         bytes = 0;
+
+    while (lines < end) {
+        const char* eol = memchr(lines, '\n', (size_t)(end - lines));
+        size_t      n   = (eol ? (size_t)(eol - lines) : (size_t)(end - lines));
+
+        fputs(ctx->indent_string, stdout);
+        bytes += (int)fwrite(lines, 1, n, stdout);
+        fputs("\n", stdout);
+
+        lines += n + 1;
+    }
+
+    return bytes;
+}
+
 int PrintAttribute(out_ctx* ctx, const char* label, const char* format, ...)
 {
     va_list argp;
@@ -55,6 +55,8 @@ int  BeginSection   (out_ctx* ctx, const char* format, ...);
 void EndSection     (out_ctx* ctx);
 
 int Print           (out_ctx* ctx, const char* format, ...);
+// Prints a block of already formatted, newline-separated lines, each indented as Print would.
+int PrintLines      (out_ctx* ctx, const char* lines, size_t length);
 int PrintAttribute  (out_ctx* ctx, const char* label, const char* format, ...);
 int _PrintUIChar    (out_ctx* ctx, const char* label, const char* i, size_t nbytes);
 
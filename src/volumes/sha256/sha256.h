@@ -0,0 +1,26 @@
+//
+//  sha256.h
+//  volumes
+//
+//
+
+// FIPS 180-4 SHA-256, streaming.  Small and dependency-free so it builds anywhere hfsinspect does.
+
+#ifndef volumes_sha256_h
+#define volumes_sha256_h
+
+#define SHA256_DIGEST_LENGTH 32
+#define SHA256_BLOCK_LENGTH  64
+
+typedef struct sha256_ctx {
+    uint32_t state[8];
+    uint64_t length;                        // Message length so far (bytes)
+    uint8_t  buffer[SHA256_BLOCK_LENGTH];   // Partial block
+    size_t   buffered;
+} sha256_ctx;
+
+void sha256_init   (sha256_ctx* ctx);
+void sha256_update (sha256_ctx* ctx, const void* data, size_t len);
+void sha256_final  (sha256_ctx* ctx, uint8_t digest[SHA256_DIGEST_LENGTH]);
+
+#endif
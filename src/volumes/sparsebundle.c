@@ -0,0 +1,413 @@
+//
+//  sparsebundle.c
+//  volumes
+//
+//
+
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "sparsebundle.h"
+#include "workqueue.h"
+#include "utilities.h"
+#include "logging/logging.h"    // console printing routines
+
+// Band files kept open at once, and the smallest read spanning several bands that's split across threads.
+#define kBundleOpenBands     64
+#define kBundleParallelBytes (1024 * 1024)
+
+#define kBundleMaxPlist      (1024 * 1024)
+
+enum {
+    kBandEmpty = 0,
+    kBandOpening,
+    kBandOpen,
+};
+
+typedef struct BandFile {
+    uint64_t band;
+    int      fd;
+    int      state;
+    unsigned refs;                  // Readers using the descriptor; a slot with references isn't evicted
+    uint64_t used;                  // Clock at the last hit, for LRU eviction
+} BandFile;
+
+typedef struct SparseBundle {
+    int             bands_fd;       // The bands/ directory
+    uint64_t        band_size;
+    uint64_t        band_count;
+    uint64_t        length;
+    uint8_t*        present;        // Bitmap of the bands with a file
+
+    pthread_mutex_t lock;           // Guards the descriptor cache
+    pthread_cond_t  changed;        // A slot finished opening or lost its last reference
+    BandFile        files[kBundleOpenBands];
+    uint64_t        clock;
+    WorkQueue*      queue;          // Started by the first read spanning bands
+} SparseBundle;
+
+#pragma mark Band Files
+
+static bool bundle_band_present(const SparseBundle* bundle, uint64_t band)
+{
+    return (band < bundle->band_count) && (bundle->present[band / 8] & (1 << (band % 8)));
+}
+
+// Returns a cache slot with the band file open, holding a reference the caller drops with bundle_release().
+static BandFile* bundle_acquire(SparseBundle* bundle, uint64_t band)
+{
+    BandFile* file = NULL;
+    int       old  = -1;
+
+    pthread_mutex_lock(&bundle->lock);
+
+    while (1) {
+        BandFile* victim = NULL;
+        file = NULL;
+
+        for (unsigned i = 0; i < kBundleOpenBands; i++) {
+            BandFile* f = &bundle->files[i];
+
+            if ((f->state != kBandEmpty) && (f->band == band)) { file = f; break; }
+            if (f->refs || (f->state == kBandOpening)) continue;
+
+            // Prefer an empty slot, then the least recently used one.
+            if ((victim == NULL) || ((victim->state == kBandOpen) && ((f->state == kBandEmpty) || (f->used < victim->used))))
+                victim = f;
+        }
+
+        if (file && (file->state == kBandOpen)) {
+            file->refs++;
+            file->used = ++bundle->clock;
+            pthread_mutex_unlock(&bundle->lock);
+            return file;
+        }
+
+        // Another thread is opening this band, or every descriptor is in use.
+        if (file || (victim == NULL)) {
+            pthread_cond_wait(&bundle->changed, &bundle->lock);
+            continue;
+        }
+
+        file = victim;
+        break;
+    }
+
+    if (file->state == kBandOpen) old = file->fd;
+
+    file->state = kBandOpening;
+    file->band  = band;
+    file->refs  = 1;
+    pthread_mutex_unlock(&bundle->lock);
+
+    // Opening (possibly over a network) happens outside the lock.
+    if (old >= 0) close(old);
+
+    char name[32] = "";
+    snprintf(name, sizeof(name), "%jx", (uintmax_t)band);
+    int  fd       = openat(bundle->bands_fd, name, O_RDONLY);
+    if (fd < 0) error("sparse bundle: can't open band %s: %s", name, strerror(errno));
+
+    pthread_mutex_lock(&bundle->lock);
+    if (fd < 0) {
+        file->state = kBandEmpty;
+        file->refs  = 0;
+        file        = NULL;
+    } else {
+        file->fd    = fd;
+        file->state = kBandOpen;
+        file->used  = ++bundle->clock;
+    }
+    pthread_cond_broadcast(&bundle->changed);
+    pthread_mutex_unlock(&bundle->lock);
+
+    return file;
+}
+
+static void bundle_release(SparseBundle* bundle, BandFile* file)
+{
+    pthread_mutex_lock(&bundle->lock);
+    if (--file->refs == 0) pthread_cond_broadcast(&bundle->changed);
+    pthread_mutex_unlock(&bundle->lock);
+}
+
+// Reads part of one band. Missing bands and the space past the end of a short band file read as zeroes.
+static int bundle_read_band(SparseBundle* bundle, uint64_t band, off_t offset, char* buf, size_t length)
+{
+    if ( !bundle_band_present(bundle, band) ) {
+        memset(buf, 0, length);
+        return 0;
+    }
+
+    BandFile* file = bundle_acquire(bundle, band);
+    if (file == NULL) return -1;
+
+    ssize_t bytes = fdpread(file->fd, buf, length, offset);
+    bundle_release(bundle, file);
+
+    if (bytes < 0) return -1;
+    if ((size_t)bytes < length) memset(buf + bytes, 0, length - bytes);
+
+    return 0;
+}
+
+#pragma mark Parallel Reads
+
+typedef struct BundleRequest {
+    pthread_mutex_t lock;
+    pthread_cond_t  done;
+    size_t          remaining;
+    int             error;
+} BundleRequest;
+
+typedef struct BundleJob {
+    SparseBundle*  bundle;
+    BundleRequest* request;
+    uint64_t       band;
+    off_t          offset;
+    char*          buf;
+    size_t         length;
+} BundleJob;
+
+static void bundle_finish(BundleRequest* request, int result)
+{
+    pthread_mutex_lock(&request->lock);
+    if ((result < 0) && (request->error == 0)) request->error = (errno ? errno : EIO);
+    if (--request->remaining == 0) pthread_cond_signal(&request->done);
+    pthread_mutex_unlock(&request->lock);
+}
+
+static void bundle_job(void* context)
+{
+    BundleJob* job = context;
+
+    bundle_finish(job->request, bundle_read_band(job->bundle, job->band, job->offset, job->buf, job->length));
+    SFREE(job);
+}
+
+#pragma mark Source Operations
+
+static ssize_t bundle_read(void* context, void* buf, size_t nbytes, off_t offset)
+{
+    SparseBundle* bundle   = context;
+    char*         out      = buf;
+    uint64_t      first    = 0;
+    uint64_t      last     = 0;
+    bool          parallel = false;
+
+    if (offset < 0) { errno = EINVAL; return -1; }
+    if ((uint64_t)offset >= bundle->length) return 0;
+
+    nbytes   = MIN(nbytes, bundle->length - offset);
+    first    = offset / bundle->band_size;
+    last     = (offset + nbytes - 1) / bundle->band_size;
+    parallel = (last > first) && (nbytes >= kBundleParallelBytes);
+
+    if (parallel) {
+        pthread_mutex_lock(&bundle->lock);
+        if (bundle->queue == NULL) bundle->queue = workqueue_make(0);
+        parallel = (bundle->queue != NULL);
+        pthread_mutex_unlock(&bundle->lock);
+    }
+
+    if ( !parallel ) {
+        size_t done = 0;
+
+        while (done < nbytes) {
+            uint64_t pos    = offset + done;
+            off_t    within = pos % bundle->band_size;
+            size_t   run    = MIN(nbytes - done, bundle->band_size - within);
+
+            if (bundle_read_band(bundle, pos / bundle->band_size, within, out + done, run) < 0)
+                return (done ? (ssize_t)done : -1);
+            done += run;
+        }
+
+        return done;
+    }
+
+    // One job per band after the first; this thread reads the first band itself, then waits for the rest.
+    BundleRequest request = { .remaining = (last - first) + 1 };
+    pthread_mutex_init(&request.lock, NULL);
+    pthread_cond_init(&request.done, NULL);
+
+    off_t  head   = offset % bundle->band_size;
+    size_t length = MIN(nbytes, bundle->band_size - head);
+    size_t done   = length;
+
+    for (uint64_t band = first + 1; band <= last; band++) {
+        BundleJob* job = NULL;
+        size_t     run = MIN(nbytes - done, bundle->band_size);
+
+        SALLOC(job, sizeof(BundleJob));
+        *job  = (BundleJob){ bundle, &request, band, 0, out + done, run };
+        if (workqueue_add(bundle->queue, bundle_job, job) < 0) {
+            SFREE(job);
+            bundle_finish(&request, -1);
+        }
+        done += run;
+    }
+
+    bundle_finish(&request, bundle_read_band(bundle, first, head, out, length));
+
+    pthread_mutex_lock(&request.lock);
+    while (request.remaining) pthread_cond_wait(&request.done, &request.lock);
+    pthread_mutex_unlock(&request.lock);
+
+    pthread_cond_destroy(&request.done);
+    pthread_mutex_destroy(&request.lock);
+
+    if (request.error) { errno = request.error; return -1; }
+
+    return nbytes;
+}
+
+static void bundle_close(void* context)
+{
+    SparseBundle* bundle = context;
+
+    if (bundle->queue) workqueue_free(bundle->queue);
+
+    for (unsigned i = 0; i < kBundleOpenBands; i++)
+        if (bundle->files[i].state == kBandOpen) close(bundle->files[i].fd);
+
+    close(bundle->bands_fd);
+    pthread_cond_destroy(&bundle->changed);
+    pthread_mutex_destroy(&bundle->lock);
+    SFREE(bundle->present);
+    SFREE(bundle);
+}
+
+static const SourceOps bundle_ops = {
+    .name  = "sparse bundle",
+    .read  = bundle_read,
+    .close = bundle_close,
+};
+
+#pragma mark Opening
+
+// Finds <key>name</key> and returns the <integer> that follows it, or 0.
+static uint64_t plist_integer(const char* xml, const char* name)
+{
+    char        key[64] = "";
+    const char* p       = NULL;
+
+    snprintf(key, sizeof(key), "<key>%s</key>", name);
+    if ((p = strstr(xml, key)) == NULL) return 0;
+    if ((p = strstr(p + strlen(key), "<integer>")) == NULL) return 0;
+
+    return strtoull(p + strlen("<integer>"), NULL, 10);
+}
+
+static char* bundle_read_plist(int dir_fd)
+{
+    struct stat s   = {0};
+    char*       xml = NULL;
+    int         fd  = openat(dir_fd, "Info.plist", O_RDONLY);
+
+    if (fd < 0) return NULL;
+
+    if ((fstat(fd, &s) < 0) || (s.st_size > kBundleMaxPlist)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SALLOC(xml, s.st_size + 1);
+    if (fdpread(fd, xml, s.st_size, 0) != s.st_size) {
+        SFREE(xml);
+        close(fd);
+        errno = EIO;
+        return NULL;
+    }
+    xml[s.st_size] = '\0';
+
+    close(fd);
+    return xml;
+}
+
+// Marks every band with a file. Names that aren't band numbers are ignored.
+static int bundle_list_bands(SparseBundle* bundle)
+{
+    int            fd    = dup(bundle->bands_fd);
+    DIR*           dir   = (fd < 0 ? NULL : fdopendir(fd));
+    struct dirent* entry = NULL;
+    uint64_t       count = 0;
+
+    if (dir == NULL) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        char*    end  = NULL;
+        uint64_t band = strtoull(entry->d_name, &end, 16);
+
+        if ((entry->d_name[0] == '.') || (*end != '\0') || (band >= bundle->band_count)) continue;
+
+        bundle->present[band / 8] |= (1 << (band % 8));
+        count++;
+    }
+
+    closedir(dir);
+
+    info("Sparse bundle: %ju of %ju bands present (%ju bytes each)", (uintmax_t)count, (uintmax_t)bundle->band_count, (uintmax_t)bundle->band_size);
+
+    return 0;
+}
+
+int sparsebundle_open(Volume* vol)
+{
+    SparseBundle* bundle = NULL;
+    char*         xml    = NULL;
+    int           bands  = -1;
+
+    if ( !S_ISDIR(vol->mode) ) return 0;
+
+    if ((xml = bundle_read_plist(vol->fd)) == NULL) return 0;
+
+    if (strstr(xml, "com.apple.diskimage.sparsebundle") == NULL) {
+        SFREE(xml);
+        return 0;
+    }
+
+    uint64_t band_size = plist_integer(xml, "band-size");
+    uint64_t size      = plist_integer(xml, "size");
+    SFREE(xml);
+
+    if ((band_size == 0) || (size == 0)) {
+        error("sparse bundle: Info.plist has no band-size or size");
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((bands = openat(vol->fd, "bands", O_RDONLY | O_DIRECTORY)) < 0) {
+        error("sparse bundle: can't open the bands directory: %s", strerror(errno));
+        return -1;
+    }
+
+    SALLOC(bundle, sizeof(SparseBundle));
+    bundle->bands_fd   = bands;
+    bundle->band_size  = band_size;
+    bundle->length     = size;
+    bundle->band_count = (size + band_size - 1) / band_size;
+    SALLOC(bundle->present, (bundle->band_count + 7) / 8);
+
+    if (bundle_list_bands(bundle) < 0) {
+        close(bands);
+        SFREE(bundle->present);
+        SFREE(bundle);
+        return -1;
+    }
+
+    pthread_mutex_init(&bundle->lock, NULL);
+    pthread_cond_init(&bundle->changed, NULL);
+
+    vol->source_ops = &bundle_ops;
+    vol->source_ctx = bundle;
+    vol->length     = size;
+    strlcpy(vol->native_desc, "sparse bundle disk image", sizeof(vol->native_desc));
+
+    return 1;
+}
@@ -0,0 +1,28 @@
+//
+//  sparsebundle.h
+//  volumes
+//
+//
+
+/*
+   Sparse bundle (.sparsebundle) sources.
+
+   A sparse bundle is a directory holding an Info.plist with the image's size and band size, and a
+   bands/ directory with one file per band that has ever been written, named for the band's index
+   in lowercase hex. Bands that don't exist read as zeroes, as does anything past the end of a short
+   band file. The band files present are listed once when the bundle is opened, so reads of missing
+   bands never touch the disk.
+ */
+
+#ifndef volumes_sparsebundle_h
+#define volumes_sparsebundle_h
+
+#include "volume.h"
+
+/**
+   Attaches a sparse bundle backend to a newly opened volume if its source is a sparse bundle directory, and sets the volume's length to the image size.
+   @return Returns -1 on error (check errno), 0 if the source isn't a sparse bundle, 1 if it is.
+ */
+int sparsebundle_open(Volume* vol) __attribute__((nonnull));
+
+#endif
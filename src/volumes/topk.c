@@ -0,0 +1,125 @@
+//
+//  topk.c
+//  volumes
+//
+//
+
+#include "topk.h"
+
+
+struct TopK {
+    char*             items;            // Min-heap: items[0] is the lowest-ranked item kept
+    size_t            count;
+    size_t            k;
+    size_t            itemSize;
+    topk_compare_func compare;
+    char*             swap;             // Scratch item for exchanges
+};
+
+#define TOPK_ITEM(topk, i) ((topk)->items + ((i) * (topk)->itemSize))
+
+static void topk_exchange(TopK* topk, size_t a, size_t b)
+{
+    memcpy(topk->swap, TOPK_ITEM(topk, a), topk->itemSize);
+    memcpy(TOPK_ITEM(topk, a), TOPK_ITEM(topk, b), topk->itemSize);
+    memcpy(TOPK_ITEM(topk, b), topk->swap, topk->itemSize);
+}
+
+// Restores the heap below `i` over the first `count` items.
+static void topk_sift_down(TopK* topk, size_t i, size_t count)
+{
+    while (1) {
+        size_t lowest = i;
+        size_t left   = (2 * i) + 1;
+        size_t right  = left + 1;
+
+        if ((left < count) && (topk->compare(TOPK_ITEM(topk, left), TOPK_ITEM(topk, lowest)) < 0)) lowest = left;
+        if ((right < count) && (topk->compare(TOPK_ITEM(topk, right), TOPK_ITEM(topk, lowest)) < 0)) lowest = right;
+        if (lowest == i) return;
+
+        topk_exchange(topk, i, lowest);
+        i = lowest;
+    }
+}
+
+static void topk_sift_up(TopK* topk, size_t i)
+{
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (topk->compare(TOPK_ITEM(topk, i), TOPK_ITEM(topk, parent)) >= 0) return;
+
+        topk_exchange(topk, i, parent);
+        i = parent;
+    }
+}
+
+TopK* topk_make(size_t k, size_t itemSize, topk_compare_func compare)
+{
+    TopK* topk = NULL;
+
+    if ((k == 0) || (itemSize == 0)) { errno = EINVAL; return NULL; }
+
+    SALLOC(topk, sizeof(TopK));
+    SALLOC(topk->items, k * itemSize);
+    SALLOC(topk->swap, itemSize);
+    topk->k        = k;
+    topk->itemSize = itemSize;
+    topk->compare  = compare;
+
+    return topk;
+}
+
+bool topk_insert(TopK* topk, const void* item)
+{
+    if (topk->count < topk->k) {
+        memcpy(TOPK_ITEM(topk, topk->count), item, topk->itemSize);
+        topk_sift_up(topk, topk->count++);
+        return true;
+    }
+
+    // Full: replace the lowest-ranked item only if this one ranks above it.
+    if (topk->compare(item, TOPK_ITEM(topk, 0)) <= 0) return false;
+
+    memcpy(TOPK_ITEM(topk, 0), item, topk->itemSize);
+    topk_sift_down(topk, 0, topk->count);
+    return true;
+}
+
+void topk_merge(TopK* into, const TopK* from)
+{
+    for (size_t i = 0; i < from->count; i++)
+        (void)topk_insert(into, TOPK_ITEM(from, i));
+}
+
+const void* topk_min(const TopK* topk)
+{
+    return (topk->count < topk->k ? NULL : topk->items);
+}
+
+size_t topk_count(const TopK* topk)
+{
+    return topk->count;
+}
+
+const void* topk_finish(TopK* topk, size_t* count)
+{
+    // Heapsort in place: moving each minimum to the end leaves the array best first.
+    for (size_t end = topk->count; end > 1; end--) {
+        topk_exchange(topk, 0, end - 1);
+        topk_sift_down(topk, 0, end - 1);
+    }
+
+    *count = topk->count;
+
+    // The array is no longer a heap; start over if anything else is inserted.
+    topk->count = 0;
+
+    return topk->items;
+}
+
+void topk_free(TopK* topk)
+{
+    SFREE(topk->items);
+    SFREE(topk->swap);
+    SFREE(topk);
+}
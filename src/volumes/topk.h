@@ -0,0 +1,38 @@
+//
+//  topk.h
+//  volumes
+//
+//
+
+// Keeps the K best of a stream of fixed-size items in a bounded min-heap, so each insert costs O(log K) instead of a sort.
+
+#ifndef volumes_topk_h
+#define volumes_topk_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Returns >0 if `a` ranks above `b`, <0 if below, 0 if they tie.
+typedef int (* topk_compare_func)(const void* a, const void* b);
+
+typedef struct TopK TopK;
+
+TopK*       topk_make   (size_t k, size_t itemSize, topk_compare_func compare) __attribute__((nonnull));
+
+// Copies the item in if it ranks among the best K seen so far. Returns true if it was kept.
+bool        topk_insert (TopK* topk, const void* item) __attribute__((nonnull));
+
+// Offers every item `from` holds to `into`, so per-thread heaps can be combined. Both must rank the same way.
+void        topk_merge  (TopK* into, const TopK* from) __attribute__((nonnull));
+
+// The lowest-ranked item kept, or NULL while fewer than K are held; anything not ranking above it can be skipped.
+const void* topk_min    (const TopK* topk) __attribute__((nonnull));
+
+size_t      topk_count  (const TopK* topk) __attribute__((nonnull));
+
+// Sorts the kept items best first and returns them; the array belongs to topk and lives until topk_free.
+const void* topk_finish (TopK* topk, size_t* count) __attribute__((nonnull));
+
+void        topk_free   (TopK* topk) __attribute__((nonnull));
+
+#endif
@@ -0,0 +1,631 @@
+//
+//  udif.c
+//  volumes
+//
+//
+
+#include <pthread.h>
+#include <zlib.h>
+#include <bzlib.h>
+
+#if defined (__APPLE__)
+    #include <compression.h>
+#endif
+
+#include "udif.h"
+#include "workqueue.h"
+#include "utilities.h"
+#include "_endian.h"
+#include "logging/logging.h"    // console printing routines
+
+// Memory for expanded chunks (always room for at least one), and how far ahead of a sequential reader to expand.
+#define kUDIFCacheBytes  (64 * 1024 * 1024)
+#define kUDIFPrefetch    8
+
+// Limits that keep a damaged image from asking for absurd allocations.
+#define kUDIFMaxChunk    (64 * 1024 * 1024)
+#define kUDIFMaxPlist    (256 * 1024 * 1024)
+
+typedef struct UDIFChunk {
+    uint64_t sector;                // First sector in the expanded image
+    uint64_t count;                 // Sectors
+    uint64_t offset;                // Stored data, from the start of the file
+    uint64_t length;                // Stored bytes
+    uint32_t type;                  // UDIFChunkType
+    uint32_t _reserved;
+} UDIFChunk;
+
+enum {
+    kSlotEmpty = 0,
+    kSlotLoading,
+    kSlotReady,
+};
+
+typedef struct UDIFSlot {
+    uint8_t* data;                  // chunk_bytes, allocated on first use
+    size_t   chunk;
+    uint64_t used;                  // Clock at the last hit, for LRU eviction
+    unsigned refs;                  // Readers copying out; a slot with references isn't evicted
+    int      state;
+} UDIFSlot;
+
+typedef struct UDIF {
+    int             fd;
+    UDIFChunk*      chunks;         // Sorted by sector
+    size_t          chunk_count;
+    size_t          chunk_capacity;
+    size_t          chunk_bytes;    // Largest expanded compressed chunk
+    uint64_t        length;         // Expanded bytes
+
+    pthread_mutex_t lock;           // Guards everything below
+    pthread_cond_t  changed;        // A slot finished loading or lost its last reference
+    UDIFSlot*       slots;
+    size_t          slot_count;
+    uint64_t        clock;
+    size_t          last_chunk;     // The chunk the last read ended in
+    size_t          prefetched;     // Chunks before this one have been queued for expansion
+    WorkQueue*      queue;          // Started by the first sequential read
+} UDIF;
+
+#pragma mark Decompression
+
+// Apple Data Compression: a byte-oriented LZ77 variant.
+static ssize_t adc_decompress(uint8_t* out, size_t outSize, const uint8_t* in, size_t inSize)
+{
+    size_t i = 0;
+    size_t o = 0;
+
+    while ((i < inSize) && (o < outSize)) {
+        uint8_t op = in[i++];
+
+        if (op & 0x80) {
+            // Literal run
+            size_t length = (op & 0x7f) + 1;
+            if (((i + length) > inSize) || ((o + length) > outSize)) return -1;
+            memcpy(out + o, in + i, length);
+            i += length;
+            o += length;
+
+        } else {
+            size_t length   = 0;
+            size_t distance = 0;
+
+            if (op & 0x40) {
+                // Three-byte copy
+                if ((i + 2) > inSize) return -1;
+                length   = (op & 0x3f) + 4;
+                distance = ((size_t)in[i] << 8 | in[i + 1]) + 1;
+                i       += 2;
+            } else {
+                // Two-byte copy
+                if ((i + 1) > inSize) return -1;
+                length   = ((op >> 2) & 0x0f) + 3;
+                distance = ((size_t)(op & 0x03) << 8 | in[i]) + 1;
+                i       += 1;
+            }
+
+            if ((distance > o) || ((o + length) > outSize)) return -1;
+
+            // Byte by byte: copies may overlap their own output.
+            for (size_t k = 0; k < length; k++, o++)
+                out[o] = out[o - distance];
+        }
+    }
+
+    return o;
+}
+
+// Reads and expands one compressed chunk into `out`, which holds chunk->count sectors.
+static int udif_expand(const UDIF* udif, const UDIFChunk* chunk, uint8_t* out)
+{
+    size_t   size   = chunk->count * kUDIFSectorSize;
+    ssize_t  result = -1;
+    uint8_t* in     = NULL;
+
+    SALLOC(in, chunk->length);
+
+    if (fdpread(udif->fd, in, chunk->length, chunk->offset) != (ssize_t)chunk->length) {
+        error("UDIF: couldn't read %ju bytes at %#jx", (uintmax_t)chunk->length, (uintmax_t)chunk->offset);
+        SFREE(in);
+        errno = EIO;
+        return -1;
+    }
+
+    switch (chunk->type) {
+        case kUDIFChunkADC:
+        {
+            result = adc_decompress(out, size, in, chunk->length);
+            break;
+        }
+
+        case kUDIFChunkZlib:
+        {
+            uLongf length = size;
+            if (uncompress(out, &length, in, chunk->length) == Z_OK) result = length;
+            break;
+        }
+
+        case kUDIFChunkBzip2:
+        {
+            unsigned int length = (unsigned int)size;
+            if (BZ2_bzBuffToBuffDecompress((char*)out, &length, (char*)in, (unsigned int)chunk->length, 0, 0) == BZ_OK) result = length;
+            break;
+        }
+
+#if defined (__APPLE__)
+        case kUDIFChunkLZFSE:
+        case kUDIFChunkLZMA:
+        {
+            compression_algorithm algorithm = (chunk->type == kUDIFChunkLZFSE ? COMPRESSION_LZFSE : COMPRESSION_LZMA);
+            size_t                length    = compression_decode_buffer(out, size, in, chunk->length, NULL, algorithm);
+            if (length) result = length;
+            break;
+        }
+#endif
+
+        default:
+        {
+            error("UDIF: chunk type %#x isn't supported on this platform", chunk->type);
+            SFREE(in);
+            errno = ENOTSUP;
+            return -1;
+        }
+    }
+
+    SFREE(in);
+
+    if (result < 0) {
+        error("UDIF: chunk at sector %ju (type %#x) is corrupt", (uintmax_t)chunk->sector, chunk->type);
+        errno = EIO;
+        return -1;
+    }
+
+    // Anything the chunk didn't cover reads as zeroes.
+    if ((size_t)result < size) memset(out + result, 0, size - result);
+
+    return 0;
+}
+
+#pragma mark Chunk Cache
+
+// Returns the slot holding a chunk's expanded data, expanding it first if needed. Drop the reference with udif_release().
+static UDIFSlot* udif_acquire(UDIF* udif, size_t chunk)
+{
+    UDIFSlot* slot = NULL;
+
+    pthread_mutex_lock(&udif->lock);
+
+    while (1) {
+        UDIFSlot* victim = NULL;
+        slot = NULL;
+
+        for (size_t i = 0; i < udif->slot_count; i++) {
+            UDIFSlot* s = &udif->slots[i];
+
+            if ((s->state != kSlotEmpty) && (s->chunk == chunk)) { slot = s; break; }
+            if (s->refs || (s->state == kSlotLoading)) continue;
+
+            // Prefer an empty slot, then the least recently used one.
+            if ((victim == NULL) || ((victim->state == kSlotReady) && ((s->state == kSlotEmpty) || (s->used < victim->used))))
+                victim = s;
+        }
+
+        if (slot && (slot->state == kSlotReady)) {
+            slot->refs++;
+            slot->used = ++udif->clock;
+            pthread_mutex_unlock(&udif->lock);
+            return slot;
+        }
+
+        // Wait for another thread to finish loading this chunk, or to free up a slot.
+        if (slot || (victim == NULL)) {
+            pthread_cond_wait(&udif->changed, &udif->lock);
+            continue;
+        }
+
+        slot = victim;
+        break;
+    }
+
+    slot->state = kSlotLoading;
+    slot->chunk = chunk;
+    slot->refs  = 1;
+    pthread_mutex_unlock(&udif->lock);
+
+    // The slot is ours while it's loading, so expanding happens outside the lock.
+    if (slot->data == NULL) SALLOC(slot->data, udif->chunk_bytes);
+    int result = udif_expand(udif, &udif->chunks[chunk], slot->data);
+
+    pthread_mutex_lock(&udif->lock);
+    if (result < 0) {
+        slot->state = kSlotEmpty;
+        slot->refs  = 0;
+        slot        = NULL;
+    } else {
+        slot->state = kSlotReady;
+        slot->used  = ++udif->clock;
+    }
+    pthread_cond_broadcast(&udif->changed);
+    pthread_mutex_unlock(&udif->lock);
+
+    return slot;
+}
+
+static void udif_release(UDIF* udif, UDIFSlot* slot)
+{
+    pthread_mutex_lock(&udif->lock);
+    if (--slot->refs == 0) pthread_cond_broadcast(&udif->changed);
+    pthread_mutex_unlock(&udif->lock);
+}
+
+typedef struct UDIFPrefetch {
+    UDIF*  udif;
+    size_t chunk;
+} UDIFPrefetch;
+
+static void udif_prefetch(void* context)
+{
+    UDIFPrefetch* job  = context;
+    UDIFSlot*     slot = udif_acquire(job->udif, job->chunk);
+
+    if (slot) udif_release(job->udif, slot);
+    SFREE(job);
+}
+
+static bool udif_chunk_is_compressed(const UDIFChunk* chunk)
+{
+    return (chunk->type & 0x80000000) && (chunk->type != kUDIFChunkLast);
+}
+
+// Notes which chunk a read reached. When reads walk forward chunk by chunk, the next few compressed chunks are expanded in the background.
+static void udif_read_ahead(UDIF* udif, size_t chunk)
+{
+    size_t first = 0;
+    size_t last  = 0;
+
+    pthread_mutex_lock(&udif->lock);
+
+    if (chunk == udif->last_chunk) {
+        pthread_mutex_unlock(&udif->lock);
+        return;
+    }
+
+    if (chunk == (udif->last_chunk + 1)) {
+        first = MAX(chunk + 1, udif->prefetched);
+        // Leave the slot the reader is using out of it, so read-ahead never evicts the chunk being read.
+        last  = MIN(chunk + 1 + MIN(kUDIFPrefetch, udif->slot_count - 1), udif->chunk_count);
+        if (first < last) udif->prefetched = last;
+        if ((first < last) && (udif->queue == NULL)) udif->queue = workqueue_make(0);
+    }
+    udif->last_chunk = chunk;
+
+    pthread_mutex_unlock(&udif->lock);
+
+    for (size_t i = first; i < last; i++) {
+        if ( !udif_chunk_is_compressed(&udif->chunks[i]) ) continue;
+
+        UDIFPrefetch* job = NULL;
+        SALLOC(job, sizeof(UDIFPrefetch));
+        *job = (UDIFPrefetch){ udif, i };
+        if ((udif->queue == NULL) || (workqueue_add(udif->queue, udif_prefetch, job) < 0)) SFREE(job);
+    }
+}
+
+#pragma mark Source Operations
+
+// Index of the last chunk starting at or before the sector, or SIZE_MAX if there isn't one.
+static size_t udif_find_chunk(const UDIF* udif, uint64_t sector)
+{
+    size_t low  = 0;
+    size_t high = udif->chunk_count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (udif->chunks[mid].sector <= sector)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low - 1;
+}
+
+static ssize_t udif_read(void* context, void* buf, size_t nbytes, off_t offset)
+{
+    UDIF*  udif = context;
+    char*  out  = buf;
+    size_t done = 0;
+
+    if (offset < 0) { errno = EINVAL; return -1; }
+    if ((uint64_t)offset >= udif->length) return 0;
+
+    nbytes = MIN(nbytes, udif->length - offset);
+
+    while (done < nbytes) {
+        uint64_t         pos   = offset + done;
+        size_t           index = udif_find_chunk(udif, pos / kUDIFSectorSize);
+        const UDIFChunk* chunk = (index == SIZE_MAX ? NULL : &udif->chunks[index]);
+        uint64_t         start = (chunk ? chunk->sector * kUDIFSectorSize : 0);
+        uint64_t         end   = (chunk ? start + chunk->count * kUDIFSectorSize : 0);
+        size_t           run   = 0;
+
+        // Sectors that no table describes read as zeroes.
+        if ((chunk == NULL) || (pos >= end)) {
+            size_t   next_index = (index == SIZE_MAX ? 0 : index + 1);
+            uint64_t next       = (next_index < udif->chunk_count ? udif->chunks[next_index].sector * kUDIFSectorSize : udif->length);
+            run = MIN(nbytes - done, next - pos);
+            memset(out + done, 0, run);
+            done += run;
+            continue;
+        }
+
+        run = MIN(nbytes - done, end - pos);
+
+        udif_read_ahead(udif, index);
+
+        switch (chunk->type) {
+            case kUDIFChunkZeroFill:
+            case kUDIFChunkIgnore:
+            {
+                memset(out + done, 0, run);
+                break;
+            }
+
+            case kUDIFChunkRaw:
+            {
+                ssize_t bytes = fdpread(udif->fd, out + done, run, chunk->offset + (pos - start));
+                if (bytes < (ssize_t)run) {
+                    if (bytes > 0) done += bytes;
+                    return (done ? (ssize_t)done : -1);
+                }
+                break;
+            }
+
+            default:
+            {
+                UDIFSlot* slot = udif_acquire(udif, index);
+                if (slot == NULL) return (done ? (ssize_t)done : -1);
+                memcpy(out + done, slot->data + (pos - start), run);
+                udif_release(udif, slot);
+                break;
+            }
+        }
+
+        done += run;
+    }
+
+    return done;
+}
+
+static void udif_close(void* context)
+{
+    UDIF* udif = context;
+
+    if (udif->queue) workqueue_free(udif->queue);
+
+    for (size_t i = 0; i < udif->slot_count; i++)
+        SFREE(udif->slots[i].data);
+
+    pthread_cond_destroy(&udif->changed);
+    pthread_mutex_destroy(&udif->lock);
+    SFREE(udif->slots);
+    SFREE(udif->chunks);
+    SFREE(udif);
+}
+
+static const SourceOps udif_ops = {
+    .name  = "UDIF",
+    .read  = udif_read,
+    .close = udif_close,
+};
+
+#pragma mark Parsing
+
+static int base64_value(char c)
+{
+    if ((c >= 'A') && (c <= 'Z')) return c - 'A';
+    if ((c >= 'a') && (c <= 'z')) return c - 'a' + 26;
+    if ((c >= '0') && (c <= '9')) return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+// Decodes base64 text, skipping whitespace and stopping at padding. Returns the allocated bytes.
+static uint8_t* base64_decode(const char* text, size_t length, size_t* size)
+{
+    uint8_t* out   = NULL;
+    uint32_t bits  = 0;
+    unsigned count = 0;
+
+    SALLOC(out, length / 4 * 3 + 3);
+    *size = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        int value = base64_value(text[i]);
+        if (text[i] == '=') break;
+        if (value < 0) continue;
+
+        bits = (bits << 6) | (uint32_t)value;
+        if (++count == 4) {
+            out[(*size)++] = (uint8_t)(bits >> 16);
+            out[(*size)++] = (uint8_t)(bits >> 8);
+            out[(*size)++] = (uint8_t)bits;
+            bits           = 0;
+            count          = 0;
+        }
+    }
+
+    if (count == 3) {
+        out[(*size)++] = (uint8_t)(bits >> 10);
+        out[(*size)++] = (uint8_t)(bits >> 2);
+    } else if (count == 2) {
+        out[(*size)++] = (uint8_t)(bits >> 4);
+    }
+
+    return out;
+}
+
+static int udif_add_table(UDIF* udif, const uint8_t* data, size_t size, uint64_t data_fork_offset)
+{
+    const UDIFBlockTable* table = (const void*)data;
+
+    if ((size < sizeof(UDIFBlockTable)) || (be32toh(table->signature) != kUDIFBlockSig)) {
+        error("UDIF: block table has a bad signature");
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint64_t first  = be64toh(table->sector_number);
+    uint64_t base   = data_fork_offset + be64toh(table->data_offset);
+    uint32_t count  = be32toh(table->chunk_count);
+
+    if (count > ((size - sizeof(UDIFBlockTable)) / sizeof(UDIFBlockChunk))) {
+        error("UDIF: block table claims %u chunks but holds fewer", count);
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const UDIFBlockChunk* entry = &table->chunks[i];
+        UDIFChunk             chunk = {
+            .type   = be32toh(entry->type),
+            .sector = first + be64toh(entry->sector_number),
+            .count  = be64toh(entry->sector_count),
+            .offset = base + be64toh(entry->compressed_offset),
+            .length = be64toh(entry->compressed_length),
+        };
+
+        if ((chunk.type == kUDIFChunkComment) || (chunk.type == kUDIFChunkLast) || (chunk.count == 0)) continue;
+
+        if (udif_chunk_is_compressed(&chunk)) {
+            if ((chunk.count > (kUDIFMaxChunk / kUDIFSectorSize)) || (chunk.length > kUDIFMaxChunk)) {
+                error("UDIF: compressed chunk at sector %ju is too large (%ju sectors)", (uintmax_t)chunk.sector, (uintmax_t)chunk.count);
+                errno = EINVAL;
+                return -1;
+            }
+            udif->chunk_bytes = MAX(udif->chunk_bytes, chunk.count * kUDIFSectorSize);
+        }
+
+        if (udif->chunk_count == udif->chunk_capacity) {
+            udif->chunk_capacity = (udif->chunk_capacity ? udif->chunk_capacity * 2 : 256);
+            SREALLOC(udif->chunks, udif->chunk_capacity * sizeof(UDIFChunk));
+        }
+        udif->chunks[udif->chunk_count++] = chunk;
+    }
+
+    return 0;
+}
+
+// Walks the <data> elements of the "blkx" array; each is a base64-encoded block table.
+static int udif_parse_plist(UDIF* udif, const char* xml, uint64_t data_fork_offset)
+{
+    const char* p   = strstr(xml, "<key>blkx</key>");
+    const char* end = (p ? strstr(p, "</array>") : NULL);
+
+    if (end == NULL) {
+        error("UDIF: property list has no blkx array");
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (((p = strstr(p, "<data>")) != NULL) && (p < end)) {
+        const char* close = strstr(p, "</data>");
+        size_t      size  = 0;
+        uint8_t*    table = NULL;
+
+        if ((close == NULL) || (close > end)) break;
+
+        p     += strlen("<data>");
+        table  = base64_decode(p, close - p, &size);
+        int result = udif_add_table(udif, table, size, data_fork_offset);
+        SFREE(table);
+
+        if (result < 0) return -1;
+
+        p = close;
+    }
+
+    return 0;
+}
+
+static int chunk_compare(const void* a, const void* b)
+{
+    const UDIFChunk* ca = a;
+    const UDIFChunk* cb = b;
+
+    return (ca->sector > cb->sector) - (ca->sector < cb->sector);
+}
+
+int udif_open(Volume* vol)
+{
+    UDIFTrailer koly = {0};
+    struct stat s    = {0};
+    UDIF*       udif = NULL;
+    char*       xml  = NULL;
+
+    if (fstat(vol->fd, &s) < 0) return -1;
+    if ( !S_ISREG(s.st_mode) || (s.st_size < (off_t)sizeof(UDIFTrailer)) ) return 0;
+
+    if (fdpread(vol->fd, &koly, sizeof(koly), s.st_size - sizeof(koly)) != sizeof(koly)) return -1;
+    if (be32toh(koly.signature) != kUDIFSignature) return 0;
+
+    uint64_t data_fork_offset = be64toh(koly.data_fork_offset);
+    uint64_t xml_offset       = be64toh(koly.xml_offset);
+    uint64_t xml_length       = be64toh(koly.xml_length);
+    uint64_t sector_count     = be64toh(koly.sector_count);
+
+    debug("UDIF trailer: version %u, %ju sectors, plist %ju bytes at %#jx", be32toh(koly.version), (uintmax_t)sector_count, (uintmax_t)xml_length, (uintmax_t)xml_offset);
+
+    if (xml_length == 0) {
+        error("UDIF: images without a property list (resource fork only) aren't supported");
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if ((xml_length > kUDIFMaxPlist) || ((xml_offset + xml_length) > (uint64_t)s.st_size)) {
+        error("UDIF: property list is out of range");
+        errno = EINVAL;
+        return -1;
+    }
+
+    SALLOC(xml, xml_length + 1);
+    if (fdpread(vol->fd, xml, xml_length, xml_offset) != (ssize_t)xml_length) {
+        SFREE(xml);
+        errno = EIO;
+        return -1;
+    }
+    xml[xml_length] = '\0';
+
+    SALLOC(udif, sizeof(UDIF));
+    udif->fd = vol->fd;
+
+    int result = udif_parse_plist(udif, xml, data_fork_offset);
+    SFREE(xml);
+
+    if ((result < 0) || (udif->chunk_count == 0)) {
+        if (result == 0) { error("UDIF: image has no block tables"); errno = EINVAL; }
+        SFREE(udif->chunks);
+        SFREE(udif);
+        return -1;
+    }
+
+    qsort(udif->chunks, udif->chunk_count, sizeof(UDIFChunk), chunk_compare);
+
+    udif->length     = sector_count * kUDIFSectorSize;
+    udif->last_chunk = SIZE_MAX;
+    udif->slot_count = (udif->chunk_bytes ? MAX(1, kUDIFCacheBytes / udif->chunk_bytes) : 0);
+    if (udif->slot_count) SALLOC(udif->slots, udif->slot_count * sizeof(UDIFSlot));
+
+    pthread_mutex_init(&udif->lock, NULL);
+    pthread_cond_init(&udif->changed, NULL);
+
+    info("UDIF image: %zu chunks, %ju bytes expanded", udif->chunk_count, (uintmax_t)udif->length);
+
+    vol->source_ops = &udif_ops;
+    vol->source_ctx = udif;
+    vol->length     = udif->length;
+    strlcpy(vol->native_desc, "UDIF disk image", sizeof(vol->native_desc));
+
+    return 1;
+}
@@ -0,0 +1,114 @@
+//
+//  udif.h
+//  volumes
+//
+//
+
+/*
+   Universal Disk Image Format (.dmg) sources.
+
+   A UDIF image ends with a 512-byte "koly" trailer pointing at an XML property list. Its "blkx"
+   array holds one "mish" table per partition, each a list of chunks that are zero-filled, stored
+   raw, or compressed (ADC, zlib, bzip2; LZFSE and LZMA on macOS). Reads are served chunk by chunk:
+   raw chunks straight from the file, compressed ones through a cache of expanded chunks that is
+   filled ahead of sequential scans on a pool of worker threads.
+
+   All on-disk values are big-endian.
+ */
+
+#ifndef volumes_udif_h
+#define volumes_udif_h
+
+#include "volume.h"
+
+#pragma mark - Structures
+
+enum {
+    kUDIFSignature     = 'koly',
+    kUDIFBlockSig      = 'mish',
+    kUDIFSectorSize    = 512,
+};
+
+enum UDIFChunkType {
+    kUDIFChunkZeroFill = 0x00000000,
+    kUDIFChunkRaw      = 0x00000001,
+    kUDIFChunkIgnore   = 0x00000002,            // Free space; reads as zeroes
+    kUDIFChunkADC      = 0x80000004,
+    kUDIFChunkZlib     = 0x80000005,
+    kUDIFChunkBzip2    = 0x80000006,
+    kUDIFChunkLZFSE    = 0x80000007,
+    kUDIFChunkLZMA     = 0x80000008,
+    kUDIFChunkComment  = 0x7ffffffe,
+    kUDIFChunkLast     = 0xffffffff,
+};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpacked"
+
+// 136 bytes
+typedef struct UDIFChecksum {
+    uint32_t type;
+    uint32_t size;                              // Bits
+    uint32_t data[32];
+} __attribute__((aligned(2), packed)) UDIFChecksum;
+
+// 512 bytes, at the end of the file
+typedef struct UDIFTrailer {
+    uint32_t     signature;                     // 0; 'koly'
+    uint32_t     version;                       // 4; 4
+    uint32_t     header_size;                   // 8; 512
+    uint32_t     flags;                         // 12
+    uint64_t     running_data_fork_offset;      // 16
+    uint64_t     data_fork_offset;              // 24
+    uint64_t     data_fork_length;              // 32
+    uint64_t     rsrc_fork_offset;              // 40
+    uint64_t     rsrc_fork_length;              // 48
+    uint32_t     segment_number;                // 56
+    uint32_t     segment_count;                 // 60
+    uuid_t       segment_id;                    // 64
+    UDIFChecksum data_checksum;                 // 80
+    uint64_t     xml_offset;                    // 216
+    uint64_t     xml_length;                    // 224
+    uint8_t      reserved1[120];                // 232
+    UDIFChecksum checksum;                      // 352
+    uint32_t     image_variant;                 // 488
+    uint64_t     sector_count;                  // 492
+    uint32_t     reserved2[3];                  // 500
+} __attribute__((aligned(2), packed)) UDIFTrailer;
+
+// 40 bytes
+typedef struct UDIFBlockChunk {
+    uint32_t type;                              // 0; UDIFChunkType
+    uint32_t comment;                           // 4
+    uint64_t sector_number;                     // 8; relative to the table's first sector
+    uint64_t sector_count;                      // 16
+    uint64_t compressed_offset;                 // 24; relative to the data fork
+    uint64_t compressed_length;                 // 32
+} __attribute__((aligned(2), packed)) UDIFBlockChunk;
+
+// 204 bytes, then the chunks
+typedef struct UDIFBlockTable {
+    uint32_t       signature;                   // 0; 'mish'
+    uint32_t       version;                     // 4; 1
+    uint64_t       sector_number;               // 8
+    uint64_t       sector_count;                // 16
+    uint64_t       data_offset;                 // 24
+    uint32_t       buffers_needed;              // 32
+    uint32_t       block_descriptors;           // 36
+    uint32_t       reserved[6];                 // 40
+    UDIFChecksum   checksum;                    // 64
+    uint32_t       chunk_count;                 // 200
+    UDIFBlockChunk chunks[];                    // 204
+} __attribute__((aligned(2), packed)) UDIFBlockTable;
+
+#pragma GCC diagnostic pop
+
+#pragma mark - Functions
+
+/**
+   Attaches a UDIF backend to a newly opened volume if its source is a disk image, and sets the volume's length to the expanded size.
+   @return Returns -1 on error (check errno), 0 if the source isn't a UDIF image, 1 if it is.
+ */
+int udif_open(Volume* vol) __attribute__((nonnull));
+
+#endif
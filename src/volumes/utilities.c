@@ -16,3 +16,19 @@ ssize_t fpread(FILE* f, void* buf, size_t nbytes, off_t offset)
         return -1;
 }
 
+ssize_t fdpread(int fd, void* buf, size_t nbytes, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < nbytes) {
+        ssize_t bytes = pread(fd, (char*)buf + done, nbytes - done, offset + done);
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            return (done ? (ssize_t)done : -1);
+        }
+        if (bytes == 0) break;
+        done += bytes;
+    }
+
+    return done;
+}
@@ -11,4 +11,7 @@
 
 ssize_t fpread(FILE* f, void* buf, size_t nbytes, off_t offset) __attribute__((nonnull(1,2)));
 
+// pread(2) that retries interrupted and short reads; safe to call from several threads on one descriptor.
+ssize_t fdpread(int fd, void* buf, size_t nbytes, off_t offset) __attribute__((nonnull(2)));
+
 #endif
@@ -0,0 +1,187 @@
+//
+//  volmap.c
+//  volumes
+//
+//
+
+#include "volmap.h"
+#include "logging/logging.h"    // console printing routines
+
+VolumeMap* volmap_make(uint32_t block_size)
+{
+    VolumeMap* map = NULL;
+
+    if (block_size == 0) { errno = EINVAL; return NULL; }
+
+    SALLOC(map, sizeof(VolumeMap));
+    map->block_size = block_size;
+
+    return map;
+}
+
+int volmap_add(VolumeMap* map, uint64_t logical, uint64_t physical, uint64_t count)
+{
+    if (count == 0) return 0;
+    if ((logical + count) < logical) { errno = EINVAL; return -1; }
+
+    if (map->count == map->capacity) {
+        map->capacity = (map->capacity ? map->capacity * 2 : 16);
+        SREALLOC(map->ranges, map->capacity * sizeof(VolumeMapRange));
+    }
+
+    map->ranges[map->count++] = (VolumeMapRange){ logical, physical, count };
+    map->finished             = 0;
+
+    return 0;
+}
+
+static int range_compare(const void* a, const void* b)
+{
+    const VolumeMapRange* ra = a;
+    const VolumeMapRange* rb = b;
+
+    return (ra->logical > rb->logical) - (ra->logical < rb->logical);
+}
+
+int volmap_finish(VolumeMap* map)
+{
+    size_t out = 0;
+
+    if (map->count == 0) { map->finished = 1; return 0; }
+
+    qsort(map->ranges, map->count, sizeof(VolumeMapRange), range_compare);
+
+    for (size_t i = 1; i < map->count; i++) {
+        VolumeMapRange* last = &map->ranges[out];
+        VolumeMapRange* r    = &map->ranges[i];
+
+        if (r->logical < (last->logical + last->count)) {
+            error("volume map: range at block %ju overlaps the one at %ju", (uintmax_t)r->logical, (uintmax_t)last->logical);
+            errno = EINVAL;
+            return -1;
+        }
+
+        // Contiguous on both sides: one range.
+        if ((r->logical == (last->logical + last->count)) && (r->physical == (last->physical + last->count))) {
+            last->count += r->count;
+            continue;
+        }
+
+        map->ranges[++out] = *r;
+    }
+
+    map->count    = out + 1;
+    map->finished = 1;
+
+    // Give back what merging freed.
+    if (map->count < map->capacity) {
+        SREALLOC(map->ranges, map->count * sizeof(VolumeMapRange));
+        map->capacity = map->count;
+    }
+
+    debug("volume map: %zu ranges of %u-byte blocks", map->count, map->block_size);
+
+    return 0;
+}
+
+const VolumeMapRange* volmap_lookup(const VolumeMap* map, uint64_t logical, uint64_t* next)
+{
+    size_t low  = 0;
+    size_t high = map->count;
+
+    assert(map->finished);
+
+    // Find the first range starting after the block; the one before it is the only candidate.
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (map->ranges[mid].logical <= logical)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low > 0) {
+        const VolumeMapRange* r = &map->ranges[low - 1];
+        if (logical < (r->logical + r->count)) return r;
+    }
+
+    if (next) *next = (low < map->count ? map->ranges[low].logical : UINT64_MAX);
+
+    return NULL;
+}
+
+VolumeMap* volmap_slice(const VolumeMap* map, uint64_t first, uint64_t count)
+{
+    VolumeMap* slice = volmap_make(map->block_size);
+    uint64_t   end   = first + count;
+
+    for (size_t i = 0; i < map->count; i++) {
+        const VolumeMapRange* r     = &map->ranges[i];
+        uint64_t              start = MAX(r->logical, first);
+        uint64_t              stop  = MIN(r->logical + r->count, end);
+
+        if (start >= stop) continue;
+        volmap_add(slice, start - first, r->physical + (start - r->logical), stop - start);
+    }
+
+    slice->finished = 1;
+
+    return slice;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b) { uint32_t t = a % b; a = b; b = t; }
+    return a;
+}
+
+VolumeMap* volmap_compose(const VolumeMap* inner, const VolumeMap* outer)
+{
+    uint32_t   bs     = gcd(inner->block_size, outer->block_size);
+    uint64_t   iscale = inner->block_size / bs;
+    uint64_t   oscale = outer->block_size / bs;
+    VolumeMap* result = volmap_make(bs);
+
+    for (size_t i = 0; i < inner->count; i++) {
+        uint64_t logical  = inner->ranges[i].logical * iscale;
+        uint64_t physical = inner->ranges[i].physical * iscale;
+        uint64_t end      = physical + inner->ranges[i].count * iscale;
+
+        // Walk the outer ranges under this one; whatever falls in an outer hole stays a hole.
+        while (physical < end) {
+            uint64_t              next  = 0;
+            uint64_t              run   = 0;
+            const VolumeMapRange* range = volmap_lookup(outer, physical / oscale, &next);
+
+            if (range == NULL) {
+                run = (next == UINT64_MAX ? end : MIN(end, next * oscale)) - physical;
+            } else {
+                uint64_t start = range->logical * oscale;
+                run = MIN(end, start + range->count * oscale) - physical;
+                volmap_add(result, logical, range->physical * oscale + (physical - start), run);
+            }
+
+            logical  += run;
+            physical += run;
+        }
+    }
+
+    volmap_finish(result);
+
+    return result;
+}
+
+uint64_t volmap_length(const VolumeMap* map)
+{
+    if (map->count == 0) return 0;
+
+    const VolumeMapRange* last = &map->ranges[map->count - 1];
+
+    return last->logical + last->count;
+}
+
+void volmap_free(VolumeMap* map)
+{
+    SFREE(map->ranges);
+    SFREE(map);
+}
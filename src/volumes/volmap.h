@@ -0,0 +1,62 @@
+//
+//  volmap.h
+//  volumes
+//
+//
+
+/*
+   A logical-to-physical block map for volumes that aren't a single run of their source
+   (Core Storage logical volumes, disk images with chunk tables).
+
+   The map is a flat array of ranges sorted by logical block, with neighbours that continue
+   each other on disk merged together, so a lookup is one binary search over a few cache
+   lines. Logical blocks that no range covers are holes and read as zeroes.
+ */
+
+#ifndef volumes_volmap_h
+#define volumes_volmap_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct VolumeMapRange {
+    uint64_t logical;                       // First block in the mapped volume
+    uint64_t physical;                      // First block on the source, relative to the volume's offset
+    uint64_t count;                         // Blocks in the range
+} VolumeMapRange;
+
+typedef struct VolumeMap {
+    VolumeMapRange* ranges;                 // Sorted by logical block once finished
+    size_t          count;
+    size_t          capacity;
+    uint32_t        block_size;             // Bytes per map block
+    uint32_t        finished;
+} VolumeMap;
+
+VolumeMap*            volmap_make   (uint32_t block_size);
+
+// Adds a range. Ranges may be added in any order; volmap_finish sorts them.
+int                   volmap_add    (VolumeMap* map, uint64_t logical, uint64_t physical, uint64_t count) __attribute__((nonnull));
+
+// Sorts and merges the ranges. Returns -1 with errno EINVAL if two ranges overlap.
+int                   volmap_finish (VolumeMap* map) __attribute__((nonnull));
+
+/**
+   Finds the range holding a logical block.
+   @param next Set to the first logical block of the following range (or UINT64_MAX) when the block is in a hole. May be NULL.
+   @return The range, or NULL if the block is in a hole.
+ */
+const VolumeMapRange* volmap_lookup (const VolumeMap* map, uint64_t logical, uint64_t* next) __attribute__((nonnull(1)));
+
+// Copies the part of a finished map covering `count` blocks from `first`, renumbered to start at zero.
+VolumeMap*            volmap_slice  (const VolumeMap* map, uint64_t first, uint64_t count) __attribute__((nonnull));
+
+// Maps `inner`'s physical blocks through `outer`, for a mapped volume inside another one. The result uses the largest block size dividing both.
+VolumeMap*            volmap_compose(const VolumeMap* inner, const VolumeMap* outer) __attribute__((nonnull));
+
+// Blocks from zero through the end of the last range.
+uint64_t              volmap_length (const VolumeMap* map) __attribute__((nonnull));
+
+void                  volmap_free   (VolumeMap* map) __attribute__((nonnull));
+
+#endif
@@ -18,16 +18,30 @@
 #endif
 
 #include "volume.h"
+#include "udif.h"
+#include "sparsebundle.h"
+#include "workqueue.h"
 #include "output.h"
 #include "utilities.h"
 #include "logging/logging.h"    // console printing routines
 
 #define ASSERT_VOL(vol) { assert(vol != NULL); assert(vol->fp); }
 
+// Covers the MBR, GPT (header and entries, even with 4K sectors), APM, CS and HFS headers.
+#define kVolProbeSize    (32 * 1024)
+#define kVolProbeThreads 16
+
+// Disk image formats, tried in order when a source is opened. Each returns 1 if it attached a backend.
+static int (* const imageFormats[])(Volume* vol) = {
+    udif_open,
+    sparsebundle_open,
+};
+
 int vol_open(Volume* vol, const char* path, int mode, off_t offset, size_t length, size_t block_size)
 {
-    struct stat s = {0};
-    FILE*       f = NULL;
+    struct stat s     = {0};
+    FILE*       f     = NULL;
+    int         image = 0;
 
     trace("vol (%p), path '%s', mode %#o, offset %zd, length %zu, block_size %zu", vol, path, mode, offset, length, block_size);
 
@@ -46,6 +60,12 @@ int vol_open(Volume* vol, const char* path, int mode, off_t offset, size_t lengt
 
     vol->mode   = s.st_mode;
 
+    // Disk images are expanded on the fly by a backend, which sets the expanded length.
+    for (unsigned i = 0; (image == 0) && (i < (sizeof(imageFormats) / sizeof(imageFormats[0]))); i++) {
+        if ( (image = imageFormats[i](vol)) < 0 )
+            return -errno;
+    }
+
     (void)strlcpy(vol->source, path, PATH_MAX);
     vol->offset = offset;
 
@@ -53,6 +73,9 @@ int vol_open(Volume* vol, const char* path, int mode, off_t offset, size_t lengt
         vol->length       = length;
         vol->sector_size  = block_size;
         vol->sector_count = (length / block_size);
+    } else if (image) {
+        vol->sector_size  = S_BLKSIZE;
+        vol->sector_count = vol->length / S_BLKSIZE;
     } else {
         vol->length       = s.st_size;
         vol->sector_size  = S_BLKSIZE;
@@ -101,7 +124,7 @@ int vol_open(Volume* vol, const char* path, int mode, off_t offset, size_t lengt
     } else if (S_ISCHR(vol->mode)) {
         strlcpy((char*)vol->native_desc, "character device", 99);
 
-    } else {
+    } else if ( !image ) {
         strlcpy((char*)vol->native_desc, "regular file", 99);
     }
 
@@ -131,6 +154,49 @@ Volume* vol_qopen(const char* path)
     return vol;
 }
 
+// Reads bytes from the source, through its disk image backend if it has one.
+static ssize_t vol_pread(const Volume* vol, void* buf, size_t nbytes, off_t offset)
+{
+    if (vol->source_ops != NULL) return vol->source_ops->read(vol->source_ctx, buf, nbytes, offset);
+
+    return fdpread(vol->fd, buf, nbytes, offset);
+}
+
+// Reads through the volume's block map, one pread per contiguous run. Holes read as zeroes.
+static ssize_t vol_map_get(const Volume* vol, void* buf, size_t count, off_t start, size_t blksz)
+{
+    const VolumeMap* map  = vol->map;
+    uint64_t         mbs  = map->block_size;
+    uint64_t         pos  = (uint64_t)start * blksz;
+    uint64_t         end  = pos + (uint64_t)count * blksz;
+    size_t           done = 0;
+
+    while (pos < end) {
+        uint64_t              block = pos / mbs;
+        uint64_t              next  = 0;
+        uint64_t              run   = 0;
+        const VolumeMapRange* range = volmap_lookup(map, block, &next);
+
+        if (range == NULL) {
+            run = (next == UINT64_MAX ? end : MIN(end, next * mbs)) - pos;
+            memset((char*)buf + done, 0, run);
+        } else {
+            off_t   off   = vol->offset + (range->physical + (block - range->logical)) * mbs + (pos % mbs);
+            ssize_t bytes = 0;
+
+            run   = MIN(end, (range->logical + range->count) * mbs) - pos;
+            bytes = vol_pread(vol, (char*)buf + done, run, off);
+            if (bytes < 0) return (done ? (ssize_t)(done / blksz) : -1);
+            if ((uint64_t)bytes < run) { done += bytes; break; }
+        }
+
+        done += run;
+        pos  += run;
+    }
+
+    return done / blksz;
+}
+
 ssize_t vol_blk_get(const Volume* vol, void* buf, size_t count, off_t start, size_t blksz)
 {
     ssize_t rval = 0;
@@ -138,12 +204,15 @@ ssize_t vol_blk_get(const Volume* vol, void* buf, size_t count, off_t start, siz
 
     trace("vol (%p), start %zd, count %zu, blksz %zu, buf (%p)", vol, start, count, blksz, buf);
 
+    if (vol->map != NULL) return vol_map_get(vol, buf, count, start, blksz);
+
     // Determine offset based on block size.
     off  = start * blksz + vol->offset;
 
     debug2("Seeking to %zd then reading %zu blocks of size %zu.", off, count, blksz);
 
-    rval = fpread(vol->fp, buf, blksz * count, off);
+    // Positioned reads on the descriptor keep the FILE* position untouched, so B-tree read-ahead can read from another thread.
+    rval = vol_pread(vol, buf, blksz * count, off);
 
     if (rval > 0) {
         rval /= blksz;
@@ -184,6 +253,12 @@ ssize_t vol_read(const Volume* vol, void* buf, size_t size, off_t offset)
         return 0;
     }
 
+    // Header reads made while probing come from the probe buffer.
+    if (vol->probe && (((size_t)offset + size) <= vol->probe_size)) {
+        memcpy(buf, vol->probe + offset, size);
+        return size;
+    }
+
 
     // Determine which block size to use.
     if (vol->phy_sector_size > 0) {
@@ -197,26 +272,37 @@ ssize_t vol_read(const Volume* vol, void* buf, size_t size, off_t offset)
     }
 
 
-    // Add a block to the read if the offset is not block-aligned.
-    block_count = (size / blksz) + ( ((offset + size) % blksz) ? 1 : 0);
-
-    // Use the calculated size instead of the passed size to account for block alignment.
-    SALLOC(read_buffer, block_count * blksz);
-
     // The range starts somewhere in this block.
     start_block = (size_t)(offset / blksz);
 
     // Offset of the request within the start block.
     byte_offset = (offset % blksz);
 
+    // Aligned requests can be read straight into the caller's buffer.
+    if ((byte_offset == 0) && ((size % blksz) == 0)) {
+        read_blocks = vol_blk_get(vol, buf, size / blksz, start_block, blksz);
+        if (read_blocks < 0) return -1;
+        return MIN((size_t)read_blocks * blksz, size);
+    }
+
+    // Round the read out to whole blocks on both ends.
+    block_count = (byte_offset + size + blksz - 1) / blksz;
+
+    // Use the calculated size instead of the passed size to account for block alignment.
+    SALLOC(read_buffer, block_count * blksz);
+
     // Fetch the data into a read buffer (it may fail).
     read_blocks = vol_blk_get(vol, read_buffer, block_count, start_block, blksz);
+    if ((read_blocks <= 0) || ((size_t)read_blocks * blksz <= byte_offset)) {
+        SFREE(read_buffer);
+        return (read_blocks < 0 ? -1 : 0);
+    }
 
     // Adjust for truncated reads.
     size        = MIN( (read_blocks * blksz) - byte_offset, size );
 
     // On success, copy the output.
-    if (read_blocks) memcpy(buf, read_buffer + byte_offset, size);
+    memcpy(buf, read_buffer + byte_offset, size);
 
     // Clean up.
     SFREE(read_buffer);
@@ -231,17 +317,27 @@ int vol_close(Volume* vol)
     ASSERT_VOL(vol);
 
     int      fd  = 0, result = 0;
-    unsigned idx = 0;
 
-    if (vol->partition_count) {
-        while (vol->partition_count) {
-            idx                  = (vol->partition_count - 1);
-            vol_close( (vol->partitions[idx]) );
-            vol->partitions[idx] = NULL;
-            vol->partition_count--;
+    // Partitions may sit at any position; each one unlinks itself as it closes.
+    for (unsigned i = 0; vol->partition_count && (i < (sizeof(vol->partitions) / sizeof(vol->partitions[0]))); i++) {
+        if (vol->partitions[i] != NULL) vol_close(vol->partitions[i]);
+    }
+
+    // Unlink from the parent, so closing a partition on its own leaves the parent safe to close later.
+    Volume* parent = vol->parent_partition;
+    if (parent != NULL) {
+        for (unsigned i = 0; i < (sizeof(parent->partitions) / sizeof(parent->partitions[0])); i++) {
+            if (parent->partitions[i] != vol) continue;
+            parent->partitions[i] = NULL;
+            if (parent->partition_count) parent->partition_count--;
+            break;
         }
     }
 
+    if (vol->map) volmap_free(vol->map);
+    SFREE(vol->probe);
+    if (vol->source_ops && (vol->parent_partition == NULL)) vol->source_ops->close(vol->source_ctx);
+
     fd = vol->fd;
     SFREE(vol);
 
@@ -263,16 +359,32 @@ Volume* vol_make_partition(Volume* vol, uint16_t pos, off_t offset, size_t lengt
         perror("dup");
         return NULL;
     }
-    if( (newvol->fp = fdopen(vol->fd, "r")) == NULL) {
+    if( (newvol->fp = fdopen(newvol->fd, "r")) == NULL) {
         SFREE(newvol);
         perror("fdopen");
         return NULL;
     }
     memcpy(newvol->source, vol->source, PATH_MAX);
+    newvol->mode             = vol->mode;
+    newvol->source_ops       = vol->source_ops;
+    newvol->source_ctx       = vol->source_ctx;
 
-    newvol->offset           = offset;
+    newvol->offset           = vol->offset + offset;
     newvol->length           = length;
 
+    // A partition of a mapped volume reads through its own slice of the map, from the same physical base.
+    if (vol->map != NULL) {
+        if (offset % vol->map->block_size) {
+            error("partition at %jd isn't aligned to the %u-byte blocks of its container", (intmax_t)offset, vol->map->block_size);
+            fclose(newvol->fp);
+            SFREE(newvol);
+            errno = EINVAL;
+            return NULL;
+        }
+        newvol->map    = volmap_slice(vol->map, offset / vol->map->block_size, (length + vol->map->block_size - 1) / vol->map->block_size);
+        newvol->offset = vol->offset;
+    }
+
     newvol->sector_size      = vol->sector_size;
     newvol->sector_count     = length / vol->sector_size;
     newvol->phy_sector_size  = vol->phy_sector_size;
@@ -291,6 +403,75 @@ Volume* vol_make_partition(Volume* vol, uint16_t pos, off_t offset, size_t lengt
     return newvol;
 }
 
+Volume* vol_make_mapped(Volume* vol, uint16_t pos, VolumeMap* map)
+{
+    Volume* newvol = vol_make_partition(vol, pos, 0, volmap_length(map) * map->block_size);
+
+    if (newvol == NULL) {
+        volmap_free(map);
+        return NULL;
+    }
+
+    // Inside another mapped volume, the blocks go through both maps.
+    if (newvol->map != NULL) {
+        volmap_free(newvol->map);
+        newvol->map = volmap_compose(map, vol->map);
+        volmap_free(map);
+    } else {
+        newvol->map = map;
+    }
+
+    return newvol;
+}
+
+int vol_probe(Volume* vol)
+{
+    uint8_t* probe = NULL;
+    size_t   size  = kVolProbeSize;
+    ssize_t  bytes = 0;
+
+    if (vol->probe != NULL) return 0;
+    if (vol->length) size = MIN(size, vol->length);
+
+    SALLOC(probe, size);
+    if ( (bytes = vol_read(vol, probe, size, 0)) < 0 ) {
+        SFREE(probe);
+        return -1;
+    }
+
+    vol->probe_size = bytes;
+    vol->probe      = probe;
+
+    return 0;
+}
+
+static void vol_probe_job(void* context)
+{
+    Volume* vol = context;
+
+    if (vol_probe(vol) < 0)
+        debug("Couldn't probe the partition at %jd: %s", (intmax_t)vol->offset, strerror(errno));
+}
+
+void vol_probe_partitions(Volume* vol)
+{
+    WorkQueue* queue = NULL;
+
+    // On slow devices the reads dominate, so they're all issued together rather than one after another.
+    if (vol->partition_count > 1)
+        queue = workqueue_make(MIN(vol->partition_count, kVolProbeThreads));
+
+    for (unsigned i = 0; i < vol->partition_count; i++) {
+        Volume* partition = vol->partitions[i];
+        if (partition == NULL) continue;
+
+        if ((queue == NULL) || (workqueue_add(queue, vol_probe_job, partition) < 0))
+            vol_probe_job(partition);
+    }
+
+    if (queue) workqueue_free(queue);
+}
+
 void vol_dump(Volume* vol)
 {
     if (vol == NULL) {
@@ -330,6 +511,12 @@ void vol_dump(Volume* vol)
     PrintDataLength(vol->ctx, vol, offset);
     PrintDataLength(vol->ctx, vol, length);
 
+    if (vol->source_ops != NULL)
+        PrintAttribute(vol->ctx, "image", "%s", vol->source_ops->name);
+
+    if (vol->map != NULL)
+        PrintAttribute(vol->ctx, "map", "%zu ranges of %u-byte blocks", vol->map->count, vol->map->block_size);
+
     PrintUI(vol->ctx, vol, sector_count);
     PrintDataLength(vol->ctx, vol, sector_size);
     PrintDataLength(vol->ctx, vol, phy_sector_size);
@@ -12,9 +12,11 @@
 #include <sys/param.h>          //PATH_MAX
 
 #include "output.h"
+#include "volmap.h"
 
 typedef struct Volume       Volume;
 typedef struct PartitionOps PartitionOps;
+typedef struct SourceOps    SourceOps;
 
 #include "hfs/types.h"
 
@@ -76,6 +78,11 @@ struct Volume {
 
     off_t    offset;                        // offset in bytes on source
     size_t   length;                        // length in bytes
+    VolumeMap* map;                         // logical-to-physical block map; NULL if the volume is one run at offset
+    const SourceOps* source_ops;            // disk image backend serving the source's bytes; NULL for plain files and devices
+    void*    source_ctx;                    // backend state, owned by the root volume
+    uint8_t* probe;                         // the first bytes of the volume, read once for header tests
+    size_t   probe_size;
 
     VolType  type;                          // Major type of volume (partition map or filesystem)
     VolType  subtype;                       // Minor type of volume (style of pmap or fs (eg. GPT or HFSPlus)
@@ -98,6 +105,13 @@ struct PartitionOps {
     volop dump;
 };
 
+// For sources whose bytes aren't stored as-is (disk images). Reads take offsets in the expanded image, like pread(2).
+struct SourceOps {
+    char    name[32];
+    ssize_t (* read)  (void* context, void* buf, size_t nbytes, off_t offset);
+    void    (* close) (void* context);
+};
+
 #pragma mark - Functions
 
 /**
@@ -149,8 +163,26 @@ ssize_t vol_blk_get(const Volume* vol, void* buf, size_t count, off_t start, siz
 int vol_close(Volume* vol) __attribute__((nonnull));
 
 /**
+   Adds a sub-volume to a container at the given slot.
+   @param offset The offset of the sub-volume within the container, in bytes.
  */
 Volume* vol_make_partition(Volume* vol, uint16_t pos, off_t offset, size_t length) __attribute__((nonnull(1)));
+
+/**
+   Adds a sub-volume whose blocks are scattered across the container, as described by a finished map of container-relative blocks. The new volume takes ownership of the map.
+ */
+Volume* vol_make_mapped(Volume* vol, uint16_t pos, VolumeMap* map) __attribute__((nonnull));
+/**
+   Reads the start of the volume, where partition maps and filesystems keep their headers, in a single request. Later reads that fall inside it are served from memory.
+   @return Zero on success, -1 on failure (check errno).
+ */
+int     vol_probe(Volume* vol) __attribute__((nonnull));
+
+/**
+   Probes all of a volume's partitions at once, one thread per partition up to a limit.
+ */
+void    vol_probe_partitions(Volume* vol) __attribute__((nonnull));
+
 void    vol_dump(Volume* vol) __attribute__((nonnull));
 
 #endif
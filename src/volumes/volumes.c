@@ -24,6 +24,11 @@ int volumes_load(Volume* vol)
     info("Loading partitions.");
 
     PartitionOps** ops = (PartitionOps**)&partitionTypes;
+
+    // Every partition type's test is answered from this one read.
+    if (vol_probe(vol) < 0)
+        warning("Couldn't read the start of the volume: %s", strerror(errno));
+
     while ((*ops)->test != NULL) {
         info("Testing for a %s partition.", (*ops)->name);
         if ((*ops)->test(vol) == 1) {
@@ -45,6 +50,9 @@ int volumes_load(Volume* vol)
         (ops)++;
     }
 
+    // Read the start of every partition at once; the nested loads and filesystem tests then mostly run from memory.
+    vol_probe_partitions(vol);
+
     // Recursive load
     for(unsigned i = 0; i < vol->partition_count; i++) {
         info("Looking for nested partitions on partition %u", i);
@@ -0,0 +1,137 @@
+//
+//  workqueue.c
+//  volumes
+//
+//
+
+#include "workqueue.h"
+
+#include <pthread.h>
+
+
+typedef struct WorkItem {
+    workqueue_func   func;
+    void*            context;
+    struct WorkItem* next;
+} WorkItem;
+
+struct WorkQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t  work_available;     // Signalled when items are queued or the pool shuts down
+    pthread_cond_t  work_done;          // Signalled when the queue drains and no worker is busy
+    WorkItem*       head;
+    WorkItem*       tail;
+    size_t          busy;               // Workers currently running an item
+    bool            stopping;
+    uint8_t         _reserved[3];
+    unsigned        thread_count;
+    pthread_t*      threads;
+};
+
+static void* workqueue_worker(void* arg)
+{
+    WorkQueue* queue = arg;
+
+    pthread_mutex_lock(&queue->lock);
+    while (1) {
+        while ((queue->head == NULL) && !queue->stopping)
+            pthread_cond_wait(&queue->work_available, &queue->lock);
+
+        if (queue->head == NULL) break; // Stopping, and nothing left to do.
+
+        WorkItem* item = queue->head;
+        queue->head = item->next;
+        if (queue->head == NULL) queue->tail = NULL;
+        queue->busy++;
+        pthread_mutex_unlock(&queue->lock);
+
+        item->func(item->context);
+        SFREE(item);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->busy--;
+        if ((queue->head == NULL) && (queue->busy == 0))
+            pthread_cond_broadcast(&queue->work_done);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+WorkQueue* workqueue_make(unsigned threads)
+{
+    WorkQueue* queue = NULL;
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0 ? (unsigned)cpus : 1);
+    }
+
+    SALLOC(queue, sizeof(WorkQueue));
+    SALLOC(queue->threads, threads * sizeof(pthread_t));
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->work_available, NULL);
+    pthread_cond_init(&queue->work_done, NULL);
+
+    for (unsigned i = 0; i < threads; i++) {
+        if (pthread_create(&queue->threads[i], NULL, workqueue_worker, queue) != 0) break;
+        queue->thread_count++;
+    }
+
+    if (queue->thread_count == 0) {
+        workqueue_free(queue);
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    return queue;
+}
+
+int workqueue_add(WorkQueue* queue, workqueue_func func, void* context)
+{
+    WorkItem* item = NULL;
+    SALLOC(item, sizeof(WorkItem));
+    item->func    = func;
+    item->context = context;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail) queue->tail->next = item;
+    else queue->head = item;
+    queue->tail = item;
+    pthread_cond_signal(&queue->work_available);
+    pthread_mutex_unlock(&queue->lock);
+
+    return 0;
+}
+
+void workqueue_wait(WorkQueue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    while ((queue->head != NULL) || (queue->busy != 0))
+        pthread_cond_wait(&queue->work_done, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+unsigned workqueue_threads(const WorkQueue* queue)
+{
+    return queue->thread_count;
+}
+
+void workqueue_free(WorkQueue* queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = true;
+    pthread_cond_broadcast(&queue->work_available);
+    pthread_mutex_unlock(&queue->lock);
+
+    for (unsigned i = 0; i < queue->thread_count; i++)
+        pthread_join(queue->threads[i], NULL);
+
+    pthread_cond_destroy(&queue->work_done);
+    pthread_cond_destroy(&queue->work_available);
+    pthread_mutex_destroy(&queue->lock);
+
+    SFREE(queue->threads);
+    SFREE(queue);
+}
@@ -0,0 +1,30 @@
+//
+//  workqueue.h
+//  volumes
+//
+//
+
+// A fixed pool of pthreads draining a FIFO of (function, context) pairs.
+
+#ifndef volumes_workqueue_h
+#define volumes_workqueue_h
+
+typedef void (* workqueue_func)(void* context);
+
+typedef struct WorkQueue WorkQueue;
+
+// Starts `threads` workers; 0 uses one per online CPU.
+WorkQueue* workqueue_make    (unsigned threads);
+
+// Queues a call to func(context) on the next free worker.
+int        workqueue_add     (WorkQueue* queue, workqueue_func func, void* context) __attribute__((nonnull(1,2)));
+
+// Blocks until every queued item has finished running.
+void       workqueue_wait    (WorkQueue* queue) __attribute__((nonnull));
+
+unsigned   workqueue_threads (const WorkQueue* queue) __attribute__((nonnull));
+
+// Waits for outstanding work, then stops and joins the workers.
+void       workqueue_free    (WorkQueue* queue) __attribute__((nonnull));
+
+#endif
@@ -0,0 +1,452 @@
+//
+//  bench.c
+//  hfsinspect
+//
+//
+
+// Times the common operations on one volume (usually from bench_image).  Run with `make bench`.
+//
+// Each benchmark runs a fixed amount of work a few times and reports the median run, one tab-separated line apiece, so
+// the output of two builds can be compared directly; `-b file` does that against a saved run.  Everything after the
+// open benchmark shares one open volume, so the page cache and the B-tree node cache are warm.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "hfs/hfs.h"
+#include "hfs/catalog.h"
+#include "hfs/hfs_io.h"
+#include "hfs/listing.h"
+#include "hfs/unicode.h"
+#include "volumes/volumes.h"
+#include "operations/operations.h"
+
+#define kBenchRounds       5
+#define kBenchOpens        20
+#define kBenchSamples      1000
+#define kBenchMaxResults   16
+#define kBenchBitmapWalks  20
+#define kBenchBitmapBlocks (16 * 1024 * 1024)
+
+typedef struct BenchResult {
+    char     name[32];
+    uint64_t ops;
+    uint64_t bytes;
+    double   seconds;
+} BenchResult;
+
+// What the catalog holds, gathered once so the lookups have something to look up.
+typedef struct BenchCatalog {
+    uint32_t*        parents;               // By CNID
+    char**           names;                 // By CNID
+    size_t           capacity;
+    bt_nodeid_t*     files;
+    HFSPlusForkData* forks;                 // Data fork of each of files
+    size_t           fileCount;
+    size_t           fileCapacity;
+    bt_nodeid_t*     folders;
+    size_t           folderCount;
+    size_t           folderCapacity;
+} BenchCatalog;
+
+typedef struct BenchContext {
+    const char*   path;
+    HFSPlus*      hfs;
+    BenchCatalog  catalog;
+    bt_nodeid_t*  samples;                  // Files spread evenly through the catalog
+    char**        samplePaths;
+    size_t        sampleCount;
+} BenchContext;
+
+// The operations call this on fatal errors; hfsinspect.c has the full version.
+void die(int val, char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(val);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x < y ? -1 : (x > y));
+}
+
+#pragma mark Catalog contents
+
+static int collect_record(void* context, const HFSPlusCatalogKey* key, const HFSPlusCatalogRecord* record)
+{
+    BenchCatalog* catalog = context;
+    bt_nodeid_t   cnid    = 0;
+    hfs_str       name    = {0};
+
+    if (record->record_type == kHFSPlusFolderRecord) {
+        cnid = record->catalogFolder.folderID;
+    } else if (record->record_type == kHFSPlusFileRecord) {
+        cnid = record->catalogFile.fileID;
+    } else {
+        return 0;
+    }
+
+    if (cnid >= catalog->capacity) {
+        size_t capacity = MAX(cnid + 1, catalog->capacity * 2);
+        SREALLOC(catalog->parents, capacity * sizeof(uint32_t));
+        SREALLOC(catalog->names, capacity * sizeof(char*));
+        memset(catalog->parents + catalog->capacity, 0, (capacity - catalog->capacity) * sizeof(uint32_t));
+        memset(catalog->names + catalog->capacity, 0, (capacity - catalog->capacity) * sizeof(char*));
+        catalog->capacity = capacity;
+    }
+
+    hfsuc_to_str(&name, &key->nodeName);
+    catalog->parents[cnid] = key->parentID;
+    catalog->names[cnid]   = strdup((char*)name);
+
+    if (record->record_type == kHFSPlusFolderRecord) {
+        if (catalog->folderCount == catalog->folderCapacity) {
+            catalog->folderCapacity = MAX(64, catalog->folderCapacity * 2);
+            SREALLOC(catalog->folders, catalog->folderCapacity * sizeof(bt_nodeid_t));
+        }
+        catalog->folders[catalog->folderCount++] = cnid;
+    } else {
+        if (catalog->fileCount == catalog->fileCapacity) {
+            catalog->fileCapacity = MAX(64, catalog->fileCapacity * 2);
+            SREALLOC(catalog->files, catalog->fileCapacity * sizeof(bt_nodeid_t));
+            SREALLOC(catalog->forks, catalog->fileCapacity * sizeof(HFSPlusForkData));
+        }
+        catalog->forks[catalog->fileCount] = record->catalogFile.dataFork;
+        catalog->files[catalog->fileCount++] = cnid;
+    }
+
+    return 0;
+}
+
+static char* catalog_path(const BenchCatalog* catalog, bt_nodeid_t cnid)
+{
+    char path[PATH_MAX] = "";
+    char temp[PATH_MAX];
+
+    while ((cnid != kHFSRootFolderID) && (cnid < catalog->capacity) && catalog->names[cnid]) {
+        (void)snprintf(temp, PATH_MAX, "/%s%s", catalog->names[cnid], path);
+        (void)strlcpy(path, temp, PATH_MAX);
+        cnid = catalog->parents[cnid];
+    }
+
+    return strdup(path);
+}
+
+static void catalog_free(BenchCatalog* catalog)
+{
+    for (size_t i = 0; i < catalog->capacity; i++)
+        if (catalog->names[i]) free(catalog->names[i]);
+    SFREE(catalog->names);
+    SFREE(catalog->parents);
+    SFREE(catalog->files);
+    SFREE(catalog->forks);
+    SFREE(catalog->folders);
+}
+
+#pragma mark Benchmarks
+
+// Opens the image, finds the volume and loads the catalog's header, then closes it all again.
+static int bench_open(BenchContext* context, BenchResult* result)
+{
+    for (unsigned i = 0; i < kBenchOpens; i++) {
+        Volume*   vol     = NULL;
+        Volume*   fs      = NULL;
+        HFSPlus*  hfs     = NULL;
+        BTreePtr  catalog = NULL;
+
+        SALLOC(hfs, sizeof(HFSPlus));
+        if ( (vol = vol_qopen(context->path)) == NULL ) return -1;
+        if ( (volumes_load(vol) < 0) || ((fs = hfsplus_find(vol)) == NULL) ) return -1;
+        if ( hfs_open(hfs, fs) < 0 ) return -1;
+        if ( hfsplus_get_catalog_btree(&catalog, hfs) < 0 ) return -1;
+        hfs_close(hfs);
+        if (vol != fs) vol_close(vol);
+        SFREE(hfs);
+
+        result->ops++;
+    }
+    return 0;
+}
+
+static int bench_path_lookup(BenchContext* context, BenchResult* result)
+{
+    for (size_t i = 0; i < context->sampleCount; i++) {
+        FSSpec               spec   = {0};
+        HFSPlusCatalogRecord record = {0};
+
+        if ( HFSPlusGetCatalogInfoByPath(&spec, &record, context->samplePaths[i], context->hfs) < 0 ) return -1;
+        result->ops++;
+    }
+    return 0;
+}
+
+static int bench_cnid_lookup(BenchContext* context, BenchResult* result)
+{
+    for (size_t i = 0; i < context->sampleCount; i++) {
+        FSSpec               spec   = {0};
+        HFSPlusCatalogRecord record = {0};
+
+        if ( HFSPlusGetCatalogInfoByCNID(&spec, &record, context->hfs, context->samples[i]) < 0 ) return -1;
+        result->ops++;
+    }
+    return 0;
+}
+
+// A full --summary pass; ops are catalog records and bytes the catalog file.
+static int bench_summary(BenchContext* context, BenchResult* result)
+{
+    HIOptions     options = { .hfs = context->hfs, .quiet = true };
+    VolumeSummary summary = {0};
+
+    if (generateVolumeSummary(&summary, &options) < 0) return -1;
+
+    result->ops   += summary.recordCount;
+    result->bytes += context->hfs->vh.catalogFile.logicalSize;
+    freeVolumeSummary(&summary);
+    return 0;
+}
+
+// Lists every folder; ops are the entries listed.
+static int bench_listing(BenchContext* context, BenchResult* result)
+{
+    for (size_t i = 0; i < context->catalog.folderCount; i++) {
+        HFSListing             listing = {0};
+        const HFSListingEntry* entries = NULL;
+        size_t                 count   = 0;
+        int                    status  = 0;
+
+        if ( hfs_listing_open(&listing, context->hfs, context->catalog.folders[i], NULL) < 0 ) return -1;
+        while ( (status = hfs_listing_next(&listing, &entries, &count)) > 0 )
+            result->ops += count;
+        hfs_listing_close(&listing);
+        if (status < 0) return -1;
+    }
+    return 0;
+}
+
+// Reads the allocation bitmap and walks it into used and free runs, as --freespace does; ops are blocks walked.
+// Small volumes are walked more times, so every run covers at least kBenchBitmapBlocks blocks.
+static int bench_free_space(BenchContext* context, BenchResult* result)
+{
+    size_t walks = MAX(kBenchBitmapWalks, kBenchBitmapBlocks / MAX(1, context->hfs->vh.totalBlocks));
+
+    for (size_t i = 0; i < walks; i++) {
+        FreeSpaceStats stats = {0};
+
+        if (generateFreeSpaceStats(&stats, context->hfs) < 0) return -1;
+
+        result->ops   += stats.usedBlocks + stats.freeBlocks;
+        result->bytes += stats.bitmapBytes;
+    }
+    return 0;
+}
+
+// Extracts the sampled files' data forks to a scratch file with extractFork, as -x does. Which copy that
+// times depends on the image: the direct copy for a plain file, the queued copy for disk images.
+static int bench_extraction(BenchContext* context, BenchResult* result)
+{
+    char path[PATH_MAX] = "";
+    int  fd             = -1;
+    int  saved          = -1;
+    int  status         = 0;
+
+    (void)snprintf(path, PATH_MAX, "%s/hfsinspect-bench-XXXXXX", (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp"));
+    if ( (fd = mkstemp(path)) < 0 ) return -1;
+    close(fd);
+
+    // extractFork reports its progress on stdout; keep it out of the results.
+    fflush(stdout);
+    if ( ((saved = dup(STDOUT_FILENO)) < 0) || ((fd = open("/dev/null", O_WRONLY)) < 0) ) {
+        unlink(path);
+        return -1;
+    }
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+
+    for (size_t i = 0; (i < context->sampleCount) && (status == 0); i++) {
+        HFSPlusFork* fork  = NULL;
+        size_t       index = 0;
+
+        // Samples were chosen by position in the file list.
+        while (context->catalog.files[index] != context->samples[i]) index++;
+
+        const HFSPlusForkData* forkData = &context->catalog.forks[index];
+
+        if ( hfsfork_make(&fork, context->hfs, *forkData, HFSDataForkType, context->samples[i]) < 0 ) { status = -1; break; }
+        if (extractFork(fork, path) < 0) status = -1;
+        hfsfork_free(fork);
+
+        result->ops++;
+        result->bytes += forkData->logicalSize;
+    }
+
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    unlink(path);
+    return status;
+}
+
+typedef struct Benchmark {
+    const char* name;
+    int         (* run)(BenchContext* context, BenchResult* result);
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    { "open",        bench_open        },
+    { "path-lookup", bench_path_lookup },
+    { "cnid-lookup", bench_cnid_lookup },
+    { "summary",     bench_summary     },
+    { "listing",     bench_listing     },
+    { "free-space",  bench_free_space  },
+    { "extraction",  bench_extraction  },
+};
+
+static int run_benchmark(BenchContext* context, const Benchmark* benchmark, BenchResult* result)
+{
+    double times[kBenchRounds];
+
+    for (unsigned r = 0; r < kBenchRounds; r++) {
+        BenchResult pass    = {0};
+        double      started = now();
+
+        if (benchmark->run(context, &pass) < 0) return -1;
+        times[r] = now() - started;
+
+        // Every pass does the same work.
+        result->ops   = pass.ops;
+        result->bytes = pass.bytes;
+    }
+
+    qsort(times, kBenchRounds, sizeof(double), compare_doubles);
+    (void)strlcpy(result->name, benchmark->name, sizeof(result->name));
+    result->seconds = times[kBenchRounds / 2];
+    return 0;
+}
+
+#pragma mark Baselines
+
+// Reads a previous run's results; lines that aren't results are skipped.
+static size_t read_baseline(const char* path, BenchResult* results, size_t limit)
+{
+    FILE*  fp    = fopen(path, "r");
+    char   line[256];
+    size_t count = 0;
+
+    if (fp == NULL) { perror(path); exit(1); }
+
+    while ((count < limit) && fgets(line, sizeof(line), fp)) {
+        BenchResult*       result = &results[count];
+        unsigned long long ops    = 0;
+
+        if ( (line[0] == '#') || (sscanf(line, "%31s %llu %lf", result->name, &ops, &result->seconds) != 3) ) continue;
+        result->ops = ops;
+        count++;
+    }
+
+    fclose(fp);
+    return count;
+}
+
+static void print_result(const BenchResult* result, const BenchResult* baseline, size_t baselineCount)
+{
+    double opsPerSecond = result->ops / result->seconds;
+    double mibPerSecond = result->bytes / (1024.0 * 1024.0) / result->seconds;
+
+    printf("%-12s\t%10llu\t%10.6f\t%12.1f\t%10.1f", result->name, (unsigned long long)result->ops, result->seconds, opsPerSecond, mibPerSecond);
+
+    for (size_t i = 0; i < baselineCount; i++) {
+        if ( (strcmp(baseline[i].name, result->name) != 0) || (baseline[i].ops == 0) ) continue;
+
+        // Compare rates, so a baseline from a different amount of work still lines up.
+        double before = baseline[i].ops / baseline[i].seconds;
+        printf("\t%+7.1f%%", (opsPerSecond - before) / before * 100.0);
+        break;
+    }
+    printf("\n");
+}
+
+#pragma mark Main
+
+int main (int argc, char* const* argv)
+{
+    BenchContext context                       = {0};
+    BenchResult  baseline[kBenchMaxResults]    = {0};
+    size_t       baselineCount                 = 0;
+    size_t       sampleLimit                   = kBenchSamples;
+    Volume*      vol                           = NULL;
+    Volume*      fs                            = NULL;
+    int          opt                           = 0;
+
+    while ((opt = getopt(argc, argv, "b:n:")) != -1) {
+        switch (opt) {
+            case 'b': baselineCount = read_baseline(optarg, baseline, kBenchMaxResults); break;
+            case 'n': sampleLimit   = MAX(1, strtoul(optarg, NULL, 0));                  break;
+            default:
+                fprintf(stderr, "usage: %s [-b baseline] [-n lookups] image\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-b baseline] [-n lookups] image\n", argv[0]);
+        return 1;
+    }
+    context.path = argv[optind];
+
+    SALLOC(context.hfs, sizeof(HFSPlus));
+    if ( (vol = vol_qopen(context.path)) == NULL ) { perror(context.path); return 1; }
+    if ( (volumes_load(vol) < 0) || ((fs = hfsplus_find(vol)) == NULL) ) { fprintf(stderr, "%s: no HFS+ filesystem found\n", context.path); return 1; }
+    if ( hfs_open(context.hfs, fs) < 0 ) { perror("hfs_open"); return 1; }
+
+    if ( hfsplus_catalog_scan(context.hfs, collect_record, &context.catalog) < 0 ) { fprintf(stderr, "catalog scan failed\n"); return 1; }
+    if (context.catalog.fileCount == 0) { fprintf(stderr, "%s: no files to look up\n", context.path); return 1; }
+
+    context.sampleCount = MIN(sampleLimit, context.catalog.fileCount);
+    SALLOC(context.samples, context.sampleCount * sizeof(bt_nodeid_t));
+    SALLOC(context.samplePaths, context.sampleCount * sizeof(char*));
+    for (size_t i = 0; i < context.sampleCount; i++) {
+        context.samples[i]     = context.catalog.files[i * context.catalog.fileCount / context.sampleCount];
+        context.samplePaths[i] = catalog_path(&context.catalog, context.samples[i]);
+    }
+
+    printf("# %s: %zu files, %zu folders, %zu-byte blocks, catalog %.1f MiB; %zu lookups, median of each benchmark's runs\n",
+           context.path, context.catalog.fileCount, context.catalog.folderCount, context.hfs->block_size,
+           context.hfs->vh.catalogFile.logicalSize / (1024.0 * 1024.0), context.sampleCount);
+    printf("# %-10s\t%10s\t%10s\t%12s\t%10s%s\n", "benchmark", "ops", "seconds", "ops/s", "MiB/s", (baselineCount ? "\tchange" : ""));
+
+    for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+        BenchResult result = {0};
+
+        if (run_benchmark(&context, &benchmarks[b], &result) < 0) {
+            fprintf(stderr, "%s: %s failed: %s\n", context.path, benchmarks[b].name, strerror(errno));
+            return 1;
+        }
+        print_result(&result, baseline, baselineCount);
+    }
+
+    for (size_t i = 0; i < context.sampleCount; i++) free(context.samplePaths[i]);
+    SFREE(context.samplePaths);
+    SFREE(context.samples);
+    catalog_free(&context.catalog);
+    hfs_close(context.hfs);
+    if (vol != fs) vol_close(vol);
+    SFREE(context.hfs);
+
+    return 0;
+}
@@ -0,0 +1,762 @@
+//
+//  bench_image.c
+//  hfsinspect
+//
+//
+
+// Writes a synthetic HFS+ image for benchmarking.  The same options and seed always produce the same bytes.
+// Built by `make bench`; run it with -h for the knobs.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "hfs/hfs_endian.h"
+#include "hfs/catalog.h"
+#include "hfs/btree/btree_endian.h"
+
+#define kBenchCatalogNodeSize   8192
+#define kBenchExtentsNodeSize   4096
+#define kBenchHeaderMapOffset   248         // Descriptor, header record and the 128-byte user record come first
+#define kBenchDate              3850070400U // 2026-01-01 in HFS time
+
+typedef struct BenchShape {
+    uint32_t files;
+    uint32_t fanout;                        // Files per folder, and subfolders per folder
+    uint32_t extents;                       // Per data fork; more than 8 spill into the extents overflow file
+    uint32_t nameLength;
+    uint64_t fileSize;
+    uint32_t blockSize;
+    uint64_t seed;
+    bool     caseSensitive;
+} BenchShape;
+
+// A folder or file; folders come first, with the root at index 0.
+typedef struct BenchItem {
+    uint32_t cnid;
+    uint32_t parent;
+    uint32_t nameOffset;                    // Into BenchImage.names, in UTF-16 units
+    uint16_t nameLength;
+    uint16_t folder;
+    uint32_t valence;
+    uint32_t date;
+} BenchItem;
+
+// A catalog record: the item's file or folder record, or its thread.
+typedef struct BenchRecord {
+    uint32_t item;
+    uint32_t thread;
+} BenchRecord;
+
+// One B-tree file, written a node at a time.
+typedef struct TreeBuilder {
+    uint8_t* nodes;
+    size_t   capacity;                      // Nodes
+    uint32_t nodeSize;
+    uint32_t nodeCount;                     // Including the header node
+    uint32_t current;                       // Node being filled; 0 when none is open
+    uint32_t used;                          // Bytes used in the current node, descriptor included
+    uint16_t records;
+    int8_t   kind;
+    uint8_t  height;
+    uint32_t leafRecords;
+    uint32_t rootNode;
+    uint32_t firstLeaf;
+    uint32_t lastLeaf;
+    uint16_t depth;
+} TreeBuilder;
+
+typedef struct BenchImage {
+    BenchShape   shape;
+    BenchItem*   items;
+    uint32_t     folderCount;               // Including the root
+    uint32_t     itemCount;
+    uint16_t*    names;
+    size_t       namesLength;
+    uint32_t     fileBlocks;                // Allocation blocks per data fork
+    uint32_t     overflowRecords;           // Extents overflow records per data fork
+
+    // Layout, in allocation blocks
+    uint32_t     headBlocks;
+    uint32_t     bitmapStart,  bitmapBlocks;
+    uint32_t     dataStart,    dataBlocks;
+    uint32_t     extentsStart, extentsBlocks;
+    uint32_t     catalogStart, catalogBlocks;
+    uint32_t     tailBlocks;
+    uint32_t     totalBlocks;
+    uint32_t     usedBlocks;
+
+    TreeBuilder  extents;
+    TreeBuilder  catalog;
+} BenchImage;
+
+static uint64_t prng_state = 1;
+
+static uint64_t prng(void)
+{
+    // xorshift64*
+    prng_state ^= prng_state >> 12;
+    prng_state ^= prng_state << 25;
+    prng_state ^= prng_state >> 27;
+    return prng_state * 0x2545F4914F6CDD1DULL;
+}
+
+#pragma mark Big-endian fields
+
+static void put16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put32(uint8_t* p, uint32_t v) { put16(p, (uint16_t)(v >> 16)); put16(p + 2, (uint16_t)v); }
+
+static uint16_t get16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+
+#pragma mark B-Tree construction
+
+static void tb_init(TreeBuilder* tb, uint32_t nodeSize)
+{
+    memset(tb, 0, sizeof(TreeBuilder));
+    tb->nodeSize  = nodeSize;
+    tb->nodeCount = 1;                      // Node 0 is the header
+    tb->capacity  = 64;
+    SALLOC(tb->nodes, tb->capacity * nodeSize);
+}
+
+static uint8_t* tb_node(const TreeBuilder* tb, uint32_t nodeNum)
+{
+    return tb->nodes + (size_t)nodeNum * tb->nodeSize;
+}
+
+static void tb_finish_node(TreeBuilder* tb)
+{
+    if (tb->current == 0) return;
+
+    uint8_t* node = tb_node(tb, tb->current);
+    node[8] = (uint8_t)tb->kind;
+    node[9] = tb->height;
+    put16(node + 10, tb->records);
+    tb->current = 0;
+}
+
+static void tb_start_node(TreeBuilder* tb)
+{
+    uint32_t previous = tb->current;
+
+    tb_finish_node(tb);
+
+    if (tb->nodeCount == tb->capacity) {
+        size_t capacity = tb->capacity * 2;
+        SREALLOC(tb->nodes, capacity * tb->nodeSize);
+        memset(tb->nodes + tb->capacity * tb->nodeSize, 0, (capacity - tb->capacity) * tb->nodeSize);
+        tb->capacity = capacity;
+    }
+
+    tb->current = tb->nodeCount++;
+    tb->used    = sizeof(BTNodeDescriptor);
+    tb->records = 0;
+
+    // Every level is a doubly-linked list.
+    if (previous) {
+        put32(tb_node(tb, previous), tb->current);
+        put32(tb_node(tb, tb->current) + 4, previous);
+    }
+    put16(tb_node(tb, tb->current) + tb->nodeSize - 2, (uint16_t)tb->used);
+}
+
+// Starts a level of the tree; its nodes are numbered from the return value.
+static uint32_t tb_begin_level(TreeBuilder* tb, int8_t kind, uint8_t height)
+{
+    tb_finish_node(tb);
+    tb->kind   = kind;
+    tb->height = height;
+    return tb->nodeCount;
+}
+
+static void tb_append(TreeBuilder* tb, const uint8_t* record, size_t length)
+{
+    // The offset table needs one more slot for the record and keeps one for the free space.
+    if ( (tb->current == 0) || (tb->used + length + 2 * (tb->records + 2u) > tb->nodeSize) )
+        tb_start_node(tb);
+
+    uint8_t* node = tb_node(tb, tb->current);
+    memcpy(node + tb->used, record, length);
+    tb->used += (uint32_t)length;
+    tb->records++;
+    put16(node + tb->nodeSize - 2 * (tb->records + 1u), (uint16_t)tb->used);
+
+    if (tb->kind == kBTLeafNode) tb->leafRecords++;
+}
+
+// Adds index levels over the leaves until one node remains, then writes the header node.
+static void tb_finish_tree(TreeBuilder* tb, uint16_t maxKeyLength, uint32_t attributes, uint8_t keyCompareType, uint32_t blockSize, uint32_t* blocks)
+{
+    uint32_t first = 1;
+    uint32_t last  = tb->nodeCount - 1;
+
+    tb_finish_node(tb);
+
+    if (tb->nodeCount > 1) {
+        tb->firstLeaf = first;
+        tb->lastLeaf  = last;
+        tb->depth     = 1;
+
+        while (first != last) {
+            uint32_t level = tb_begin_level(tb, kBTIndexNode, (uint8_t)(tb->depth + 1));
+
+            for (uint32_t child = first; child <= last; child++) {
+                uint8_t  record[kBenchCatalogNodeSize];
+                uint8_t* node   = tb_node(tb, child);
+                uint16_t offset = get16(node + tb->nodeSize - 2);
+
+                // Both trees here use each child's first key whole, so the index records are the key plus a pointer.
+                size_t keySize = 2 + get16(node + offset);
+                memcpy(record, node + offset, keySize);
+                put32(record + keySize, child);
+                tb_append(tb, record, keySize + 4);
+            }
+            tb_finish_node(tb);
+
+            first = level;
+            last  = tb->nodeCount - 1;
+            tb->depth++;
+        }
+        tb->rootNode = first;
+    }
+
+    // Round the file up to whole allocation blocks; the slack becomes free nodes.
+    uint64_t bytes      = (uint64_t)tb->nodeCount * tb->nodeSize;
+    bytes               = (bytes + blockSize - 1) / blockSize * blockSize;
+    uint32_t totalNodes = (uint32_t)(bytes / tb->nodeSize);
+    uint32_t mapNodes   = (tb->nodeSize - kBenchHeaderMapOffset - 8) * 8;
+
+    if (totalNodes > mapNodes) {
+        fprintf(stderr, "bench_image: %u nodes need map nodes, which aren't supported; use fewer files\n", totalNodes);
+        exit(1);
+    }
+
+    if (totalNodes > tb->capacity) {
+        SREALLOC(tb->nodes, (size_t)totalNodes * tb->nodeSize);
+        memset(tb->nodes + tb->capacity * tb->nodeSize, 0, (totalNodes - tb->capacity) * tb->nodeSize);
+        tb->capacity = totalNodes;
+    }
+
+    BTHeaderRec header = {
+        .treeDepth      = tb->depth,
+        .rootNode       = tb->rootNode,
+        .leafRecords    = tb->leafRecords,
+        .firstLeafNode  = tb->firstLeaf,
+        .lastLeafNode   = tb->lastLeaf,
+        .nodeSize       = (uint16_t)tb->nodeSize,
+        .maxKeyLength   = maxKeyLength,
+        .totalNodes     = totalNodes,
+        .freeNodes      = totalNodes - tb->nodeCount,
+        .clumpSize      = blockSize,
+        .btreeType      = 0,                // kHFSBTreeType
+        .keyCompareType = keyCompareType,
+        .attributes     = attributes,
+    };
+    swap_BTHeaderRec(&header);
+
+    uint8_t* node = tb_node(tb, 0);
+    memset(node, 0, tb->nodeSize);
+    node[8] = (uint8_t)kBTHeaderNode;
+    put16(node + 10, 3);
+    memcpy(node + sizeof(BTNodeDescriptor), &header, sizeof(BTHeaderRec));
+
+    // Header record, user data record, map record, free space.
+    put16(node + tb->nodeSize - 2, sizeof(BTNodeDescriptor));
+    put16(node + tb->nodeSize - 4, sizeof(BTNodeDescriptor) + sizeof(BTHeaderRec));
+    put16(node + tb->nodeSize - 6, kBenchHeaderMapOffset);
+    put16(node + tb->nodeSize - 8, (uint16_t)(tb->nodeSize - 8));
+
+    for (uint32_t i = 0; i < tb->nodeCount; i++)
+        node[kBenchHeaderMapOffset + i / 8] |= (uint8_t)(0x80 >> (i % 8));
+
+    *blocks = (uint32_t)(bytes / blockSize);
+}
+
+#pragma mark Catalog
+
+static const BenchImage* sort_image = NULL;
+
+static void record_key(HFSPlusCatalogKey* key, const BenchImage* image, const BenchRecord* record)
+{
+    const BenchItem* item = &image->items[record->item];
+
+    if (record->thread) {
+        key->parentID        = item->cnid;
+        key->nodeName.length = 0;
+    } else {
+        key->parentID        = item->parent;
+        key->nodeName.length = item->nameLength;
+        memcpy(key->nodeName.unicode, image->names + item->nameOffset, item->nameLength * sizeof(uint16_t));
+    }
+    key->keyLength = (uint16_t)(6 + 2 * key->nodeName.length);
+}
+
+static int compare_records(const void* a, const void* b)
+{
+    static HFSPlusCatalogKey key1, key2;
+
+    record_key(&key1, sort_image, a);
+    record_key(&key2, sort_image, b);
+
+    if (sort_image->shape.caseSensitive)
+        return hfsplus_catalog_compare_keys_bc(&key1, &key2);
+    return hfsplus_catalog_compare_keys_cf(&key1, &key2);
+}
+
+static size_t put_name(uint8_t* p, const BenchImage* image, const BenchItem* item)
+{
+    put16(p, item->nameLength);
+    for (unsigned i = 0; i < item->nameLength; i++)
+        put16(p + 2 + 2 * i, image->names[item->nameOffset + i]);
+    return 2 + 2 * (size_t)item->nameLength;
+}
+
+// A data fork's index'th extent. Forks are laid out back to back in CNID order, with a free block between their extents.
+static HFSPlusExtentDescriptor file_extent(const BenchImage* image, uint32_t file, uint32_t index)
+{
+    HFSPlusExtentDescriptor extent = {0};
+    uint32_t count = MIN(image->shape.extents, image->fileBlocks);
+
+    if (index >= count) return extent;
+
+    uint32_t base  = image->fileBlocks / count;
+    uint32_t extra = image->fileBlocks % count;
+    uint32_t span  = image->fileBlocks + count - 1;
+
+    extent.startBlock = image->dataStart + file * span + index * (base + 1) + MIN(index, extra);
+    extent.blockCount = base + (index < extra);
+    return extent;
+}
+
+static void build_catalog(BenchImage* image, const BenchRecord* records, size_t count)
+{
+    uint8_t record[kBenchCatalogNodeSize];
+
+    tb_init(&image->catalog, kBenchCatalogNodeSize);
+    tb_begin_level(&image->catalog, kBTLeafNode, 1);
+
+    for (size_t r = 0; r < count; r++) {
+        const BenchItem* item   = &image->items[records[r].item];
+        size_t           length = 0;
+
+        memset(record, 0, sizeof(record));
+
+        // Key
+        if (records[r].thread) {
+            put16(record, 6);
+            put32(record + 2, item->cnid);
+            length = 8;
+        } else {
+            put16(record, (uint16_t)(6 + 2 * item->nameLength));
+            put32(record + 2, item->parent);
+            length = 6 + put_name(record + 6, image, item);
+        }
+
+        // Data
+        if (records[r].thread) {
+            put16(record + length, item->folder ? kHFSPlusFolderThreadRecord : kHFSPlusFileThreadRecord);
+            put32(record + length + 4, item->parent);
+            length += 8 + put_name(record + length + 8, image, item);
+
+        } else if (item->folder) {
+            HFSPlusCatalogFolder folder = {
+                .recordType       = kHFSPlusFolderRecord,
+                .valence          = item->valence,
+                .folderID         = item->cnid,
+                .createDate       = item->date,
+                .contentModDate   = item->date,
+                .attributeModDate = item->date,
+                .accessDate       = item->date,
+                .bsdInfo          = { .ownerID = 501, .groupID = 20, .fileMode = S_IFDIR | 0755 },
+            };
+            swap_HFSPlusCatalogFolder(&folder);
+            Swap16(folder.recordType);
+            memcpy(record + length, &folder, sizeof(folder));
+            length += sizeof(folder);
+
+        } else {
+            uint32_t           index = records[r].item - image->folderCount;
+            HFSPlusCatalogFile file  = {
+                .recordType       = kHFSPlusFileRecord,
+                .flags            = kHFSThreadExistsMask,
+                .fileID           = item->cnid,
+                .createDate       = item->date,
+                .contentModDate   = item->date,
+                .attributeModDate = item->date,
+                .accessDate       = item->date,
+                .bsdInfo          = { .ownerID = 501, .groupID = 20, .fileMode = S_IFREG | 0644 },
+                .dataFork         = { .logicalSize = image->shape.fileSize, .totalBlocks = image->fileBlocks },
+            };
+            for (uint32_t e = 0; e < kHFSPlusExtentDensity; e++)
+                file.dataFork.extents[e] = file_extent(image, index, e);
+            swap_HFSPlusCatalogFile(&file);
+            Swap16(file.recordType);
+            memcpy(record + length, &file, sizeof(file));
+            length += sizeof(file);
+        }
+
+        tb_append(&image->catalog, record, length);
+    }
+
+    uint8_t keyCompareType = (image->shape.caseSensitive ? kHFSBinaryCompare : kHFSCaseFolding);
+    tb_finish_tree(&image->catalog, kHFSPlusCatalogKeyMaximumLength, kBTBigKeysMask | kBTVariableIndexKeysMask, keyCompareType, image->shape.blockSize, &image->catalogBlocks);
+}
+
+static void build_extents(BenchImage* image)
+{
+    uint32_t count = MIN(image->shape.extents, image->fileBlocks);
+
+    tb_init(&image->extents, kBenchExtentsNodeSize);
+    tb_begin_level(&image->extents, kBTLeafNode, 1);
+
+    for (uint32_t file = 0; file < image->shape.files && image->overflowRecords; file++) {
+        uint32_t logical = 0;
+
+        for (uint32_t e = 0; e < kHFSPlusExtentDensity; e++)
+            logical += file_extent(image, file, e).blockCount;
+
+        for (uint32_t first = kHFSPlusExtentDensity; first < count; first += kHFSPlusExtentDensity) {
+            uint8_t record[sizeof(HFSPlusExtentKey) + sizeof(HFSPlusExtentRecord)] = {0};
+
+            put16(record, kHFSPlusExtentKeyMaximumLength);
+            // forkType 0 (data) and pad
+            put32(record + 4, image->items[image->folderCount + file].cnid);
+            put32(record + 8, logical);
+
+            for (uint32_t e = 0; e < kHFSPlusExtentDensity; e++) {
+                HFSPlusExtentDescriptor extent = file_extent(image, file, first + e);
+                put32(record + 12 + 8 * e, extent.startBlock);
+                put32(record + 16 + 8 * e, extent.blockCount);
+                logical += extent.blockCount;
+            }
+            tb_append(&image->extents, record, sizeof(record));
+        }
+    }
+
+    tb_finish_tree(&image->extents, kHFSPlusExtentKeyMaximumLength, kBTBigKeysMask, 0, image->shape.blockSize, &image->extentsBlocks);
+}
+
+static void tb_free(TreeBuilder* tb)
+{
+    SFREE(tb->nodes);
+    memset(tb, 0, sizeof(TreeBuilder));
+}
+
+#pragma mark Folders and files
+
+static void add_name(BenchImage* image, BenchItem* item, char prefix, uint32_t index)
+{
+    char     name[256] = {0};
+    size_t   length    = 0;
+    uint32_t digits    = index;
+
+    // A unique lowercase stem, then mixed-case filler up to the requested length.
+    name[length++] = prefix;
+    do { length++; digits /= 36; } while (digits);
+    for (size_t i = length - 1; i > 0; i--, index /= 36)
+        name[i] = "0123456789abcdefghijklmnopqrstuvwxyz"[index % 36];
+    if (length < image->shape.nameLength) name[length++] = '.';
+    while (length < image->shape.nameLength)
+        name[length++] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"[prng() % 52];
+
+    item->nameOffset = (uint32_t)image->namesLength;
+    item->nameLength = (uint16_t)length;
+    for (size_t i = 0; i < length; i++)
+        image->names[image->namesLength++] = (uint16_t)name[i];
+}
+
+static void make_items(BenchImage* image)
+{
+    const BenchShape* shape = &image->shape;
+
+    image->folderCount = MAX(1, (shape->files + shape->fanout - 1) / shape->fanout);
+    image->itemCount   = image->folderCount + shape->files;
+    SALLOC(image->items, image->itemCount * sizeof(BenchItem));
+    SALLOC(image->names, (image->itemCount + 1) * 256 * sizeof(uint16_t));
+
+    // Folder j lives in folder (j - 1) / fanout; file i in folder i / fanout.
+    for (uint32_t j = 0; j < image->folderCount; j++) {
+        BenchItem* folder = &image->items[j];
+        folder->folder = 1;
+        folder->date   = kBenchDate - (uint32_t)(prng() % (365 * 86400));
+
+        if (j == 0) {
+            folder->cnid   = kHFSRootFolderID;
+            folder->parent = kHFSRootParentID;
+            folder->nameOffset = (uint32_t)image->namesLength;
+            folder->nameLength = 5;
+            for (const char* c = "bench"; *c; c++) image->names[image->namesLength++] = (uint16_t)*c;
+        } else {
+            folder->cnid   = kHFSFirstUserCatalogNodeID + j - 1;
+            folder->parent = image->items[(j - 1) / shape->fanout].cnid;
+            add_name(image, folder, 'd', j);
+            image->items[(j - 1) / shape->fanout].valence++;
+        }
+    }
+
+    for (uint32_t i = 0; i < shape->files; i++) {
+        BenchItem* file = &image->items[image->folderCount + i];
+        file->cnid   = kHFSFirstUserCatalogNodeID + image->folderCount - 1 + i;
+        file->parent = image->items[i / shape->fanout].cnid;
+        file->date   = kBenchDate - (uint32_t)(prng() % (4 * 365 * 86400U));
+        add_name(image, file, 'f', i);
+        image->items[i / shape->fanout].valence++;
+    }
+}
+
+#pragma mark Layout
+
+static void layout(BenchImage* image)
+{
+    uint32_t blockSize = image->shape.blockSize;
+    uint32_t count     = MIN(image->shape.extents, image->fileBlocks);
+
+    // The first 1024 bytes and the volume header; the alternate header and the 512 bytes after it.
+    image->headBlocks  = (1024 + 512 + blockSize - 1) / blockSize;
+    image->tailBlocks  = (1024 + blockSize - 1) / blockSize;
+    image->dataBlocks  = image->shape.files * (image->fileBlocks + (count ? count - 1 : 0));
+
+    uint64_t total = 0;
+    for (image->bitmapBlocks = 1;; image->bitmapBlocks++) {
+        total = (uint64_t)image->headBlocks + image->bitmapBlocks + image->dataBlocks + image->extentsBlocks + image->catalogBlocks + image->tailBlocks;
+        if ((uint64_t)image->bitmapBlocks * blockSize * 8 >= total) break;
+    }
+    if (total > UINT32_MAX) {
+        fprintf(stderr, "bench_image: the volume would need more than 2^32 blocks; use a larger block size\n");
+        exit(1);
+    }
+
+    image->totalBlocks  = (uint32_t)total;
+    image->bitmapStart  = image->headBlocks;
+    image->dataStart    = image->bitmapStart + image->bitmapBlocks;
+    image->extentsStart = image->dataStart + image->dataBlocks;
+    image->catalogStart = image->extentsStart + image->extentsBlocks;
+    image->usedBlocks   = image->totalBlocks - image->shape.files * (count ? count - 1 : 0);
+}
+
+#pragma mark Output
+
+static void write_at(int fd, const void* buffer, size_t length, off_t offset)
+{
+    const uint8_t* p = buffer;
+
+    while (length) {
+        ssize_t written = pwrite(fd, p, length, offset);
+        if (written < 0) { perror("pwrite"); exit(1); }
+        p      += written;
+        length -= (size_t)written;
+        offset += written;
+    }
+}
+
+static void mark_blocks(uint8_t* bitmap, uint32_t start, uint32_t count)
+{
+    for (uint32_t b = start; b < start + count; b++)
+        bitmap[b / 8] |= (uint8_t)(0x80 >> (b % 8));
+}
+
+// Fork contents are a stream from a generator seeded with the CNID, so readers can check what they extract.
+static void write_forks(const BenchImage* image, int fd, uint8_t* bitmap)
+{
+    uint32_t blockSize = image->shape.blockSize;
+    uint8_t* buffer    = NULL;
+
+    SALLOC(buffer, blockSize);
+
+    for (uint32_t file = 0; file < image->shape.files; file++) {
+        uint64_t state     = (image->shape.seed * 0x9E3779B97F4A7C15ULL) ^ image->items[image->folderCount + file].cnid;
+        uint64_t remaining = image->shape.fileSize;
+
+        for (uint32_t e = 0; e < image->shape.extents; e++) {
+            HFSPlusExtentDescriptor extent = file_extent(image, file, e);
+            if (extent.blockCount == 0) break;
+
+            mark_blocks(bitmap, extent.startBlock, extent.blockCount);
+
+            for (uint32_t b = 0; b < extent.blockCount; b++) {
+                for (uint32_t i = 0; i < blockSize; i += 8) {
+                    state ^= state >> 12; state ^= state << 25; state ^= state >> 27;
+                    uint64_t value = state * 0x2545F4914F6CDD1DULL;
+                    for (unsigned k = 0; k < 8; k++) buffer[i + k] = (uint8_t)(value >> (8 * k));
+                }
+                if (remaining < blockSize) memset(buffer + remaining, 0, blockSize - remaining);
+                remaining -= MIN(remaining, blockSize);
+
+                write_at(fd, buffer, blockSize, (off_t)(extent.startBlock + b) * blockSize);
+            }
+
+            // Gaps are written out too; see write_image.
+            if (e + 1 < MIN(image->shape.extents, image->fileBlocks)) {
+                memset(buffer, 0, blockSize);
+                write_at(fd, buffer, blockSize, (off_t)(extent.startBlock + extent.blockCount) * blockSize);
+            }
+        }
+    }
+
+    SFREE(buffer);
+}
+
+static void write_image(BenchImage* image, const char* path)
+{
+    uint32_t blockSize = image->shape.blockSize;
+    uint64_t size      = (uint64_t)image->totalBlocks * blockSize;
+    uint8_t* bitmap    = NULL;
+    uint8_t* zeroes    = NULL;
+    int      fd        = -1;
+
+    if ( (fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0 ) { perror(path); exit(1); }
+
+    // Every block is written rather than left as a hole: a regular file's volume is sized by the blocks it has allocated.
+    SALLOC(zeroes, (size_t)(image->headBlocks + image->tailBlocks) * blockSize);
+    write_at(fd, zeroes, (size_t)image->headBlocks * blockSize, 0);
+    write_at(fd, zeroes, (size_t)image->tailBlocks * blockSize, (off_t)(size - (uint64_t)image->tailBlocks * blockSize));
+    SFREE(zeroes);
+
+    SALLOC(bitmap, (size_t)image->bitmapBlocks * blockSize);
+
+    mark_blocks(bitmap, 0, image->headBlocks);
+    mark_blocks(bitmap, image->bitmapStart, image->bitmapBlocks);
+    mark_blocks(bitmap, image->extentsStart, image->extentsBlocks);
+    mark_blocks(bitmap, image->catalogStart, image->catalogBlocks);
+    mark_blocks(bitmap, image->totalBlocks - image->tailBlocks, image->tailBlocks);
+
+    write_forks(image, fd, bitmap);
+    write_at(fd, bitmap, (size_t)image->bitmapBlocks * blockSize, (off_t)image->bitmapStart * blockSize);
+    write_at(fd, image->extents.nodes, (size_t)image->extentsBlocks * blockSize, (off_t)image->extentsStart * blockSize);
+    write_at(fd, image->catalog.nodes, (size_t)image->catalogBlocks * blockSize, (off_t)image->catalogStart * blockSize);
+
+    HFSPlusVolumeHeader vh = {
+        .signature          = (image->shape.caseSensitive ? kHFSXSigWord : kHFSPlusSigWord),
+        .version            = (image->shape.caseSensitive ? kHFSXVersion : kHFSPlusVersion),
+        .attributes         = kHFSVolumeUnmountedMask,
+        .lastMountedVersion = kHFSPlusMountVersion,
+        .createDate         = kBenchDate,
+        .modifyDate         = kBenchDate,
+        .checkedDate        = kBenchDate,
+        .fileCount          = image->shape.files,
+        .folderCount        = image->folderCount - 1,
+        .blockSize          = blockSize,
+        .totalBlocks        = image->totalBlocks,
+        .freeBlocks         = image->totalBlocks - image->usedBlocks,
+        .nextAllocation     = image->catalogStart + image->catalogBlocks,
+        .rsrcClumpSize      = blockSize,
+        .dataClumpSize      = blockSize,
+        .nextCatalogID      = kHFSFirstUserCatalogNodeID + image->itemCount - 1,
+        .writeCount         = 1,
+        .encodingsBitmap    = 1,
+    };
+    HFSPlusVolumeFinderInfo* finderInfo = (void*)&vh.finderInfo;
+    finderInfo->volID = image->shape.seed * 0x9E3779B97F4A7C15ULL;
+
+    HFSPlusForkData* forks[3]  = { &vh.allocationFile, &vh.extentsFile, &vh.catalogFile };
+    uint32_t         starts[3] = { image->bitmapStart, image->extentsStart, image->catalogStart };
+    uint32_t         counts[3] = { image->bitmapBlocks, image->extentsBlocks, image->catalogBlocks };
+    for (unsigned i = 0; i < 3; i++) {
+        forks[i]->logicalSize          = (uint64_t)counts[i] * blockSize;
+        forks[i]->totalBlocks          = counts[i];
+        forks[i]->clumpSize            = blockSize;
+        forks[i]->extents[0].startBlock = starts[i];
+        forks[i]->extents[0].blockCount = counts[i];
+    }
+
+    swap_HFSPlusVolumeHeader(&vh);
+    write_at(fd, &vh, sizeof(vh), 1024);
+    write_at(fd, &vh, sizeof(vh), (off_t)size - 1024);
+
+    if ( close(fd) < 0 ) { perror(path); exit(1); }
+    SFREE(bitmap);
+}
+
+#pragma mark Main
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-n files] [-f fanout] [-x extents] [-l name length] [-s file size] [-b block size] [-S seed] [-c] image\n"
+            "  -n  files to create (10000)\n"
+            "  -f  files and subfolders per folder (32)\n"
+            "  -x  extents per data fork; beyond 8 they go in the extents overflow file (1)\n"
+            "  -l  name length in characters (12)\n"
+            "  -s  bytes in each data fork (4096)\n"
+            "  -b  allocation block size (4096)\n"
+            "  -S  seed for names, dates and contents (1)\n"
+            "  -c  case-sensitive (HFSX, binary compare) catalog\n",
+            name);
+    exit(1);
+}
+
+int main (int argc, char* const* argv)
+{
+    BenchImage   image   = { .shape = { .files = 10000, .fanout = 32, .extents = 1, .nameLength = 12, .fileSize = 4096, .blockSize = 4096, .seed = 1 } };
+    BenchShape*  shape   = &image.shape;
+    BenchRecord* records = NULL;
+    int          opt     = 0;
+
+    while ((opt = getopt(argc, argv, "n:f:x:l:s:b:S:ch")) != -1) {
+        switch (opt) {
+            case 'n': shape->files      = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'f': shape->fanout     = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'x': shape->extents    = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'l': shape->nameLength = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': shape->fileSize   = strtoull(optarg, NULL, 0);          break;
+            case 'b': shape->blockSize  = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'S': shape->seed       = strtoull(optarg, NULL, 0);          break;
+            case 'c': shape->caseSensitive = true;                             break;
+            default:  usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) usage(argv[0]);
+
+    if ( (shape->fanout < 1) || (shape->extents < 1) || (shape->nameLength > 255) ||
+         (shape->blockSize < 512) || (shape->blockSize > 65536) || (shape->blockSize & (shape->blockSize - 1)) ) {
+        fprintf(stderr, "bench_image: fanout and extents must be at least 1, names at most 255 characters, and the block size a power of two from 512 to 65536\n");
+        return 1;
+    }
+
+    prng_state       = shape->seed ? shape->seed : 1;
+    image.fileBlocks = (uint32_t)((shape->fileSize + shape->blockSize - 1) / shape->blockSize);
+    if (shape->extents > image.fileBlocks) shape->extents = MAX(1, image.fileBlocks);
+    if (shape->extents > kHFSPlusExtentDensity)
+        image.overflowRecords = (shape->extents - 1) / kHFSPlusExtentDensity;
+
+    make_items(&image);
+
+    // Every folder and file has a record and a thread record.
+    size_t recordCount = 2 * (size_t)image.itemCount;
+    SALLOC(records, recordCount * sizeof(BenchRecord));
+    for (size_t r = 0; r < recordCount; r++) {
+        records[r].item   = (uint32_t)(r / 2);
+        records[r].thread = (uint32_t)(r % 2);
+    }
+    sort_image = &image;
+    qsort(records, recordCount, sizeof(BenchRecord), compare_records);
+
+    // Extent start blocks depend on where the data goes, and that on the size of the trees; rebuild until they agree.
+    for (uint32_t dataStart = 0;; dataStart = image.dataStart) {
+        image.dataStart = dataStart;
+        tb_free(&image.extents);
+        tb_free(&image.catalog);
+        build_extents(&image);
+        build_catalog(&image, records, recordCount);
+        layout(&image);
+        if (image.dataStart == dataStart) break;
+    }
+
+    write_image(&image, argv[optind]);
+
+    printf("%s: %u files in %u folders, %u extents per fork, %u-character names, %s; %u blocks of %u bytes (%u catalog, %u extents nodes)\n",
+           argv[optind], shape->files, image.folderCount, shape->extents, shape->nameLength,
+           (shape->caseSensitive ? "case-sensitive" : "case-insensitive"),
+           image.totalBlocks, shape->blockSize, image.catalog.nodeCount, image.extents.nodeCount);
+
+    tb_free(&image.extents);
+    tb_free(&image.catalog);
+    SFREE(records);
+    SFREE(image.items);
+    SFREE(image.names);
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+//
+//  crc32_bench.c
+//  hfsinspect
+//
+//
+
+// Checks the CRC-32 implementations against each other and times them.  Build with `make crc32-bench`.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "volumes/crc32/crc32.h"
+#include "crc32c/crc32c.h"
+
+#define BENCH_SIZE (64 * 1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char* name, crc32_func func, const uint8_t* buf, size_t len, unsigned rounds)
+{
+    uint32_t crc     = 0;
+    double   started = now();
+
+    for (unsigned i = 0; i < rounds; i++)
+        crc = func(crc, buf, len);
+
+    double   seconds = now() - started;
+    printf("%-12s %8.2f MiB/s  (%08x)\n", name, (len * (double)rounds) / seconds / (1024 * 1024), crc);
+}
+
+int main (int argc, char const *argv[])
+{
+    const char*  check  = "123456789";
+    uint8_t*     buf    = malloc(BENCH_SIZE + 64);
+    unsigned     rounds = (argc > 1 ? (unsigned)atoi(argv[1]) : 4);
+    int          failed = 0;
+    struct {
+        const char* name;
+        crc32_func  func;
+        uint32_t    expect;
+    } impls[] = {
+        { "bytewise",    crc32_bytewise, 0xcbf43926 },
+        { "slice-by-8",  crc32_slice8,   0xcbf43926 },
+        { "pclmul",      crc32_pclmul,   0xcbf43926 },
+        { "crc32c",      crc32c,         0xe3069283 },
+        { "crc32c_fast", crc32c_fast,    0xe3069283 },
+    };
+    unsigned     count  = sizeof(impls) / sizeof(impls[0]);
+
+    if (buf == NULL) return 1;
+
+    srand(1);
+    for (size_t i = 0; i < BENCH_SIZE + 64; i++) buf[i] = (uint8_t)rand();
+
+    // Known answers, then agreement on every small length and alignment, then chained calls.
+    for (unsigned i = 0; i < count; i++) {
+        uint32_t crc = impls[i].func(0, check, strlen(check));
+        if (crc != impls[i].expect) { printf("FAIL: %s(\"%s\") = %08x, expected %08x\n", impls[i].name, check, crc, impls[i].expect); failed = 1; }
+    }
+
+    for (size_t offset = 0; offset < 16; offset++) {
+        for (size_t len = 0; len < 1024; len++) {
+            uint32_t ieee = crc32_bytewise(0, buf + offset, len);
+            uint32_t c    = crc32c(0, buf + offset, len);
+            for (unsigned i = 0; i < count; i++) {
+                uint32_t crc = impls[i].func(0, buf + offset, len);
+                if (crc != (impls[i].expect == 0xcbf43926 ? ieee : c)) {
+                    printf("FAIL: %s at offset %zu, length %zu\n", impls[i].name, offset, len);
+                    failed = 1;
+                }
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        uint32_t whole = impls[i].func(0, buf, 100000);
+        uint32_t parts = impls[i].func(impls[i].func(0, buf, 33333), buf + 33333, 100000 - 33333);
+        if (whole != parts) { printf("FAIL: %s chained\n", impls[i].name); failed = 1; }
+    }
+
+    printf("crc32 uses %s\n", crc32_implementation());
+
+    for (unsigned i = 0; i < count; i++)
+        bench(impls[i].name, impls[i].func, buf, BENCH_SIZE, rounds);
+
+    free(buf);
+    return failed;
+}
@@ -0,0 +1,526 @@
+//
+//  microbench.c
+//  hfsinspect
+//
+//
+
+// Times the primitives under the hot paths one at a time.  Run with `make microbench`.
+//
+// Every benchmark does a fixed number of iterations, so runs from two builds do the same work and line up.  Each
+// reports the median of several runs as nanoseconds, cycles (TSC ticks, on x86) and allocations per iteration.
+// Node swaps and small reads need an HFS+ image; without one only the in-memory benchmarks run.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>      // __rdtsc
+#endif
+#include "hfs/hfs.h"
+#include "hfs/catalog.h"
+#include "hfs/extents.h"
+#include "hfs/hfs_endian.h"
+#include "hfs/hfs_extentlist.h"
+#include "hfs/Apple/hfs_unicode.h"
+#include "hfs/btree/btree.h"
+#include "hfs/btree/btree_endian.h"
+#include "hfs/btree/cache.h"
+#include "volumes/volumes.h"
+
+#define kMicroRounds    5
+#define kMicroNames     1024
+
+#pragma mark Allocation counting
+
+static uint64_t allocations = 0;
+
+#if defined(__GLIBC__)
+// glibc lets a program replace its allocator; these count calls and pass them through.
+extern void* __libc_malloc  (size_t size);
+extern void* __libc_calloc  (size_t count, size_t size);
+extern void* __libc_realloc (void* ptr, size_t size);
+extern void  __libc_free    (void* ptr);
+
+void* malloc(size_t size)                { __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED); return __libc_malloc(size); }
+void* calloc(size_t count, size_t size)  { __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED); return __libc_calloc(count, size); }
+void* realloc(void* ptr, size_t size)    { __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED); return __libc_realloc(ptr, size); }
+void  free(void* ptr)                    { __libc_free(ptr); }
+
+    #define HAVE_ALLOCATION_COUNTS 1
+#endif
+
+#pragma mark Measurement
+
+typedef struct Measure {
+    double   seconds;
+    uint64_t cycles;
+    uint64_t allocations;
+    double   startSeconds;
+    uint64_t startCycles;
+    uint64_t startAllocations;
+} Measure;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Benchmarks bracket just their timed loop with these; setup and teardown stay outside.
+static void measure_start(Measure* m)
+{
+    m->startAllocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    m->startSeconds     = now();
+    m->startCycles      = cycles();
+}
+
+static void measure_stop(Measure* m)
+{
+    m->cycles      = cycles() - m->startCycles;
+    m->seconds     = now() - m->startSeconds;
+    m->allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - m->startAllocations;
+}
+
+// Results the compiler can't prove unused.
+static volatile uint64_t sink = 0;
+
+static uint64_t prng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t prng(void)
+{
+    prng_state ^= prng_state >> 12;
+    prng_state ^= prng_state << 25;
+    prng_state ^= prng_state >> 27;
+    return prng_state * 0x2545F4914F6CDD1DULL;
+}
+
+#pragma mark Context
+
+typedef struct MicroContext {
+    HFSPlusCatalogKey* keys;                // kMicroNames random names, two to a parent
+    Volume*            vol;
+    Volume*            fs;
+    HFSPlus*           hfs;                 // NULL without an image
+    char*              catalogLeaf;         // Raw (big-endian) nodes read from the image
+    char*              catalogIndex;
+    char*              extentsLeaf;
+    BTreePtr           catalog;
+    BTreePtr           extents;
+} MicroContext;
+
+typedef struct MicroBenchmark {
+    const char* name;
+    uint64_t    iterations;
+    int         (* run)(MicroContext* context, uint64_t iterations, Measure* m);
+    bool        needsImage;
+} MicroBenchmark;
+
+#pragma mark Node cache
+
+static int bench_cache_set(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    Cache cache       = NULL;
+    char  node[4096]  = {0};
+
+    (void)context;
+
+    // Twice as many keys as slots, so every set past the first lap evicts.
+    if (cache_init(&cache, 1024) < 0) return -1;
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) cache_set(cache, node, sizeof(node), i % 2048);
+    measure_stop(m);
+    cache_destroy(cache);
+    return 0;
+}
+
+static int bench_cache_get(MicroContext* context, uint64_t iterations, Measure* m, bool hit)
+{
+    Cache cache       = NULL;
+    char  node[4096]  = {0};
+
+    (void)context;
+
+    if (cache_init(&cache, 1024) < 0) return -1;
+    for (ckey_t key = 0; key < 1024; key++) cache_set(cache, node, sizeof(node), key);
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) sink += cache_get(cache, node, sizeof(node), (i * 7919) % 1024 + (hit ? 0 : 1024));
+    measure_stop(m);
+
+    cache_destroy(cache);
+    return 0;
+}
+
+static int bench_cache_get_hit(MicroContext* context, uint64_t iterations, Measure* m)  { return bench_cache_get(context, iterations, m, true); }
+static int bench_cache_get_miss(MicroContext* context, uint64_t iterations, Measure* m) { return bench_cache_get(context, iterations, m, false); }
+
+#pragma mark Extent lists
+
+// Builds fragmented forks of 64 extents; an iteration is one add.
+static int bench_extentlist_add(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    (void)context;
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i += 64) {
+        ExtentList* list = extentlist_make();
+        for (size_t e = 0; e < 64; e++) extentlist_add(list, 1000 + e * 32, 16);
+        extentlist_free(list);
+    }
+    measure_stop(m);
+    return 0;
+}
+
+static int bench_extentlist_find(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    ExtentList* list   = extentlist_make();
+    size_t      offset = 0;
+    size_t      length = 0;
+
+    (void)context;
+
+    for (size_t e = 0; e < 64; e++) extentlist_add(list, 1000 + e * 32, 16);
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += extentlist_find(list, (i * 7919) % (64 * 16), &offset, &length);
+        sink += offset;
+    }
+    measure_stop(m);
+
+    extentlist_free(list);
+    return 0;
+}
+
+#pragma mark Comparators
+
+static int bench_fast_unicode_compare(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) {
+        const HFSUniStr255* a = &context->keys[i % kMicroNames].nodeName;
+        const HFSUniStr255* b = &context->keys[(i + 1) % kMicroNames].nodeName;
+        sink += FastUnicodeCompare(a->unicode, a->length, b->unicode, b->length);
+    }
+    measure_stop(m);
+    return 0;
+}
+
+static int bench_compare_keys(MicroContext* context, uint64_t iterations, Measure* m, int (* compare)(const HFSPlusCatalogKey*, const HFSPlusCatalogKey*))
+{
+    // Neighbours share a parent half the time, so both the parent and name comparisons run.
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++)
+        sink += compare(&context->keys[i % kMicroNames], &context->keys[(i + 1) % kMicroNames]);
+    measure_stop(m);
+    return 0;
+}
+
+static int bench_compare_keys_cf(MicroContext* context, uint64_t iterations, Measure* m) { return bench_compare_keys(context, iterations, m, hfsplus_catalog_compare_keys_cf); }
+static int bench_compare_keys_bc(MicroContext* context, uint64_t iterations, Measure* m) { return bench_compare_keys(context, iterations, m, hfsplus_catalog_compare_keys_bc); }
+static int bench_compare_keys_hfs(MicroContext* context, uint64_t iterations, Measure* m) { return bench_compare_keys(context, iterations, m, hfs_standard_catalog_compare_keys); }
+
+#pragma mark Record swaps
+
+// These swaps are their own inverse, so one record can be swapped back and forth.
+static int bench_swap_catalog_file(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    HFSPlusCatalogFile file = { .fileID = 1234, .dataFork = { .logicalSize = 4096, .totalBlocks = 1 } };
+
+    (void)context;
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) {
+        swap_HFSPlusCatalogFile(&file);
+        __asm__ volatile ("" : : "r" (&file) : "memory");
+    }
+    measure_stop(m);
+    sink += file.fileID;
+    return 0;
+}
+
+static int bench_swap_catalog_folder(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    HFSPlusCatalogFolder folder = { .folderID = 1234, .valence = 12 };
+
+    (void)context;
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) {
+        swap_HFSPlusCatalogFolder(&folder);
+        __asm__ volatile ("" : : "r" (&folder) : "memory");
+    }
+    measure_stop(m);
+    sink += folder.folderID;
+    return 0;
+}
+
+static int bench_swap_extent_record(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    HFSPlusExtentKey    key    = { .keyLength = kHFSPlusExtentKeyMaximumLength, .fileID = 1234 };
+    HFSPlusExtentRecord record = {{ .startBlock = 100, .blockCount = 8 }};
+
+    (void)context;
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) {
+        swap_HFSPlusExtentKey(&key);
+        swap_HFSPlusExtentRecord(record);
+        __asm__ volatile ("" : : "r" (&key), "r" (record) : "memory");
+    }
+    measure_stop(m);
+    sink += key.fileID + record[0].startBlock;
+    return 0;
+}
+
+#pragma mark Node swaps
+
+// Copies a raw node into `scratch` and swaps it as btree_get_node does, optionally followed by the tree's record swaps.
+// The copy is part of every iteration; "node copy" times it alone.
+static int swap_node(BTreeNodePtr node, const char* raw, bool records)
+{
+    memcpy(node->data, raw, node->nodeSize);
+    if (swap_BTreeNode(node) < 0) return -1;
+    node->recordCount = node->nodeDescriptor->numRecords;
+
+    if (!records) return 0;
+
+    for (unsigned r = 0; r < node->recordCount; r++) {
+        void* record = BTGetRecord(node, r);
+
+        if (node->bTree->treeID == kHFSCatalogFileID) {
+            swap_HFSPlusCatalogKey(record);
+            if (node->nodeDescriptor->kind == kBTLeafNode)
+                swap_HFSPlusCatalogRecord((void*)((char*)record + BTGetRecordKeyLength(node, r)));
+        } else {
+            swap_HFSPlusExtentKey(record);
+            if (node->nodeDescriptor->kind == kBTLeafNode)
+                swap_HFSPlusExtentRecord((void*)((char*)record + BTGetRecordKeyLength(node, r)));
+        }
+    }
+    return 0;
+}
+
+static int bench_nodes(BTreePtr tree, const char* raw, uint64_t iterations, Measure* m, int mode)
+{
+    struct _BTreeNode node = { .bTree = tree, .nodeSize = tree->headerRecord.nodeSize, .treeID = tree->treeID };
+
+    if (raw == NULL) { errno = ENOENT; return -1; }
+    SALLOC(node.data, node.nodeSize);
+
+    int result = 0;
+
+    measure_start(m);
+    for (uint64_t i = 0; (i < iterations) && (result == 0); i++) {
+        if (mode == 0) {
+            memcpy(node.data, raw, node.nodeSize);
+            __asm__ volatile ("" : : "r" (node.data) : "memory");
+        } else {
+            result = swap_node(&node, raw, (mode == 2));
+        }
+    }
+    measure_stop(m);
+
+    SFREE(node.data);
+    return result;
+}
+
+static int bench_node_copy(MicroContext* context, uint64_t iterations, Measure* m)           { return bench_nodes(context->catalog, context->catalogLeaf, iterations, m, 0); }
+static int bench_swap_catalog_leaf(MicroContext* context, uint64_t iterations, Measure* m)   { return bench_nodes(context->catalog, context->catalogLeaf, iterations, m, 1); }
+static int bench_swap_catalog_index(MicroContext* context, uint64_t iterations, Measure* m)  { return bench_nodes(context->catalog, context->catalogIndex, iterations, m, 1); }
+static int bench_swap_catalog_records(MicroContext* context, uint64_t iterations, Measure* m){ return bench_nodes(context->catalog, context->catalogLeaf, iterations, m, 2); }
+static int bench_swap_extents_records(MicroContext* context, uint64_t iterations, Measure* m){ return bench_nodes(context->extents, context->extentsLeaf, iterations, m, 2); }
+
+#pragma mark Allocation bitmap
+
+static int bench_block_used(MicroContext* context, uint64_t iterations, Measure* m)
+{
+    size_t   length = 1 << 17;              // One million blocks
+    uint8_t* bitmap = NULL;
+
+    (void)context;
+
+    SALLOC(bitmap, length);
+    for (size_t i = 0; i < length; i++) bitmap[i] = (uint8_t)prng();
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) sink += BTIsBlockUsed((uint32_t)(i % (length * 8)), bitmap, length);
+    measure_stop(m);
+
+    SFREE(bitmap);
+    return 0;
+}
+
+#pragma mark Volume reads
+
+static int bench_vol_read(MicroContext* context, uint64_t iterations, Measure* m, size_t size)
+{
+    // Stay inside the HFS+ volume; the source's length can be rounded up past the end of the image.
+    const Volume* vol     = context->hfs->vol;
+    uint64_t      sectors = ((uint64_t)context->hfs->block_count * context->hfs->block_size) / size;
+    char          buffer[4096];
+
+    measure_start(m);
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (vol_read(vol, buffer, size, (off_t)(((i * 7919) % sectors) * size)) != (ssize_t)size) return -1;
+    }
+    measure_stop(m);
+    return 0;
+}
+
+static int bench_vol_read_512(MicroContext* context, uint64_t iterations, Measure* m)  { return bench_vol_read(context, iterations, m, 512); }
+static int bench_vol_read_4096(MicroContext* context, uint64_t iterations, Measure* m) { return bench_vol_read(context, iterations, m, 4096); }
+
+static const MicroBenchmark benchmarks[] = {
+    { "cache_set",                 100000, bench_cache_set,             false },
+    { "cache_get hit",            1000000, bench_cache_get_hit,         false },
+    { "cache_get miss",           1000000, bench_cache_get_miss,        false },
+    { "extentlist_add",            640000, bench_extentlist_add,        false },
+    { "extentlist_find",          1000000, bench_extentlist_find,       false },
+    { "FastUnicodeCompare",       1000000, bench_fast_unicode_compare,  false },
+    { "compare_keys_cf",          1000000, bench_compare_keys_cf,       false },
+    { "compare_keys_bc",          1000000, bench_compare_keys_bc,       false },
+    { "compare_keys_hfs",         1000000, bench_compare_keys_hfs,      false },
+    { "swap catalog file",       10000000, bench_swap_catalog_file,     false },
+    { "swap catalog folder",     10000000, bench_swap_catalog_folder,   false },
+    { "swap extent key+record",  10000000, bench_swap_extent_record,    false },
+    { "BTIsBlockUsed",           10000000, bench_block_used,            false },
+    { "node copy",                 100000, bench_node_copy,             true  },
+    { "swap_BTreeNode leaf",       100000, bench_swap_catalog_leaf,     true  },
+    { "swap_BTreeNode index",      100000, bench_swap_catalog_index,    true  },
+    { "swap catalog leaf",         100000, bench_swap_catalog_records,  true  },
+    { "swap extents leaf",         100000, bench_swap_extents_records,  true  },
+    { "vol_read 512",              100000, bench_vol_read_512,          true  },
+    { "vol_read 4096",             100000, bench_vol_read_4096,         true  },
+};
+
+#pragma mark Setup
+
+static void make_keys(MicroContext* context)
+{
+    SALLOC(context->keys, kMicroNames * sizeof(HFSPlusCatalogKey));
+
+    for (unsigned i = 0; i < kMicroNames; i++) {
+        HFSPlusCatalogKey* key    = &context->keys[i];
+        unsigned           length = 8 + (unsigned)(prng() % 24);
+
+        key->parentID        = 16 + i / 2;
+        key->nodeName.length = (uint16_t)length;
+        key->keyLength       = (uint16_t)(6 + 2 * length);
+        for (unsigned c = 0; c < length; c++)
+            key->nodeName.unicode[c] = (uint16_t)"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._"[prng() % 64];
+    }
+}
+
+// Raw copies of the first node of `kind` in the tree, or NULL if it has none.
+static char* read_raw_node(BTreePtr tree, int8_t kind)
+{
+    for (bt_nodeid_t n = 1; n < tree->headerRecord.totalNodes; n++) {
+        BTreeNodePtr node = NULL;
+        char*        raw  = NULL;
+
+        if (btree_read_node(&node, tree, n) < 0) return NULL;
+        if ( (node != NULL) && (((BTNodeDescriptor*)node->data)->kind == kind) && (((BTNodeDescriptor*)node->data)->numRecords != 0) ) {
+            SALLOC(raw, node->nodeSize);
+            memcpy(raw, node->data, node->nodeSize);
+        }
+        if (node != NULL) btree_free_node(node);
+        if (raw != NULL) return raw;
+    }
+    return NULL;
+}
+
+static int open_image(MicroContext* context, const char* path)
+{
+    SALLOC(context->hfs, sizeof(HFSPlus));
+    if ( (context->vol = vol_qopen(path)) == NULL ) return -1;
+    if ( (volumes_load(context->vol) < 0) || ((context->fs = hfsplus_find(context->vol)) == NULL) ) { errno = EINVAL; return -1; }
+    if ( hfs_open(context->hfs, context->fs) < 0 ) return -1;
+    if ( hfsplus_get_catalog_btree(&context->catalog, context->hfs) < 0 ) return -1;
+    if ( hfsplus_get_extents_btree(&context->extents, context->hfs) < 0 ) return -1;
+
+    context->catalogLeaf  = read_raw_node(context->catalog, kBTLeafNode);
+    context->catalogIndex = read_raw_node(context->catalog, kBTIndexNode);
+    context->extentsLeaf  = read_raw_node(context->extents, kBTLeafNode);
+    return 0;
+}
+
+#pragma mark Main
+
+static int compare_measures(const void* a, const void* b)
+{
+    double x = ((const Measure*)a)->seconds, y = ((const Measure*)b)->seconds;
+    return (x < y ? -1 : (x > y));
+}
+
+int main (int argc, char const* argv[])
+{
+    MicroContext context = {0};
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [image]\n", argv[0]);
+        return 1;
+    }
+
+    make_keys(&context);
+    if ( (argc == 2) && (open_image(&context, argv[1]) < 0) ) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    printf("# %s; median of %u runs%s\n", (argc == 2 ? argv[1] : "no image"), kMicroRounds,
+           (cycles() ? ", cycles are TSC ticks" : ", no cycle counter"));
+    printf("# %-22s\t%10s\t%10s\t%10s\t%10s\n", "benchmark", "iterations", "ns/op", "cycles/op", "allocs/op");
+
+    for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+        const MicroBenchmark* benchmark = &benchmarks[b];
+        Measure               runs[kMicroRounds];
+        bool                  failed    = false;
+
+        if (benchmark->needsImage && (context.hfs == NULL)) continue;
+
+        memset(runs, 0, sizeof(runs));
+        for (unsigned r = 0; (r < kMicroRounds) && !failed; r++)
+            failed = (benchmark->run(&context, benchmark->iterations, &runs[r]) < 0);
+
+        if (failed) {
+            printf("%-24s\t%10llu\t%10s\t%10s\t%10s\n", benchmark->name, (unsigned long long)benchmark->iterations, "-", "-", "-");
+            continue;
+        }
+
+        qsort(runs, kMicroRounds, sizeof(Measure), compare_measures);
+        const Measure* median = &runs[kMicroRounds / 2];
+        double         count  = (double)benchmark->iterations;
+
+        printf("%-24s\t%10llu\t%10.2f\t", benchmark->name, (unsigned long long)benchmark->iterations, median->seconds * 1e9 / count);
+        if (median->cycles) printf("%10.1f\t", median->cycles / count); else printf("%10s\t", "-");
+#if defined(HAVE_ALLOCATION_COUNTS)
+        printf("%10.3f\n", median->allocations / count);
+#else
+        printf("%10s\n", "-");
+#endif
+    }
+
+    SFREE(context.keys);
+    if (context.hfs != NULL) {
+        SFREE(context.catalogLeaf);
+        SFREE(context.catalogIndex);
+        SFREE(context.extentsLeaf);
+        hfs_close(context.hfs);
+        if (context.vol != context.fs) vol_close(context.vol);
+        SFREE(context.hfs);
+    }
+
+    return 0;
+}
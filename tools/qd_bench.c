@@ -0,0 +1,101 @@
+//
+//  qd_bench.c
+//  hfsinspect
+//
+//
+
+// Times a full catalog scan at different queue depths (1 and 32 by default).  Build and run with `make qd-bench IMAGE=path`.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include "hfs/hfs.h"
+#include "hfs/catalog.h"
+#include "volumes/volumes.h"
+
+#define BENCH_ROUNDS 5
+
+typedef struct ScanCount {
+    uint64_t nodes;
+    uint64_t records;
+} ScanCount;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_node(void* context, const BTreeNodePtr node)
+{
+    ScanCount* count = context;
+    __atomic_add_fetch(&count->nodes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&count->records, node->recordCount, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x < y ? -1 : (x > y));
+}
+
+int main (int argc, char const *argv[])
+{
+    Volume*   vol     = NULL;
+    Volume*   fs      = NULL;
+    HFSPlus*  hfs     = NULL;
+    BTreePtr  catalog = NULL;
+    unsigned  depths[16];
+    unsigned  count   = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s image [depth ...]\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 2; (i < argc) && (count < 16); i++) depths[count++] = (unsigned)atoi(argv[i]);
+    if (count == 0) { depths[count++] = 1; depths[count++] = 32; }
+
+    SALLOC(hfs, sizeof(HFSPlus));
+    if ( (vol = vol_qopen(argv[1])) == NULL ) { perror(argv[1]); return 1; }
+    if ( (volumes_load(vol) < 0) || ((fs = hfsplus_find(vol)) == NULL) ) { fprintf(stderr, "%s: no HFS+ filesystem found\n", argv[1]); return 1; }
+    if ( hfs_open(hfs, fs) < 0 ) { perror("hfs_open"); return 1; }
+    if ( hfsplus_get_catalog_btree(&catalog, hfs) < 0 ) { perror("catalog"); return 1; }
+
+    double catalogMiB = catalog->fork->logicalSize / (1024.0 * 1024.0);
+    printf("%s: catalog %.1f MiB, %u nodes of %u bytes\n", argv[1], catalogMiB, catalog->headerRecord.totalNodes, catalog->headerRecord.nodeSize);
+
+    for (unsigned d = 0; d < count; d++) {
+        double    times[BENCH_ROUNDS];
+        ScanCount scan = {0};
+
+        // The scan makes its own engine at the volume's queue depth.
+        hfs->queue_depth = depths[d];
+
+        for (unsigned r = 0; r < BENCH_ROUNDS; r++) {
+            // Start every round cold, so the scan measures the device rather than the page cache.
+            (void)posix_fadvise(vol->fd, 0, 0, POSIX_FADV_DONTNEED);
+
+            memset(&scan, 0, sizeof(scan));
+            double started = now();
+            if (hfsplus_catalog_scan_parallel(hfs, count_node, &scan) < 0) { fprintf(stderr, "scan failed\n"); return 1; }
+            times[r] = now() - started;
+        }
+
+        qsort(times, BENCH_ROUNDS, sizeof(double), compare_doubles);
+        double median = times[BENCH_ROUNDS / 2];
+        printf("QD%-4u  median %8.2f ms  best %8.2f ms  %9.1f MiB/s  %11.0f nodes/s  (%llu leaves, %llu records)\n",
+               depths[d], median * 1000, times[0] * 1000, catalogMiB / median, scan.nodes / median,
+               (unsigned long long)scan.nodes, (unsigned long long)scan.records);
+    }
+
+    hfs_close(hfs);
+    if (vol != fs) vol_close(vol);
+    SFREE(hfs);
+
+    return 0;
+}
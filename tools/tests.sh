@@ -2,6 +2,10 @@
 
 HFSINSPECT="$1"
 IMAGE="$2"
+HFS_IMAGE="$3"
+UDIF_IMAGE="$4"
+SPARSE_BUNDLE="$5"
+CS_IMAGE="$6"
 
 test_cmd() {
     echo "---"
@@ -11,6 +15,43 @@ test_cmd() {
     echo "*** SUCCESS: $1"
 }
 
+# Runs a command and checks that its output has a line matching the extended regex $2.
+test_output() {
+    echo "---"
+    echo "Running: $1"
+    echo "Expecting: $2"
+    echo ""
+    ( set -o pipefail; $1 | grep -E -- "$2" > /dev/null ) || { echo "*** FAIL: $1"; exit 1; }
+    echo "*** SUCCESS: $1"
+}
+
+# Runs a command that should exit with an error and checks that its output still has a line matching $2.
+test_failure_output() {
+    echo "---"
+    echo "Running: $1"
+    echo "Expecting failure and: $2"
+    echo ""
+    ( $1 > "${TMPDIR:-/tmp}/hfsinspect-test.out" ) && { echo "*** FAIL: $1"; exit 1; }
+    grep -E -- "$2" "${TMPDIR:-/tmp}/hfsinspect-test.out" > /dev/null || { echo "*** FAIL: $1"; exit 1; }
+    echo "*** SUCCESS: $1"
+}
+
+# Runs two commands and checks that they print the same lines matching the extended regex $3, and at least one.
+test_same_output() {
+    echo "---"
+    echo "Running: $1"
+    echo "Comparing with: $2"
+    echo ""
+    local first second
+    first=$( set -o pipefail; $1 | grep -E -- "$3" ) || { echo "*** FAIL: $1"; exit 1; }
+    second=$( set -o pipefail; $2 | grep -E -- "$3" ) || { echo "*** FAIL: $2"; exit 1; }
+    [ "${first}" = "${second}" ] || { echo "*** FAIL: $1 differs from $2"; exit 1; }
+    echo "*** SUCCESS: $1"
+}
+
+# The per-fork lines of --hash.
+DIGESTS="^ +[0-9]+ +(data|rsrc) [0-9a-f]+  /"
+
 test_cmd "${HFSINSPECT}"
 test_cmd "${HFSINSPECT} -h"
 test_cmd "${HFSINSPECT} -v"
@@ -19,6 +60,8 @@ test_cmd "${HFSINSPECT} -d ${IMAGE} -r"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -j"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -D"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -0"
+test_cmd "${HFSINSPECT} -d ${IMAGE} -s -t 3"
+test_cmd "${HFSINSPECT} -d ${IMAGE} -s --json"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -P / -l"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -b catalog"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -b catalog -n 1"
@@ -26,3 +69,81 @@ test_cmd "${HFSINSPECT} -d ${IMAGE} -b extents"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -b extents -n 1"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -b attributes"
 test_cmd "${HFSINSPECT} -d ${IMAGE} -b attributes -n 1"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --hash"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --hash=crc32c"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --hash=crc32"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --hash --queue-depth 1"
+test_cmd "${HFSINSPECT} -d ${IMAGE} -b catalog -o ${TMPDIR:-/tmp}/hfsinspect-test-catalog.btree"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --verify-btree"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --check-allocation"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --block-owner 0,1-3,2508"
+test_cmd "${HFSINSPECT} -d ${IMAGE} -f -t 5"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --du -t 5"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --index ${TMPDIR:-/tmp}/hfsinspect-test.index -c 16"
+test_cmd "${HFSINSPECT} -d ${IMAGE} --index ${TMPDIR:-/tmp}/hfsinspect-test.index -P / -l"
+test_cmd "${HFSINSPECT} -d ${IMAGE} -P / -l --sort size --limit 3 --larger 1K"
+test_cmd "${HFSINSPECT} --batch ${IMAGE} ${IMAGE}"
+test_cmd "${HFSINSPECT} --batch -s --verify-btree -y ${TMPDIR:-/tmp}/hfsinspect-test-batch --threads 2 --memory 4M ${IMAGE}"
+
+# Probing: the test image is GPT-partitioned; its HFS+ partition, cut out at sector 40, is a bare volume.
+BARE="${TMPDIR:-/tmp}/hfsinspect-test-bare.img"
+dd if="${IMAGE}" of="${BARE}" bs=512 skip=40 2> /dev/null
+test_output "${HFSINSPECT} -d ${IMAGE} -D" "vol->subtype += 'GPT ' \(kPMTypeGPT\)"
+test_output "${HFSINSPECT} -d ${IMAGE} -D" "# Volume 'Test HFS Plus Volume' \(Mac OS Extended \(HFS\+\)\)"
+test_output "${HFSINSPECT} -d ${BARE} -D" "partition_count += 0"
+test_output "${HFSINSPECT} -d ${BARE}" "volume name += Test HFS Plus Volume"
+test_same_output "${HFSINSPECT} -d ${BARE} --hash" "${HFSINSPECT} -d ${IMAGE} --hash" "${DIGESTS}"
+
+# A truncated image fails on its own; the rest of the batch still runs and the array is closed.
+TRUNCATED="${TMPDIR:-/tmp}/hfsinspect-test-truncated.img"
+head -c 5000000 "${IMAGE}" > "${TRUNCATED}"
+test_failure_output "${HFSINSPECT} --batch -s --verify-btree ${TRUNCATED} ${IMAGE}" "\"status\": \"error\", \"error\": \"could not summarize the catalog"
+test_failure_output "${HFSINSPECT} --batch -s --verify-btree ${TRUNCATED} ${IMAGE}" "^  \"status\": \"ok\""
+test_failure_output "${HFSINSPECT} --batch -s --threads 1 ${IMAGE} ${TRUNCATED}" "^\]$"
+
+# Standard HFS: images/hfs.img has 150 files in /Docs, Mac OS Roman names, a six-extent file and a resource fork.
+if [ -n "${HFS_IMAGE}" ]; then
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE}" "^# HFS Volume Format"
+    test_cmd "${HFSINSPECT} -d ${HFS_IMAGE} -s"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -P /Docs/file001.txt" "fileID += 19$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -P /résumé.doc" "fileID += 171$"
+    # RelString keeps the case of accented letters and sorts curly quotes with the straight ones
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -P /Äb" "fileID += 174$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -P /äa" "fileID += 175$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -P /“Quoted”" "fileID += 176$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -c 19" "\| file001.txt "
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} -P /big.bin" "= +6 extents +41 +100.00$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} --hash" "^ +19 +data f29f91bca00a84fbc43291e6b25062a4b1a9bc9f6b15c6ffe93c9fa085d673f4  /Docs/file001.txt$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} --hash" "^ +172 +data aeacddb001b5ff68e91f4937723e2295892f592cde43208950c63c1b874e8926  /big.bin$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} --hash" "^ +173 +rsrc 877201c97e2f43c2e5a8a5cc5483c63d2f95c006b594dbceafe71daccadb6a77  /Forked$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} --du -t 3" " 150 +0 +16 /Docs$"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} --verify-btree" "Result += OK"
+    test_output "${HFSINSPECT} -d ${HFS_IMAGE} --check-allocation" "Result += OK"
+    test_output "${HFSINSPECT} --batch ${HFS_IMAGE}" "\"status\": \"ok\""
+fi
+
+# UDIF: images/hfs.dmg is images/hfs.img in zlib, raw and free-space chunks.
+if [ -n "${HFS_IMAGE}" ] && [ -n "${UDIF_IMAGE}" ]; then
+    test_output "${HFSINSPECT} -d ${UDIF_IMAGE} -D" "image += UDIF$"
+    test_same_output "${HFSINSPECT} -d ${UDIF_IMAGE} --hash" "${HFSINSPECT} -d ${HFS_IMAGE} --hash" "${DIGESTS}"
+    test_same_output "${HFSINSPECT} -d ${UDIF_IMAGE} --hash --queue-depth 1" "${HFSINSPECT} -d ${HFS_IMAGE} --hash" "${DIGESTS}"
+fi
+
+# Sparse bundle: images/hfs.sparsebundle is images/hfs.img in 128 KiB bands. All-zero bands (band 5 lies
+# inside /Zeros) are left out and others are cut short, so both have to read back as zeroes.
+if [ -n "${HFS_IMAGE}" ] && [ -n "${SPARSE_BUNDLE}" ]; then
+    test_output "${HFSINSPECT} -d ${SPARSE_BUNDLE} -D" "image += sparse bundle$"
+    test_output "${HFSINSPECT} -d ${SPARSE_BUNDLE} --hash" "^ +177 +data 8a39d2abd3999ab73c34db2476849cddf303ce389b35826850f9a700589b4a90  /Zeros$"
+    test_same_output "${HFSINSPECT} -d ${SPARSE_BUNDLE} --hash" "${HFSINSPECT} -d ${HFS_IMAGE} --hash" "${DIGESTS}"
+fi
+
+# Core Storage: images/CoreStorageDemo.sparsebundle is a GPT disk with one Core Storage physical volume holding
+# one logical volume. Its map is in the encrypted metadata, so finding the volume means decrypting that.
+if [ -n "${CS_IMAGE}" ]; then
+    test_output "${HFSINSPECT} -d ${CS_IMAGE} -D" "vol->subtype += 'CS  ' \(kPMCoreStorage\)"
+    test_output "${HFSINSPECT} -d ${CS_IMAGE} -D" "# Volume 'Core Storage Demo' \(Core Storage Logical Volume\)"
+    test_output "${HFSINSPECT} -d ${CS_IMAGE} -D" "map += 1 ranges of 4096-byte blocks"
+    test_output "${HFSINSPECT} -d ${CS_IMAGE} -D" "length += 622.50 MiB \(652738560 bytes\)"
+    test_output "${HFSINSPECT} -d ${CS_IMAGE} --hash" "^ +16 +data c4d3de197cd3c6dc3974759f0670fd250b14839860f9f64275311fc299c2c701  /.journal$"
+    test_output "${HFSINSPECT} -d ${CS_IMAGE} --verify-btree" "Result += OK"
+fi